@@ -38,6 +38,7 @@
 #include <tp-account-widgets/tpaw-utils.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "empathy-chat-snapshot.h"
 #include "empathy-client-factory.h"
 #include "empathy-gsettings.h"
 #include "empathy-individual-information-dialog.h"
@@ -57,6 +58,18 @@
 
 #define IS_ENTER(v) (v == GDK_KEY_Return || v == GDK_KEY_ISO_Enter || v == GDK_KEY_KP_Enter)
 #define COMPOSING_STOP_TIMEOUT 5
+/* Longer insertions are spell checked in idle */
+#define SPELL_CHECK_MAX_INSERTED_CHARS 256
+/* Number of words spell checked by each update_misspelled_words () call */
+#define SPELL_CHECK_SLICE_WORDS 100
+/* Bounds of the number of events fetched from the logs at once */
+#define BACKLOG_MIN_PAGE_SIZE 10
+#define BACKLOG_MAX_PAGE_SIZE 200
+/* Rough height of a message in the view, in pixels */
+#define BACKLOG_MESSAGE_HEIGHT 30
+/* Pages taking longer than this to be fetched are made bigger, so the next
+ * one is requested further ahead of the top of the view */
+#define BACKLOG_TARGET_FETCH_TIME (150 * G_TIME_SPAN_MILLISECOND)
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyChat)
 struct _EmpathyChatPriv {
@@ -71,18 +84,17 @@ struct _EmpathyChatPriv {
 
 	GSettings         *gsettings_chat;
 	GSettings         *gsettings_ui;
+	GSettings         *gsettings_logger;
 
 	TplLogManager     *log_manager;
 	TplLogWalker      *log_walker;
-	/* Are we watching for scrolling movements? */
-	gboolean           watch_scroll;
-	/* Maximum page size of the chat->view. */
-	guint              max_page_size;
-	/* The offset from the lower edge of the chat->view before it
-	 * expanded to fit in the newly fetched logs. This is to
-	 * restore the chat->view to the page it was on before the
-	 * latest batch of logs were inserted. */
-	guint              scroll_offset;
+	/* TRUE if the logs being fetched have been requested by scrolling
+	 * up, rather than being the initial backlog. */
+	gboolean           backlog_paging;
+	/* When the logs being fetched have been requested, and the time
+	 * taken to fetch the previous pages, smoothed (in µs). */
+	gint64             backlog_fetch_start;
+	gint64             backlog_fetch_time;
 
 	TpAccountManager  *account_manager;
 	GList             *input_history;
@@ -111,6 +123,8 @@ struct _EmpathyChatPriv {
 	guint              save_paned_pos_id;
 	/* Source func ID for chat_contacts_visible_timeout_cb () */
 	guint              contacts_visible_id;
+	/* Source func ID for chat_notify_unread_messages_cb () */
+	guint              notify_unread_messages_id;
 
 	GtkWidget         *widget;
 	GtkWidget         *hpaned;
@@ -164,6 +178,26 @@ struct _EmpathyChatPriv {
 	/* TRUE if empathy_chat_is_room () and there are unread highlighted messages.
 	 * Cleared by empathy_chat_messages_read (). */
 	gboolean           highlighted;
+
+	/* Set of owned PendingFingerprint for the pending messages of
+	 * tp_chat, used by chat_log_filter (). NULL if it has to be built
+	 * again. */
+	GHashTable        *pending_fingerprints;
+
+	/* Senders of the backlog, shared by all the batches */
+	EmpathyContactMemo *log_contacts;
+
+	/* Last messages of the conversation, shown before the logs are
+	 * there. NULL in rooms. */
+	EmpathyChatSnapshot *snapshot;
+	/* gint64 timestamps of the messages shown from the snapshot, the
+	 * most recent first, until they are checked against the logs */
+	GArray            *snapshot_timestamps;
+	/* TRUE once the snapshot has been updated from the logs, from then on
+	 * it follows the conversation */
+	gboolean           snapshot_synced;
+	/* TRUE if the view waits for the initial backlog to load its page */
+	gboolean           document_frozen;
 };
 
 typedef struct {
@@ -198,10 +232,6 @@ static guint signals[LAST_SIGNAL] = { 0 };
 
 G_DEFINE_TYPE (EmpathyChat, empathy_chat, GTK_TYPE_BOX);
 
-#if 0
-/* FIXME: We need to figure out how to fill backlog automatically with WebKit2 */
-static gboolean chat_scrollable_connect (gpointer user_data);
-#endif
 static gboolean update_misspelled_words (gpointer data);
 
 static void
@@ -1456,6 +1486,16 @@ chat_should_highlight (EmpathyChat *chat,
 	return g_regex_match (priv->highlight_regex, msg, 0, NULL);
 }
 
+/* The snapshot of the conversation is only kept if its logs are */
+static gboolean
+chat_logging_enabled (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	return g_settings_get_boolean (priv->gsettings_logger,
+		EMPATHY_PREFS_LOGGER_ENABLED);
+}
+
 static void
 chat_message_received (EmpathyChat *chat,
 	EmpathyMessage *message,
@@ -1486,6 +1526,9 @@ chat_message_received (EmpathyChat *chat,
 
 		empathy_theme_adium_append_message (chat->view, message, should_highlight);
 
+		if (priv->snapshot_synced && chat_logging_enabled (chat))
+			empathy_chat_snapshot_add_message (priv->snapshot, message);
+
 		if (empathy_message_is_incoming (message)) {
 			priv->unread_messages++;
 			g_object_notify (G_OBJECT (chat), "nb-unread-messages");
@@ -1507,9 +1550,25 @@ chat_message_received_cb (EmpathyTpChat  *tp_chat,
 			  EmpathyMessage *message,
 			  EmpathyChat    *chat)
 {
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	tp_clear_pointer (&priv->pending_fingerprints, g_hash_table_unref);
+
 	chat_message_received (chat, message, FALSE);
 }
 
+static gboolean
+chat_notify_unread_messages_cb (gpointer user_data)
+{
+	EmpathyChat *chat = user_data;
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+
+	priv->notify_unread_messages_id = 0;
+	g_object_notify (G_OBJECT (chat), "nb-unread-messages");
+
+	return G_SOURCE_REMOVE;
+}
+
 static void
 chat_message_acknowledged_cb (EmpathyTpChat  *tp_chat,
 			      EmpathyMessage *message,
@@ -1517,12 +1576,19 @@ chat_message_acknowledged_cb (EmpathyTpChat  *tp_chat,
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 
+	tp_clear_pointer (&priv->pending_fingerprints, g_hash_table_unref);
+
 	empathy_theme_adium_message_acknowledged (chat->view,
 	    message);
 
+	/* Messages are usually acknowledged in batches, notify only once the
+	 * whole batch has been removed */
 	if (!empathy_message_is_edit (message)) {
 		priv->unread_messages--;
-		g_object_notify (G_OBJECT (chat), "nb-unread-messages");
+
+		if (priv->notify_unread_messages_id == 0)
+			priv->notify_unread_messages_id = g_idle_add (
+				chat_notify_unread_messages_cb, chat);
 	}
 }
 
@@ -1766,6 +1832,83 @@ chat_input_text_get_word_from_iter (GtkTextIter   *iter,
 	return TRUE;
 }
 
+/* Updates the misspelled tag of the word between @start and @end. The word
+ * being typed at @pos is never marked as misspelled. */
+static void
+chat_input_check_word (GtkTextBuffer *buffer,
+                       GtkTextIter   *start,
+                       GtkTextIter   *end,
+                       GtkTextIter   *pos)
+{
+	gchar *str;
+
+	str = gtk_text_buffer_get_text (buffer, start, end, FALSE);
+
+	if (gtk_text_iter_in_range (pos, start, end) ||
+			gtk_text_iter_equal (pos, end) ||
+			empathy_spell_check (str)) {
+		gtk_text_buffer_remove_tag_by_name (buffer, "misspelled", start, end);
+	} else {
+		gtk_text_buffer_apply_tag_by_name (buffer, "misspelled", start, end);
+	}
+
+	g_free (str);
+}
+
+/* Checks the words between @start and @end in idle, a slice at a time.
+ * The range is merged with the one still being checked, if any. */
+static void
+chat_input_queue_spell_check (EmpathyChat *chat,
+                              GtkTextIter *start,
+                              GtkTextIter *end)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GtkTextBuffer *buffer;
+	GtkTextMark *start_mark, *end_mark;
+	GtkTextIter iter;
+
+	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
+
+	start_mark = gtk_text_buffer_get_mark (buffer, "spell-check-start");
+	end_mark = gtk_text_buffer_get_mark (buffer, "spell-check-end");
+
+	if (start_mark == NULL) {
+		gtk_text_buffer_create_mark (buffer, "spell-check-start",
+					     start, TRUE);
+		gtk_text_buffer_create_mark (buffer, "spell-check-end",
+					     end, FALSE);
+	} else if (priv->update_misspelled_words_id == 0) {
+		gtk_text_buffer_move_mark (buffer, start_mark, start);
+		gtk_text_buffer_move_mark (buffer, end_mark, end);
+	} else {
+		gtk_text_buffer_get_iter_at_mark (buffer, &iter, start_mark);
+		if (gtk_text_iter_compare (start, &iter) < 0)
+			gtk_text_buffer_move_mark (buffer, start_mark, start);
+
+		gtk_text_buffer_get_iter_at_mark (buffer, &iter, end_mark);
+		if (gtk_text_iter_compare (end, &iter) > 0)
+			gtk_text_buffer_move_mark (buffer, end_mark, end);
+	}
+
+	if (priv->update_misspelled_words_id == 0) {
+		priv->update_misspelled_words_id =
+			g_idle_add (update_misspelled_words, chat);
+	}
+}
+
+/* Checks the whole buffer, see chat_input_queue_spell_check() */
+static void
+chat_input_queue_spell_check_all (EmpathyChat *chat)
+{
+	GtkTextBuffer *buffer;
+	GtkTextIter start, end;
+
+	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
+	gtk_text_buffer_get_bounds (buffer, &start, &end);
+
+	chat_input_queue_spell_check (chat, &start, &end);
+}
+
 static void
 chat_input_text_buffer_insert_text_cb (GtkTextBuffer *buffer,
                                        GtkTextIter   *location,
@@ -1774,34 +1917,31 @@ chat_input_text_buffer_insert_text_cb (GtkTextBuffer *buffer,
                                        EmpathyChat   *chat)
 {
 	GtkTextIter iter, pos;
+	glong n_chars;
 
 	/* Remove all misspelled tags in the inserted text.
 	 * This happens when text is inserted within a misspelled word. */
+	n_chars = g_utf8_strlen (text, len);
 	gtk_text_buffer_get_iter_at_offset (buffer, &iter,
-					    gtk_text_iter_get_offset (location) - len);
+					    gtk_text_iter_get_offset (location) - n_chars);
 	gtk_text_buffer_remove_tag_by_name (buffer, "misspelled",
 					    &iter, location);
 
+	/* Don't block typing on large pastes */
+	if (n_chars > SPELL_CHECK_MAX_INSERTED_CHARS) {
+		chat_input_queue_spell_check (chat, &iter, location);
+		return;
+	}
+
 	gtk_text_buffer_get_iter_at_mark (buffer, &pos, gtk_text_buffer_get_insert (buffer));
 
 	do {
 		GtkTextIter start, end;
-		gchar *str;
 
 		if (!chat_input_text_get_word_from_iter (&iter, &start, &end))
 			continue;
 
-		str = gtk_text_buffer_get_text (buffer, &start, &end, FALSE);
-
-		if (gtk_text_iter_in_range (&pos, &start, &end) ||
-				gtk_text_iter_equal (&pos, &end) ||
-				empathy_spell_check (str)) {
-			gtk_text_buffer_remove_tag_by_name (buffer, "misspelled", &start, &end);
-		} else {
-			gtk_text_buffer_apply_tag_by_name (buffer, "misspelled", &start, &end);
-		}
-
-		g_free (str);
+		chat_input_check_word (buffer, &start, &end, &pos);
 
 	} while (gtk_text_iter_forward_word_end (&iter) &&
 		 gtk_text_iter_compare (&iter, location) <= 0);
@@ -2262,12 +2402,9 @@ static void
 chat_add_to_dictionary_activate_cb (GtkMenuItem     *menu_item,
 				    EmpathyChatWord *chat_word)
 {
-	EmpathyChatPriv *priv = GET_PRIV (chat_word->chat);
-
 	empathy_spell_add_to_dictionary (chat_word->code,
 					 chat_word->word);
-	priv->update_misspelled_words_id =
-		g_idle_add (update_misspelled_words, chat_word->chat);
+	chat_input_queue_spell_check_all (chat_word->chat);
 }
 
 static GtkWidget *
@@ -2490,32 +2627,93 @@ chat_input_populate_popup_cb (GtkTextView *view,
 }
 
 
+/* What empathy_message_equal () compares */
+typedef struct {
+	gint64 timestamp;
+	gchar *body;
+} PendingFingerprint;
+
+static guint
+pending_fingerprint_hash (gconstpointer key)
+{
+	const PendingFingerprint *fingerprint = key;
+
+	return g_int64_hash (&fingerprint->timestamp) ^
+		(fingerprint->body != NULL ? g_str_hash (fingerprint->body) : 0);
+}
+
+static gboolean
+pending_fingerprint_equal (gconstpointer a,
+			   gconstpointer b)
+{
+	const PendingFingerprint *fingerprint_a = a;
+	const PendingFingerprint *fingerprint_b = b;
+
+	return fingerprint_a->timestamp == fingerprint_b->timestamp &&
+		!tp_strdiff (fingerprint_a->body, fingerprint_b->body);
+}
+
+static void
+pending_fingerprint_free (PendingFingerprint *fingerprint)
+{
+	g_free (fingerprint->body);
+	g_slice_free (PendingFingerprint, fingerprint);
+}
+
+static GHashTable *
+chat_get_pending_fingerprints (EmpathyChat *chat)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	const GList *l;
+
+	if (priv->pending_fingerprints != NULL)
+		return priv->pending_fingerprints;
+
+	priv->pending_fingerprints = g_hash_table_new_full (
+		pending_fingerprint_hash, pending_fingerprint_equal,
+		(GDestroyNotify) pending_fingerprint_free, NULL);
+
+	for (l = empathy_tp_chat_get_pending_messages (priv->tp_chat);
+	     l != NULL; l = g_list_next (l)) {
+		PendingFingerprint *fingerprint;
+
+		fingerprint = g_slice_new (PendingFingerprint);
+		fingerprint->timestamp = empathy_message_get_timestamp (l->data);
+		fingerprint->body = g_strdup (empathy_message_get_body (l->data));
+
+		g_hash_table_add (priv->pending_fingerprints, fingerprint);
+	}
+
+	return priv->pending_fingerprints;
+}
+
 static gboolean
 chat_log_filter (TplEvent *event,
 		 gpointer user_data)
 {
 	EmpathyChat *chat = EMPATHY_CHAT (user_data);
-	EmpathyChatPriv *priv = GET_PRIV (chat);
-	EmpathyMessage *message;
-	const GList *pending;
-	bool retval = FALSE;
+	TplTextEvent *text_event;
+	PendingFingerprint fingerprint;
 
 	g_return_val_if_fail (TPL_IS_EVENT (event), FALSE);
 	g_return_val_if_fail (EMPATHY_IS_CHAT (chat), FALSE);
 
-	pending = empathy_tp_chat_get_pending_messages (priv->tp_chat);
-	message = empathy_message_from_tpl_log_event (event);
+	/* Pending messages are text messages */
+	if (!TPL_IS_TEXT_EVENT (event))
+		return TRUE;
 
-	for (; pending; pending = g_list_next (pending)) {
-		if (empathy_message_equal (message, pending->data))
-			goto out;
-	}
+	text_event = TPL_TEXT_EVENT (event);
 
-	retval = TRUE;
+	/* Same timestamp as empathy_message_from_tpl_log_event () gives */
+	if (tp_str_empty (tpl_text_event_get_supersedes_token (text_event)))
+		fingerprint.timestamp = tpl_event_get_timestamp (event);
+	else
+		fingerprint.timestamp = tpl_text_event_get_edit_timestamp (text_event);
 
-out:
-	g_object_unref (message);
-	return retval;
+	fingerprint.body = (gchar *) tpl_text_event_get_message (text_event);
+
+	return !g_hash_table_contains (chat_get_pending_fingerprints (chat),
+				       &fingerprint);
 }
 
 static void
@@ -2535,28 +2733,134 @@ show_pending_messages (EmpathyChat *chat) {
 	}
 }
 
-#if 0
-/* FIXME: We need to figure out how to fill backlog automatically with WebKit2 */
-static gboolean
-chat_scrollable_set_value (gpointer user_data)
+static void
+chat_prepend_backlog_message (EmpathyChat    *chat,
+			      EmpathyMessage *message)
+{
+	if (empathy_message_is_edit (message)) {
+		/* this is an edited message, create a synthetic event
+		 * using the supersedes token and
+		 * original-message-sent timestamp, that we can then
+		 * replace */
+		EmpathyMessage *syn_msg = g_object_new (
+			EMPATHY_TYPE_MESSAGE,
+			"body", "",
+			"token", empathy_message_get_supersedes (message),
+			"type", empathy_message_get_tptype (message),
+			"timestamp", empathy_message_get_original_timestamp (message),
+			"incoming", empathy_message_is_incoming (message),
+			"is-backlog", TRUE,
+			"receiver", empathy_message_get_receiver (message),
+			"sender", empathy_message_get_sender (message),
+			NULL);
+
+		empathy_theme_adium_prepend_message (chat->view, syn_msg,
+						  chat_should_highlight (chat, syn_msg));
+		empathy_theme_adium_edit_message (chat->view, message);
+
+		g_object_unref (syn_msg);
+	} else {
+		/* append the latest message */
+		empathy_theme_adium_prepend_message (chat->view, message,
+						  chat_should_highlight (chat, message));
+	}
+}
+
+/* Show the messages of the snapshot, but the pending ones which are shown
+ * anyway. The logs give the same messages in the same order, unless the
+ * snapshot is out of date. */
+static void
+chat_show_snapshot (EmpathyChat *chat)
 {
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	GtkAdjustment *adjustment;
-	guint upper;
+	GHashTable *pending = NULL;
+	GList *messages, *l;
 
-	adjustment = gtk_scrollable_get_vadjustment (
-	    GTK_SCROLLABLE (chat->view));
+	if (priv->tp_chat != NULL)
+		pending = chat_get_pending_fingerprints (chat);
 
-	/* Set the chat->view's adjustment back to the value it had
-	 * before it grew as a result of new logs being inserted.
-	 */
-	upper  = (guint) gtk_adjustment_get_upper (adjustment);
-	gtk_adjustment_set_value (adjustment, upper - priv->scroll_offset);
+	priv->snapshot_timestamps = g_array_new (FALSE, FALSE, sizeof (gint64));
+	messages = empathy_chat_snapshot_dup_messages (priv->snapshot,
+		priv->log_contacts);
 
-	return G_SOURCE_REMOVE;
+	for (l = g_list_last (messages); l; l = g_list_previous (l)) {
+		EmpathyMessage *message = l->data;
+		PendingFingerprint fingerprint;
+
+		fingerprint.timestamp = empathy_message_get_timestamp (message);
+		fingerprint.body = (gchar *) empathy_message_get_body (message);
+
+		if (pending == NULL ||
+		    !g_hash_table_contains (pending, &fingerprint)) {
+			chat_prepend_backlog_message (chat, message);
+			g_array_append_val (priv->snapshot_timestamps,
+				fingerprint.timestamp);
+		}
+
+		g_object_unref (message);
+	}
+	g_list_free (messages);
+
+	DEBUG ("Showing %u messages from the snapshot",
+		priv->snapshot_timestamps->len);
+}
+
+/* Check the messages shown from the snapshot against @backlog, the first
+ * events given by the logs, and start the snapshot again from them.
+ * Returns the number of messages of @backlog which are already shown. */
+static guint
+chat_sync_snapshot (EmpathyChat *chat,
+		    GPtrArray   *backlog)
+{
+	EmpathyChatPriv *priv = GET_PRIV (chat);
+	GArray *shown = priv->snapshot_timestamps;
+	gboolean valid;
+	guint n_shown = 0;
+	guint i;
+
+	if (shown != NULL) {
+		valid = backlog->len >= shown->len;
+
+		for (i = 0; valid && i < shown->len; i++) {
+			EmpathyMessage *message = g_ptr_array_index (backlog, i);
+
+			valid = empathy_message_get_timestamp (message) ==
+				g_array_index (shown, gint64, i);
+		}
+
+		if (valid) {
+			n_shown = shown->len;
+		} else {
+			/* The logs are right, show them instead */
+			DEBUG ("Snapshot is out of date, showing the logs");
+			empathy_theme_adium_reset (chat->view);
+
+			if (priv->tp_chat != NULL)
+				show_pending_messages (chat);
+		}
+
+		g_array_unref (shown);
+		priv->snapshot_timestamps = NULL;
+	}
+
+	empathy_chat_snapshot_clear (priv->snapshot);
+
+	for (i = backlog->len; i > 0; i--)
+		empathy_chat_snapshot_add_message (priv->snapshot,
+			g_ptr_array_index (backlog, i - 1));
+
+	if (priv->tp_chat != NULL) {
+		const GList *l;
+
+		for (l = empathy_tp_chat_get_pending_messages (priv->tp_chat);
+		     l != NULL; l = g_list_next (l))
+			empathy_chat_snapshot_add_message (priv->snapshot, l->data);
+	}
+
+	priv->snapshot_synced = TRUE;
+
+	return n_shown;
 }
-#endif
 
 static void
 got_filtered_messages_cb (GObject *walker,
@@ -2568,6 +2872,16 @@ got_filtered_messages_cb (GObject *walker,
 	EmpathyChat *chat = EMPATHY_CHAT (user_data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	GError *error = NULL;
+	GPtrArray *backlog;
+	guint n_shown = 0;
+	guint i;
+	gint64 elapsed;
+
+	elapsed = g_get_monotonic_time () - priv->backlog_fetch_start;
+	if (priv->backlog_fetch_time == 0)
+		priv->backlog_fetch_time = elapsed;
+	else
+		priv->backlog_fetch_time = (3 * priv->backlog_fetch_time + elapsed) / 4;
 
 	if (!tpl_log_walker_get_events_finish (TPL_LOG_WALKER (walker),
 		result, &messages, &error)) {
@@ -2578,196 +2892,151 @@ got_filtered_messages_cb (GObject *walker,
 		goto out;
 	}
 
+	DEBUG ("Got %u events from the logs in %" G_GINT64_FORMAT " ms",
+		g_list_length (messages), elapsed / G_TIME_SPAN_MILLISECOND);
+
+	/* The most recent first */
+	backlog = g_ptr_array_new_with_free_func (g_object_unref);
 	for (l = g_list_last (messages); l; l = g_list_previous (l)) {
 		EmpathyMessage *message;
 
 		g_assert (TPL_IS_EVENT (l->data));
 
-		message = empathy_message_from_tpl_log_event (l->data);
+		message = empathy_message_from_tpl_log_event_memo (l->data,
+			priv->log_contacts);
 		g_object_unref (l->data);
 
-		if (empathy_message_is_edit (message)) {
-			/* this is an edited message, create a synthetic event
-			 * using the supersedes token and
-			 * original-message-sent timestamp, that we can then
-			 * replace */
-			EmpathyMessage *syn_msg = g_object_new (
-				EMPATHY_TYPE_MESSAGE,
-				"body", "",
-				"token", empathy_message_get_supersedes (message),
-				"type", empathy_message_get_tptype (message),
-				"timestamp", empathy_message_get_original_timestamp (message),
-				"incoming", empathy_message_is_incoming (message),
-				"is-backlog", TRUE,
-				"receiver", empathy_message_get_receiver (message),
-				"sender", empathy_message_get_sender (message),
-				NULL);
-
-			empathy_theme_adium_prepend_message (chat->view, syn_msg,
-							  chat_should_highlight (chat, syn_msg));
-			empathy_theme_adium_edit_message (chat->view, message);
-
-			g_object_unref (syn_msg);
-		} else {
-			/* append the latest message */
-			empathy_theme_adium_prepend_message (chat->view, message,
-							  chat_should_highlight (chat, message));
-		}
-
-		g_object_unref (message);
+		if (message != NULL)
+			g_ptr_array_add (backlog, message);
 	}
 	g_list_free (messages);
 
+	/* Some of them may already be shown */
+	if (!priv->backlog_paging && priv->snapshot != NULL)
+		n_shown = chat_sync_snapshot (chat, backlog);
+
+	/* Render the whole page at once */
+	if (priv->backlog_paging)
+		empathy_theme_adium_begin_backlog_page (chat->view);
+
+	for (i = n_shown; i < backlog->len; i++)
+		chat_prepend_backlog_message (chat,
+			g_ptr_array_index (backlog, i));
+
+	g_ptr_array_unref (backlog);
+
+	DEBUG ("Sender resolutions avoided so far: %u",
+		empathy_contact_memo_get_n_avoided (priv->log_contacts));
+
 out:
 	/* FIXME: See Bug#610994, we are forcing the ACK of the queue. See comments
 	 * about it in EmpathyChatPriv definition */
 	priv->retrieving_backlogs = FALSE;
 	empathy_chat_messages_read (chat);
 
-	/* Turn back on scrolling */
-	empathy_theme_adium_scroll (chat->view, TRUE);
+	/* Let the view ask for the next page */
+	empathy_theme_adium_end_backlog_page (chat->view,
+		tpl_log_walker_is_end (priv->log_walker));
 
-#if 0
-	/* FIXME: We need to figure out how to fill backlog automatically with WebKit2 */
-	/* We start watching the scrolling movements only after the first
-	 * batch of logs have been fetched. Otherwise, if the
-	 * chat->view's page size is too small the scrollbar might hit
-	 * the upper edge and trigger another batch of logs to be
-	 * fetched.
-	 */
-	if (G_UNLIKELY (!priv->watch_scroll &&
-			!tpl_log_walker_is_end (priv->log_walker))) {
-		priv->watch_scroll = TRUE;
-		g_idle_add_full (G_PRIORITY_LOW, chat_scrollable_connect,
-		    g_object_ref (chat), g_object_unref);
-	}
-	else {
-		GtkAdjustment *adjustment;
-		guint upper;
-		guint value;
-
-		/* The chat->view's adjustment won't change unless we
-		 * return to the main loop. Save the current offset
-		 * from the lower edge (or the upper value of the
-		 * adjustment) so that we can restore it later once the
-		 * adjustment grows.
-		 */
-		adjustment = gtk_scrollable_get_vadjustment (
-		    GTK_SCROLLABLE (chat->view));
-		upper = (guint) gtk_adjustment_get_upper (adjustment);
-		value = (guint) gtk_adjustment_get_value (adjustment);
-		priv->scroll_offset = upper - value;
+	if (!priv->backlog_paging) {
+		/* Turn back on scrolling */
+		empathy_theme_adium_scroll (chat->view, TRUE);
 
-		g_idle_add_full (G_PRIORITY_LOW, chat_scrollable_set_value,
-		    g_object_ref (chat), g_object_unref);
+		/* The view can now be loaded, with the backlog in it */
+		if (priv->document_frozen) {
+			empathy_theme_adium_thaw_document (chat->view);
+			priv->document_frozen = FALSE;
+		}
 	}
-#endif
+
 	g_object_unref (chat);
 }
 
-static gboolean
-chat_add_logs (EmpathyChat *chat)
+/* Fetch enough events to fill the view a couple of times, and more if the
+ * logs are slow to come */
+static guint
+chat_get_backlog_page_size (EmpathyChat *chat)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
+	guint screen;
+	guint screens;
 
-	if (!priv->id) {
-		return G_SOURCE_REMOVE;
-	}
-
-	/* Turn off scrolling temporarily */
-	empathy_theme_adium_scroll (chat->view, FALSE);
-
-	tpl_log_walker_get_events_async (priv->log_walker, 5,
-	    got_filtered_messages_cb, g_object_ref (chat));
+	screen = gtk_widget_get_allocated_height (GTK_WIDGET (chat->view)) /
+		BACKLOG_MESSAGE_HEIGHT;
+	screens = 2 + MIN (priv->backlog_fetch_time / BACKLOG_TARGET_FETCH_TIME, 4);
 
-	return G_SOURCE_REMOVE;
+	return CLAMP (screen * screens, BACKLOG_MIN_PAGE_SIZE,
+		BACKLOG_MAX_PAGE_SIZE);
 }
 
-#if 0
-/* FIXME: We need to figure out how to fill backlog automatically with WebKit2 */
 static void
-chat_schedule_logs (EmpathyChat *chat)
+chat_add_logs (EmpathyChat *chat,
+	       gboolean     paging)
 {
 	EmpathyChatPriv *priv = GET_PRIV (chat);
+	guint page_size;
 
-	if (priv->retrieving_backlogs)
+	if (!priv->id) {
 		return;
+	}
 
-	priv->retrieving_backlogs = TRUE;
-	g_timeout_add_full (G_PRIORITY_LOW, 500, /* ms */
-	    (GSourceFunc) chat_add_logs, g_object_ref (chat), g_object_unref);
-}
+	page_size = chat_get_backlog_page_size (chat);
 
-static void
-chat_view_adjustment_changed_cb (GtkAdjustment *adjustment,
-				 gpointer user_data)
-{
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
-	EmpathyChatPriv *priv = GET_PRIV (chat);
-	guint page_size;
+	if (!paging) {
+		/* Turn off scrolling temporarily */
+		empathy_theme_adium_scroll (chat->view, FALSE);
 
-	if (tpl_log_walker_is_end (priv->log_walker)) {
-		g_signal_handlers_disconnect_by_func (adjustment,
-		    chat_view_adjustment_changed_cb, user_data);
-		return;
+		/* Show what we had last time right away; the snapshot is a
+		 * copy of the logs, so there is none if they are disabled */
+		if (priv->account != NULL && chat_logging_enabled (chat)) {
+			priv->snapshot = empathy_chat_snapshot_new (priv->account,
+				priv->id);
+			chat_show_snapshot (chat);
+
+			/* The logs have to give them again, to check them */
+			page_size = MAX (page_size,
+				priv->snapshot_timestamps->len + BACKLOG_MIN_PAGE_SIZE);
+		}
+
+		/* Otherwise render the initial backlog as part of the view's
+		 * page */
+		if (priv->snapshot_timestamps == NULL ||
+		    priv->snapshot_timestamps->len == 0) {
+			empathy_theme_adium_freeze_document (chat->view);
+			priv->document_frozen = TRUE;
+		}
 	}
 
-	page_size = (guint) gtk_adjustment_get_page_size (adjustment);
-	if (page_size <= priv->max_page_size)
-		return;
+	DEBUG ("Fetching %u events from the logs", page_size);
 
-	/* We need to fetch more logs if the page size of the view
-	 * increases, so that there is no empty space at the top.
-	 */
-	if (G_LIKELY (priv->max_page_size != 0))
-		chat_schedule_logs (chat);
+	priv->retrieving_backlogs = TRUE;
+	priv->backlog_paging = paging;
+	priv->backlog_fetch_start = g_get_monotonic_time ();
 
-	priv->max_page_size = page_size;
+	tpl_log_walker_get_events_async (priv->log_walker, page_size,
+	    got_filtered_messages_cb, g_object_ref (chat));
 }
 
 static void
-chat_view_adjustment_value_changed_cb (GtkAdjustment *adjustment,
-				       gpointer user_data)
+chat_view_backlog_needed_cb (EmpathyThemeAdium *view,
+			     EmpathyChat       *chat)
 {
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
-	guint lower;
-	guint value;
 
-	if (tpl_log_walker_is_end (priv->log_walker)) {
-		g_signal_handlers_disconnect_by_func (adjustment,
-		    chat_view_adjustment_value_changed_cb, user_data);
+	/* The page being fetched will be the answer */
+	if (priv->retrieving_backlogs)
 		return;
-	}
 
-	lower = (guint) gtk_adjustment_get_lower (adjustment);
-	value = (guint) gtk_adjustment_get_value (adjustment);
-	if (value != lower)
+	/* Like the initial backlog, this is not wanted in rooms */
+	if (priv->handle_type == TP_HANDLE_TYPE_ROOM ||
+	    priv->log_walker == NULL ||
+	    tpl_log_walker_is_end (priv->log_walker)) {
+		empathy_theme_adium_end_backlog_page (view, TRUE);
 		return;
+	}
 
-	/* Request for more logs to be fetched if the user hit the
-	 * upper edge of the chat->view.
-	 */
-	chat_schedule_logs (chat);
-}
-
-static gboolean
-chat_scrollable_connect (gpointer user_data)
-{
-	EmpathyChat *chat = EMPATHY_CHAT (user_data);
-	GtkAdjustment *adjustment;
-
-	adjustment = gtk_scrollable_get_vadjustment (
-	    GTK_SCROLLABLE (chat->view));
-
-	g_signal_connect (adjustment, "changed",
-	    G_CALLBACK (chat_view_adjustment_changed_cb), chat);
-	g_signal_connect (adjustment, "value-changed",
-	    G_CALLBACK (chat_view_adjustment_value_changed_cb), chat);
-
-	return G_SOURCE_REMOVE;
+	chat_add_logs (chat, TRUE);
 }
-#endif
 
 static gint
 chat_contacts_completion_func (const gchar *s1,
@@ -3085,6 +3354,7 @@ chat_invalidated_cb (EmpathyTpChat *tp_chat,
 	chat_composing_remove_timeout (chat);
 	g_object_unref (priv->tp_chat);
 	priv->tp_chat = NULL;
+	tp_clear_pointer (&priv->pending_fingerprints, g_hash_table_unref);
 	g_object_notify (G_OBJECT (chat), "tp-chat");
 
 	empathy_theme_adium_append_event (chat->view, _("Disconnected"));
@@ -3101,16 +3371,41 @@ update_misspelled_words (gpointer data)
 	EmpathyChat *chat = EMPATHY_CHAT (data);
 	EmpathyChatPriv *priv = GET_PRIV (chat);
 	GtkTextBuffer *buffer;
-	GtkTextIter iter;
-	gint length;
+	GtkTextMark *start_mark;
+	GtkTextIter iter, end, pos;
+	guint n_words = 0;
 
 	buffer = gtk_text_view_get_buffer (GTK_TEXT_VIEW (chat->input_text_view));
 
-	gtk_text_buffer_get_end_iter (buffer, &iter);
-	length = gtk_text_iter_get_offset (&iter);
-	chat_input_text_buffer_insert_text_cb (buffer, &iter,
-					       NULL, length, chat);
+	start_mark = gtk_text_buffer_get_mark (buffer, "spell-check-start");
+	gtk_text_buffer_get_iter_at_mark (buffer, &iter, start_mark);
+	gtk_text_buffer_get_iter_at_mark (buffer, &end,
+		gtk_text_buffer_get_mark (buffer, "spell-check-end"));
+	gtk_text_buffer_get_iter_at_mark (buffer, &pos,
+		gtk_text_buffer_get_insert (buffer));
+
+	/* The tag may have been removed since this was queued */
+	if (!priv->spell_checking_enabled)
+		goto out;
+
+	do {
+		GtkTextIter word_start, word_end;
+
+		if (n_words++ == SPELL_CHECK_SLICE_WORDS) {
+			/* Let the main loop run, we'll continue from here */
+			gtk_text_buffer_move_mark (buffer, start_mark, &iter);
+			return TRUE;
+		}
 
+		if (!chat_input_text_get_word_from_iter (&iter, &word_start, &word_end))
+			continue;
+
+		chat_input_check_word (buffer, &word_start, &word_end, &pos);
+
+	} while (gtk_text_iter_forward_word_end (&iter) &&
+		 gtk_text_iter_compare (&iter, &end) <= 0);
+
+out:
 	priv->update_misspelled_words_id = 0;
 
 	return FALSE;
@@ -3143,8 +3438,7 @@ conf_spell_checking_cb (GSettings *gsettings_chat,
 			/* Possibly changed dictionaries,
 			 * update misspelled words. Need to do so in idle
 			 * so the spell checker is updated. */
-			priv->update_misspelled_words_id =
-				g_idle_add (update_misspelled_words, chat);
+			chat_input_queue_spell_check_all (chat);
 		}
 
 		return;
@@ -3177,8 +3471,7 @@ conf_spell_checking_cb (GSettings *gsettings_chat,
 
 		/* Mark misspelled words in the existing buffer.
 		 * Need to do so in idle so the spell checker is updated. */
-		priv->update_misspelled_words_id =
-			g_idle_add (update_misspelled_words, chat);
+		chat_input_queue_spell_check_all (chat);
 	} else {
 		GtkTextTagTable *table;
 		GtkTextTag *tag;
@@ -3268,7 +3561,7 @@ chat_create_ui (EmpathyChat *chat)
 
 	/* Add message view. */
 	theme_mgr = empathy_theme_manager_dup_singleton ();
-	chat->view = empathy_theme_manager_create_view (theme_mgr);
+	chat->view = empathy_theme_manager_dup_view (theme_mgr);
 	g_object_unref (theme_mgr);
 	/* If this is a GtkTextView, it's set as a drag destination for text/plain
 	   and other types, even though it's non-editable and doesn't accept any
@@ -3279,6 +3572,9 @@ chat_create_ui (EmpathyChat *chat)
 	g_signal_connect (chat->view, "focus_in_event",
 			  G_CALLBACK (chat_text_view_focus_in_event_cb),
 			  chat);
+	g_signal_connect (chat->view, "backlog-needed",
+			  G_CALLBACK (chat_view_backlog_needed_cb),
+			  chat);
 	if (GTK_IS_SCROLLABLE (chat->view))
 	  {
 	    gtk_container_add (GTK_CONTAINER (priv->scrolled_window_chat),
@@ -3360,11 +3656,28 @@ chat_create_ui (EmpathyChat *chat)
 	g_object_unref (gui);
 }
 
+static void
+chat_destroy (GtkWidget *widget)
+{
+	EmpathyChat *chat = EMPATHY_CHAT (widget);
+	GtkWidget   *view = GTK_WIDGET (chat->view);
+
+	/* Don't let the view be destroyed with us, it's given back to the
+	 * theme manager in chat_finalize() */
+	if (view != NULL && gtk_widget_get_parent (view) != NULL) {
+		gtk_container_remove (GTK_CONTAINER (gtk_widget_get_parent (view)),
+				      view);
+	}
+
+	GTK_WIDGET_CLASS (empathy_chat_parent_class)->destroy (widget);
+}
+
 static void
 chat_finalize (GObject *object)
 {
 	EmpathyChat     *chat;
 	EmpathyChatPriv *priv;
+	EmpathyThemeManager *theme_mgr;
 
 	chat = EMPATHY_CHAT (object);
 	priv = GET_PRIV (chat);
@@ -3374,6 +3687,9 @@ chat_finalize (GObject *object)
 	if (priv->update_misspelled_words_id != 0)
 		g_source_remove (priv->update_misspelled_words_id);
 
+	if (priv->notify_unread_messages_id != 0)
+		g_source_remove (priv->notify_unread_messages_id);
+
 	if (priv->save_paned_pos_id != 0)
 		g_source_remove (priv->save_paned_pos_id);
 
@@ -3382,6 +3698,7 @@ chat_finalize (GObject *object)
 
 	g_object_unref (priv->gsettings_chat);
 	g_object_unref (priv->gsettings_ui);
+	g_object_unref (priv->gsettings_logger);
 
 	g_list_foreach (priv->input_history, (GFunc) chat_input_history_entry_free, NULL);
 	g_list_free (priv->input_history);
@@ -3442,6 +3759,24 @@ chat_finalize (GObject *object)
 	g_completion_free (priv->completion);
 
 	tp_clear_pointer (&priv->highlight_regex, g_regex_unref);
+	tp_clear_pointer (&priv->pending_fingerprints, g_hash_table_unref);
+	empathy_contact_memo_free (priv->log_contacts);
+
+	if (priv->snapshot != NULL) {
+		if (chat_logging_enabled (chat))
+			empathy_chat_snapshot_save (priv->snapshot);
+		empathy_chat_snapshot_free (priv->snapshot);
+	}
+	tp_clear_pointer (&priv->snapshot_timestamps, g_array_unref);
+
+	/* Done last, so nothing we still had pending could touch the view once
+	 * another chat uses it */
+	if (chat->view != NULL) {
+		g_signal_handlers_disconnect_by_data (chat->view, chat);
+		theme_mgr = empathy_theme_manager_dup_singleton ();
+		empathy_theme_manager_release_view (theme_mgr, chat->view);
+		g_object_unref (theme_mgr);
+	}
 
 	G_OBJECT_CLASS (empathy_chat_parent_class)->finalize (object);
 }
@@ -3480,7 +3815,7 @@ chat_constructed (GObject *object)
 	g_object_unref (target);
 
 	if (priv->handle_type != TP_HANDLE_TYPE_ROOM) {
-		chat_add_logs (chat);
+		chat_add_logs (chat, FALSE);
 	}
 }
 
@@ -3488,12 +3823,15 @@ static void
 empathy_chat_class_init (EmpathyChatClass *klass)
 {
 	GObjectClass   *object_class = G_OBJECT_CLASS (klass);
+	GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
 
 	object_class->finalize = chat_finalize;
 	object_class->get_property = chat_get_property;
 	object_class->set_property = chat_set_property;
 	object_class->constructed = chat_constructed;
 
+	widget_class->destroy = chat_destroy;
+
 	g_object_class_install_property (object_class,
 					 PROP_TP_CHAT,
 					 g_param_spec_object ("tp-chat",
@@ -3663,8 +4001,10 @@ empathy_chat_init (EmpathyChat *chat)
 
 	chat->priv = priv;
 	priv->log_manager = tpl_log_manager_dup_singleton ();
+	priv->log_contacts = empathy_contact_memo_new ();
 	priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
 	priv->gsettings_ui = g_settings_new (EMPATHY_PREFS_UI_SCHEMA);
+	priv->gsettings_logger = g_settings_new (EMPATHY_PREFS_LOGGER_SCHEMA);
 
 	priv->contacts_width = g_settings_get_int (priv->gsettings_ui,
 		EMPATHY_PREFS_UI_CHAT_WINDOW_PANED_POS);
@@ -4142,6 +4482,7 @@ empathy_chat_set_tp_chat (EmpathyChat   *chat,
 	}
 
 	priv->tp_chat = g_object_ref (tp_chat);
+	tp_clear_pointer (&priv->pending_fingerprints, g_hash_table_unref);
 	priv->account = g_object_ref (empathy_tp_chat_get_account (priv->tp_chat));
 
 	g_signal_connect (tp_chat, "invalidated",
@@ -4515,9 +4856,10 @@ empathy_chat_messages_read (EmpathyChat *self)
 	if (priv->retrieving_backlogs)
 		return;
 
+	/* Only ack what has been shown, in one round-trip */
 	if (priv->tp_chat != NULL) {
-		tp_text_channel_ack_all_pending_messages_async (
-			TP_TEXT_CHANNEL (priv->tp_chat), NULL, NULL);
+		empathy_tp_chat_acknowledge_messages (priv->tp_chat,
+			empathy_tp_chat_get_pending_messages (priv->tp_chat));
 	}
 
 	priv->highlighted = FALSE;
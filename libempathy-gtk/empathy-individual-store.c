@@ -47,6 +47,14 @@
 /* Time in seconds after connecting which we wait before active users are enabled */
 #define ACTIVE_USER_WAIT_TO_ENABLE_TIME 5
 
+/* Maximum time in microseconds spent updating changed individuals before
+ * letting the next frame be drawn */
+#define MAX_FRAME_UPDATE_TIME 8000
+
+/* From this number of changed individuals it's faster to sort the whole
+ * store once than to move each row */
+#define CHANGED_INDIVIDUALS_RESORT_THRESHOLD 200
+
 struct _EmpathyIndividualStorePriv
 {
   gboolean show_avatars;
@@ -64,6 +72,12 @@ struct _EmpathyIndividualStorePriv
   /* Hash: char *groupname -> GtkTreeIter * */
   GHashTable                  *empathy_group_cache;
   gboolean show_active;
+  /* Set of reffed FolksIndividual to update before the next frame */
+  GHashTable *changed_individuals;
+  guint changed_individuals_id;
+  /* TRUE if the store is left unsorted until all the changed individuals
+   * are updated */
+  gboolean sort_pending;
 };
 
 typedef struct
@@ -87,6 +101,7 @@ enum
 /* prototypes to break cycles */
 static void individual_store_contact_update (EmpathyIndividualStore *self,
     FolksIndividual *individual);
+static void individual_store_apply_sort (EmpathyIndividualStore *self);
 
 G_DEFINE_TYPE (EmpathyIndividualStore, empathy_individual_store,
     GTK_TYPE_TREE_STORE);
@@ -239,6 +254,8 @@ empathy_individual_store_remove_individual (EmpathyIndividualStore *self,
   GQueue *row_refs;
   GList *l;
 
+  g_hash_table_remove (self->priv->changed_individuals, individual);
+
   row_refs = g_hash_table_lookup (self->priv->folks_individual_cache,
       individual);
   if (!row_refs)
@@ -699,12 +716,83 @@ individual_store_contact_update (EmpathyIndividualStore *self,
   empathy_individual_store_free_iters (iters);
 }
 
+static gboolean
+individual_store_apply_changes_cb (gpointer user_data)
+{
+  EmpathyIndividualStore *self = user_data;
+  GHashTableIter iter;
+  gpointer key;
+  gint64 start;
+  guint n = 0;
+
+  start = g_get_monotonic_time ();
+
+  /* When a lot of individuals changed, leave the store unsorted until all
+   * of them are updated, however many frames it takes, and sort it once
+   * then rather than after each update */
+  if (!self->priv->sort_pending &&
+      g_hash_table_size (self->priv->changed_individuals) >=
+      CHANGED_INDIVIDUALS_RESORT_THRESHOLD)
+    {
+      self->priv->sort_pending = TRUE;
+      gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
+          GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->changed_individuals);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      FolksIndividual *individual = key;
+
+      g_hash_table_iter_steal (&iter);
+      individual_store_contact_update (self, individual);
+      g_object_unref (individual);
+      n++;
+
+      if (g_get_monotonic_time () - start > MAX_FRAME_UPDATE_TIME)
+        break;
+    }
+
+  DEBUG ("Updated %u individuals in %" G_GINT64_FORMAT " us, %u left", n,
+      g_get_monotonic_time () - start,
+      g_hash_table_size (self->priv->changed_individuals));
+
+  if (g_hash_table_size (self->priv->changed_individuals) > 0)
+    return G_SOURCE_CONTINUE;
+
+  if (self->priv->sort_pending)
+    {
+      self->priv->sort_pending = FALSE;
+      individual_store_apply_sort (self);
+    }
+
+  self->priv->changed_individuals_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+/* Presence, avatar, etc changes of a lot of individuals often arrive at the
+ * same time, when connecting for example. Update them all just before the
+ * next frame is drawn rather than one by one. */
+static void
+individual_store_queue_contact_update (EmpathyIndividualStore *self,
+    FolksIndividual *individual)
+{
+  if (!g_hash_table_contains (self->priv->changed_individuals, individual))
+    g_hash_table_add (self->priv->changed_individuals,
+        g_object_ref (individual));
+
+  if (self->priv->changed_individuals_id == 0)
+    self->priv->changed_individuals_id = g_idle_add_full (
+        GDK_PRIORITY_REDRAW - 1, individual_store_apply_changes_cb, self,
+        NULL);
+}
+
 static void
 individual_store_individual_updated_cb (FolksIndividual *individual,
     GParamSpec *param,
     EmpathyIndividualStore *self)
 {
-  individual_store_contact_update (self, individual);
+  individual_store_queue_contact_update (self, individual);
 }
 
 static void
@@ -718,7 +806,7 @@ individual_store_contact_updated_cb (EmpathyContact *contact,
   if (individual == NULL)
     return;
 
-  individual_store_contact_update (self, individual);
+  individual_store_queue_contact_update (self, individual);
 }
 
 static void
@@ -846,6 +934,8 @@ empathy_individual_store_disconnect_individual (EmpathyIndividualStore *self,
       (GCallback) individual_personas_changed_cb, self);
   g_signal_handlers_disconnect_by_func (individual,
       (GCallback) individual_store_favourites_changed_cb, self);
+
+  g_hash_table_remove (self->priv->changed_individuals, individual);
 }
 
 void
@@ -880,9 +970,16 @@ individual_store_dispose (GObject *object)
       g_source_remove (self->priv->inhibit_active);
     }
 
+  if (self->priv->changed_individuals_id != 0)
+    {
+      g_source_remove (self->priv->changed_individuals_id);
+      self->priv->changed_individuals_id = 0;
+    }
+
   g_hash_table_unref (self->priv->status_icons);
   g_hash_table_unref (self->priv->folks_individual_cache);
   g_hash_table_unref (self->priv->empathy_group_cache);
+  g_hash_table_unref (self->priv->changed_individuals);
   G_OBJECT_CLASS (empathy_individual_store_parent_class)->dispose (object);
 }
 
@@ -1324,6 +1421,8 @@ empathy_individual_store_init (EmpathyIndividualStore *self)
       g_queue_free_full_iter);
   self->priv->empathy_group_cache = g_hash_table_new_full (g_str_hash,
       g_str_equal, g_free, (GDestroyNotify) gtk_tree_iter_free);
+  self->priv->changed_individuals = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, NULL);
   individual_store_setup (self);
 }
 
@@ -1505,7 +1604,17 @@ empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
 
   self->priv->sort_criterium = sort_criterium;
 
-  switch (sort_criterium)
+  /* Otherwise the store is sorted once the changes are applied */
+  if (!self->priv->sort_pending)
+    individual_store_apply_sort (self);
+
+  g_object_notify (G_OBJECT (self), "sort-criterium");
+}
+
+static void
+individual_store_apply_sort (EmpathyIndividualStore *self)
+{
+  switch (self->priv->sort_criterium)
     {
     case EMPATHY_INDIVIDUAL_STORE_SORT_STATE:
       gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self),
@@ -1520,8 +1629,6 @@ empathy_individual_store_set_sort_criterium (EmpathyIndividualStore *self,
     default:
       g_assert_not_reached ();
     }
-
-  g_object_notify (G_OBJECT (self), "sort-criterium");
 }
 
 gboolean
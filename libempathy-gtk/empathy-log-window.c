@@ -36,10 +36,12 @@
 #include "action-chain-internal.h"
 #include "empathy-account-chooser.h"
 #include "empathy-call-utils.h"
+#include "empathy-chat-snapshot.h"
 #include "empathy-geometry.h"
 #include "empathy-gsettings.h"
 #include "empathy-images.h"
 #include "empathy-individual-information-dialog.h"
+#include "empathy-log-index.h"
 #include "empathy-request-util.h"
 #include "empathy-theme-manager.h"
 #include "empathy-ui-utils.h"
@@ -84,6 +86,7 @@ struct _EmpathyLogWindowPriv
 
   TplActionChain *chain;
   TplLogManager *log_manager;
+  EmpathyLogIndex *log_index;
 
   /* Hash of TpChannel<->TpAccount for use by the observer until we can
    * get a TpAccount from a TpConnection or wherever */
@@ -134,6 +137,8 @@ static void log_window_when_changed_cb           (GtkTreeSelection *selection,
                                                   EmpathyLogWindow *self);
 static void log_window_delete_menu_clicked_cb    (GtkMenuItem      *menuitem,
                                                   EmpathyLogWindow *self);
+static void log_window_log_index_updated_cb      (EmpathyLogIndex  *log_index,
+                                                  EmpathyLogWindow *self);
 static void start_spinner                        (void);
 
 static void log_window_create_observer           (EmpathyLogWindow *window);
@@ -614,6 +619,7 @@ empathy_log_window_dispose (GObject *object)
 
   tp_clear_object (&self->priv->observer);
   tp_clear_object (&self->priv->log_manager);
+  tp_clear_object (&self->priv->log_index);
   tp_clear_object (&self->priv->selected_account);
   tp_clear_object (&self->priv->selected_contact);
   tp_clear_object (&self->priv->events_contact);
@@ -671,6 +677,11 @@ empathy_log_window_init (EmpathyLogWindow *self)
 
   self->priv->log_manager = tpl_log_manager_dup_singleton ();
 
+  self->priv->log_index = empathy_log_index_dup_singleton ();
+  tp_g_signal_connect_object (self->priv->log_index, "updated",
+      G_CALLBACK (log_window_log_index_updated_cb), self, 0);
+  empathy_log_index_update (self->priv->log_index);
+
   self->priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
   self->priv->gsettings_desktop = g_settings_new (
       EMPATHY_PREFS_DESKTOP_INTERFACE_SCHEMA);
@@ -1290,7 +1301,6 @@ log_window_append_chat_message (TplEvent *event,
   GtkTreeIter iter, parent;
   gchar *pretty_date, *alias, *body;
   GDateTime *date;
-  TpawStringParser *parsers;
   GString *msg;
 
   date = g_date_time_new_from_unix_local (
@@ -1304,13 +1314,11 @@ log_window_append_chat_message (TplEvent *event,
       tpl_entity_get_alias (tpl_event_get_sender (event)), -1);
 
   /* escape the text */
-  parsers = empathy_webkit_get_string_parser (
-      g_settings_get_boolean (log_window->priv->gsettings_chat,
-        EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
   msg = g_string_new ("");
 
-  tpaw_string_parser_substr (empathy_message_get_body (message), -1,
-      parsers, msg);
+  empathy_webkit_append_body (msg, empathy_message_get_body (message), -1,
+      g_settings_get_boolean (log_window->priv->gsettings_chat,
+        EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
 
   if (tpl_text_event_get_message_type (TPL_TEXT_EVENT (event))
       == TP_CHANNEL_TEXT_MESSAGE_TYPE_ACTION)
@@ -1974,14 +1982,33 @@ populate_entities_from_search_hits (void)
     gtk_tree_selection_select_iter (selection, &iter);
 }
 
+/* Takes ownership of @hits */
+static void
+log_window_set_search_hits (EmpathyLogWindow *self,
+    GList *hits)
+{
+  GtkTreeView *view;
+  GtkTreeSelection *selection;
+
+  tp_clear_pointer (&self->priv->hits, tpl_log_manager_search_free);
+  self->priv->hits = hits;
+
+  view = GTK_TREE_VIEW (self->priv->treeview_when);
+  selection = gtk_tree_view_get_selection (view);
+
+  g_signal_handlers_unblock_by_func (selection,
+      log_window_when_changed_cb,
+      self);
+
+  populate_entities_from_search_hits ();
+}
+
 static void
 log_manager_searched_new_cb (GObject *manager,
     GAsyncResult *result,
     gpointer user_data)
 {
   GList *hits;
-  GtkTreeView *view;
-  GtkTreeSelection *selection;
   GError *error = NULL;
 
   if (log_window == NULL)
@@ -1995,17 +2022,7 @@ log_manager_searched_new_cb (GObject *manager,
       return;
     }
 
-  tp_clear_pointer (&log_window->priv->hits, tpl_log_manager_search_free);
-  log_window->priv->hits = hits;
-
-  view = GTK_TREE_VIEW (log_window->priv->treeview_when);
-  selection = gtk_tree_view_get_selection (view);
-
-  g_signal_handlers_unblock_by_func (selection,
-      log_window_when_changed_cb,
-      log_window);
-
-  populate_entities_from_search_hits ();
+  log_window_set_search_hits (log_window, hits);
 }
 
 static void
@@ -2051,6 +2068,13 @@ log_window_find_populate (EmpathyLogWindow *self,
       webkit_web_view_get_find_controller (WEBKIT_WEB_VIEW (self->priv->webview)),
       search_criteria, WEBKIT_FIND_OPTIONS_CASE_INSENSITIVE, G_MAXUINT);
 
+  if (empathy_log_index_can_search (self->priv->log_index, search_criteria))
+    {
+      log_window_set_search_hits (self,
+          empathy_log_index_search (self->priv->log_index, search_criteria));
+      return;
+    }
+
   tpl_log_manager_search_async (self->priv->log_manager,
       search_criteria, TPL_EVENT_MASK_ANY,
       log_manager_searched_new_cb, NULL);
@@ -2070,6 +2094,9 @@ start_find_search (EmpathyLogWindow *self)
   g_free (self->priv->last_find);
   self->priv->last_find = g_strdup (str);
 
+  /* Pick up what was logged since the window was opened */
+  empathy_log_index_update (self->priv->log_index);
+
   log_window_find_populate (self, str);
 
   return FALSE;
@@ -2100,8 +2127,23 @@ log_window_search_entry_changed_cb (GtkWidget *entry,
 
   if (self->priv->source != 0)
     g_source_remove (self->priv->source);
-  self->priv->source = g_timeout_add (500, (GSourceFunc) start_find_search,
-      self);
+  /* The index answers without reading the logs, so there is no need to
+   * wait as long for the user to stop typing */
+  self->priv->source = g_timeout_add (
+      empathy_log_index_can_search (self->priv->log_index, str) ? 100 : 500,
+      (GSourceFunc) start_find_search, self);
+}
+
+static void
+log_window_log_index_updated_cb (EmpathyLogIndex *log_index,
+    EmpathyLogWindow *self)
+{
+  /* Newly indexed messages may match the current search */
+  if (TPAW_STR_EMPTY (self->priv->last_find) ||
+      !empathy_log_index_can_search (log_index, self->priv->last_find))
+    return;
+
+  log_window_find_populate (self, self->priv->last_find);
 }
 
 static void
@@ -3232,6 +3274,7 @@ log_window_got_messages_for_date_cb (GObject *manager,
   GtkTreeIter iter;
   GList *events;
   GList *l;
+  EmpathyContactMemo *contacts;
   GError *error = NULL;
   gint n;
 
@@ -3253,6 +3296,9 @@ log_window_got_messages_for_date_cb (GObject *manager,
       goto out;
     }
 
+  /* A day usually has a handful of distinct senders */
+  contacts = empathy_contact_memo_new ();
+
   for (l = events; l; l = l->next)
     {
       TplEvent *event = l->data;
@@ -3297,7 +3343,8 @@ log_window_got_messages_for_date_cb (GObject *manager,
 
       if (append)
         {
-          EmpathyMessage *msg = empathy_message_from_tpl_log_event (event);
+          EmpathyMessage *msg = empathy_message_from_tpl_log_event_memo (
+              event, contacts);
           log_window_append_message (event, msg);
           tp_clear_object (&msg);
         }
@@ -3306,6 +3353,10 @@ log_window_got_messages_for_date_cb (GObject *manager,
     }
   g_list_free (events);
 
+  DEBUG ("Sender resolutions avoided: %u",
+      empathy_contact_memo_get_n_avoided (contacts));
+  empathy_contact_memo_free (contacts);
+
   model = GTK_TREE_MODEL (log_window->priv->store_events);
   n = gtk_tree_model_iter_n_children (model, NULL) - 1;
 
@@ -3837,6 +3888,8 @@ log_window_delete_menu_clicked_cb (GtkMenuItem *menuitem,
     {
       DEBUG ("Deleting logs for all the accounts");
 
+      empathy_chat_snapshot_delete (NULL);
+      empathy_log_index_clear (self->priv->log_index, NULL);
       emp_cli_logger_call_clear (logger, -1,
           log_window_logger_clear_account_cb,
           self, NULL, G_OBJECT (self));
@@ -3849,6 +3902,8 @@ log_window_delete_menu_clicked_cb (GtkMenuItem *menuitem,
 
       DEBUG ("Deleting logs for %s", tp_proxy_get_object_path (account));
 
+      empathy_chat_snapshot_delete (account);
+      empathy_log_index_clear (self->priv->log_index, account);
       emp_cli_logger_call_clear_account (logger, -1,
           tp_proxy_get_object_path (account),
           log_window_logger_clear_account_cb,
@@ -5,12 +5,15 @@
 #include <tp-account-widgets/tpaw-images.h>
 #include <tp-account-widgets/tpaw-pixbuf-utils.h>
 
+#include "empathy-conversation-index.h"
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
 G_DEFINE_TYPE (EmpathyRosterContact, empathy_roster_contact, GTK_TYPE_LIST_BOX_ROW)
 
 #define AVATAR_SIZE 48
+/* Vertical padding around the avatar */
+#define ROW_PADDING 4
 
 enum
 {
@@ -18,7 +21,7 @@ enum
   PROP_GROUP,
   PROP_ONLINE,
   PROP_ALIAS,
-  PROP_MOST_RECENT_EVENT,
+  PROP_MOST_RECENT_TIMESTAMP,
   N_PROPS
 };
 
@@ -37,9 +40,10 @@ struct _EmpathyRosterContactPriv
   EmpathyContact *contact;
   gchar *group;
 
-  TplLogManager *log_manager;
-  TplEvent *most_recent_event;
+  EmpathyConversationIndex *conversation_index;
 
+  /* The widgets are only created by empathy_roster_contact_ensure_content()
+   * so they are all NULL until the row is close to be displayed */
   GtkWidget *avatar;
   GtkWidget *first_line_alig;
   GtkWidget *alias;
@@ -54,6 +58,12 @@ struct _EmpathyRosterContactPriv
   gboolean online;
 };
 
+static gboolean
+has_content (EmpathyRosterContact *self)
+{
+  return self->priv->avatar != NULL;
+}
+
 static const gchar *
 get_alias (EmpathyRosterContact *self)
 {
@@ -83,8 +93,9 @@ empathy_roster_contact_get_property (GObject *object,
       case PROP_ALIAS:
         g_value_set_string (value, get_alias (self));
         break;
-      case PROP_MOST_RECENT_EVENT:
-        g_value_set_object (value, self->priv->most_recent_event);
+      case PROP_MOST_RECENT_TIMESTAMP:
+        g_value_set_int64 (value,
+            empathy_roster_contact_get_most_recent_timestamp (self));
         break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -119,19 +130,25 @@ empathy_roster_contact_set_property (GObject *object,
 gint64
 empathy_roster_contact_get_most_recent_timestamp (EmpathyRosterContact *contact)
 {
-  if (contact->priv->most_recent_event) {
-    return tpl_event_get_timestamp (contact->priv->most_recent_event);
-  }
-  return 0;
+  if (contact->priv->contact == NULL)
+    return 0;
+
+  return empathy_conversation_index_get_timestamp (
+      contact->priv->conversation_index,
+      empathy_contact_get_account (contact->priv->contact),
+      empathy_contact_get_id (contact->priv->contact));
 }
 
 static const gchar*
 get_most_recent_message (EmpathyRosterContact *contact)
 {
-  if (contact->priv->most_recent_event) {
-    return tpl_text_event_get_message (TPL_TEXT_EVENT(contact->priv->most_recent_event));
-  }
-  return NULL;
+  if (contact->priv->contact == NULL)
+    return NULL;
+
+  return empathy_conversation_index_get_message (
+      contact->priv->conversation_index,
+      empathy_contact_get_account (contact->priv->contact),
+      empathy_contact_get_id (contact->priv->contact));
 }
 
 static void
@@ -168,7 +185,12 @@ out:
 static void
 update_most_recent_msg (EmpathyRosterContact *self)
 {
-  const gchar* msg = get_most_recent_message (self);
+  const gchar* msg;
+
+  if (!has_content (self))
+    return;
+
+  msg = get_most_recent_message (self);
 
   if (tp_str_empty (msg))
     {
@@ -191,6 +213,9 @@ update_most_recent_msg (EmpathyRosterContact *self)
 static void
 update_avatar (EmpathyRosterContact *self)
 {
+  if (!has_content (self))
+    return;
+
   empathy_pixbuf_avatar_from_individual_scaled_async (self->priv->individual,
       AVATAR_SIZE, AVATAR_SIZE, NULL, avatar_loaded_cb,
       tp_weak_ref_new (self, NULL, NULL));
@@ -207,7 +232,8 @@ avatar_changed_cb (FolksIndividual *individual,
 static void
 update_alias (EmpathyRosterContact *self)
 {
-  gtk_label_set_text (GTK_LABEL (self->priv->alias), get_alias (self));
+  if (has_content (self))
+    gtk_label_set_text (GTK_LABEL (self->priv->alias), get_alias (self));
 
   g_object_notify (G_OBJECT (self), "alias");
 }
@@ -226,6 +252,9 @@ update_presence_msg (EmpathyRosterContact *self)
   const gchar *msg;
   GStrv types;
 
+  if (!has_content (self))
+    return;
+
   msg = folks_presence_details_get_presence_message (
       FOLKS_PRESENCE_DETAILS (self->priv->individual));
 
@@ -285,6 +314,9 @@ update_presence_icon (EmpathyRosterContact *self)
 {
   const gchar *icon;
 
+  if (!has_content (self))
+    return;
+
   if (self->priv->event_icon == NULL)
     icon = empathy_icon_name_for_individual (self->priv->individual);
   else
@@ -342,35 +374,19 @@ presence_status_changed_cb (FolksIndividual *individual,
 }
 
 static void
-get_filtered_events (GObject *source_object, GAsyncResult *res, gpointer user_data)
+conversation_updated_cb (EmpathyConversationIndex *index,
+    TpAccount *account,
+    const gchar *id,
+    EmpathyRosterContact *self)
 {
-  EmpathyRosterContact *contact = EMPATHY_ROSTER_CONTACT (user_data);
-  GError *error;
-  GList *events;
-
-  error = NULL;
-  if (!tpl_log_manager_get_filtered_events_finish (contact->priv->log_manager, res, &events, &error))
-    {
-      g_warning ("Unable to get events: %s", error->message);
-      g_error_free (error);
-      goto out;
-    }
-
-  if (events) {
-    contact->priv->most_recent_event = TPL_EVENT (events->data);
-    g_object_notify (G_OBJECT (contact), "most-recent-event");
-    update_most_recent_msg (contact);
-  }
-
- out:
-  return;
+  g_object_notify (G_OBJECT (self), "most-recent-timestamp");
+  update_most_recent_msg (self);
 }
 
 static void
 empathy_roster_contact_constructed (GObject *object)
 {
   EmpathyRosterContact *self = EMPATHY_ROSTER_CONTACT (object);
-  TplEntity *tpl_entity;
   void (*chain_up) (GObject *) =
       ((GObjectClass *) empathy_roster_contact_parent_class)->constructed;
 
@@ -383,21 +399,23 @@ empathy_roster_contact_constructed (GObject *object)
                   self->priv->individual,
                   EMPATHY_ACTION_CHAT);
 
-  self->priv->log_manager = tpl_log_manager_dup_singleton ();
-
-  tpl_entity = tpl_entity_new_from_tp_contact (
-                  empathy_contact_get_tp_contact (self->priv->contact),
-                  TPL_ENTITY_CONTACT);
-  tpl_log_manager_get_filtered_events_async(
-                  self->priv->log_manager,
-                  empathy_contact_get_account (self->priv->contact),
-                  tpl_entity,
-                  TPL_EVENT_MASK_TEXT,
-                  1,
-                  NULL,
-                  NULL,
-                  get_filtered_events,
-                  object);
+  self->priv->conversation_index = empathy_conversation_index_dup_singleton ();
+
+  if (self->priv->contact != NULL)
+    {
+      gchar *signal_name, *detail;
+
+      detail = empathy_conversation_index_dup_detail (
+          empathy_contact_get_account (self->priv->contact),
+          empathy_contact_get_id (self->priv->contact));
+      signal_name = g_strconcat ("updated::", detail, NULL);
+
+      tp_g_signal_connect_object (self->priv->conversation_index,
+          signal_name, G_CALLBACK (conversation_updated_cb), self, 0);
+
+      g_free (signal_name);
+      g_free (detail);
+    }
 
   tp_g_signal_connect_object (self->priv->individual, "notify::avatar",
       G_CALLBACK (avatar_changed_cb), self, 0);
@@ -409,11 +427,7 @@ empathy_roster_contact_constructed (GObject *object)
   tp_g_signal_connect_object (self->priv->individual, "notify::presence-status",
       G_CALLBACK (presence_status_changed_cb), self, 0);
 
-  update_avatar (self);
   update_alias (self);
-  update_presence_msg (self);
-  update_presence_icon (self);
-
   update_online (self);
 }
 
@@ -439,7 +453,7 @@ empathy_roster_contact_finalize (GObject *object)
 
   g_free (self->priv->group);
   g_free (self->priv->event_icon);
-  g_object_unref (self->priv->log_manager);
+  g_object_unref (self->priv->conversation_index);
 
   if (chain_up != NULL)
     chain_up (object);
@@ -482,27 +496,49 @@ empathy_roster_contact_class_init (
       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
   g_object_class_install_property (oclass, PROP_ALIAS, spec);
 
-  spec = g_param_spec_object ("most-recent-event", "Most recent event",
-      "Most recent event",
-      TPL_TYPE_EVENT,
+  spec = g_param_spec_int64 ("most-recent-timestamp", "Most recent timestamp",
+      "Timestamp of the most recent message exchanged with the individual",
+      G_MININT64, G_MAXINT64, 0,
       G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
-  g_object_class_install_property (oclass, PROP_MOST_RECENT_EVENT, spec);
+  g_object_class_install_property (oclass, PROP_MOST_RECENT_TIMESTAMP, spec);
 
   g_type_class_add_private (klass, sizeof (EmpathyRosterContactPriv));
 }
 
 static void
 empathy_roster_contact_init (EmpathyRosterContact *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_ROSTER_CONTACT, EmpathyRosterContactPriv);
+
+  /* Keep the height of the row while it's still empty so the view doesn't
+   * change when its content is created */
+  gtk_widget_set_size_request (GTK_WIDGET (self), -1,
+      AVATAR_SIZE + 2 * ROW_PADDING);
+}
+
+/**
+ * empathy_roster_contact_ensure_content:
+ * @self: a #EmpathyRosterContact
+ *
+ * Creates the widgets displaying the contact, if they don't exist yet, and
+ * starts loading its avatar. The row can be sorted and filtered without them
+ * so the roster only creates them for the rows which are about to be
+ * displayed.
+ */
+void
+empathy_roster_contact_ensure_content (EmpathyRosterContact *self)
 {
   GtkWidget *alig, *main_box, *box, *first_line_box;
   GtkStyleContext *context;
 
-  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
-      EMPATHY_TYPE_ROSTER_CONTACT, EmpathyRosterContactPriv);
+  if (has_content (self))
+    return;
 
   alig = gtk_alignment_new (0.5, 0.5, 1, 1);
   gtk_widget_show (alig);
-  gtk_alignment_set_padding (GTK_ALIGNMENT (alig), 4, 4, 4, 12);
+  gtk_alignment_set_padding (GTK_ALIGNMENT (alig), ROW_PADDING, ROW_PADDING,
+      4, 12);
 
   main_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 8);
 
@@ -576,6 +612,12 @@ empathy_roster_contact_init (EmpathyRosterContact *self)
   gtk_container_add (GTK_CONTAINER (self), alig);
   gtk_container_add (GTK_CONTAINER (alig), main_box);
   gtk_widget_show (main_box);
+
+  update_avatar (self);
+  update_alias (self);
+  update_presence_msg (self);
+  update_presence_icon (self);
+  update_most_recent_msg (self);
 }
 
 GtkWidget *
@@ -630,5 +672,8 @@ empathy_roster_contact_set_event_icon (EmpathyRosterContact *self,
 GdkPixbuf *
 empathy_roster_contact_get_avatar_pixbuf (EmpathyRosterContact *self)
 {
+  if (!has_content (self))
+    return NULL;
+
   return gtk_image_get_pixbuf (GTK_IMAGE (self->priv->avatar));
 }
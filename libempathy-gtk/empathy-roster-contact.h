@@ -67,6 +67,8 @@ GdkPixbuf * empathy_roster_contact_get_avatar_pixbuf (
 
 gint64 empathy_roster_contact_get_most_recent_timestamp (EmpathyRosterContact *contact);
 
+void empathy_roster_contact_ensure_content (EmpathyRosterContact *self);
+
 G_END_DECLS
 
 #endif /* #ifndef __EMPATHY_ROSTER_CONTACT_H__*/
@@ -0,0 +1,453 @@
+#include "config.h"
+#include "empathy-roster-search-index.h"
+
+#include <string.h>
+#include <telepathy-glib/telepathy-glib.h>
+#include <tp-account-widgets/tpaw-live-search.h>
+
+#include "empathy-utils.h"
+
+G_DEFINE_TYPE (EmpathyRosterSearchIndex, empathy_roster_search_index,
+    G_TYPE_OBJECT)
+
+/* Index of the words empathy_individual_match_string() looks at, so a search
+ * costs a lookup per match instead of matching every individual.
+ *
+ * Each individual has a list of fields: its alias, then the part before the
+ * '@' of the ID of each interesting persona. A field is stored as the words
+ * tpaw_live_search_strip_utf8_string() gives, which are case folded and
+ * stripped of their accents as tpaw_live_search_match_words() expects.
+ * An individual matches if all the searched words are a prefix of a word of
+ * one of its fields, or if its ID starts with the searched text.
+ *
+ * Individuals are indexed again when their alias or personas change. */
+
+enum
+{
+  SIG_INDIVIDUAL_CHANGED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+typedef struct
+{
+  gchar *token;
+  /* borrowed, IndexedIndividual holds the ref */
+  FolksIndividual *individual;
+  guint field;
+} IndexEntry;
+
+typedef struct
+{
+  /* GSequenceIter of the IndexEntry of this individual, in words and ids */
+  GPtrArray *iters;
+  /* GPtrArray of owned GPtrArray of owned gchar * */
+  GPtrArray *fields;
+} IndexedIndividual;
+
+struct _EmpathyRosterSearchIndexPriv
+{
+  /* owned FolksIndividual -> owned IndexedIndividual */
+  GHashTable *individuals;
+  /* IndexEntry sorted by stripped word */
+  GSequence *words;
+  /* IndexEntry sorted by persona display ID */
+  GSequence *ids;
+};
+
+static IndexEntry *
+index_entry_new (const gchar *token,
+    FolksIndividual *individual,
+    guint field)
+{
+  IndexEntry *entry = g_slice_new (IndexEntry);
+
+  entry->token = g_strdup (token);
+  entry->individual = individual;
+  entry->field = field;
+  return entry;
+}
+
+static void
+index_entry_free (gpointer data)
+{
+  IndexEntry *entry = data;
+
+  g_free (entry->token);
+  g_slice_free (IndexEntry, entry);
+}
+
+static void
+indexed_individual_free (gpointer data)
+{
+  IndexedIndividual *indexed = data;
+  guint i;
+
+  for (i = 0; i < indexed->iters->len; i++)
+    g_sequence_remove (g_ptr_array_index (indexed->iters, i));
+
+  g_ptr_array_unref (indexed->iters);
+  g_ptr_array_unref (indexed->fields);
+  g_slice_free (IndexedIndividual, indexed);
+}
+
+static gint
+compare_entries (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  const IndexEntry *entry_a = a;
+  const IndexEntry *entry_b = b;
+
+  return g_strcmp0 (entry_a->token, entry_b->token);
+}
+
+/* Returns the first entry of @seq whose token is not smaller than @prefix,
+ * so all the tokens starting with @prefix follow it */
+static GSequenceIter *
+lookup_prefix (GSequence *seq,
+    const gchar *prefix)
+{
+  IndexEntry key = { (gchar *) prefix, NULL, 0 };
+  GSequenceIter *iter;
+
+  /* This points after the tokens equal to @prefix */
+  iter = g_sequence_search (seq, &key, compare_entries, NULL);
+
+  while (!g_sequence_iter_is_begin (iter))
+    {
+      GSequenceIter *prev = g_sequence_iter_prev (iter);
+      IndexEntry *entry = g_sequence_get (prev);
+
+      if (g_strcmp0 (entry->token, prefix) < 0)
+        break;
+
+      iter = prev;
+    }
+
+  return iter;
+}
+
+static void
+add_field (EmpathyRosterSearchIndex *self,
+    FolksIndividual *individual,
+    IndexedIndividual *indexed,
+    const gchar *str)
+{
+  GPtrArray *words;
+  guint field = indexed->fields->len;
+  guint i;
+
+  words = tpaw_live_search_strip_utf8_string (str);
+  if (words == NULL)
+    words = g_ptr_array_new_with_free_func (g_free);
+
+  g_ptr_array_add (indexed->fields, words);
+
+  for (i = 0; i < words->len; i++)
+    {
+      IndexEntry *entry;
+
+      entry = index_entry_new (g_ptr_array_index (words, i), individual,
+          field);
+      g_ptr_array_add (indexed->iters, g_sequence_insert_sorted (
+            self->priv->words, entry, compare_entries, NULL));
+    }
+}
+
+static IndexedIndividual *
+index_individual (EmpathyRosterSearchIndex *self,
+    FolksIndividual *individual)
+{
+  IndexedIndividual *indexed;
+  GeeSet *personas;
+  GeeIterator *iter;
+
+  indexed = g_slice_new (IndexedIndividual);
+  indexed->iters = g_ptr_array_new ();
+  indexed->fields = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_ptr_array_unref);
+
+  add_field (self, individual, indexed,
+      folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)));
+
+  personas = folks_individual_get_personas (individual);
+  iter = gee_iterable_iterator (GEE_ITERABLE (personas));
+  while (gee_iterator_next (iter))
+    {
+      FolksPersona *persona = gee_iterator_get (iter);
+
+      if (empathy_folks_persona_is_interesting (persona))
+        {
+          const gchar *id = folks_persona_get_display_id (persona);
+          gchar *local;
+          IndexEntry *entry;
+
+          entry = index_entry_new (id, individual, 0);
+          g_ptr_array_add (indexed->iters, g_sequence_insert_sorted (
+                self->priv->ids, entry, compare_entries, NULL));
+
+          /* Remove the @server.com part */
+          local = g_strndup (id, strcspn (id, "@"));
+          add_field (self, individual, indexed, local);
+          g_free (local);
+        }
+
+      g_clear_object (&persona);
+    }
+  g_clear_object (&iter);
+
+  return indexed;
+}
+
+static void
+reindex_individual (EmpathyRosterSearchIndex *self,
+    FolksIndividual *individual)
+{
+  if (!g_hash_table_contains (self->priv->individuals, individual))
+    return;
+
+  /* Replacing the value frees the old entries */
+  g_hash_table_insert (self->priv->individuals, g_object_ref (individual),
+      index_individual (self, individual));
+
+  g_signal_emit (self, signals[SIG_INDIVIDUAL_CHANGED], 0, individual);
+}
+
+static void
+individual_alias_changed_cb (FolksIndividual *individual,
+    GParamSpec *spec,
+    EmpathyRosterSearchIndex *self)
+{
+  reindex_individual (self, individual);
+}
+
+static void
+individual_personas_changed_cb (FolksIndividual *individual,
+    GeeSet *added,
+    GeeSet *removed,
+    EmpathyRosterSearchIndex *self)
+{
+  reindex_individual (self, individual);
+}
+
+static void
+disconnect_individual (EmpathyRosterSearchIndex *self,
+    FolksIndividual *individual)
+{
+  g_signal_handlers_disconnect_by_func (individual,
+      individual_alias_changed_cb, self);
+  g_signal_handlers_disconnect_by_func (individual,
+      individual_personas_changed_cb, self);
+}
+
+void
+empathy_roster_search_index_add (EmpathyRosterSearchIndex *self,
+    FolksIndividual *individual)
+{
+  g_return_if_fail (EMPATHY_IS_ROSTER_SEARCH_INDEX (self));
+  g_return_if_fail (FOLKS_IS_INDIVIDUAL (individual));
+
+  if (g_hash_table_contains (self->priv->individuals, individual))
+    return;
+
+  g_hash_table_insert (self->priv->individuals, g_object_ref (individual),
+      index_individual (self, individual));
+
+  g_signal_connect (individual, "notify::alias",
+      G_CALLBACK (individual_alias_changed_cb), self);
+  g_signal_connect (individual, "personas-changed",
+      G_CALLBACK (individual_personas_changed_cb), self);
+}
+
+void
+empathy_roster_search_index_remove (EmpathyRosterSearchIndex *self,
+    FolksIndividual *individual)
+{
+  g_return_if_fail (EMPATHY_IS_ROSTER_SEARCH_INDEX (self));
+
+  if (!g_hash_table_contains (self->priv->individuals, individual))
+    return;
+
+  disconnect_individual (self, individual);
+  g_hash_table_remove (self->priv->individuals, individual);
+}
+
+void
+empathy_roster_search_index_clear (EmpathyRosterSearchIndex *self)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  g_return_if_fail (EMPATHY_IS_ROSTER_SEARCH_INDEX (self));
+
+  g_hash_table_iter_init (&iter, self->priv->individuals);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    disconnect_individual (self, key);
+
+  g_hash_table_remove_all (self->priv->individuals);
+}
+
+static gboolean
+field_match_words (GPtrArray *field,
+    GPtrArray *words)
+{
+  guint i, j;
+
+  for (i = 0; i < words->len; i++)
+    {
+      const gchar *word = g_ptr_array_index (words, i);
+      gboolean found = FALSE;
+
+      for (j = 0; j < field->len && !found; j++)
+        found = g_str_has_prefix (g_ptr_array_index (field, j), word);
+
+      if (!found)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * empathy_roster_search_index_search:
+ * @self: the index
+ * @text: the searched text
+ * @words: tpaw_live_search_strip_utf8_string (@text); every individual
+ *   matches if it's %NULL or empty, which isn't looked up
+ *
+ * Returns: a new set of the (borrowed) FolksIndividual for which
+ * empathy_individual_match_string() would return %TRUE
+ */
+GHashTable *
+empathy_roster_search_index_search (EmpathyRosterSearchIndex *self,
+    const gchar *text,
+    GPtrArray *words)
+{
+  GHashTable *result;
+  GSequenceIter *iter;
+  const gchar *longest = NULL;
+  guint i;
+
+  g_return_val_if_fail (EMPATHY_IS_ROSTER_SEARCH_INDEX (self), NULL);
+
+  result = g_hash_table_new (NULL, NULL);
+
+  /* Accept individuals if @text is a full prefix of one of their IDs */
+  if (!tp_str_empty (text))
+    {
+      for (iter = lookup_prefix (self->priv->ids, text);
+          !g_sequence_iter_is_end (iter);
+          iter = g_sequence_iter_next (iter))
+        {
+          IndexEntry *entry = g_sequence_get (iter);
+
+          if (!g_str_has_prefix (entry->token, text))
+            break;
+
+          g_hash_table_add (result, entry->individual);
+        }
+    }
+
+  if (words == NULL || words->len == 0)
+    return result;
+
+  /* The longest word usually has the fewest matches, look it up and check
+   * the other words on the field it was found in */
+  for (i = 0; i < words->len; i++)
+    {
+      const gchar *word = g_ptr_array_index (words, i);
+
+      if (longest == NULL || strlen (word) > strlen (longest))
+        longest = word;
+    }
+
+  for (iter = lookup_prefix (self->priv->words, longest);
+      !g_sequence_iter_is_end (iter);
+      iter = g_sequence_iter_next (iter))
+    {
+      IndexEntry *entry = g_sequence_get (iter);
+      IndexedIndividual *indexed;
+
+      if (!g_str_has_prefix (entry->token, longest))
+        break;
+
+      if (g_hash_table_contains (result, entry->individual))
+        continue;
+
+      indexed = g_hash_table_lookup (self->priv->individuals,
+          entry->individual);
+
+      if (field_match_words (g_ptr_array_index (indexed->fields, entry->field),
+            words))
+        g_hash_table_add (result, entry->individual);
+    }
+
+  return result;
+}
+
+static void
+empathy_roster_search_index_dispose (GObject *object)
+{
+  EmpathyRosterSearchIndex *self = EMPATHY_ROSTER_SEARCH_INDEX (object);
+  void (*chain_up) (GObject *) =
+      ((GObjectClass *) empathy_roster_search_index_parent_class)->dispose;
+
+  empathy_roster_search_index_clear (self);
+
+  if (chain_up != NULL)
+    chain_up (object);
+}
+
+static void
+empathy_roster_search_index_finalize (GObject *object)
+{
+  EmpathyRosterSearchIndex *self = EMPATHY_ROSTER_SEARCH_INDEX (object);
+  void (*chain_up) (GObject *) =
+      ((GObjectClass *) empathy_roster_search_index_parent_class)->finalize;
+
+  g_hash_table_unref (self->priv->individuals);
+  g_sequence_free (self->priv->words);
+  g_sequence_free (self->priv->ids);
+
+  if (chain_up != NULL)
+    chain_up (object);
+}
+
+static void
+empathy_roster_search_index_class_init (
+    EmpathyRosterSearchIndexClass *klass)
+{
+  GObjectClass *oclass = G_OBJECT_CLASS (klass);
+
+  oclass->dispose = empathy_roster_search_index_dispose;
+  oclass->finalize = empathy_roster_search_index_finalize;
+
+  signals[SIG_INDIVIDUAL_CHANGED] = g_signal_new ("individual-changed",
+      G_OBJECT_CLASS_TYPE (klass),
+      G_SIGNAL_RUN_LAST,
+      0, NULL, NULL, NULL,
+      G_TYPE_NONE,
+      1, FOLKS_TYPE_INDIVIDUAL);
+
+  g_type_class_add_private (klass, sizeof (EmpathyRosterSearchIndexPriv));
+}
+
+static void
+empathy_roster_search_index_init (EmpathyRosterSearchIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_ROSTER_SEARCH_INDEX, EmpathyRosterSearchIndexPriv);
+
+  self->priv->individuals = g_hash_table_new_full (NULL, NULL,
+      g_object_unref, indexed_individual_free);
+  self->priv->words = g_sequence_new (index_entry_free);
+  self->priv->ids = g_sequence_new (index_entry_free);
+}
+
+EmpathyRosterSearchIndex *
+empathy_roster_search_index_new (void)
+{
+  return g_object_new (EMPATHY_TYPE_ROSTER_SEARCH_INDEX, NULL);
+}
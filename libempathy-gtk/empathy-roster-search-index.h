@@ -0,0 +1,64 @@
+#ifndef __EMPATHY_ROSTER_SEARCH_INDEX_H__
+#define __EMPATHY_ROSTER_SEARCH_INDEX_H__
+
+#include <folks/folks.h>
+
+G_BEGIN_DECLS
+
+typedef struct _EmpathyRosterSearchIndex EmpathyRosterSearchIndex;
+typedef struct _EmpathyRosterSearchIndexClass EmpathyRosterSearchIndexClass;
+typedef struct _EmpathyRosterSearchIndexPriv EmpathyRosterSearchIndexPriv;
+
+struct _EmpathyRosterSearchIndexClass
+{
+  /*<private>*/
+  GObjectClass parent_class;
+};
+
+struct _EmpathyRosterSearchIndex
+{
+  /*<private>*/
+  GObject parent;
+  EmpathyRosterSearchIndexPriv *priv;
+};
+
+GType empathy_roster_search_index_get_type (void);
+
+/* TYPE MACROS */
+#define EMPATHY_TYPE_ROSTER_SEARCH_INDEX \
+  (empathy_roster_search_index_get_type ())
+#define EMPATHY_ROSTER_SEARCH_INDEX(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), \
+    EMPATHY_TYPE_ROSTER_SEARCH_INDEX, \
+    EmpathyRosterSearchIndex))
+#define EMPATHY_ROSTER_SEARCH_INDEX_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), \
+    EMPATHY_TYPE_ROSTER_SEARCH_INDEX, \
+    EmpathyRosterSearchIndexClass))
+#define EMPATHY_IS_ROSTER_SEARCH_INDEX(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), \
+    EMPATHY_TYPE_ROSTER_SEARCH_INDEX))
+#define EMPATHY_IS_ROSTER_SEARCH_INDEX_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), \
+    EMPATHY_TYPE_ROSTER_SEARCH_INDEX))
+#define EMPATHY_ROSTER_SEARCH_INDEX_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+    EMPATHY_TYPE_ROSTER_SEARCH_INDEX, \
+    EmpathyRosterSearchIndexClass))
+
+EmpathyRosterSearchIndex * empathy_roster_search_index_new (void);
+
+void empathy_roster_search_index_add (EmpathyRosterSearchIndex *self,
+    FolksIndividual *individual);
+void empathy_roster_search_index_remove (EmpathyRosterSearchIndex *self,
+    FolksIndividual *individual);
+void empathy_roster_search_index_clear (EmpathyRosterSearchIndex *self);
+
+GHashTable * empathy_roster_search_index_search (
+    EmpathyRosterSearchIndex *self,
+    const gchar *text,
+    GPtrArray *words);
+
+G_END_DECLS
+
+#endif /* #ifndef __EMPATHY_ROSTER_SEARCH_INDEX_H__*/
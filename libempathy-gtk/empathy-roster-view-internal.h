@@ -0,0 +1,13 @@
+
+#ifndef __EMPATHY_ROSTER_VIEW_INTERNAL_H__
+#define __EMPATHY_ROSTER_VIEW_INTERNAL_H__
+
+#include "empathy-roster-view.h"
+
+G_BEGIN_DECLS
+
+gboolean _empathy_roster_view_has_pending_changes (EmpathyRosterView *self);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_ROSTER_VIEW_INTERNAL_H__ */
@@ -1,13 +1,18 @@
 #include "config.h"
 #include "empathy-roster-view.h"
+#include "empathy-roster-view-internal.h"
 
 #include <glib/gi18n-lib.h>
 
 #include "empathy-contact-groups.h"
 #include "empathy-roster-contact.h"
 #include "empathy-roster-group.h"
+#include "empathy-roster-search-index.h"
 #include "empathy-ui-utils.h"
 
+#define DEBUG_FLAG EMPATHY_DEBUG_CONTACT
+#include "empathy-debug.h"
+
 G_DEFINE_TYPE (EmpathyRosterView, empathy_roster_view, GTK_TYPE_LIST_BOX)
 
 /* Flashing delay for icons (milliseconds). */
@@ -17,6 +22,14 @@ G_DEFINE_TYPE (EmpathyRosterView, empathy_roster_view, GTK_TYPE_LIST_BOX)
  * of the live search. */
 #define SEARCH_TIMEOUT 500
 
+/* Maximum time in microseconds spent applying changed rows in one frame, the
+ * remaining ones are applied in the next frames. */
+#define MAX_FRAME_UPDATE_TIME 8000
+
+/* Distance in pixels above and below the visible part of the view in which
+ * the contact rows are filled, so they are ready when scrolling. */
+#define FILL_ROWS_MARGIN 600
+
 enum
 {
   PROP_MODEL = 1,
@@ -53,6 +66,23 @@ struct _EmpathyRosterViewPriv
   GHashTable *roster_groups;
   /* Hash of the EmpathyRosterContact currently displayed */
   GHashTable *displayed_contacts;
+  /* Hash of the EmpathyRosterContact for which contact_should_be_displayed()
+   * returned TRUE when they were last filtered */
+  GHashTable *shown_contacts;
+  /* EmpathyRosterGroup (borrowed) -> number of its shown_contacts */
+  GHashTable *group_shown_counts;
+  /* Hash of the EmpathyRosterContact (borrowed) which changed since the last
+   * frame */
+  GHashTable *changed_rows;
+  guint changed_rows_tick_id;
+  /* Hash of the EmpathyRosterGroup (borrowed) to filter again once the
+   * contacts have been filtered */
+  GHashTable *changed_groups;
+  guint changed_groups_id;
+
+  /* The vertical adjustment of the scrollable containing the view, if any */
+  GtkAdjustment *vadjustment;
+  guint fill_rows_id;
 
   guint last_event_id;
   /* queue of (Event *). The most recent events are in the head of the queue
@@ -62,6 +92,14 @@ struct _EmpathyRosterViewPriv
   gboolean display_flash_event;
 
   guint search_id;
+  EmpathyRosterSearchIndex *search_index;
+  /* Set of the FolksIndividual (borrowed) matching search_matches_text,
+   * looked up in search_index when the filter is first evaluated */
+  GHashTable *search_matches;
+  gchar *search_matches_text;
+  /* The search text the rows have been filtered with, NULL if we were not
+   * searching */
+  gchar *filtered_search_text;
 
   gboolean show_offline;
   gboolean show_groups;
@@ -76,6 +114,40 @@ struct _EmpathyRosterViewPriv
 static void remove_from_group (EmpathyRosterView *self,
     FolksIndividual *individual,
     const gchar *group);
+static void forget_contact (EmpathyRosterView *self,
+    EmpathyRosterContact *contact);
+static void queue_row_changed (EmpathyRosterView *self,
+    EmpathyRosterContact *contact);
+static void set_vadjustment (EmpathyRosterView *self,
+    GtkAdjustment *adjustment);
+
+static void
+clear_search_matches (EmpathyRosterView *self)
+{
+  tp_clear_pointer (&self->priv->search_matches, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->search_matches_text, g_free);
+}
+
+static void
+search_index_individual_changed_cb (EmpathyRosterSearchIndex *index,
+    FolksIndividual *individual,
+    EmpathyRosterView *self)
+{
+  GHashTable *contacts;
+  GHashTableIter iter;
+  gpointer value;
+
+  contacts = g_hash_table_lookup (self->priv->roster_contacts, individual);
+  if (contacts == NULL)
+    return;
+
+  clear_search_matches (self);
+
+  /* The individual may now match, or stop matching, the current search */
+  g_hash_table_iter_init (&iter, contacts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    queue_row_changed (self, value);
+}
 
 typedef struct
 {
@@ -164,12 +236,119 @@ empathy_roster_view_set_property (GObject *object,
     }
 }
 
+/* Filter again the groups whose first contact has been shown or whose last
+ * one has been hidden. This can't be done from the filter function of the
+ * contacts, as GtkListBox is filtering them. */
+static void
+apply_changed_groups (EmpathyRosterView *self)
+{
+  GList *groups, *l;
+
+  if (self->priv->changed_groups_id != 0)
+    {
+      g_source_remove (self->priv->changed_groups_id);
+      self->priv->changed_groups_id = 0;
+    }
+
+  groups = g_hash_table_get_keys (self->priv->changed_groups);
+  g_hash_table_remove_all (self->priv->changed_groups);
+
+  for (l = groups; l != NULL; l = g_list_next (l))
+    gtk_list_box_row_changed (l->data);
+
+  g_list_free (groups);
+}
+
+static gboolean
+apply_changed_groups_cb (gpointer user_data)
+{
+  EmpathyRosterView *self = user_data;
+
+  self->priv->changed_groups_id = 0;
+  apply_changed_groups (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+queue_group_changed (EmpathyRosterView *self,
+    EmpathyRosterGroup *group)
+{
+  g_hash_table_add (self->priv->changed_groups, group);
+
+  /* Before the next redraw */
+  if (self->priv->changed_groups_id == 0)
+    self->priv->changed_groups_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+        apply_changed_groups_cb, self, NULL);
+}
+
+static gboolean
+apply_changed_rows_cb (GtkWidget *widget,
+    GdkFrameClock *frame_clock,
+    gpointer user_data)
+{
+  EmpathyRosterView *self = EMPATHY_ROSTER_VIEW (widget);
+  GHashTableIter iter;
+  gpointer key;
+  gint64 start;
+  guint n = 0;
+
+  start = g_get_monotonic_time ();
+
+  /* Moving each row is more work in total than sorting the whole list
+   * once, but it can be spread over as many frames as needed */
+  g_hash_table_iter_init (&iter, self->priv->changed_rows);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      g_hash_table_iter_remove (&iter);
+      gtk_list_box_row_changed (key);
+      n++;
+
+      if (g_get_monotonic_time () - start > MAX_FRAME_UPDATE_TIME)
+        break;
+    }
+
+  apply_changed_groups (self);
+
+  DEBUG ("Applied %u changed rows in %" G_GINT64_FORMAT " us, %u left", n,
+      g_get_monotonic_time () - start,
+      g_hash_table_size (self->priv->changed_rows));
+
+  if (g_hash_table_size (self->priv->changed_rows) > 0)
+    return G_SOURCE_CONTINUE;
+
+  self->priv->changed_rows_tick_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+/* Presence, alias, etc changes of a lot of contacts often arrive at the same
+ * time, when connecting for example. Apply them once per frame rather than
+ * sorting and filtering the list for each of them. */
+static void
+queue_row_changed (EmpathyRosterView *self,
+    EmpathyRosterContact *contact)
+{
+  if (self->priv->changed_rows_tick_id == 0 &&
+      !gtk_widget_get_realized (GTK_WIDGET (self)))
+    {
+      /* Nothing is drawn yet */
+      gtk_list_box_row_changed (GTK_LIST_BOX_ROW (contact));
+      return;
+    }
+
+  g_hash_table_add (self->priv->changed_rows, contact);
+
+  if (self->priv->changed_rows_tick_id == 0)
+    self->priv->changed_rows_tick_id = gtk_widget_add_tick_callback (
+        GTK_WIDGET (self), apply_changed_rows_cb, NULL, NULL);
+}
+
 static void
 roster_contact_changed_cb (GtkListBoxRow *child,
     GParamSpec *spec,
     EmpathyRosterView *self)
 {
-  gtk_list_box_row_changed (child);
+  queue_row_changed (self, EMPATHY_ROSTER_CONTACT (child));
 }
 
 static GtkWidget *
@@ -190,7 +369,7 @@ add_roster_contact (EmpathyRosterView *self,
       G_CALLBACK (roster_contact_changed_cb), self);
 
   /* Need to resort if most recent event changed */
-  g_signal_connect (contact, "notify::most-recent-event",
+  g_signal_connect (contact, "notify::most-recent-timestamp",
       G_CALLBACK (roster_contact_changed_cb), self);
 
   gtk_widget_show (contact);
@@ -387,7 +566,7 @@ individual_favourite_change_cb (FolksIndividual *individual,
   if (contact == NULL)
     return;
 
-  gtk_list_box_row_changed (GTK_LIST_BOX_ROW (contact));
+  queue_row_changed (self, EMPATHY_ROSTER_CONTACT (contact));
 }
 
 static void
@@ -404,6 +583,9 @@ individual_added (EmpathyRosterView *self,
 
   g_hash_table_insert (self->priv->roster_contacts, individual, contacts);
 
+  empathy_roster_search_index_add (self->priv->search_index, individual);
+  clear_search_matches (self);
+
   if (!self->priv->show_groups)
     {
       add_to_group (self, individual, NO_GROUP);
@@ -565,6 +747,8 @@ individual_removed (EmpathyRosterView *self,
       GtkWidget *contact = value;
       EmpathyRosterGroup *group;
 
+      forget_contact (self, EMPATHY_ROSTER_CONTACT (contact));
+
       group = lookup_roster_group (self, group_name);
       if (group != NULL)
         {
@@ -576,6 +760,9 @@ individual_removed (EmpathyRosterView *self,
     }
 
   g_hash_table_remove (self->priv->roster_contacts, individual);
+
+  empathy_roster_search_index_remove (self->priv->search_index, individual);
+  clear_search_matches (self);
 }
 
 static void
@@ -836,13 +1023,13 @@ add_to_displayed (EmpathyRosterView *self,
   while (g_hash_table_iter_next (&iter, &k, NULL))
     {
       const gchar *group_name = k;
-      GtkListBoxRow *group;
+      EmpathyRosterGroup *group;
 
       group = g_hash_table_lookup (self->priv->roster_groups, group_name);
       if (group == NULL)
         continue;
 
-      gtk_list_box_row_changed (group);
+      queue_group_changed (self, group);
     }
 }
 
@@ -866,6 +1053,34 @@ contact_is_favorite (EmpathyRosterContact *contact)
       FOLKS_FAVOURITE_DETAILS (individual));
 }
 
+static gboolean
+individual_match_search (EmpathyRosterView *self,
+    FolksIndividual *individual)
+{
+  const gchar *text;
+  GPtrArray *words;
+
+  text = tpaw_live_search_get_text (self->priv->search);
+  words = tpaw_live_search_get_words (self->priv->search);
+
+  if (words == NULL || words->len == 0)
+    return TRUE;
+
+  /* The filter is evaluated for each row, only look up the matches once per
+   * search */
+  if (self->priv->search_matches == NULL ||
+      tp_strdiff (self->priv->search_matches_text, text))
+    {
+      clear_search_matches (self);
+
+      self->priv->search_matches = empathy_roster_search_index_search (
+          self->priv->search_index, text, words);
+      self->priv->search_matches_text = g_strdup (text);
+    }
+
+  return g_hash_table_contains (self->priv->search_matches, individual);
+}
+
 /**
  * check if @contact should be displayed according to @self's current status
  * and without consideration for the state of @contact's groups.
@@ -880,9 +1095,7 @@ contact_should_be_displayed (EmpathyRosterView *self,
 
       individual = empathy_roster_contact_get_individual (contact);
 
-      return empathy_individual_match_string (individual,
-          tpaw_live_search_get_text (self->priv->search),
-          tpaw_live_search_get_words (self->priv->search));
+      return individual_match_search (self, individual);
     }
 
   if (self->priv->show_offline)
@@ -896,6 +1109,97 @@ contact_should_be_displayed (EmpathyRosterView *self,
   return empathy_roster_contact_is_online (contact);
 }
 
+static gboolean
+set_contact_shown (EmpathyRosterView *self,
+    EmpathyRosterContact *contact,
+    gboolean shown)
+{
+  EmpathyRosterGroup *group;
+  guint count;
+
+  if (shown == g_hash_table_contains (self->priv->shown_contacts, contact))
+    return FALSE;
+
+  if (shown)
+    g_hash_table_add (self->priv->shown_contacts, contact);
+  else
+    g_hash_table_remove (self->priv->shown_contacts, contact);
+
+  group = lookup_roster_group (self, empathy_roster_contact_get_group (contact));
+  if (group == NULL)
+    return TRUE;
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (
+        self->priv->group_shown_counts, group));
+
+  if (shown)
+    count++;
+  else
+    count--;
+
+  if (count > 0)
+    g_hash_table_insert (self->priv->group_shown_counts, group,
+        GUINT_TO_POINTER (count));
+  else
+    g_hash_table_remove (self->priv->group_shown_counts, group);
+
+  /* The group header has to be displayed, or hidden, only when its first
+   * contact is shown or its last one is hidden. */
+  if (count == (shown ? 1 : 0))
+    queue_group_changed (self, group);
+
+  return TRUE;
+}
+
+/* Returns TRUE if @contact has to be filtered again */
+static gboolean
+update_contact_shown (EmpathyRosterView *self,
+    EmpathyRosterContact *contact)
+{
+  return set_contact_shown (self, contact,
+      contact_should_be_displayed (self, contact));
+}
+
+static void
+forget_contact (EmpathyRosterView *self,
+    EmpathyRosterContact *contact)
+{
+  set_contact_shown (self, contact, FALSE);
+  remove_from_displayed (self, contact);
+  g_hash_table_remove (self->priv->changed_rows, contact);
+}
+
+/* Filter again the rows of @contacts whose state changed rather than
+ * invalidating the filter of the whole list */
+static void
+refilter_contacts (EmpathyRosterView *self,
+    GList *contacts)
+{
+  GList *l;
+
+  for (l = contacts; l != NULL; l = g_list_next (l))
+    {
+      EmpathyRosterContact *contact = l->data;
+
+      if (!EMPATHY_IS_ROSTER_CONTACT (contact))
+        continue;
+
+      if (update_contact_shown (self, contact))
+        gtk_list_box_row_changed (GTK_LIST_BOX_ROW (contact));
+    }
+
+  apply_changed_groups (self);
+}
+
+static void
+refilter_all_contacts (EmpathyRosterView *self)
+{
+  GList *children;
+
+  children = gtk_container_get_children (GTK_CONTAINER (self));
+  refilter_contacts (self, children);
+  g_list_free (children);
+}
 
 static gboolean
 filter_contact (EmpathyRosterView *self,
@@ -903,7 +1207,8 @@ filter_contact (EmpathyRosterView *self,
 {
   gboolean displayed;
 
-  displayed = contact_should_be_displayed (self, contact);
+  update_contact_shown (self, contact);
+  displayed = g_hash_table_contains (self->priv->shown_contacts, contact);
 
   if (self->priv->show_groups)
     {
@@ -938,25 +1243,8 @@ static gboolean
 filter_group (EmpathyRosterView *self,
     EmpathyRosterGroup *group)
 {
-  GList *widgets, *l;
-  gboolean result = FALSE;
-
   /* Display the group if it contains at least one displayed contact */
-  widgets = empathy_roster_group_get_widgets (group);
-  for (l = widgets; l != NULL; l = g_list_next (l))
-    {
-      EmpathyRosterContact *contact = l->data;
-
-      if (contact_should_be_displayed (self, contact))
-        {
-          result = TRUE;
-          break;
-        }
-    }
-
-  g_list_free (widgets);
-
-  return result;
+  return g_hash_table_lookup (self->priv->group_shown_counts, group) != NULL;
 }
 
 static gboolean
@@ -1014,6 +1302,8 @@ remove_from_group (EmpathyRosterView *self,
       add_to_group (self, individual, EMPATHY_ROSTER_MODEL_GROUP_UNGROUPED);
     }
 
+  forget_contact (self, EMPATHY_ROSTER_CONTACT (contact));
+
   roster_group = lookup_roster_group (self, group);
 
   if (roster_group != NULL)
@@ -1085,9 +1375,17 @@ empathy_roster_view_constructed (GObject *object)
 static void
 clear_view (EmpathyRosterView *self)
 {
+  empathy_roster_search_index_clear (self->priv->search_index);
+  clear_search_matches (self);
+
   g_hash_table_remove_all (self->priv->roster_contacts);
   g_hash_table_remove_all (self->priv->roster_groups);
   g_hash_table_remove_all (self->priv->displayed_contacts);
+  g_hash_table_remove_all (self->priv->shown_contacts);
+  g_hash_table_remove_all (self->priv->group_shown_counts);
+  g_hash_table_remove_all (self->priv->changed_rows);
+  g_hash_table_remove_all (self->priv->changed_groups);
+  tp_clear_pointer (&self->priv->filtered_search_text, g_free);
 
   gtk_container_foreach (GTK_CONTAINER (self),
       (GtkCallback) gtk_widget_destroy, NULL);
@@ -1115,6 +1413,27 @@ empathy_roster_view_dispose (GObject *object)
       self->priv->search_id = 0;
     }
 
+  if (self->priv->changed_rows_tick_id != 0)
+    {
+      gtk_widget_remove_tick_callback (GTK_WIDGET (self),
+          self->priv->changed_rows_tick_id);
+      self->priv->changed_rows_tick_id = 0;
+    }
+
+  if (self->priv->changed_groups_id != 0)
+    {
+      g_source_remove (self->priv->changed_groups_id);
+      self->priv->changed_groups_id = 0;
+    }
+
+  if (self->priv->fill_rows_id != 0)
+    {
+      g_source_remove (self->priv->fill_rows_id);
+      self->priv->fill_rows_id = 0;
+    }
+
+  set_vadjustment (self, NULL);
+
   if (chain_up != NULL)
     chain_up (object);
 }
@@ -1129,7 +1448,17 @@ empathy_roster_view_finalize (GObject *object)
   g_hash_table_unref (self->priv->roster_contacts);
   g_hash_table_unref (self->priv->roster_groups);
   g_hash_table_unref (self->priv->displayed_contacts);
+  g_hash_table_unref (self->priv->shown_contacts);
+  g_hash_table_unref (self->priv->group_shown_counts);
+  g_hash_table_unref (self->priv->changed_rows);
+  g_hash_table_unref (self->priv->changed_groups);
+  g_free (self->priv->filtered_search_text);
   g_queue_free_full (self->priv->events, event_free);
+  clear_search_matches (self);
+
+  g_signal_handlers_disconnect_by_func (self->priv->search_index,
+      search_index_individual_changed_cb, self);
+  g_object_unref (self->priv->search_index);
 
   if (chain_up != NULL)
     chain_up (object);
@@ -1301,6 +1630,138 @@ empathy_roster_view_query_tooltip (GtkWidget *widget,
   return result;
 }
 
+static void
+ensure_content_foreach (GtkWidget *child,
+    gpointer user_data)
+{
+  if (EMPATHY_IS_ROSTER_CONTACT (child))
+    empathy_roster_contact_ensure_content (EMPATHY_ROSTER_CONTACT (child));
+}
+
+/* Contact rows only create their widgets when they are about to be
+ * displayed, the others are just used to sort and filter the roster */
+static gboolean
+fill_visible_rows_cb (gpointer user_data)
+{
+  EmpathyRosterView *self = user_data;
+  GtkListBox *box = GTK_LIST_BOX (self);
+  GtkListBoxRow *row;
+  gdouble value, bottom;
+  gint i;
+
+  self->priv->fill_rows_id = 0;
+
+  if (self->priv->vadjustment == NULL)
+    {
+      /* Not scrolled, all the rows can be displayed */
+      gtk_container_foreach (GTK_CONTAINER (self), ensure_content_foreach,
+          NULL);
+      return G_SOURCE_REMOVE;
+    }
+
+  value = gtk_adjustment_get_value (self->priv->vadjustment);
+  bottom = value + gtk_adjustment_get_page_size (self->priv->vadjustment) +
+    FILL_ROWS_MARGIN;
+
+  row = gtk_list_box_get_row_at_y (box, MAX (value - FILL_ROWS_MARGIN, 0));
+  if (row == NULL)
+    return G_SOURCE_REMOVE;
+
+  for (i = gtk_list_box_row_get_index (row);
+      (row = gtk_list_box_get_row_at_index (box, i)) != NULL;
+      i++)
+    {
+      GtkAllocation allocation;
+
+      if (!gtk_widget_get_child_visible (GTK_WIDGET (row)))
+        continue;
+
+      gtk_widget_get_allocation (GTK_WIDGET (row), &allocation);
+      if (allocation.y > bottom)
+        break;
+
+      if (EMPATHY_IS_ROSTER_CONTACT (row))
+        empathy_roster_contact_ensure_content (EMPATHY_ROSTER_CONTACT (row));
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+queue_fill_visible_rows (EmpathyRosterView *self)
+{
+  if (self->priv->fill_rows_id != 0)
+    return;
+
+  self->priv->fill_rows_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+      fill_visible_rows_cb, self, NULL);
+}
+
+static void
+vadjustment_changed_cb (GtkAdjustment *adjustment,
+    EmpathyRosterView *self)
+{
+  queue_fill_visible_rows (self);
+}
+
+static void
+set_vadjustment (EmpathyRosterView *self,
+    GtkAdjustment *adjustment)
+{
+  if (self->priv->vadjustment == adjustment)
+    return;
+
+  if (self->priv->vadjustment != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (self->priv->vadjustment,
+          vadjustment_changed_cb, self);
+      g_clear_object (&self->priv->vadjustment);
+    }
+
+  if (adjustment == NULL)
+    return;
+
+  self->priv->vadjustment = g_object_ref (adjustment);
+
+  g_signal_connect (adjustment, "value-changed",
+      G_CALLBACK (vadjustment_changed_cb), self);
+  g_signal_connect (adjustment, "changed",
+      G_CALLBACK (vadjustment_changed_cb), self);
+}
+
+static void
+empathy_roster_view_map (GtkWidget *widget)
+{
+  EmpathyRosterView *self = EMPATHY_ROSTER_VIEW (widget);
+  GtkWidget *scrollable;
+  void (*chain_up) (GtkWidget *) =
+      ((GtkWidgetClass *) empathy_roster_view_parent_class)->map;
+
+  chain_up (widget);
+
+  scrollable = gtk_widget_get_ancestor (widget, GTK_TYPE_SCROLLABLE);
+  if (scrollable != NULL)
+    set_vadjustment (self,
+        gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (scrollable)));
+  else
+    set_vadjustment (self, NULL);
+
+  queue_fill_visible_rows (self);
+}
+
+static void
+empathy_roster_view_size_allocate (GtkWidget *widget,
+    GtkAllocation *allocation)
+{
+  void (*chain_up) (GtkWidget *, GtkAllocation *) =
+      ((GtkWidgetClass *) empathy_roster_view_parent_class)->size_allocate;
+
+  chain_up (widget, allocation);
+
+  /* Rows may have been added, moved, shown or hidden */
+  queue_fill_visible_rows (EMPATHY_ROSTER_VIEW (widget));
+}
+
 static void
 empathy_roster_view_remove (GtkContainer *container,
     GtkWidget *widget)
@@ -1334,6 +1795,8 @@ empathy_roster_view_class_init (
   widget_class->button_press_event = empathy_roster_view_button_press_event;
   widget_class->key_press_event = empathy_roster_view_key_press_event;
   widget_class->query_tooltip = empathy_roster_view_query_tooltip;
+  widget_class->map = empathy_roster_view_map;
+  widget_class->size_allocate = empathy_roster_view_size_allocate;
 
   container_class->remove = empathy_roster_view_remove;
 
@@ -1406,9 +1869,17 @@ empathy_roster_view_init (EmpathyRosterView *self)
   self->priv->roster_groups = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, NULL);
   self->priv->displayed_contacts = g_hash_table_new (NULL, NULL);
+  self->priv->shown_contacts = g_hash_table_new (NULL, NULL);
+  self->priv->group_shown_counts = g_hash_table_new (NULL, NULL);
+  self->priv->changed_rows = g_hash_table_new (NULL, NULL);
+  self->priv->changed_groups = g_hash_table_new (NULL, NULL);
 
   self->priv->events = g_queue_new ();
 
+  self->priv->search_index = empathy_roster_search_index_new ();
+  g_signal_connect (self->priv->search_index, "individual-changed",
+      G_CALLBACK (search_index_individual_changed_cb), self);
+
   self->priv->empty = TRUE;
 }
 
@@ -1430,7 +1901,7 @@ empathy_roster_view_show_offline (EmpathyRosterView *self,
     return;
 
   self->priv->show_offline = show;
-  gtk_list_box_invalidate_filter (GTK_LIST_BOX (self));
+  refilter_all_contacts (self);
 
   g_object_notify (G_OBJECT (self), "show-offline");
 }
@@ -1477,7 +1948,36 @@ select_first_contact (EmpathyRosterView *self)
 static gboolean
 search_timeout_cb (EmpathyRosterView *self)
 {
-  gtk_list_box_invalidate_filter (GTK_LIST_BOX (self));
+  const gchar *text = NULL;
+  GList *shown;
+
+  if (is_searching (self))
+    text = tpaw_live_search_get_text (self->priv->search);
+
+  clear_search_matches (self);
+
+  if (text != NULL && self->priv->filtered_search_text != NULL &&
+      g_str_has_prefix (text, self->priv->filtered_search_text))
+    {
+      /* The search has been extended so it can only hide contacts which
+       * are currently shown. */
+      shown = g_hash_table_get_keys (self->priv->shown_contacts);
+      refilter_contacts (self, shown);
+      g_list_free (shown);
+    }
+  else
+    {
+      /* Update the shown contacts first so the groups are filtered with the
+       * right counts, then filter again everything as starting or stopping
+       * the search also changes if the contacts of closed groups are
+       * displayed. */
+      refilter_all_contacts (self);
+      gtk_list_box_invalidate_filter (GTK_LIST_BOX (self));
+      apply_changed_groups (self);
+    }
+
+  g_free (self->priv->filtered_search_text);
+  self->priv->filtered_search_text = g_strdup (text);
 
   select_first_contact (self);
 
@@ -1604,3 +2104,12 @@ empathy_roster_view_get_selected_individual (EmpathyRosterView *self)
 
   return empathy_roster_contact_get_individual (EMPATHY_ROSTER_CONTACT (row));
 }
+
+/* Whether some rows haven't been sorted or filtered again since they
+ * changed. For the tests. */
+gboolean
+_empathy_roster_view_has_pending_changes (EmpathyRosterView *self)
+{
+  return g_hash_table_size (self->priv->changed_rows) > 0 ||
+    g_hash_table_size (self->priv->changed_groups) > 0;
+}
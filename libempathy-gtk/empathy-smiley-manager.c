@@ -29,58 +29,316 @@
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
 
-typedef struct _SmileyManagerTree SmileyManagerTree;
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* Smileys are matched with a double-array trie over the UTF-8 bytes of
+ * their strings, compiled the first time a text is parsed after smileys
+ * have been added. Transition from node s on byte c goes to node
+ * t = base[s] + c + 1 if check[t] == s. The root node is 0. */
+#define DA_ROOT 0
+#define DA_CODE(c) ((guint) (guchar) (c) + 1)
+
+typedef struct {
+	GdkPixbuf *pixbuf;
+	gchar     *path;
+} SmileyTarget;
+
+typedef struct {
+	gchar *str;
+	gsize  len;
+	/* Index in targets */
+	guint  target;
+	/* Insertion order, the last added string wins */
+	guint  serial;
+} SmileyPattern;
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathySmileyManager)
 typedef struct {
-	SmileyManagerTree *tree;
+	/* array of SmileyPattern, in insertion order */
+	GArray            *patterns;
+	/* owned SmileyTarget */
+	GPtrArray         *targets;
+	gboolean           compiled;
+
+	/* The compiled double-array */
+	gint32            *base;
+	gint32            *check;
+	/* Index in targets of the smiley ending at this node, or -1 */
+	gint32            *value;
+	guint              size;
+	/* Circular list of the free nodes, headed by the root node. Only
+	 * used while compiling. */
+	guint             *next_free;
+	guint             *prev_free;
+	/* Whether a byte can start a smiley, so we can skip all
+	 * other bytes without walking the trie */
+	gboolean           first_byte[256];
+
 	GSList            *smileys;
 } EmpathySmileyManagerPriv;
 
-struct _SmileyManagerTree {
-	gunichar     c;
-	GdkPixbuf   *pixbuf;
-	gchar       *path;
-	GSList      *childrens;
-};
-
 G_DEFINE_TYPE (EmpathySmileyManager, empathy_smiley_manager, G_TYPE_OBJECT);
 
 static EmpathySmileyManager *manager_singleton = NULL;
 
-static SmileyManagerTree *
-smiley_manager_tree_new (gunichar c)
+static void
+smiley_target_free (SmileyTarget *target)
+{
+	g_object_unref (target->pixbuf);
+	g_free (target->path);
+	g_slice_free (SmileyTarget, target);
+}
+
+static void
+smiley_manager_clear_patterns (EmpathySmileyManagerPriv *priv)
+{
+	guint i;
+
+	for (i = 0; i < priv->patterns->len; i++) {
+		g_free (g_array_index (priv->patterns, SmileyPattern, i).str);
+	}
+	g_array_unref (priv->patterns);
+}
+
+static void
+smiley_manager_da_free (EmpathySmileyManagerPriv *priv)
+{
+	g_free (priv->base);
+	g_free (priv->check);
+	g_free (priv->value);
+	priv->base = NULL;
+	priv->check = NULL;
+	priv->value = NULL;
+	priv->size = 0;
+	memset (priv->first_byte, 0, sizeof (priv->first_byte));
+}
+
+/* Make sure nodes up to @size - 1 exist */
+static void
+smiley_manager_da_reserve (EmpathySmileyManagerPriv *priv,
+			   guint                     size)
+{
+	guint new_size;
+	guint i;
+
+	if (size <= priv->size) {
+		return;
+	}
+
+	new_size = MAX (priv->size, 512);
+	while (new_size < size) {
+		new_size *= 2;
+	}
+
+	priv->base = g_renew (gint32, priv->base, new_size);
+	priv->check = g_renew (gint32, priv->check, new_size);
+	priv->value = g_renew (gint32, priv->value, new_size);
+
+	for (i = priv->size; i < new_size; i++) {
+		priv->base[i] = 0;
+		priv->check[i] = -1;
+		priv->value[i] = -1;
+	}
+
+	if (priv->next_free != NULL) {
+		priv->next_free = g_renew (guint, priv->next_free, new_size);
+		priv->prev_free = g_renew (guint, priv->prev_free, new_size);
+
+		/* Append the new nodes to the free list */
+		for (i = priv->size; i < new_size; i++) {
+			guint last = priv->prev_free[DA_ROOT];
+
+			priv->next_free[last] = i;
+			priv->prev_free[i] = last;
+			priv->next_free[i] = DA_ROOT;
+			priv->prev_free[DA_ROOT] = i;
+		}
+	}
+
+	priv->size = new_size;
+}
+
+static void
+smiley_manager_da_use (EmpathySmileyManagerPriv *priv,
+		       guint                     t,
+		       gint32                    parent)
+{
+	priv->check[t] = parent;
+
+	priv->next_free[priv->prev_free[t]] = priv->next_free[t];
+	priv->prev_free[priv->next_free[t]] = priv->prev_free[t];
+}
+
+/* Find a base at which all the @codes are free */
+static gint32
+smiley_manager_da_find_base (EmpathySmileyManagerPriv *priv,
+			     const guint16            *codes,
+			     guint                     n_codes)
+{
+	guint e;
+	guint b;
+
+	/* Try to put the first child in each free node */
+	for (e = priv->next_free[DA_ROOT];
+	     e != DA_ROOT;
+	     e = priv->next_free[e]) {
+		guint i;
+
+		if (e <= codes[0]) {
+			continue;
+		}
+
+		b = e - codes[0];
+		smiley_manager_da_reserve (priv, b + codes[n_codes - 1] + 1);
+
+		for (i = 1; i < n_codes; i++) {
+			if (priv->check[b + codes[i]] >= 0) {
+				break;
+			}
+		}
+
+		if (i == n_codes) {
+			return b;
+		}
+	}
+
+	/* Use new nodes */
+	b = priv->size - codes[0];
+	smiley_manager_da_reserve (priv, b + codes[n_codes - 1] + 1);
+
+	return b;
+}
+
+/* Build node @s for the sorted, unique patterns [@lo, @hi) which all
+ * share their first @depth bytes */
+static void
+smiley_manager_da_build (EmpathySmileyManagerPriv *priv,
+			 const SmileyPattern      *patterns,
+			 guint                     lo,
+			 guint                     hi,
+			 gsize                     depth,
+			 gint32                    s)
+{
+	guint16 codes[256];
+	guint   starts[257];
+	guint   n_codes = 0;
+	guint   i = lo;
+	gint32  b;
+
+	/* Patterns are sorted, so one ending here comes first */
+	if (patterns[i].len == depth) {
+		priv->value[s] = patterns[i].target;
+		i++;
+	}
+
+	while (i < hi) {
+		guint16 code = DA_CODE (patterns[i].str[depth]);
+
+		codes[n_codes] = code;
+		starts[n_codes] = i;
+		n_codes++;
+
+		while (i < hi && DA_CODE (patterns[i].str[depth]) == code) {
+			i++;
+		}
+	}
+	starts[n_codes] = hi;
+
+	if (n_codes == 0) {
+		return;
+	}
+
+	b = smiley_manager_da_find_base (priv, codes, n_codes);
+	priv->base[s] = b;
+
+	for (i = 0; i < n_codes; i++) {
+		smiley_manager_da_use (priv, b + codes[i], s);
+	}
+
+	for (i = 0; i < n_codes; i++) {
+		smiley_manager_da_build (priv, patterns, starts[i],
+					 starts[i + 1], depth + 1,
+					 b + codes[i]);
+	}
+}
+
+static gint
+smiley_pattern_compare (gconstpointer a,
+			gconstpointer b)
 {
-	SmileyManagerTree *tree;
+	const SmileyPattern *pa = a;
+	const SmileyPattern *pb = b;
+	gint ret;
 
-	tree = g_slice_new0 (SmileyManagerTree);
-	tree->c = c;
-	tree->pixbuf = NULL;
-	tree->childrens = NULL;
-	tree->path = NULL;
+	ret = strcmp (pa->str, pb->str);
+	if (ret != 0) {
+		return ret;
+	}
 
-	return tree;
+	return pa->serial < pb->serial ? -1 : (pa->serial > pb->serial);
 }
 
 static void
-smiley_manager_tree_free (SmileyManagerTree *tree)
+smiley_manager_compile (EmpathySmileyManager *manager)
 {
-	GSList *l;
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	GArray                   *sorted;
+	guint                     i, n;
+
+	smiley_manager_da_free (priv);
+	smiley_manager_da_reserve (priv, 1);
+	priv->check[DA_ROOT] = DA_ROOT;
+	priv->compiled = TRUE;
 
-	if (!tree) {
+	if (priv->patterns->len == 0) {
 		return;
 	}
 
-	for (l = tree->childrens; l; l = l->next) {
-		smiley_manager_tree_free (l->data);
+	/* All nodes but the root are free */
+	priv->next_free = g_new (guint, priv->size);
+	priv->prev_free = g_new (guint, priv->size);
+	for (i = 0; i < priv->size; i++) {
+		priv->next_free[i] = (i + 1) % priv->size;
+		priv->prev_free[i] = (i + priv->size - 1) % priv->size;
+	}
+
+	/* Sort the patterns, keeping only the last one added for each
+	 * string. They still belong to priv->patterns. */
+	sorted = g_array_sized_new (FALSE, FALSE, sizeof (SmileyPattern),
+				    priv->patterns->len);
+	g_array_append_vals (sorted, priv->patterns->data, priv->patterns->len);
+	g_array_sort (sorted, smiley_pattern_compare);
+
+	for (i = 0, n = 0; i < sorted->len; i++) {
+		if (i + 1 < sorted->len &&
+		    !strcmp (g_array_index (sorted, SmileyPattern, i).str,
+			     g_array_index (sorted, SmileyPattern, i + 1).str)) {
+			continue;
+		}
+
+		g_array_index (sorted, SmileyPattern, n++) =
+			g_array_index (sorted, SmileyPattern, i);
 	}
 
-	if (tree->pixbuf) {
-		g_object_unref (tree->pixbuf);
+	smiley_manager_da_build (priv, (SmileyPattern *) sorted->data,
+				 0, n, 0, DA_ROOT);
+
+	g_free (priv->next_free);
+	g_free (priv->prev_free);
+	priv->next_free = NULL;
+	priv->prev_free = NULL;
+
+	for (i = 0; i < G_N_ELEMENTS (priv->first_byte); i++) {
+		guint t = priv->base[DA_ROOT] + DA_CODE (i);
+
+		priv->first_byte[i] = t < priv->size &&
+			priv->check[t] == DA_ROOT;
 	}
-	g_slist_free (tree->childrens);
-	g_free (tree->path);
-	g_slice_free (SmileyManagerTree, tree);
+
+	DEBUG ("Compiled %u smiley strings into %u nodes", n, priv->size);
+
+	g_array_unref (sorted);
 }
 
 static EmpathySmiley *
@@ -108,7 +366,9 @@ smiley_manager_finalize (GObject *object)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (object);
 
-	smiley_manager_tree_free (priv->tree);
+	smiley_manager_da_free (priv);
+	smiley_manager_clear_patterns (priv);
+	g_ptr_array_unref (priv->targets);
 	g_slist_foreach (priv->smileys, (GFunc) smiley_free, NULL);
 	g_slist_free (priv->smileys);
 }
@@ -151,7 +411,9 @@ empathy_smiley_manager_init (EmpathySmileyManager *manager)
 		EMPATHY_TYPE_SMILEY_MANAGER, EmpathySmileyManagerPriv);
 
 	manager->priv = priv;
-	priv->tree = smiley_manager_tree_new ('\0');
+	priv->patterns = g_array_new (FALSE, FALSE, sizeof (SmileyPattern));
+	priv->targets = g_ptr_array_new_with_free_func (
+		(GDestroyNotify) smiley_target_free);
 	priv->smileys = NULL;
 
 	empathy_smiley_manager_load (manager);
@@ -163,57 +425,6 @@ empathy_smiley_manager_dup_singleton (void)
 	return g_object_new (EMPATHY_TYPE_SMILEY_MANAGER, NULL);
 }
 
-static SmileyManagerTree *
-smiley_manager_tree_find_child (SmileyManagerTree *tree, gunichar c)
-{
-	GSList *l;
-
-	for (l = tree->childrens; l; l = l->next) {
-		SmileyManagerTree *child = l->data;
-
-		if (child->c == c) {
-			return child;
-		}
-	}
-
-	return NULL;
-}
-
-static SmileyManagerTree *
-smiley_manager_tree_find_or_insert_child (SmileyManagerTree *tree, gunichar c)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_child (tree, c);
-
-	if (!child) {
-		child = smiley_manager_tree_new (c);
-		tree->childrens = g_slist_prepend (tree->childrens, child);
-	}
-
-	return child;
-}
-
-static void
-smiley_manager_tree_insert (SmileyManagerTree *tree,
-			    GdkPixbuf         *pixbuf,
-			    const gchar       *str,
-			    const gchar       *path)
-{
-	SmileyManagerTree *child;
-
-	child = smiley_manager_tree_find_or_insert_child (tree, g_utf8_get_char (str));
-
-	str = g_utf8_next_char (str);
-	if (*str) {
-		smiley_manager_tree_insert (child, pixbuf, str, path);
-		return;
-	}
-
-	child->pixbuf = g_object_ref (pixbuf);
-	child->path = g_strdup (path);
-}
-
 static void
 smiley_manager_add_valist (EmpathySmileyManager *manager,
 			   GdkPixbuf            *pixbuf,
@@ -224,11 +435,30 @@ smiley_manager_add_valist (EmpathySmileyManager *manager,
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
 	const gchar              *str;
 	EmpathySmiley            *smiley;
+	SmileyTarget             *target;
+
+	target = g_slice_new (SmileyTarget);
+	target->pixbuf = g_object_ref (pixbuf);
+	target->path = g_strdup (path);
+	g_ptr_array_add (priv->targets, target);
 
 	for (str = first_str; str; str = va_arg (var_args, gchar*)) {
-		smiley_manager_tree_insert (priv->tree, pixbuf, str, path);
+		SmileyPattern pattern;
+
+		if (*str == '\0') {
+			continue;
+		}
+
+		pattern.str = g_strdup (str);
+		pattern.len = strlen (str);
+		pattern.target = priv->targets->len - 1;
+		pattern.serial = priv->patterns->len;
+		g_array_append_val (priv->patterns, pattern);
 	}
 
+	/* Compile again on next parse */
+	priv->compiled = FALSE;
+
 	g_object_set_data_full (G_OBJECT (pixbuf), "smiley_str",
 				g_strdup (first_str), g_free);
 	smiley = smiley_new (pixbuf, first_str);
@@ -316,119 +546,151 @@ empathy_smiley_manager_load (EmpathySmileyManager *manager)
 	empathy_smiley_manager_add (manager, "emblem-favorite", "❤",     "<3", NULL);
 }
 
-static EmpathySmileyHit *
-smiley_hit_new (SmileyManagerTree *tree,
-		guint              start,
-		guint              end)
+/* Find the longest smiley at the start of the @len bytes of @str.
+ * Returns the index of its target, or -1 */
+static gint32
+smiley_manager_match (EmpathySmileyManagerPriv *priv,
+		      const guchar             *str,
+		      gsize                     len,
+		      gsize                    *match_len)
 {
-	EmpathySmileyHit *hit;
+	gint32 s = DA_ROOT;
+	gint32 target = -1;
+	gsize  i;
 
-	hit = g_slice_new (EmpathySmileyHit);
-	hit->pixbuf = tree->pixbuf;
-	hit->path = tree->path;
-	hit->start = start;
-	hit->end = end;
+	for (i = 0; i < len; i++) {
+		guint t = priv->base[s] + DA_CODE (str[i]);
+
+		if (t >= priv->size || priv->check[t] != s) {
+			break;
+		}
+
+		s = t;
+		if (priv->value[s] >= 0) {
+			target = priv->value[s];
+			*match_len = i + 1;
+		}
+	}
 
-	return hit;
+	return target;
 }
 
-void
-empathy_smiley_hit_free (EmpathySmileyHit *hit)
+static void
+smiley_manager_fill_hit (EmpathySmileyManagerPriv *priv,
+			 gint32                    target,
+			 guint                     start,
+			 guint                     end,
+			 EmpathySmileyHit         *hit)
 {
-	g_return_if_fail (hit != NULL);
+	SmileyTarget *smiley = g_ptr_array_index (priv->targets, target);
 
-	g_slice_free (EmpathySmileyHit, hit);
+	hit->pixbuf = smiley->pixbuf;
+	hit->path = smiley->path;
+	hit->start = start;
+	hit->end = end;
 }
 
-GSList *
+guint
 empathy_smiley_manager_parse_len (EmpathySmileyManager *manager,
 				  const gchar          *text,
-				  gssize                len)
+				  gssize                len,
+				  GArray               *hits)
 {
 	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
-	EmpathySmileyHit         *hit;
-	GSList                   *hits = NULL;
-	SmileyManagerTree        *cur_tree = priv->tree;
-	const gchar              *cur_str;
-	const gchar              *start = NULL;
+	const guchar             *str = (const guchar *) text;
+	const gchar              *nul;
+	guint                     n_hits = 0;
+	gsize                     i;
 
-	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
-	g_return_val_if_fail (text != NULL, NULL);
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), 0);
+	g_return_val_if_fail (text != NULL, 0);
+	g_return_val_if_fail (hits != NULL, 0);
+
+	if (!priv->compiled) {
+		smiley_manager_compile (manager);
+	}
 
 	/* If len is negative, parse the string until we find '\0' */
 	if (len < 0) {
-		len = G_MAXSSIZE;
+		len = strlen (text);
+	} else if ((nul = memchr (text, '\0', len)) != NULL) {
+		len = nul - text;
 	}
 
 	/* Parse the len first bytes of text to find smileys. Each time a smiley
-	 * is detected, append a EmpathySmileyHit struct to the returned list,
-	 * containing the smiley pixbuf and the position of the text to be
-	 * replaced by it.
-	 * cur_str is a pointer in the text showing the current position
-	 * of the parsing. It is always at the begining of an UTF-8 character,
-	 * because we support unicode smileys! For example we could want to
-	 * replace ™ by an image. */
-
-	for (cur_str = text;
-	     *cur_str != '\0' && cur_str - text < len;
-	     cur_str = g_utf8_next_char (cur_str)) {
-		SmileyManagerTree *child;
-		gunichar           c;
-
-		c = g_utf8_get_char (cur_str);
-		child = smiley_manager_tree_find_child (cur_tree, c);
-
-		/* If we have a child it means c is part of a smiley */
-		if (child) {
-			if (cur_tree == priv->tree) {
-				/* c is the first char of some smileys, keep
-				 * the begining position */
-				start = cur_str;
-			}
-			cur_tree = child;
+	 * is detected, append a EmpathySmileyHit struct to hits, containing
+	 * the smiley pixbuf and the position of the text to be replaced by
+	 * it. The longest smiley starting at the leftmost position wins, then
+	 * parsing starts again after it.
+	 * Smileys are valid UTF-8 so walking bytes can only match
+	 * whole characters, because we support unicode smileys! For example
+	 * we could want to replace ™ by an image. */
+	for (i = 0; i < (gsize) len; i++) {
+		EmpathySmileyHit hit;
+		gint32           target;
+		gsize            match_len = 0;
+
+		/* Most of the text can't start a smiley */
+		if (!priv->first_byte[str[i]]) {
 			continue;
 		}
 
-		/* c is not part of a smiley. let's check if we found a smiley
-		 * before it. */
-		if (cur_tree->pixbuf != NULL) {
-			/* found! */
-			hit = smiley_hit_new (cur_tree, start - text,
-					      cur_str - text);
-			hits = g_slist_prepend (hits, hit);
-
-			/* c was not part of this smiley, check if a new smiley
-			 * start with it. */
-			cur_tree = smiley_manager_tree_find_child (priv->tree, c);
-			if (cur_tree) {
-				start = cur_str;
-			} else {
-				cur_tree = priv->tree;
-			}
-		} else if (cur_tree != priv->tree) {
-			/* We searched a smiley starting at 'start' but we ended
-			 * with no smiley. Look again starting from next char.
-			 *
-			 * For example ">:)" and ":(" are both valid smileys,
-			 * when parsing text ">:(" we first see '>' which could
-			 * be the start of a smiley. 'start' variable is set to
-			 * that position and we parse next char which is ':' and
-			 * is still potential smiley. Then we see '(' which is
-			 * NOT part of the smiley, ">:(" does not exist, so we
-			 * have to start again from ':' to find ":(" which is
-			 * correct smiley. */
-			cur_str = start;
-			cur_tree = priv->tree;
+		target = smiley_manager_match (priv, str + i, len - i,
+					       &match_len);
+		if (target >= 0) {
+			smiley_manager_fill_hit (priv, target, i,
+						 i + match_len, &hit);
+			g_array_append_val (hits, hit);
+			n_hits++;
+
+			i += match_len - 1;
 		}
 	}
 
-	/* Check if last char of the text was the end of a smiley */
-	if (cur_tree->pixbuf != NULL) {
-		hit = smiley_hit_new (cur_tree, start - text, cur_str - text);
-		hits = g_slist_prepend (hits, hit);
+	return n_hits;
+}
+
+const gboolean *
+empathy_smiley_manager_get_start_bytes (EmpathySmileyManager *manager)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), NULL);
+
+	if (!priv->compiled) {
+		smiley_manager_compile (manager);
 	}
 
-	return g_slist_reverse (hits);
+	return priv->first_byte;
+}
+
+gboolean
+empathy_smiley_manager_match (EmpathySmileyManager *manager,
+			      const gchar          *text,
+			      gsize                 len,
+			      EmpathySmileyHit     *hit)
+{
+	EmpathySmileyManagerPriv *priv = GET_PRIV (manager);
+	gint32                    target;
+	gsize                     match_len = 0;
+
+	g_return_val_if_fail (EMPATHY_IS_SMILEY_MANAGER (manager), FALSE);
+	g_return_val_if_fail (text != NULL, FALSE);
+	g_return_val_if_fail (hit != NULL, FALSE);
+
+	if (!priv->compiled) {
+		smiley_manager_compile (manager);
+	}
+
+	target = smiley_manager_match (priv, (const guchar *) text, len,
+				       &match_len);
+	if (target < 0) {
+		return FALSE;
+	}
+
+	smiley_manager_fill_hit (priv, target, 0, match_len, hit);
+
+	return TRUE;
 }
 
 GSList *
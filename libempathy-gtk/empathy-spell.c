@@ -40,8 +40,14 @@
 typedef struct {
 	EnchantBroker *config;
 	EnchantDict   *speller;
+	/* Word (gchar *) -> GINT_TO_POINTER (TRUE) if it is correct in
+	 * this language, GINT_TO_POINTER (FALSE) otherwise */
+	GHashTable    *verdicts;
 } SpellLanguage;
 
+/* The verdicts of a language are dropped once it knows that many words */
+#define MAX_VERDICTS 4096
+
 #define ISO_CODES_DATADIR    ISO_CODES_PREFIX "/share/xml/iso-codes"
 #define ISO_CODES_LOCALESDIR ISO_CODES_PREFIX "/share/locale"
 
@@ -176,6 +182,7 @@ empathy_spell_free_language (SpellLanguage *lang)
 {
 	enchant_broker_free_dict (lang->config, lang->speller);
 	enchant_broker_free (lang->config);
+	g_hash_table_unref (lang->verdicts);
 
 	g_slice_free (SpellLanguage, lang);
 }
@@ -222,6 +229,9 @@ spell_setup_languages (void)
 			lang->config = enchant_broker_init ();
 			lang->speller = enchant_broker_request_dict (lang->config, strv[i]);
 
+			lang->verdicts = g_hash_table_new_full (g_str_hash,
+					g_str_equal, g_free, NULL);
+
 			if (lang->speller == NULL) {
 				DEBUG ("language '%s' has no valid dict", strv[i]);
 			} else {
@@ -314,7 +324,7 @@ empathy_spell_free_language_codes (GList *codes)
 gboolean
 empathy_spell_check (const gchar *word)
 {
-	gint         enchant_result = 1;
+	gboolean     correct = FALSE;
 	const gchar *p;
 	gboolean     digit;
 	gunichar     c;
@@ -345,14 +355,28 @@ empathy_spell_check (const gchar *word)
 	len = strlen (word);
 	g_hash_table_iter_init (&iter, languages);
 	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &lang)) {
-		enchant_result = enchant_dict_check (lang->speller, word, len);
+		gpointer verdict;
+
+		if (g_hash_table_lookup_extended (lang->verdicts, word,
+						  NULL, &verdict)) {
+			correct = GPOINTER_TO_INT (verdict);
+		} else {
+			correct = (enchant_dict_check (lang->speller, word, len) == 0);
+
+			if (g_hash_table_size (lang->verdicts) >= MAX_VERDICTS) {
+				g_hash_table_remove_all (lang->verdicts);
+			}
+
+			g_hash_table_insert (lang->verdicts, g_strdup (word),
+					     GINT_TO_POINTER (correct));
+		}
 
-		if (enchant_result == 0) {
+		if (correct) {
 			break;
 		}
 	}
 
-	return (enchant_result == 0);
+	return correct;
 }
 
 GList *
@@ -425,6 +449,9 @@ empathy_spell_add_to_dictionary (const gchar *code,
 		return;
 
 	enchant_dict_add_to_pwl (lang->speller, word, strlen (word));
+
+	/* The personal word list may accept other forms of the word too */
+	g_hash_table_remove_all (lang->verdicts);
 }
 
 #else /* not HAVE_ENCHANT */
@@ -30,15 +30,25 @@ empathy_string_match_smiley (const gchar *text,
 			     TpawStringParser *sub_parsers,
 			     gpointer user_data)
 {
+	/* Hits array reused from one message to the next */
+	static GArray *hits_cache = NULL;
 	guint last = 0;
 	EmpathySmileyManager *smiley_manager;
-	GSList *hits, *l;
+	GArray *hits;
+	guint i;
+
+	/* Take the cached array, a nested call would allocate its own */
+	hits = hits_cache;
+	hits_cache = NULL;
+	if (hits == NULL)
+		hits = g_array_new (FALSE, FALSE, sizeof (EmpathySmileyHit));
 
 	smiley_manager = empathy_smiley_manager_dup_singleton ();
-	hits = empathy_smiley_manager_parse_len (smiley_manager, text, len);
+	empathy_smiley_manager_parse_len (smiley_manager, text, len, hits);
 
-	for (l = hits; l; l = l->next) {
-		EmpathySmileyHit *hit = l->data;
+	for (i = 0; i < hits->len; i++) {
+		EmpathySmileyHit *hit = &g_array_index (hits,
+							EmpathySmileyHit, i);
 
 		if (hit->start > last) {
 			/* Append the text between last smiley (or the
@@ -52,12 +62,15 @@ empathy_string_match_smiley (const gchar *text,
 			      hit, user_data);
 
 		last = hit->end;
-
-		empathy_smiley_hit_free (hit);
 	}
-	g_slist_free (hits);
 	g_object_unref (smiley_manager);
 
+	g_array_set_size (hits, 0);
+	if (hits_cache == NULL)
+		hits_cache = hits;
+	else
+		g_array_unref (hits);
+
 	tpaw_string_parser_substr (text + last, len - last,
 				   sub_parsers, user_data);
 }
@@ -23,6 +23,7 @@
 #include "empathy-theme-adium.h"
 
 #include <glib/gi18n-lib.h>
+#include <JavaScriptCore/JavaScript.h>
 #include <tp-account-widgets/tpaw-images.h>
 #include <tp-account-widgets/tpaw-time.h>
 #include <tp-account-widgets/tpaw-pixbuf-utils.h>
@@ -44,6 +45,15 @@
 /* "Join" consecutive messages with timestamps within five minutes */
 #define MESSAGE_JOIN_PERIOD 5*60
 
+/* Messages added within this interval (about one frame) are sent to the
+ * web process in a single script call */
+#define SCRIPT_FLUSH_INTERVAL 16 /* ms */
+
+/* Number of messages kept in the page. The ones furthest from what the
+ * user is reading are evicted to evicted_chunks or evicted_newer_chunks and
+ * put back when the user scrolls to them. */
+#define MAX_LIVE_MESSAGES 500
+
 struct _EmpathyThemeAdiumPriv
 {
   EmpathyAdiumData *data;
@@ -71,8 +81,81 @@ struct _EmpathyThemeAdiumPriv
   gchar *variant;
   gboolean in_construction;
   gboolean show_avatars;
+
+  /* JavaScript waiting to be run in the page. Everything we send to
+   * WebKit goes through this buffer so calls keep their order. */
+  GString *pending_script;
+  guint pending_script_messages;
+  guint flush_script_id;
+  /* TRUE once empathy-chat.js has been run in the current page */
+  gboolean script_installed;
+  /* Number of run_javascript() calls made, and number of messages
+   * rendered through them */
+  guint64 n_script_calls;
+  guint64 n_rendered_messages;
+
+  /* Queues of owned gchar *, the HTML of the messages evicted from the
+   * page by trim() in empathy-chat.js, from its top and from below what the
+   * user is reading. The oldest ones are at the head. */
+  GQueue evicted_chunks;
+  GQueue evicted_newer_chunks;
+  /* owned gchar *token -> owned gchar *script, the last edit of the
+   * messages edited since they were last put back in the page, run again
+   * when they are put back */
+  GHashTable *edits;
+  /* Queue of owned gchar *token, the keys of edits from the least recently
+   * edited message */
+  GQueue edited_tokens;
+
+  /* TRUE until the page has been handed to WebKit. The messages queued
+   * before that are rendered in the page itself, see
+   * theme_adium_load_document(). */
+  gboolean document_pending;
+  /* TRUE while the messages of the page are rendered in pending_script,
+   * which mustn't be flushed meanwhile */
+  gboolean building_document;
+  guint load_document_id;
+  guint document_freeze_count;
+  /* When the view has been handed out by empathy_theme_adium_start_timing(),
+   * until the conversation is populated */
+  gint64 creation_time;
+  guint n_document_messages;
 };
 
+typedef enum
+{
+  ADIUM_OP_LITERAL,
+  ADIUM_OP_USER_ICON_PATH,
+  ADIUM_OP_SENDER_SCREEN_NAME,
+  ADIUM_OP_SENDER,
+  ADIUM_OP_SENDER_COLOR,
+  ADIUM_OP_MESSAGE_DIRECTION,
+  ADIUM_OP_MESSAGE,
+  ADIUM_OP_TIME,
+  ADIUM_OP_SHORT_TIME,
+  ADIUM_OP_SERVICE,
+  ADIUM_OP_USER_ICONS,
+  ADIUM_OP_MESSAGE_CLASSES,
+} AdiumTemplateOpType;
+
+typedef struct
+{
+  AdiumTemplateOpType type;
+  /* ADIUM_OP_LITERAL: text already escaped for the script, owned */
+  gchar *literal;
+  gsize literal_len;
+  /* ADIUM_OP_TIME: strftime format, owned by date_format_cache, or NULL
+   * to use the default one */
+  const gchar *time_format;
+} AdiumTemplateOp;
+
+/* A message template compiled by adium_template_compile() */
+typedef struct
+{
+  /* array of AdiumTemplateOp */
+  GArray *ops;
+} AdiumTemplate;
+
 struct _EmpathyAdiumData
 {
   gint ref_count;
@@ -104,8 +187,26 @@ struct _EmpathyAdiumData
    * We do this because of fallbacks, some htmls could be pointing the
    * same string. */
   GPtrArray *strings_to_free;
+
+  /* Compiled versions of the above html strings, used to render
+   * messages */
+  AdiumTemplate *in_content;
+  AdiumTemplate *in_context;
+  AdiumTemplate *in_nextcontent;
+  AdiumTemplate *in_nextcontext;
+  AdiumTemplate *out_content;
+  AdiumTemplate *out_context;
+  AdiumTemplate *out_nextcontent;
+  AdiumTemplate *out_nextcontext;
+  AdiumTemplate *status;
+  /* const gchar * html -> owned AdiumTemplate * */
+  GHashTable *templates;
 };
 
+static void escape_and_append_len (GString *string,
+    const gchar *str,
+    gint len);
+static void theme_adium_replay_queue (EmpathyThemeAdium *self);
 static gchar * adium_info_dup_path_for_variant (GHashTable *info,
     const gchar *variant);
 
@@ -116,12 +217,21 @@ enum
   PROP_VARIANT,
 };
 
+enum
+{
+  SIG_BACKLOG_NEEDED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
 G_DEFINE_TYPE (EmpathyThemeAdium, empathy_theme_adium,
        WEBKIT_TYPE_WEB_VIEW)
 
 enum
 {
   QUEUED_EVENT,
+  QUEUED_EVENT_MARKUP,
   QUEUED_MESSAGE,
   QUEUED_EDIT
 };
@@ -131,6 +241,8 @@ typedef struct
   guint type;
   EmpathyMessage *msg;
   char *str;
+  /* Plain text version of @str for QUEUED_EVENT_MARKUP */
+  char *fallback_str;
   gboolean should_highlight;
 } QueuedItem;
 
@@ -163,6 +275,7 @@ free_queued_item (QueuedItem *item)
 {
   tp_clear_object (&item->msg);
   g_free (item->str);
+  g_free (item->fallback_str);
 
   g_slice_free (QueuedItem, item);
 }
@@ -209,14 +322,429 @@ string_with_format (const gchar *format,
   return g_string_free (result, FALSE);
 }
 
+/* Returns the functions of empathy-chat.js, used by our scripts */
+static gchar *
+theme_adium_dup_helper_script (void)
+{
+  GBytes *bytes;
+  gchar *js;
+  gsize size;
+
+  bytes = g_resources_lookup_data ("/org/gnome/Empathy/Chat/empathy-chat.js",
+      G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+
+  if (bytes == NULL)
+    return NULL;
+
+  js = g_strndup (g_bytes_get_data (bytes, &size), size);
+  g_bytes_unref (bytes);
+
+  return js;
+}
+
 static void
-theme_adium_load_template (EmpathyThemeAdium *self)
+theme_adium_flush_script (EmpathyThemeAdium *self)
+{
+  GString *script = self->priv->pending_script;
+
+  if (self->priv->flush_script_id != 0)
+    {
+      g_source_remove (self->priv->flush_script_id);
+      self->priv->flush_script_id = 0;
+    }
+
+  /* Keep everything until the page is ready, it will be flushed once it
+   * has loaded, or until it is part of the page being built */
+  if (self->priv->pages_loading != 0 || self->priv->building_document ||
+      script->len == 0)
+    return;
+
+  /* Our helper functions only have to be defined once per page */
+  if (!self->priv->script_installed)
+    {
+      gchar *js = theme_adium_dup_helper_script ();
+
+      if (js != NULL)
+        {
+          g_string_prepend_c (script, '\n');
+          g_string_prepend (script, js);
+          g_free (js);
+        }
+
+      self->priv->script_installed = TRUE;
+    }
+
+  /* Keep the page small however long the chat has been open */
+  if (self->priv->pending_script_messages > 0)
+    g_string_append_printf (script, "trim(%u);\n", MAX_LIVE_MESSAGES);
+
+  /* A view which was already loaded is populated by its first messages */
+  if (self->priv->creation_time != 0 &&
+      self->priv->pending_script_messages > 0)
+    {
+      DEBUG ("Conversation populated %" G_GINT64_FORMAT " ms after the view "
+          "has been handed out, %u messages were in the first script",
+          (g_get_monotonic_time () - self->priv->creation_time) /
+            G_TIME_SPAN_MILLISECOND,
+          self->priv->pending_script_messages);
+
+      self->priv->creation_time = 0;
+    }
+
+  self->priv->n_script_calls++;
+  self->priv->n_rendered_messages += self->priv->pending_script_messages;
+
+  if (self->priv->pending_script_messages > 0)
+    DEBUG ("Rendering %u messages in one script call; %" G_GUINT64_FORMAT
+        " calls for %" G_GUINT64_FORMAT " messages (%.3f per message)",
+        self->priv->pending_script_messages, self->priv->n_script_calls,
+        self->priv->n_rendered_messages,
+        (gdouble) self->priv->n_script_calls /
+          self->priv->n_rendered_messages);
+
+  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), script->str,
+      NULL, NULL, NULL);
+
+  g_string_truncate (script, 0);
+  self->priv->pending_script_messages = 0;
+}
+
+static gboolean
+theme_adium_flush_script_cb (gpointer user_data)
+{
+  EmpathyThemeAdium *self = user_data;
+
+  self->priv->flush_script_id = 0;
+  theme_adium_flush_script (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Queue a script rendering a message; all the messages queued during the
+ * same frame are sent to WebKit at once. */
+static void
+theme_adium_schedule_flush (EmpathyThemeAdium *self)
+{
+  self->priv->pending_script_messages++;
+
+  if (self->priv->flush_script_id != 0 || self->priv->pages_loading != 0 ||
+      self->priv->building_document)
+    return;
+
+  self->priv->flush_script_id = g_timeout_add (SCRIPT_FLUSH_INTERVAL,
+      theme_adium_flush_script_cb, self);
+}
+
+/* Run @script right away, after anything which has been queued before */
+static void
+theme_adium_run_script (EmpathyThemeAdium *self,
+    const gchar *script)
+{
+  g_string_append (self->priv->pending_script, script);
+  g_string_append_c (self->priv->pending_script, '\n');
+
+  theme_adium_flush_script (self);
+}
+
+/* Forget the script which hasn't been run yet, it was meant for the page
+ * being replaced */
+static void
+theme_adium_drop_pending_script (EmpathyThemeAdium *self)
+{
+  if (self->priv->flush_script_id != 0)
+    {
+      g_source_remove (self->priv->flush_script_id);
+      self->priv->flush_script_id = 0;
+    }
+
+  g_string_truncate (self->priv->pending_script, 0);
+  self->priv->pending_script_messages = 0;
+}
+
+static gchar *
+theme_adium_dup_script_message (WebKitJavascriptResult *result)
+{
+  JSGlobalContextRef context;
+  JSValueRef value;
+  JSStringRef js_str;
+  gsize size;
+  gchar *str;
+
+  context = webkit_javascript_result_get_global_context (result);
+  value = webkit_javascript_result_get_value (result);
+
+  if (!JSValueIsString (context, value))
+    return NULL;
+
+  js_str = JSValueToStringCopy (context, value, NULL);
+  size = JSStringGetMaximumUTF8CStringSize (js_str);
+  str = g_malloc (size);
+  JSStringGetUTF8CString (js_str, str, size);
+  JSStringRelease (js_str);
+
+  return str;
+}
+
+static void
+theme_adium_evicted_cb (WebKitUserContentManager *manager,
+    WebKitJavascriptResult *result,
+    EmpathyThemeAdium *self)
+{
+  gchar *html;
+
+  /* Sent by the page being replaced */
+  if (self->priv->pages_loading != 0)
+    return;
+
+  html = theme_adium_dup_script_message (result);
+  if (html == NULL)
+    return;
+
+  g_queue_push_tail (&self->priv->evicted_chunks, html);
+
+  DEBUG ("Evicted %" G_GSIZE_FORMAT " bytes of messages from the page, "
+      "%u chunks evicted", strlen (html),
+      g_queue_get_length (&self->priv->evicted_chunks));
+}
+
+/* Messages prepended from the logs while some are evicted */
+static void
+theme_adium_evicted_oldest_cb (WebKitUserContentManager *manager,
+    WebKitJavascriptResult *result,
+    EmpathyThemeAdium *self)
+{
+  gchar *html;
+
+  if (self->priv->pages_loading != 0)
+    return;
+
+  html = theme_adium_dup_script_message (result);
+  if (html == NULL)
+    return;
+
+  g_queue_push_head (&self->priv->evicted_chunks, html);
+}
+
+/* Newer messages evicted while the user reads older ones */
+static void
+theme_adium_evicted_newer_cb (WebKitUserContentManager *manager,
+    WebKitJavascriptResult *result,
+    EmpathyThemeAdium *self)
 {
+  gchar *html;
+
+  if (self->priv->pages_loading != 0)
+    return;
+
+  html = theme_adium_dup_script_message (result);
+  if (html == NULL)
+    return;
+
+  g_queue_push_tail (&self->priv->evicted_newer_chunks, html);
+
+  DEBUG ("Evicted %" G_GSIZE_FORMAT " bytes of newer messages from the page, "
+      "%u chunks evicted", strlen (html),
+      g_queue_get_length (&self->priv->evicted_newer_chunks));
+}
+
+static void
+theme_adium_forget_edited_token (EmpathyThemeAdium *self,
+    const gchar *token)
+{
+  GList *link;
+
+  link = g_queue_find_custom (&self->priv->edited_tokens, token,
+      (GCompareFunc) g_strcmp0);
+  if (link == NULL)
+    return;
+
+  g_free (link->data);
+  g_queue_delete_link (&self->priv->edited_tokens, link);
+}
+
+/* Keep @script, the edit of the message @token, to make it again if it
+ * runs while the message is evicted */
+static void
+theme_adium_remember_edit (EmpathyThemeAdium *self,
+    const gchar *token,
+    const gchar *script)
+{
+  theme_adium_forget_edited_token (self, token);
+
+  g_hash_table_replace (self->priv->edits, g_strdup (token),
+      g_strdup (script));
+  g_queue_push_tail (&self->priv->edited_tokens, g_strdup (token));
+
+  /* Messages are edited shortly after being sent, when they are still in
+   * the page, so only the most recent edits are kept */
+  if (g_queue_get_length (&self->priv->edited_tokens) > MAX_LIVE_MESSAGES)
+    {
+      gchar *oldest = g_queue_pop_head (&self->priv->edited_tokens);
+
+      g_hash_table_remove (self->priv->edits, oldest);
+      g_free (oldest);
+    }
+}
+
+static void
+theme_adium_forget_edits (EmpathyThemeAdium *self)
+{
+  g_hash_table_remove_all (self->priv->edits);
+  g_queue_foreach (&self->priv->edited_tokens, (GFunc) g_free, NULL);
+  g_queue_clear (&self->priv->edited_tokens);
+}
+
+/* Give @html back to the page with @func, and edit again the messages it
+ * contains which have been edited since they were evicted */
+static void
+theme_adium_put_back_chunk (EmpathyThemeAdium *self,
+    const gchar *func,
+    gchar *html)
+{
+  GString *script;
+  GHashTableIter iter;
+  gpointer token, edit;
+
+  script = g_string_new (func);
+  g_string_append (script, "(\"");
+  escape_and_append_len (script, html, -1);
+  g_string_append (script, "\");\n");
+
+  g_hash_table_iter_init (&iter, self->priv->edits);
+  while (g_hash_table_iter_next (&iter, &token, &edit))
+    {
+      gchar *id;
+
+      id = g_strdup_printf ("id=\"message-token-%s\"", (gchar *) token);
+
+      if (html != NULL && strstr (html, id) != NULL)
+        {
+          g_string_append (script, edit);
+          g_string_append_c (script, '\n');
+
+          /* The page has the edit from now on, so will the HTML of the
+           * message if it is evicted again */
+          theme_adium_forget_edited_token (self, token);
+          g_hash_table_iter_remove (&iter);
+        }
+
+      g_free (id);
+    }
+
+  theme_adium_run_script (self, script->str);
+
+  g_string_free (script, TRUE);
+  g_free (html);
+}
+
+/* Put back the most recently evicted chunk on top of the page */
+static void
+theme_adium_restore_chunk (EmpathyThemeAdium *self)
+{
+  theme_adium_put_back_chunk (self, "restore",
+      g_queue_pop_tail (&self->priv->evicted_chunks));
+}
+
+/* Put back the oldest of the newer chunks, where they were evicted from */
+static void
+theme_adium_restore_newer_chunk (EmpathyThemeAdium *self)
+{
+  theme_adium_put_back_chunk (self, "restoreNewer",
+      g_queue_pop_head (&self->priv->evicted_newer_chunks));
+}
+
+static void
+theme_adium_restore_cb (WebKitUserContentManager *manager,
+    WebKitJavascriptResult *result,
+    EmpathyThemeAdium *self)
+{
+  if (self->priv->pages_loading != 0)
+    return;
+
+  theme_adium_restore_chunk (self);
+}
+
+static void
+theme_adium_restore_newer_cb (WebKitUserContentManager *manager,
+    WebKitJavascriptResult *result,
+    EmpathyThemeAdium *self)
+{
+  if (self->priv->pages_loading != 0)
+    return;
+
+  theme_adium_restore_newer_chunk (self);
+}
+
+/* The user scrolled near the top and there is nothing evicted to put back */
+static void
+theme_adium_near_top_cb (WebKitUserContentManager *manager,
+    WebKitJavascriptResult *result,
+    EmpathyThemeAdium *self)
+{
+  g_signal_emit (self, signals[SIG_BACKLOG_NEEDED], 0);
+}
+
+/* Returns @template with @script run at the end of its body. */
+static gchar *
+theme_adium_dup_document (const gchar *template,
+    const gchar *script)
+{
+  GString *document;
+  const gchar *body_end;
+  gchar **split;
+  guint i;
+
+  body_end = g_strrstr (template, "</body>");
+  if (body_end == NULL)
+    body_end = template + strlen (template);
+
+  document = g_string_new_len (template, body_end - template);
+  g_string_append (document, "<script type=\"text/javascript\">\n");
+
+  /* Don't let the messages close the <script> element; this is only
+   * found in string literals, where "<\/" is the same */
+  split = g_strsplit (script, "</", -1);
+  g_string_append (document, split[0]);
+  for (i = 1; split[i] != NULL; i++)
+    {
+      g_string_append (document, "<\\/");
+      g_string_append (document, split[i]);
+    }
+  g_strfreev (split);
+
+  g_string_append (document, "</script>\n");
+  g_string_append (document, body_end);
+
+  return g_string_free (document, FALSE);
+}
+
+static void
+theme_adium_load_document (EmpathyThemeAdium *self)
+{
+  GString *script = self->priv->pending_script;
+  guint pages_loading = self->priv->pages_loading;
   gchar *basedir_uri;
   gchar *variant_path;
   gchar *template;
 
-  self->priv->pages_loading++;
+  if (self->priv->load_document_id != 0)
+    {
+      g_source_remove (self->priv->load_document_id);
+      self->priv->load_document_id = 0;
+    }
+
+  self->priv->document_pending = FALSE;
+
+  /* Render what has been queued so far in pending_script, which becomes
+   * part of the new page. None of it, edits included, may be flushed to
+   * the page being replaced meanwhile. */
+  self->priv->pages_loading = 0;
+  self->priv->building_document = TRUE;
+  self->priv->n_document_messages = self->priv->message_queue.length;
+  theme_adium_replay_queue (self);
+  self->priv->building_document = FALSE;
+  self->priv->pages_loading = pages_loading;
+
   basedir_uri = g_strconcat ("file://", self->priv->data->basedir, NULL);
 
   variant_path = adium_info_dup_path_for_variant (self->priv->data->info,
@@ -225,6 +753,39 @@ theme_adium_load_template (EmpathyThemeAdium *self)
   template = string_with_format (self->priv->data->template_html,
     variant_path, NULL);
 
+  /* Put the messages straight in the page, so they are there when it is
+   * first painted rather than added by as many scripts once it's loaded */
+  if (script->len > 0)
+    {
+      gchar *js;
+      gchar *document;
+
+      js = theme_adium_dup_helper_script ();
+      if (js != NULL)
+        {
+          g_string_prepend_c (script, '\n');
+          g_string_prepend (script, js);
+          g_free (js);
+        }
+
+      g_string_prepend (script,
+          "if (typeof initStyle == \"function\") initStyle();\n");
+      g_string_append (script,
+          "if (typeof coalescedHTML == \"object\") coalescedHTML.cancel();\n");
+
+      document = theme_adium_dup_document (template, script->str);
+      g_free (template);
+      template = document;
+
+      self->priv->script_installed = TRUE;
+      self->priv->n_script_calls++;
+      self->priv->n_rendered_messages += self->priv->pending_script_messages;
+      g_string_truncate (script, 0);
+      self->priv->pending_script_messages = 0;
+    }
+
+  DEBUG ("Loading page with %u messages", self->priv->n_document_messages);
+
   webkit_web_view_load_html (WEBKIT_WEB_VIEW (self),
       template, basedir_uri);
 
@@ -233,19 +794,54 @@ theme_adium_load_template (EmpathyThemeAdium *self)
   g_free (template);
 }
 
+static gboolean
+theme_adium_load_document_cb (gpointer user_data)
+{
+  EmpathyThemeAdium *self = user_data;
+
+  self->priv->load_document_id = 0;
+  theme_adium_load_document (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+theme_adium_schedule_load_document (EmpathyThemeAdium *self)
+{
+  if (self->priv->document_freeze_count == 0 &&
+      self->priv->load_document_id == 0)
+    self->priv->load_document_id = g_idle_add (theme_adium_load_document_cb,
+        self);
+}
+
+static void
+theme_adium_load_template (EmpathyThemeAdium *self)
+{
+  self->priv->pages_loading++;
+  self->priv->script_installed = FALSE;
+  theme_adium_drop_pending_script (self);
+
+  /* The new page starts without any message */
+  g_queue_foreach (&self->priv->evicted_chunks, (GFunc) g_free, NULL);
+  g_queue_clear (&self->priv->evicted_chunks);
+  g_queue_foreach (&self->priv->evicted_newer_chunks, (GFunc) g_free, NULL);
+  g_queue_clear (&self->priv->evicted_newer_chunks);
+  theme_adium_forget_edits (self);
+
+  /* Give our user a chance to add the messages it already has, or to
+   * hold the page with empathy_theme_adium_freeze_document() until it
+   * gets them */
+  self->priv->document_pending = TRUE;
+  theme_adium_schedule_load_document (self);
+}
+
 static gchar *
 theme_adium_parse_body (EmpathyThemeAdium *self,
   const gchar *text,
   const gchar *token)
 {
-  TpawStringParser *parsers;
   GString *string;
 
-  /* Check if we have to parse smileys */
-  parsers = empathy_webkit_get_string_parser (
-    g_settings_get_boolean (self->priv->gsettings_chat,
-      EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
-
   /* Parse text and construct string with links and smileys replaced
    * by html tags. Also escape text to make sure html code is
    * displayed verbatim. */
@@ -258,7 +854,9 @@ theme_adium_parse_body (EmpathyThemeAdium *self,
       "<span id=\"message-token-%s\">",
       token);
 
-  tpaw_string_parser_substr (text, -1, parsers, string);
+  empathy_webkit_append_body (string, text, -1,
+    g_settings_get_boolean (self->priv->gsettings_chat,
+      EMPATHY_PREFS_CHAT_SHOW_SMILEYS));
 
   if (!tp_str_empty (token))
     g_string_append (string, "</span>");
@@ -508,71 +1106,49 @@ nsdate_to_strftime (EmpathyAdiumData *data, const gchar *nsdate)
   return g_string_free (string, FALSE);
 }
 
-static void
-theme_adium_add_html (EmpathyThemeAdium *self,
-    const gchar *func,
-    const gchar *html,
-    const gchar *message,
-    const gchar *avatar_filename,
-    const gchar *name,
-    const gchar *contact_id,
-    const gchar *service_name,
-    const gchar *message_classes,
-    gint64 timestamp,
-    gboolean is_backlog,
-    gboolean outgoing,
-    PangoDirection direction)
+/* Compile @html into a list of literal spans, escaped for inclusion in a
+ * JavaScript string, and keyword substitutions, so messages can be
+ * rendered without scanning the template again. */
+static AdiumTemplate *
+adium_template_compile (EmpathyAdiumData *data,
+    const gchar *html)
 {
-  GBytes *bytes;
-  GString *string;
-  const gchar *cur = NULL;
-  const gchar *js;
-  gchar *script;
+  AdiumTemplate *tmpl;
+  GString *literal;
+  const gchar *cur;
 
-  /* Make some search-and-replace in the html code */
-  string = g_string_sized_new (strlen (html) + strlen (message));
-  g_string_append_printf (string, "%s(\"", func);
+  tmpl = g_slice_new0 (AdiumTemplate);
+  tmpl->ops = g_array_new (FALSE, TRUE, sizeof (AdiumTemplateOp));
+
+  if (html == NULL)
+    return tmpl;
+
+  literal = g_string_new (NULL);
 
   for (cur = html; *cur != '\0'; cur++)
     {
-      const gchar *replace = NULL;
-      gchar *dup_replace = NULL;
+      AdiumTemplateOp op = { ADIUM_OP_LITERAL, NULL, 0, NULL };
       gchar *format = NULL;
+      gboolean keyword = TRUE;
 
       /* Those are all well known keywords that needs replacement in
        * html files. Please keep them in the same order than the adium
        * spec. See http://trac.adium.im/wiki/CreatingMessageStyles */
       if (theme_adium_match (&cur, "%userIconPath%"))
         {
-          replace = avatar_filename;
+          op.type = ADIUM_OP_USER_ICON_PATH;
         }
       else if (theme_adium_match (&cur, "%senderScreenName%"))
         {
-          replace = contact_id;
+          op.type = ADIUM_OP_SENDER_SCREEN_NAME;
         }
       else if (theme_adium_match (&cur, "%sender%"))
         {
-          replace = name;
+          op.type = ADIUM_OP_SENDER;
         }
       else if (theme_adium_match (&cur, "%senderColor%"))
         {
-          /* A color derived from the user's name.
-           * FIXME: If a colon separated list of HTML colors is at
-           * Incoming/SenderColors.txt it will be used instead of
-           * the default colors.
-           */
-
-          /* Ensure we always use the same color when sending messages
-           * (bgo #658821) */
-          if (outgoing)
-            {
-              replace = "inherit";
-            }
-          else if (contact_id != NULL)
-            {
-              guint hash = g_str_hash (contact_id);
-              replace = colors[hash % G_N_ELEMENTS (colors)];
-            }
+          op.type = ADIUM_OP_SENDER_COLOR;
         }
       else if (theme_adium_match (&cur, "%senderStatusIcon%"))
         {
@@ -582,22 +1158,7 @@ theme_adium_add_html (EmpathyThemeAdium *self,
         }
       else if (theme_adium_match (&cur, "%messageDirection%"))
         {
-          switch (direction)
-            {
-              case PANGO_DIRECTION_LTR:
-              case PANGO_DIRECTION_TTB_LTR:
-              case PANGO_DIRECTION_WEAK_LTR:
-                replace = "ltr";
-                break;
-              case PANGO_DIRECTION_RTL:
-              case PANGO_DIRECTION_TTB_RTL:
-              case PANGO_DIRECTION_WEAK_RTL:
-                replace = "rtl";
-                break;
-              case PANGO_DIRECTION_NEUTRAL:
-              default:
-                break;
-            }
+          op.type = ADIUM_OP_MESSAGE_DIRECTION;
         }
       else if (theme_adium_match (&cur, "%senderDisplayName%"))
         {
@@ -607,7 +1168,7 @@ theme_adium_add_html (EmpathyThemeAdium *self,
            *  We don't have access to that yet so we use
            * local alias instead.
            */
-          replace = name;
+          op.type = ADIUM_OP_SENDER;
         }
       else if (theme_adium_match (&cur, "%senderPrefix%"))
         {
@@ -628,34 +1189,21 @@ theme_adium_add_html (EmpathyThemeAdium *self,
         }
       else if (theme_adium_match (&cur, "%message%"))
         {
-          replace = message;
+          op.type = ADIUM_OP_MESSAGE;
         }
       else if (theme_adium_match (&cur, "%time%") ||
            theme_adium_match_with_format (&cur, "%time{", &format))
         {
-          const gchar *strftime_format;
-
-          strftime_format = nsdate_to_strftime (self->priv->data, format);
-          if (is_backlog)
-            dup_replace = tpaw_time_to_string_local (timestamp,
-              strftime_format ? strftime_format :
-              TPAW_TIME_DATE_FORMAT_DISPLAY_SHORT);
-          else
-            dup_replace = tpaw_time_to_string_local (timestamp,
-              strftime_format ? strftime_format :
-              TPAW_TIME_FORMAT_DISPLAY_SHORT);
-
-          replace = dup_replace;
+          op.type = ADIUM_OP_TIME;
+          op.time_format = nsdate_to_strftime (data, format);
         }
       else if (theme_adium_match (&cur, "%shortTime%"))
         {
-          dup_replace = tpaw_time_to_string_local (timestamp,
-            TPAW_TIME_FORMAT_DISPLAY_SHORT);
-          replace = dup_replace;
+          op.type = ADIUM_OP_SHORT_TIME;
         }
       else if (theme_adium_match (&cur, "%service%"))
         {
-          replace = service_name;
+          op.type = ADIUM_OP_SERVICE;
         }
       else if (theme_adium_match (&cur, "%variant%"))
         {
@@ -667,11 +1215,11 @@ theme_adium_add_html (EmpathyThemeAdium *self,
         }
       else if (theme_adium_match (&cur, "%userIcons%"))
         {
-          replace = self->priv->show_avatars ? "showIcons" : "hideIcons";
+          op.type = ADIUM_OP_USER_ICONS;
         }
       else if (theme_adium_match (&cur, "%messageClasses%"))
         {
-          replace = message_classes;
+          op.type = ADIUM_OP_MESSAGE_CLASSES;
         }
       else if (theme_adium_match (&cur, "%status%"))
         {
@@ -704,32 +1252,203 @@ theme_adium_add_html (EmpathyThemeAdium *self,
         }
       else
         {
-          escape_and_append_len (string, cur, 1);
-          continue;
+          escape_and_append_len (literal, cur, 1);
+          keyword = FALSE;
         }
 
-      /* Here we have a replacement to make */
-      escape_and_append_len (string, replace, -1);
-
-      g_free (dup_replace);
       g_free (format);
+
+      /* Keywords we don't support are simply stripped */
+      if (!keyword || op.type == ADIUM_OP_LITERAL)
+        continue;
+
+      if (literal->len > 0)
+        {
+          AdiumTemplateOp lit = { ADIUM_OP_LITERAL, NULL, 0, NULL };
+
+          lit.literal_len = literal->len;
+          lit.literal = g_string_free (literal, FALSE);
+          g_array_append_val (tmpl->ops, lit);
+
+          literal = g_string_new (NULL);
+        }
+
+      g_array_append_val (tmpl->ops, op);
     }
-  g_string_append (string, "\")");
 
-  bytes = g_resources_lookup_data ("/org/gnome/Empathy/Chat/empathy-chat.js",
-      G_RESOURCE_LOOKUP_FLAGS_NONE,
-      NULL);
+  if (literal->len > 0)
+    {
+      AdiumTemplateOp lit = { ADIUM_OP_LITERAL, NULL, 0, NULL };
 
-  if (bytes != NULL)
+      lit.literal_len = literal->len;
+      lit.literal = g_string_free (literal, FALSE);
+      g_array_append_val (tmpl->ops, lit);
+    }
+  else
     {
-      js = (const gchar *) g_bytes_get_data (bytes, NULL);
-      g_string_prepend (string, js);
-      g_bytes_unref (bytes);
+      g_string_free (literal, TRUE);
     }
 
-  script = g_string_free (string, FALSE);
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), script, NULL, NULL, NULL);
-  g_free (script);
+  return tmpl;
+}
+
+static void
+adium_template_free (AdiumTemplate *tmpl)
+{
+  guint i;
+
+  for (i = 0; i < tmpl->ops->len; i++)
+    g_free (g_array_index (tmpl->ops, AdiumTemplateOp, i).literal);
+
+  g_array_unref (tmpl->ops);
+  g_slice_free (AdiumTemplate, tmpl);
+}
+
+/* Returns the compiled version of @html, sharing it between the
+ * templates falling back to the same file */
+static AdiumTemplate *
+adium_data_compile_template (EmpathyAdiumData *data,
+    const gchar *html)
+{
+  AdiumTemplate *tmpl;
+
+  tmpl = g_hash_table_lookup (data->templates, html);
+  if (tmpl != NULL)
+    return tmpl;
+
+  tmpl = adium_template_compile (data, html);
+  g_hash_table_insert (data->templates, (gpointer) html, tmpl);
+
+  return tmpl;
+}
+
+static void
+theme_adium_add_html (EmpathyThemeAdium *self,
+    const gchar *func,
+    const AdiumTemplate *tmpl,
+    const gchar *message,
+    const gchar *avatar_filename,
+    const gchar *name,
+    const gchar *contact_id,
+    const gchar *service_name,
+    const gchar *message_classes,
+    gint64 timestamp,
+    gboolean is_backlog,
+    gboolean outgoing,
+    PangoDirection direction)
+{
+  GString *string = self->priv->pending_script;
+  guint i;
+
+  g_string_append_printf (string, "%s(\"", func);
+
+  for (i = 0; i < tmpl->ops->len; i++)
+    {
+      const AdiumTemplateOp *op = &g_array_index (tmpl->ops,
+          AdiumTemplateOp, i);
+      const gchar *replace = NULL;
+      gchar *dup_replace = NULL;
+
+      switch (op->type)
+        {
+          case ADIUM_OP_LITERAL:
+            g_string_append_len (string, op->literal, op->literal_len);
+            continue;
+
+          case ADIUM_OP_USER_ICON_PATH:
+            replace = avatar_filename;
+            break;
+
+          case ADIUM_OP_SENDER_SCREEN_NAME:
+            replace = contact_id;
+            break;
+
+          case ADIUM_OP_SENDER:
+            replace = name;
+            break;
+
+          case ADIUM_OP_SENDER_COLOR:
+            /* A color derived from the user's name.
+             * FIXME: If a colon separated list of HTML colors is at
+             * Incoming/SenderColors.txt it will be used instead of
+             * the default colors.
+             */
+
+            /* Ensure we always use the same color when sending messages
+             * (bgo #658821) */
+            if (outgoing)
+              {
+                replace = "inherit";
+              }
+            else if (contact_id != NULL)
+              {
+                guint hash = g_str_hash (contact_id);
+                replace = colors[hash % G_N_ELEMENTS (colors)];
+              }
+            break;
+
+          case ADIUM_OP_MESSAGE_DIRECTION:
+            switch (direction)
+              {
+                case PANGO_DIRECTION_LTR:
+                case PANGO_DIRECTION_TTB_LTR:
+                case PANGO_DIRECTION_WEAK_LTR:
+                  replace = "ltr";
+                  break;
+                case PANGO_DIRECTION_RTL:
+                case PANGO_DIRECTION_TTB_RTL:
+                case PANGO_DIRECTION_WEAK_RTL:
+                  replace = "rtl";
+                  break;
+                case PANGO_DIRECTION_NEUTRAL:
+                default:
+                  break;
+              }
+            break;
+
+          case ADIUM_OP_MESSAGE:
+            replace = message;
+            break;
+
+          case ADIUM_OP_TIME:
+            if (op->time_format != NULL)
+              dup_replace = tpaw_time_to_string_local (timestamp,
+                op->time_format);
+            else if (is_backlog)
+              dup_replace = tpaw_time_to_string_local (timestamp,
+                TPAW_TIME_DATE_FORMAT_DISPLAY_SHORT);
+            else
+              dup_replace = tpaw_time_to_string_local (timestamp,
+                TPAW_TIME_FORMAT_DISPLAY_SHORT);
+
+            replace = dup_replace;
+            break;
+
+          case ADIUM_OP_SHORT_TIME:
+            dup_replace = tpaw_time_to_string_local (timestamp,
+              TPAW_TIME_FORMAT_DISPLAY_SHORT);
+            replace = dup_replace;
+            break;
+
+          case ADIUM_OP_SERVICE:
+            replace = service_name;
+            break;
+
+          case ADIUM_OP_USER_ICONS:
+            replace = self->priv->show_avatars ? "showIcons" : "hideIcons";
+            break;
+
+          case ADIUM_OP_MESSAGE_CLASSES:
+            replace = message_classes;
+            break;
+        }
+
+      escape_and_append_len (string, replace, -1);
+      g_free (dup_replace);
+    }
+  g_string_append (string, "\");\n");
+
+  theme_adium_schedule_flush (self);
 }
 
 static void
@@ -738,7 +1457,7 @@ theme_adium_append_event_escaped (EmpathyThemeAdium *self,
     PangoDirection direction)
 {
   theme_adium_add_html (self, "appendMessage",
-      self->priv->data->status_html, escaped, NULL, NULL, NULL,
+      self->priv->data->status, escaped, NULL, NULL, NULL,
       NULL, "event", tpaw_time_get_current (), FALSE, FALSE, direction);
 
   /* There is no last contact */
@@ -886,7 +1605,7 @@ theme_adium_add_message (EmpathyThemeAdium *self,
   EmpathyAvatar *avatar;
   const gchar *avatar_filename = NULL;
   gint64 timestamp;
-  const gchar *html = NULL;
+  const AdiumTemplate *html = NULL;
   const gchar *func;
   const gchar *service_name;
   GString *message_classes = NULL;
@@ -1034,12 +1753,12 @@ theme_adium_add_message (EmpathyThemeAdium *self,
       /* out */
       if (is_backlog)
         /* context */
-        html = consecutive ? self->priv->data->out_nextcontext_html :
-          self->priv->data->out_context_html;
+        html = consecutive ? self->priv->data->out_nextcontext :
+          self->priv->data->out_context;
       else
         /* content */
-        html = consecutive ? self->priv->data->out_nextcontent_html :
-          self->priv->data->out_content_html;
+        html = consecutive ? self->priv->data->out_nextcontent :
+          self->priv->data->out_content;
 
       /* remove all the unread marks when we are sending a message */
       theme_adium_remove_all_focus_marks (self);
@@ -1049,12 +1768,12 @@ theme_adium_add_message (EmpathyThemeAdium *self,
       /* in */
       if (is_backlog)
         /* context */
-        html = consecutive ? self->priv->data->in_nextcontext_html :
-          self->priv->data->in_context_html;
+        html = consecutive ? self->priv->data->in_nextcontext :
+          self->priv->data->in_context;
       else
         /* content */
-        html = consecutive ? self->priv->data->in_nextcontent_html :
-          self->priv->data->in_content_html;
+        html = consecutive ? self->priv->data->in_nextcontent :
+          self->priv->data->in_content;
     }
 
   direction = pango_find_base_dir (empathy_message_get_body (msg), -1);
@@ -1125,6 +1844,16 @@ empathy_theme_adium_append_event_markup (EmpathyThemeAdium *self,
 {
   PangoDirection direction;
 
+  if (self->priv->pages_loading != 0)
+    {
+      QueuedItem *item;
+
+      item = queue_item (&self->priv->message_queue, QUEUED_EVENT_MARKUP,
+          NULL, markup_text, FALSE, FALSE);
+      item->fallback_str = g_strdup (fallback_text);
+      return;
+    }
+
   direction = pango_find_base_dir (fallback_text, -1);
   theme_adium_append_event_escaped (self, markup_text, direction);
 }
@@ -1151,18 +1880,112 @@ empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
       should_highlight, js_funcs);
 }
 
+/* Messages prepended until empathy_theme_adium_end_backlog_page() are
+ * rendered at once, without moving what the user is looking at */
+void
+empathy_theme_adium_begin_backlog_page (EmpathyThemeAdium *self)
+{
+  /* Everything is rendered at once when the page is ready */
+  if (self->priv->pages_loading != 0)
+    return;
+
+  g_string_append (self->priv->pending_script, "beginPrepend();\n");
+}
+
+void
+empathy_theme_adium_end_backlog_page (EmpathyThemeAdium *self,
+    gboolean complete)
+{
+  if (self->priv->pages_loading != 0)
+    return;
+
+  g_string_append_printf (self->priv->pending_script, "endPrepend(%s);\n",
+      complete ? "true" : "false");
+
+  theme_adium_flush_script (self);
+}
+
+/* Forget all the messages, shown or queued, and start again from an empty
+ * page */
+void
+empathy_theme_adium_reset (EmpathyThemeAdium *self)
+{
+  g_queue_foreach (&self->priv->message_queue, (GFunc) free_queued_item,
+      NULL);
+  g_queue_clear (&self->priv->message_queue);
+  g_queue_clear (&self->priv->acked_messages);
+
+  theme_adium_drop_pending_script (self);
+
+  g_clear_object (&self->priv->first_contact);
+  g_clear_object (&self->priv->last_contact);
+  self->priv->first_timestamp = 0;
+  self->priv->last_timestamp = 0;
+  self->priv->first_is_backlog = FALSE;
+  self->priv->last_is_backlog = FALSE;
+
+  /* Nothing has been shown yet */
+  if (self->priv->document_pending)
+    {
+      theme_adium_schedule_load_document (self);
+      return;
+    }
+
+  theme_adium_load_template (self);
+}
+
+/* Bring the view back to the state of a new one, so it can be given to
+ * another chat */
+void
+empathy_theme_adium_recycle (EmpathyThemeAdium *self)
+{
+  self->priv->document_freeze_count = 0;
+  self->priv->allow_scrolling = TRUE;
+  self->priv->show_avatars = TRUE;
+  self->priv->has_focus = FALSE;
+  self->priv->has_unread_message = FALSE;
+  self->priv->creation_time = 0;
+
+  empathy_theme_adium_reset (self);
+}
+
+/* The view has been given to a chat, possibly from a pool; measure the time
+ * it takes to show the conversation from now on */
+void
+empathy_theme_adium_start_timing (EmpathyThemeAdium *self)
+{
+  self->priv->creation_time = g_get_monotonic_time ();
+}
+
+/* Don't load the page until empathy_theme_adium_thaw_document() has been
+ * called as many times, so the messages added meanwhile are part of it */
+void
+empathy_theme_adium_freeze_document (EmpathyThemeAdium *self)
+{
+  self->priv->document_freeze_count++;
+}
+
+void
+empathy_theme_adium_thaw_document (EmpathyThemeAdium *self)
+{
+  g_return_if_fail (self->priv->document_freeze_count > 0);
+
+  self->priv->document_freeze_count--;
+
+  if (self->priv->document_freeze_count == 0 &&
+      self->priv->document_pending)
+    theme_adium_load_document (self);
+}
+
 void
 empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
     EmpathyMessage *message)
 {
-#if 0
-  /* FIXME: this needs to be ported to WebKit2, but I have no idea what this is for */
-  WebKitDOMDocument *doc;
-  WebKitDOMElement *span;
-  gchar *id, *parsed_body;
+  const gchar *token;
+  GString *script;
+  gchar *parsed_body;
   gchar *tooltip, *timestamp;
   GtkIconInfo *icon_info;
-  GError *error = NULL;
 
   if (self->priv->pages_loading != 0)
     {
@@ -1170,51 +1993,27 @@ empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
       return;
     }
 
-  id = g_strdup_printf ("message-token-%s",
-    empathy_message_get_supersedes (message));
+  token = empathy_message_get_supersedes (message);
+  if (tp_str_empty (token))
+    return;
+
   /* we don't pass a token here, because doing so will return another
    * <span> element, and we don't want nested <span> elements */
   parsed_body = theme_adium_parse_body (self,
     empathy_message_get_body (message), NULL);
 
-  /* find the element */
-  doc = webkit_web_view_get_dom_document (WEBKIT_WEB_VIEW (self));
-  span = webkit_dom_document_get_element_by_id (doc, id);
-
-  if (span == NULL)
-    {
-      DEBUG ("Failed to find id '%s'", id);
-      goto except;
-    }
-
-  if (!WEBKIT_DOM_IS_HTML_ELEMENT (span))
-    {
-      DEBUG ("Not a HTML element");
-      goto except;
-    }
-
-  /* update the HTML */
-  webkit_dom_html_element_set_inner_html (WEBKIT_DOM_HTML_ELEMENT (span),
-    parsed_body, &error);
-
-  if (error != NULL)
-    {
-      DEBUG ("Error setting new inner-HTML: %s", error->message);
-      g_error_free (error);
-      goto except;
-    }
-
-  /* set a tooltip */
   timestamp = tpaw_time_to_string_local (
     empathy_message_get_timestamp (message),
     "%H:%M:%S");
   tooltip = g_strdup_printf (_("Message edited at %s"), timestamp);
 
-  webkit_dom_html_element_set_title (WEBKIT_DOM_HTML_ELEMENT (span),
-    tooltip);
-
-  g_free (tooltip);
-  g_free (timestamp);
+  script = g_string_new ("editMessage(\"");
+  escape_and_append_len (script, token, -1);
+  g_string_append (script, "\", \"");
+  escape_and_append_len (script, parsed_body, -1);
+  g_string_append (script, "\", \"");
+  escape_and_append_len (script, tooltip, -1);
+  g_string_append (script, "\", \"");
 
   /* mark this message as edited */
   icon_info = gtk_icon_theme_lookup_icon (gtk_icon_theme_get_default (),
@@ -1231,30 +2030,24 @@ empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
         "padding-left:19px;", /* 16px icon + 3px padding */
         gtk_icon_info_get_filename (icon_info));
 
-      webkit_dom_element_set_attribute (span, "style", style, &error);
-
-      if (error != NULL)
-        {
-          DEBUG ("Error setting element style: %s",
-            error->message);
-          g_clear_error (&error);
-          /* not fatal */
-        }
+      escape_and_append_len (script, style, -1);
 
       g_free (style);
       g_object_unref (icon_info);
     }
 
-  goto finally;
+  g_string_append (script, "\");");
+
+  /* The message may be evicted from the page before or after the script
+   * runs, keep the edit to make it again when it is put back */
+  theme_adium_remember_edit (self, token, script->str);
 
-except:
-  DEBUG ("Could not find message to edit with: %s",
-    empathy_message_get_body (message));
+  theme_adium_run_script (self, script->str);
 
-finally:
-  g_free (id);
+  g_string_free (script, TRUE);
+  g_free (tooltip);
+  g_free (timestamp);
   g_free (parsed_body);
-#endif
 }
 
 void
@@ -1270,7 +2063,7 @@ empathy_theme_adium_scroll (EmpathyThemeAdium *self,
 void
 empathy_theme_adium_scroll_down (EmpathyThemeAdium *self)
 {
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), "alignChat(true);", NULL, NULL, NULL);
+  theme_adium_run_script (self, "alignChat(true);");
 }
 
 static void
@@ -1310,7 +2103,7 @@ empathy_theme_adium_can_copy_finish (EmpathyThemeAdium *self,
 void
 empathy_theme_adium_clear (EmpathyThemeAdium *self)
 {
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), "clearPage()", NULL, NULL, NULL);
+  theme_adium_run_script (self, "clearPage();");
   empathy_theme_adium_scroll_down (self);
 
   /* Clear last contact to avoid trying to add a 'joined'
@@ -1349,6 +2142,73 @@ empathy_theme_adium_find_abilities (EmpathyThemeAdium *self,
     *can_do_next = TRUE;
 }
 
+static gboolean
+theme_adium_chunk_matches (const gchar *html,
+    const gchar *text,
+    gboolean match_case)
+{
+  gchar *folded_html, *folded_text;
+  gboolean result;
+
+  if (match_case)
+    return strstr (html, text) != NULL;
+
+  folded_html = g_utf8_casefold (html, -1);
+  folded_text = g_utf8_casefold (text, -1);
+
+  result = (strstr (folded_html, folded_text) != NULL);
+
+  g_free (folded_html);
+  g_free (folded_text);
+
+  return result;
+}
+
+/* The find controller only searches the page, put back the evicted
+ * messages down to the oldest one, and up to the newest one, which may
+ * match @text. The HTML markup is matched as well so this may restore more
+ * than needed. */
+static void
+theme_adium_restore_matching_chunks (EmpathyThemeAdium *self,
+    const gchar *text,
+    gboolean match_case)
+{
+  GList *l;
+  guint n = 0, n_newer = 0;
+  guint i;
+
+  for (l = self->priv->evicted_chunks.head; l != NULL; l = g_list_next (l))
+    {
+      if (theme_adium_chunk_matches (l->data, text, match_case))
+        {
+          n = g_queue_get_length (&self->priv->evicted_chunks) -
+            g_queue_link_index (&self->priv->evicted_chunks, l);
+          break;
+        }
+    }
+
+  for (l = self->priv->evicted_newer_chunks.tail; l != NULL;
+      l = g_list_previous (l))
+    {
+      if (theme_adium_chunk_matches (l->data, text, match_case))
+        {
+          n_newer = g_queue_link_index (&self->priv->evicted_newer_chunks,
+              l) + 1;
+          break;
+        }
+    }
+
+  if (n + n_newer > 0)
+    DEBUG ("Restoring %u chunks of evicted messages to search them",
+        n + n_newer);
+
+  for (i = 0; i < n; i++)
+    theme_adium_restore_chunk (self);
+
+  for (i = 0; i < n_newer; i++)
+    theme_adium_restore_newer_chunk (self);
+}
+
 void
 empathy_theme_adium_search (EmpathyThemeAdium *self,
     const gchar *text,
@@ -1367,6 +2227,8 @@ empathy_theme_adium_search (EmpathyThemeAdium *self,
   if (!match_case)
     options |= WEBKIT_FIND_OPTIONS_CASE_INSENSITIVE;
 
+  theme_adium_restore_matching_chunks (self, text, match_case);
+
   webkit_find_controller_search (find_controller, text, options, G_MAXUINT);
 }
 
@@ -1501,7 +2363,6 @@ theme_adium_load_changed_cb (WebKitWebView *view,
     gpointer user_data)
 {
   EmpathyThemeAdium *self = EMPATHY_THEME_ADIUM (view);
-  GList *l;
 
   if (event != WEBKIT_LOAD_FINISHED)
     return;
@@ -1512,7 +2373,29 @@ theme_adium_load_changed_cb (WebKitWebView *view,
   if (self->priv->pages_loading != 0)
     return;
 
-  /* Display queued messages */
+  if (self->priv->creation_time != 0)
+    {
+      DEBUG ("Conversation populated %" G_GINT64_FORMAT " ms after the view "
+          "has been handed out, %u messages were in the initial page",
+          (g_get_monotonic_time () - self->priv->creation_time) /
+            G_TIME_SPAN_MILLISECOND,
+          self->priv->n_document_messages);
+
+      self->priv->creation_time = 0;
+    }
+
+  theme_adium_replay_queue (self);
+
+  /* Send the whole backlog, along with our helper functions, at once */
+  theme_adium_flush_script (self);
+}
+
+/* Display queued messages */
+static void
+theme_adium_replay_queue (EmpathyThemeAdium *self)
+{
+  GList *l;
+
   for (l = self->priv->message_queue.head; l != NULL; l = l->next)
     {
       QueuedItem *item = l->data;
@@ -1531,6 +2414,11 @@ theme_adium_load_changed_cb (WebKitWebView *view,
           case QUEUED_EVENT:
             empathy_theme_adium_append_event (self, item->str);
             break;
+
+          case QUEUED_EVENT_MARKUP:
+            empathy_theme_adium_append_event_markup (self, item->str,
+              item->fallback_str);
+            break;
         }
 
       free_queued_item (item);
@@ -1550,6 +2438,13 @@ theme_adium_finalize (GObject *object)
   g_object_unref (self->priv->gsettings_desktop);
 
   g_free (self->priv->variant);
+  g_string_free (self->priv->pending_script, TRUE);
+  g_queue_foreach (&self->priv->evicted_chunks, (GFunc) g_free, NULL);
+  g_queue_clear (&self->priv->evicted_chunks);
+  g_queue_foreach (&self->priv->evicted_newer_chunks, (GFunc) g_free, NULL);
+  g_queue_clear (&self->priv->evicted_newer_chunks);
+  theme_adium_forget_edits (self);
+  g_hash_table_unref (self->priv->edits);
 
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->finalize (object);
 }
@@ -1559,6 +2454,18 @@ theme_adium_dispose (GObject *object)
 {
   EmpathyThemeAdium *self = EMPATHY_THEME_ADIUM (object);
 
+  if (self->priv->flush_script_id != 0)
+    {
+      g_source_remove (self->priv->flush_script_id);
+      self->priv->flush_script_id = 0;
+    }
+
+  if (self->priv->load_document_id != 0)
+    {
+      g_source_remove (self->priv->load_document_id);
+      self->priv->load_document_id = 0;
+    }
+
   if (self->priv->smiley_manager)
     {
       g_object_unref (self->priv->smiley_manager);
@@ -1594,6 +2501,7 @@ theme_adium_constructed (GObject *object)
   const gchar *font_family = NULL;
   gint font_size = 0;
   WebKitWebView *webkit_view = WEBKIT_WEB_VIEW (object);
+  WebKitUserContentManager *manager;
 
   G_OBJECT_CLASS (empathy_theme_adium_parent_class)->constructed (object);
 
@@ -1619,6 +2527,40 @@ theme_adium_constructed (GObject *object)
         "default-charset", "utf8",
         NULL);
 
+  /* Messages evicted from the page by empathy-chat.js */
+  manager = webkit_web_view_get_user_content_manager (webkit_view);
+  webkit_user_content_manager_register_script_message_handler (manager,
+      "empathyEvicted");
+  webkit_user_content_manager_register_script_message_handler (manager,
+      "empathyEvictedOldest");
+  webkit_user_content_manager_register_script_message_handler (manager,
+      "empathyRestore");
+  webkit_user_content_manager_register_script_message_handler (manager,
+      "empathyEvictedNewer");
+  webkit_user_content_manager_register_script_message_handler (manager,
+      "empathyRestoreNewer");
+  webkit_user_content_manager_register_script_message_handler (manager,
+      "empathyNearTop");
+
+  tp_g_signal_connect_object (manager,
+      "script-message-received::empathyEvicted",
+      G_CALLBACK (theme_adium_evicted_cb), self, 0);
+  tp_g_signal_connect_object (manager,
+      "script-message-received::empathyEvictedOldest",
+      G_CALLBACK (theme_adium_evicted_oldest_cb), self, 0);
+  tp_g_signal_connect_object (manager,
+      "script-message-received::empathyRestore",
+      G_CALLBACK (theme_adium_restore_cb), self, 0);
+  tp_g_signal_connect_object (manager,
+      "script-message-received::empathyEvictedNewer",
+      G_CALLBACK (theme_adium_evicted_newer_cb), self, 0);
+  tp_g_signal_connect_object (manager,
+      "script-message-received::empathyRestoreNewer",
+      G_CALLBACK (theme_adium_restore_newer_cb), self, 0);
+  tp_g_signal_connect_object (manager,
+      "script-message-received::empathyNearTop",
+      G_CALLBACK (theme_adium_near_top_cb), self, 0);
+
   /* Load template */
   theme_adium_load_template (EMPATHY_THEME_ADIUM (object));
 
@@ -1699,6 +2641,16 @@ empathy_theme_adium_class_init (EmpathyThemeAdiumClass *klass)
         G_PARAM_READWRITE |
         G_PARAM_STATIC_STRINGS));
 
+  /* Emitted when the user scrolls near the top of the page, older messages
+   * should be prepended between empathy_theme_adium_begin_backlog_page()
+   * and empathy_theme_adium_end_backlog_page(). */
+  signals[SIG_BACKLOG_NEEDED] = g_signal_new ("backlog-needed",
+      G_OBJECT_CLASS_TYPE (klass),
+      G_SIGNAL_RUN_LAST,
+      0, NULL, NULL, NULL,
+      G_TYPE_NONE,
+      0);
+
   g_type_class_add_private (object_class, sizeof (EmpathyThemeAdiumPriv));
 }
 
@@ -1710,6 +2662,9 @@ empathy_theme_adium_init (EmpathyThemeAdium *self)
 
   self->priv->in_construction = TRUE;
   g_queue_init (&self->priv->message_queue);
+  self->priv->pending_script = g_string_new (NULL);
+  self->priv->edits = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      g_free);
   self->priv->allow_scrolling = TRUE;
   self->priv->smiley_manager = empathy_smiley_manager_dup_singleton ();
 
@@ -1763,7 +2718,7 @@ empathy_theme_adium_set_variant (EmpathyThemeAdium *self,
   script = g_strdup_printf ("setStylesheet(\"mainStyle\",\"%s\");",
       variant_path);
 
-  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (self), script, NULL, NULL, NULL);
+  theme_adium_run_script (self, script);
 
   g_free (variant_path);
   g_free (script);
@@ -2060,6 +3015,24 @@ empathy_adium_data_new_with_info (const gchar *path,
 
 #undef FALLBACK
 
+  data->templates = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) adium_template_free);
+
+#define COMPILE(html, tmpl) \
+  tmpl = adium_data_compile_template (data, html)
+
+  COMPILE (data->in_content_html,      data->in_content);
+  COMPILE (data->in_nextcontent_html,  data->in_nextcontent);
+  COMPILE (data->in_context_html,      data->in_context);
+  COMPILE (data->in_nextcontext_html,  data->in_nextcontext);
+  COMPILE (data->out_content_html,     data->out_content);
+  COMPILE (data->out_nextcontent_html, data->out_nextcontent);
+  COMPILE (data->out_context_html,     data->out_context);
+  COMPILE (data->out_nextcontext_html, data->out_nextcontext);
+  COMPILE (data->status_html,          data->status);
+
+#undef COMPILE
+
   /* template -> empathy's template */
   data->custom_template = (template_html != NULL);
   if (template_html == NULL)
@@ -2164,6 +3137,7 @@ empathy_adium_data_unref (EmpathyAdiumData *data)
     g_free (data->default_outgoing_avatar_filename);
     g_hash_table_unref (data->info);
     g_ptr_array_unref (data->strings_to_free);
+    tp_clear_pointer (&data->templates, g_hash_table_unref);
     tp_clear_pointer (&data->date_format_cache, g_hash_table_unref);
 
     g_slice_free (EmpathyAdiumData, data);
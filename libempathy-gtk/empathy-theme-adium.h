@@ -91,6 +91,21 @@ void empathy_theme_adium_prepend_message (EmpathyThemeAdium *self,
     EmpathyMessage *msg,
     gboolean should_highlight);
 
+void empathy_theme_adium_reset (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_recycle (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_start_timing (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_freeze_document (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_thaw_document (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_begin_backlog_page (EmpathyThemeAdium *self);
+
+void empathy_theme_adium_end_backlog_page (EmpathyThemeAdium *self,
+    gboolean complete);
+
 void empathy_theme_adium_edit_message (EmpathyThemeAdium *self,
     EmpathyMessage *message);
 
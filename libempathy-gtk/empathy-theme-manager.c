@@ -23,11 +23,21 @@
 #include "config.h"
 #include "empathy-theme-manager.h"
 
+#include <string.h>
+
 #include "empathy-gsettings.h"
 
 #define DEBUG_FLAG EMPATHY_DEBUG_OTHER
 #include "empathy-debug.h"
 
+/* Number of views kept loaded with the current theme, so opening a chat
+ * doesn't have to wait for WebKit */
+#define VIEW_POOL_SIZE 2
+/* Below this much available memory (in kB) the pool is kept smaller, and
+ * not kept at all below the second threshold */
+#define VIEW_POOL_LOW_MEMORY (1024 * 1024)
+#define VIEW_POOL_CRITICAL_MEMORY (256 * 1024)
+
 struct _EmpathyThemeManagerPriv
 {
   GSettings   *gsettings_chat;
@@ -38,6 +48,13 @@ struct _EmpathyThemeManagerPriv
   gchar *adium_variant;
   /* list of weakref to EmpathyThemeAdium objects */
   GList *adium_views;
+
+  /* owned EmpathyThemeAdium, not in use and loaded with adium_data */
+  GQueue pool;
+  guint fill_pool_id;
+  /* Number of views the pool should have, computed when it's invalidated,
+   * which includes when the theme is first loaded */
+  guint pool_size;
 };
 
 enum
@@ -118,6 +135,102 @@ theme_manager_create_adium_view (EmpathyThemeManager *self)
   return theme;
 }
 
+static guint
+theme_manager_get_pool_size (void)
+{
+  gchar *contents;
+  const gchar *line;
+  guint64 available;
+
+  /* GLib doesn't tell us about memory pressure, so check how much memory
+   * the kernel thinks is available */
+  if (!g_file_get_contents ("/proc/meminfo", &contents, NULL, NULL))
+    return VIEW_POOL_SIZE;
+
+  line = strstr (contents, "MemAvailable:");
+  if (line == NULL)
+    {
+      g_free (contents);
+      return VIEW_POOL_SIZE;
+    }
+
+  available = g_ascii_strtoull (line + strlen ("MemAvailable:"), NULL, 10);
+  g_free (contents);
+
+  if (available < VIEW_POOL_CRITICAL_MEMORY)
+    return 0;
+  else if (available < VIEW_POOL_LOW_MEMORY)
+    return 1;
+
+  return VIEW_POOL_SIZE;
+}
+
+static void
+theme_manager_destroy_view (EmpathyThemeAdium *view)
+{
+  gtk_widget_destroy (GTK_WIDGET (view));
+  g_object_unref (view);
+}
+
+static void
+theme_manager_trim_pool (EmpathyThemeManager *self,
+    guint size)
+{
+  while (g_queue_get_length (&self->priv->pool) > size)
+    theme_manager_destroy_view (g_queue_pop_tail (&self->priv->pool));
+}
+
+static gboolean
+theme_manager_fill_pool_cb (gpointer user_data)
+{
+  EmpathyThemeManager *self = user_data;
+  guint size = self->priv->pool_size;
+
+  theme_manager_trim_pool (self, size);
+
+  if (g_queue_get_length (&self->priv->pool) >= size ||
+      self->priv->adium_data == NULL)
+    {
+      self->priv->fill_pool_id = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  /* One view at a time, so we don't hold the main loop for too long */
+  g_queue_push_tail (&self->priv->pool,
+      g_object_ref_sink (theme_manager_create_adium_view (self)));
+
+  DEBUG ("Added a view to the pool, now %u of %u",
+      g_queue_get_length (&self->priv->pool), size);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+theme_manager_fill_pool (EmpathyThemeManager *self)
+{
+  if (self->priv->fill_pool_id != 0)
+    return;
+
+  self->priv->fill_pool_id = g_idle_add_full (G_PRIORITY_LOW,
+      theme_manager_fill_pool_cb, self, NULL);
+}
+
+static void
+theme_manager_invalidate_pool (EmpathyThemeManager *self)
+{
+  /* Good time to check memory again, as the pool is loaded from scratch */
+  self->priv->pool_size = theme_manager_get_pool_size ();
+
+  if (g_queue_is_empty (&self->priv->pool))
+    return;
+
+  DEBUG ("Theme changed, dropping the %u views of the pool",
+      g_queue_get_length (&self->priv->pool));
+
+  theme_manager_trim_pool (self, 0);
+  theme_manager_fill_pool (self);
+}
+
 static void
 theme_manager_notify_theme_cb (GSettings *gsettings_chat,
     const gchar *key,
@@ -145,6 +258,7 @@ theme_manager_notify_theme_cb (GSettings *gsettings_chat,
   tp_clear_pointer (&self->priv->adium_data, empathy_adium_data_unref);
   self->priv->adium_data = empathy_adium_data_new (path);
 
+  theme_manager_invalidate_pool (self);
   theme_manager_emit_changed (self);
 
   g_free (path);
@@ -175,6 +289,8 @@ theme_manager_notify_adium_variant_cb (GSettings *gsettings_chat,
       empathy_theme_adium_set_variant (EMPATHY_THEME_ADIUM (l->data),
         self->priv->adium_variant);
     }
+
+  theme_manager_invalidate_pool (self);
 }
 
 EmpathyThemeAdium *
@@ -188,6 +304,73 @@ empathy_theme_manager_create_view (EmpathyThemeManager *self)
   g_return_val_if_reached (NULL);
 }
 
+/* Start loading views in idle time, so the next chats open faster */
+void
+empathy_theme_manager_prewarm (EmpathyThemeManager *self)
+{
+  g_return_if_fail (EMPATHY_IS_THEME_MANAGER (self));
+
+  theme_manager_fill_pool (self);
+}
+
+/* Like empathy_theme_manager_create_view(), but the view may come from the
+ * pool and already be loaded. Returns a new reference rather than a
+ * floating one; give the view back with
+ * empathy_theme_manager_release_view() once done with it. */
+EmpathyThemeAdium *
+empathy_theme_manager_dup_view (EmpathyThemeManager *self)
+{
+  EmpathyThemeAdium *view;
+
+  g_return_val_if_fail (EMPATHY_IS_THEME_MANAGER (self), NULL);
+  g_return_val_if_fail (self->priv->adium_data != NULL, NULL);
+
+  view = g_queue_pop_head (&self->priv->pool);
+  if (view == NULL)
+    view = g_object_ref_sink (theme_manager_create_adium_view (self));
+  else
+    DEBUG ("Using a view from the pool");
+
+  empathy_theme_adium_start_timing (view);
+
+  theme_manager_fill_pool (self);
+
+  return view;
+}
+
+/* Takes the reference returned by empathy_theme_manager_dup_view(). The view
+ * must not be in a container anymore. */
+void
+empathy_theme_manager_release_view (EmpathyThemeManager *self,
+    EmpathyThemeAdium *view)
+{
+  EmpathyAdiumData *data;
+
+  g_return_if_fail (EMPATHY_IS_THEME_MANAGER (self));
+  g_return_if_fail (EMPATHY_IS_THEME_ADIUM (view));
+  g_return_if_fail (gtk_widget_get_parent (GTK_WIDGET (view)) == NULL);
+
+  g_object_get (view, "adium-data", &data, NULL);
+
+  /* Views of an old theme can't be used anymore; the variant of the others
+   * has been changed live with the setting */
+  if (data != self->priv->adium_data ||
+      g_queue_get_length (&self->priv->pool) >= self->priv->pool_size)
+    {
+      theme_manager_destroy_view (view);
+    }
+  else
+    {
+      empathy_theme_adium_recycle (view);
+      g_queue_push_tail (&self->priv->pool, view);
+
+      DEBUG ("View put back in the pool, now %u",
+          g_queue_get_length (&self->priv->pool));
+    }
+
+  tp_clear_pointer (&data, empathy_adium_data_unref);
+}
+
 static void
 theme_manager_finalize (GObject *object)
 {
@@ -198,6 +381,10 @@ theme_manager_finalize (GObject *object)
   if (self->priv->emit_changed_idle != 0)
     g_source_remove (self->priv->emit_changed_idle);
 
+  if (self->priv->fill_pool_id != 0)
+    g_source_remove (self->priv->fill_pool_id);
+
+  theme_manager_trim_pool (self, 0);
   clear_list_of_views (&self->priv->adium_views);
   g_free (self->priv->adium_variant);
   tp_clear_pointer (&self->priv->adium_data, empathy_adium_data_unref);
@@ -231,6 +418,7 @@ empathy_theme_manager_init (EmpathyThemeManager *self)
     EMPATHY_TYPE_THEME_MANAGER, EmpathyThemeManagerPriv);
 
   self->priv->in_constructor = TRUE;
+  g_queue_init (&self->priv->pool);
 
   self->priv->gsettings_chat = g_settings_new (EMPATHY_PREFS_CHAT_SCHEMA);
 
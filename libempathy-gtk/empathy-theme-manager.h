@@ -69,6 +69,10 @@ GType empathy_theme_manager_get_type (void) G_GNUC_CONST;
 EmpathyThemeManager * empathy_theme_manager_dup_singleton (void);
 GList * empathy_theme_manager_get_adium_themes (void);
 EmpathyThemeAdium * empathy_theme_manager_create_view (EmpathyThemeManager *self);
+void empathy_theme_manager_prewarm (EmpathyThemeManager *self);
+EmpathyThemeAdium * empathy_theme_manager_dup_view (EmpathyThemeManager *self);
+void empathy_theme_manager_release_view (EmpathyThemeManager *self,
+    EmpathyThemeAdium *view);
 gchar * empathy_theme_manager_find_theme (const gchar *name);
 
 gchar * empathy_theme_manager_dup_theme_name_from_path (const gchar *path);
@@ -319,6 +319,246 @@ avatar_pixbuf_from_loader (GdkPixbufLoader *loader)
   return pixbuf_round_corners (pixbuf);
 }
 
+/* Decoded avatars are shared by every widget showing them: roster rows,
+ * notifications, chat tabs, the call window... Entries are keyed by the
+ * avatar token, the requested size and whether corners are rounded, and
+ * the least recently used ones are dropped once the cache holds more than
+ * max_size bytes of pixels. */
+#define AVATAR_CACHE_DEFAULT_MAX_SIZE (4 * 1024 * 1024)
+#define AVATAR_CACHE_CONTACT_TOKEN "empathy-avatar-cache-token"
+
+typedef struct
+{
+  gchar *key;
+  gchar *token;
+  GdkPixbuf *pixbuf;
+  gsize size;
+  GList *link;
+} AvatarCacheEntry;
+
+typedef struct
+{
+  /* gchar *key -> owned AvatarCacheEntry */
+  GHashTable *entries;
+  /* borrowed AvatarCacheEntry, most recently used first */
+  GQueue lru;
+  gsize size;
+  gsize max_size;
+  guint64 hits;
+  guint64 misses;
+} AvatarCache;
+
+static void
+avatar_cache_entry_free (AvatarCacheEntry *entry)
+{
+  g_free (entry->key);
+  g_free (entry->token);
+  g_object_unref (entry->pixbuf);
+  g_slice_free (AvatarCacheEntry, entry);
+}
+
+static AvatarCache *
+avatar_cache_get (void)
+{
+  static AvatarCache *cache = NULL;
+
+  if (cache == NULL)
+    {
+      cache = g_slice_new0 (AvatarCache);
+      cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+          NULL, (GDestroyNotify) avatar_cache_entry_free);
+      g_queue_init (&cache->lru);
+      cache->max_size = AVATAR_CACHE_DEFAULT_MAX_SIZE;
+    }
+
+  return cache;
+}
+
+static gchar *
+avatar_cache_key (const gchar *token,
+    gint width,
+    gint height,
+    gboolean rounded)
+{
+  return g_strdup_printf ("%s|%dx%d|%d", token, width, height, rounded);
+}
+
+static void
+avatar_cache_remove (AvatarCache *cache,
+    AvatarCacheEntry *entry)
+{
+  g_queue_delete_link (&cache->lru, entry->link);
+  cache->size -= entry->size;
+  g_hash_table_remove (cache->entries, entry->key);
+}
+
+static void
+avatar_cache_trim (AvatarCache *cache,
+    gsize max_size)
+{
+  while (cache->size > max_size)
+    avatar_cache_remove (cache, g_queue_peek_tail (&cache->lru));
+}
+
+/* Return a new ref on the cached pixbuf, or NULL */
+static GdkPixbuf *
+avatar_cache_lookup (const gchar *token,
+    gint width,
+    gint height,
+    gboolean rounded)
+{
+  AvatarCache *cache = avatar_cache_get ();
+  AvatarCacheEntry *entry;
+  gchar *key;
+
+  key = avatar_cache_key (token, width, height, rounded);
+  entry = g_hash_table_lookup (cache->entries, key);
+  g_free (key);
+
+  if (entry == NULL)
+    {
+      cache->misses++;
+      return NULL;
+    }
+
+  cache->hits++;
+
+  g_queue_unlink (&cache->lru, entry->link);
+  g_queue_push_head_link (&cache->lru, entry->link);
+
+  return g_object_ref (entry->pixbuf);
+}
+
+static void
+avatar_cache_insert (const gchar *token,
+    gint width,
+    gint height,
+    gboolean rounded,
+    GdkPixbuf *pixbuf)
+{
+  AvatarCache *cache = avatar_cache_get ();
+  AvatarCacheEntry *entry;
+  gsize size;
+
+  size = gdk_pixbuf_get_byte_length (pixbuf);
+  if (size > cache->max_size)
+    return;
+
+  entry = g_slice_new0 (AvatarCacheEntry);
+  entry->key = avatar_cache_key (token, width, height, rounded);
+  entry->token = g_strdup (token);
+  entry->pixbuf = g_object_ref (pixbuf);
+  entry->size = size;
+
+  /* Two callers may have decoded the same avatar concurrently */
+  if (g_hash_table_contains (cache->entries, entry->key))
+    {
+      avatar_cache_entry_free (entry);
+      return;
+    }
+
+  avatar_cache_trim (cache, cache->max_size - size);
+
+  g_queue_push_head (&cache->lru, entry);
+  entry->link = g_queue_peek_head_link (&cache->lru);
+  g_hash_table_insert (cache->entries, entry->key, entry);
+  cache->size += size;
+
+  DEBUG ("Avatar cache: %u entries, %" G_GSIZE_FORMAT " bytes, "
+      "%" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses",
+      g_hash_table_size (cache->entries), cache->size,
+      cache->hits, cache->misses);
+}
+
+static void
+avatar_cache_remove_token (const gchar *token)
+{
+  AvatarCache *cache = avatar_cache_get ();
+  GList *l = cache->lru.head;
+
+  while (l != NULL)
+    {
+      AvatarCacheEntry *entry = l->data;
+
+      l = l->next;
+
+      if (!tp_strdiff (entry->token, token))
+        avatar_cache_remove (cache, entry);
+    }
+}
+
+static const gchar *
+avatar_cache_token (EmpathyAvatar *avatar)
+{
+  if (avatar == NULL)
+    return NULL;
+
+  if (!TPAW_STR_EMPTY (avatar->token))
+    return avatar->token;
+
+  return avatar->filename;
+}
+
+static void
+avatar_cache_contact_avatar_changed_cb (EmpathyContact *contact,
+    GParamSpec *pspec,
+    gpointer user_data)
+{
+  const gchar *old_token;
+  const gchar *token;
+
+  old_token = g_object_get_data (G_OBJECT (contact),
+      AVATAR_CACHE_CONTACT_TOKEN);
+  token = avatar_cache_token (empathy_contact_get_avatar (contact));
+
+  if (!tp_strdiff (old_token, token))
+    return;
+
+  if (!TPAW_STR_EMPTY (old_token))
+    {
+      DEBUG ("Avatar token of %s changed, dropping cached pixbufs",
+          empathy_contact_get_id (contact));
+      avatar_cache_remove_token (old_token);
+    }
+
+  g_object_set_data_full (G_OBJECT (contact), AVATAR_CACHE_CONTACT_TOKEN,
+      g_strdup (token != NULL ? token : ""), g_free);
+}
+
+static void
+avatar_cache_watch_contact (EmpathyContact *contact)
+{
+  const gchar *token;
+
+  /* Contacts without avatar are tagged with "" */
+  if (g_object_get_data (G_OBJECT (contact),
+        AVATAR_CACHE_CONTACT_TOKEN) != NULL)
+    return;
+
+  token = avatar_cache_token (empathy_contact_get_avatar (contact));
+  g_object_set_data_full (G_OBJECT (contact), AVATAR_CACHE_CONTACT_TOKEN,
+      g_strdup (token != NULL ? token : ""), g_free);
+
+  g_signal_connect (contact, "notify::avatar",
+      G_CALLBACK (avatar_cache_contact_avatar_changed_cb), NULL);
+}
+
+/**
+ * empathy_pixbuf_avatar_cache_set_max_size:
+ * @max_size: the maximum number of bytes of decoded pixels to keep
+ *
+ * Sets how much memory the shared avatar cache may use. Setting it to 0
+ * empties the cache and disables it.
+ */
+void
+empathy_pixbuf_avatar_cache_set_max_size (gsize max_size)
+{
+  AvatarCache *cache = avatar_cache_get ();
+
+  cache->max_size = max_size;
+  avatar_cache_trim (cache, max_size);
+}
+
 static GdkPixbuf *
 empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
     gint width,
@@ -328,10 +568,19 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
   GdkPixbufLoader *loader;
   struct SizeData data;
   GError *error = NULL;
+  const gchar *token;
 
   if (!avatar)
     return NULL;
 
+  token = avatar_cache_token (avatar);
+  if (token != NULL)
+    {
+      pixbuf = avatar_cache_lookup (token, width, height, TRUE);
+      if (pixbuf != NULL)
+        return pixbuf;
+    }
+
   data.width = width;
   data.height = height;
   data.preserve_aspect_ratio = TRUE;
@@ -361,6 +610,9 @@ empathy_pixbuf_from_avatar_scaled (EmpathyAvatar *avatar,
 
   g_object_unref (loader);
 
+  if (pixbuf != NULL && token != NULL)
+    avatar_cache_insert (token, width, height, TRUE, pixbuf);
+
   return pixbuf;
 }
 
@@ -373,6 +625,7 @@ empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
 
   g_return_val_if_fail (EMPATHY_IS_CONTACT (contact), NULL);
 
+  avatar_cache_watch_contact (contact);
   avatar = empathy_contact_get_avatar (contact);
 
   return empathy_pixbuf_from_avatar_scaled (avatar, width, height);
@@ -384,6 +637,7 @@ typedef struct
   guint width;
   guint height;
   GCancellable *cancellable;
+  gchar *token;
 } PixbufAvatarFromIndividualClosure;
 
 static PixbufAvatarFromIndividualClosure *
@@ -414,6 +668,7 @@ pixbuf_avatar_from_individual_closure_free (
     PixbufAvatarFromIndividualClosure *closure)
 {
   g_clear_object (&closure->cancellable);
+  g_free (closure->token);
   g_object_unref (closure->result);
   g_slice_free (PixbufAvatarFromIndividualClosure, closure);
 }
@@ -468,6 +723,10 @@ avatar_icon_load_cb (GObject *object,
 
   final_pixbuf = transform_pixbuf (pixbuf);
 
+  if (closure->token != NULL)
+    avatar_cache_insert (closure->token, closure->width, closure->height,
+        TRUE, final_pixbuf);
+
   /* Pass ownership of final_pixbuf to the result */
   g_simple_async_result_set_op_res_gpointer (closure->result,
       final_pixbuf, g_object_unref);
@@ -491,6 +750,8 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
   GLoadableIcon *avatar_icon;
   GSimpleAsyncResult *result;
   PixbufAvatarFromIndividualClosure *closure;
+  gchar *token = NULL;
+  GdkPixbuf *pixbuf;
 
   result = g_simple_async_result_new (G_OBJECT (individual),
       callback, user_data, empathy_pixbuf_avatar_from_individual_scaled_async);
@@ -508,11 +769,30 @@ empathy_pixbuf_avatar_from_individual_scaled_async (
       return;
     }
 
+  /* Folks stores avatars in files named after their token */
+  if (G_IS_FILE_ICON (avatar_icon))
+    token = g_file_get_uri (g_file_icon_get_file (G_FILE_ICON (avatar_icon)));
+
+  pixbuf = token != NULL ?
+    avatar_cache_lookup (token, width, height, TRUE) : NULL;
+
+  if (pixbuf != NULL)
+    {
+      g_simple_async_result_set_op_res_gpointer (result, pixbuf,
+          g_object_unref);
+      g_simple_async_result_complete_in_idle (result);
+      g_object_unref (result);
+      g_free (token);
+      return;
+    }
+
   closure = pixbuf_avatar_from_individual_closure_new (individual, result,
       width, height, cancellable);
 
   g_return_if_fail (closure != NULL);
 
+  closure->token = token;
+
   g_loadable_icon_load_async (avatar_icon, width, cancellable,
       avatar_icon_load_cb, closure);
 
@@ -72,6 +72,7 @@ GdkPixbuf * empathy_pixbuf_avatar_from_individual_scaled_finish (
 GdkPixbuf * empathy_pixbuf_avatar_from_contact_scaled (EmpathyContact *contact,
     gint width,
     gint height);
+void empathy_pixbuf_avatar_cache_set_max_size (gsize max_size);
 GdkPixbuf * empathy_pixbuf_contact_status_icon (EmpathyContact *contact,
     gboolean show_protocol);
 GdkPixbuf * empathy_pixbuf_contact_status_icon_with_icon_name (
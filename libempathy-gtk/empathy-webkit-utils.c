@@ -22,6 +22,7 @@
 #include "empathy-webkit-utils.h"
 
 #include <glib/gi18n-lib.h>
+#include <string.h>
 
 #include "empathy-smiley-manager.h"
 #include "empathy-string-parser.h"
@@ -99,6 +100,235 @@ empathy_webkit_get_string_parser (gboolean smileys)
     return string_parsers;
 }
 
+/* Byte classes of the single pass body tokenizer */
+enum {
+  BODY_PLAIN = 0,
+  BODY_ESCAPE, /* & < > " ' */
+  BODY_NEWLINE,
+  BODY_CR,
+  BODY_CONTROL,
+  BODY_C2, /* may start a C1 control character */
+  BODY_NUL
+};
+
+static const guint8 *
+webkit_get_body_classes (void)
+{
+  static guint8 classes[256];
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint c;
+
+      for (c = 0x01; c < 0x20; c++)
+        classes[c] = BODY_CONTROL;
+
+      classes['\0'] = BODY_NUL;
+      classes['\t'] = BODY_PLAIN;
+      classes['\n'] = BODY_NEWLINE;
+      classes['\r'] = BODY_CR;
+      classes[0x7f] = BODY_CONTROL;
+      classes['&'] = BODY_ESCAPE;
+      classes['<'] = BODY_ESCAPE;
+      classes['>'] = BODY_ESCAPE;
+      classes['"'] = BODY_ESCAPE;
+      classes['\''] = BODY_ESCAPE;
+      classes[0xc2] = BODY_C2;
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return classes;
+}
+
+/* Same output as the newline + tpaw_string_replace_escaped parsers, with
+ * smileys replaced like empathy_webkit_replace_smiley() */
+static void
+webkit_append_body_segment (GString *string,
+    const gchar *text,
+    gsize len,
+    EmpathySmileyManager *smiley_manager,
+    const gboolean *smiley_start)
+{
+  const guint8 *classes = webkit_get_body_classes ();
+  const guchar *str = (const guchar *) text;
+  gsize plain = 0;
+  gsize i = 0;
+
+  while (i < len)
+    {
+      guchar c = str[i];
+      guint8 class = classes[c];
+      EmpathySmileyHit hit;
+
+      if (smiley_start != NULL && smiley_start[c] &&
+          empathy_smiley_manager_match (smiley_manager, text + i, len - i,
+            &hit))
+        {
+          g_string_append_len (string, text + plain, i - plain);
+          empathy_webkit_replace_smiley (text + i, hit.end, &hit, string);
+          i += hit.end;
+          plain = i;
+          continue;
+        }
+
+      if (class == BODY_PLAIN ||
+          (class == BODY_C2 && (i + 1 >= len || str[i + 1] < 0x80 ||
+            str[i + 1] > 0x9f || str[i + 1] == 0x85)))
+        {
+          i++;
+          continue;
+        }
+
+      g_string_append_len (string, text + plain, i - plain);
+
+      switch (class)
+        {
+          case BODY_ESCAPE:
+            if (c == '&')
+              g_string_append (string, "&amp;");
+            else if (c == '<')
+              g_string_append (string, "&lt;");
+            else if (c == '>')
+              g_string_append (string, "&gt;");
+            else if (c == '"')
+              g_string_append (string, "&quot;");
+            else
+              g_string_append (string, "&apos;");
+            break;
+          case BODY_NEWLINE:
+            g_string_append (string, "<br/>");
+            break;
+          case BODY_CR:
+            break;
+          case BODY_CONTROL:
+            g_string_append_printf (string, "&#x%x;", c);
+            break;
+          case BODY_C2:
+            g_string_append_printf (string, "&#x%x;", str[i + 1]);
+            i++;
+            break;
+          case BODY_NUL:
+          default:
+            return;
+        }
+
+      i++;
+      plain = i;
+    }
+
+  g_string_append_len (string, text + plain, i - plain);
+}
+
+/* Cheap test ruling out most messages before running the link regex */
+static gboolean
+webkit_body_may_contain_link (const gchar *text,
+    gsize len)
+{
+  gsize i;
+
+  if (memchr (text, '@', len) != NULL)
+    return TRUE;
+
+  for (i = 0; i < len; i++)
+    {
+      if (text[i] == ':' && i + 2 < len &&
+          text[i + 1] == '/' && text[i + 2] == '/')
+        return TRUE;
+
+      /* "www." and "ftp." */
+      if (text[i] == '.' && i >= 3 &&
+          (!g_ascii_strncasecmp (text + i - 3, "www", 3) ||
+           !g_ascii_strncasecmp (text + i - 3, "ftp", 3)))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+typedef struct {
+  const gchar *text;
+  GArray *spans;
+} LinkSpans;
+
+static void
+webkit_record_link (const gchar *text,
+    gssize len,
+    gpointer match_data,
+    gpointer user_data)
+{
+  LinkSpans *links = user_data;
+  gsize span[2];
+
+  span[0] = text - links->text;
+  span[1] = span[0] + len;
+  g_array_append_vals (links->spans, span, 2);
+}
+
+/**
+ * empathy_webkit_append_body:
+ * @string: the #GString to append to
+ * @text: the message body
+ * @len: length of @text in bytes, or -1 if it is nul-terminated
+ * @smileys: whether smileys should be replaced by images
+ *
+ * Appends @text to @string as HTML, producing the same output as running
+ * the parsers returned by empathy_webkit_get_string_parser() but in a
+ * single pass over the body.
+ */
+void
+empathy_webkit_append_body (GString *string,
+    const gchar *text,
+    gssize len,
+    gboolean smileys)
+{
+  static TpawStringParser no_parsers[] = { { NULL, NULL } };
+  EmpathySmileyManager *smiley_manager = NULL;
+  const gboolean *smiley_start = NULL;
+  LinkSpans links = { text, NULL };
+  gsize last = 0;
+  guint i;
+
+  g_return_if_fail (string != NULL);
+  g_return_if_fail (text != NULL);
+
+  if (len < 0)
+    len = strlen (text);
+
+  if (smileys)
+    {
+      smiley_manager = empathy_smiley_manager_dup_singleton ();
+      smiley_start = empathy_smiley_manager_get_start_bytes (smiley_manager);
+    }
+
+  if (webkit_body_may_contain_link (text, len))
+    {
+      links.spans = g_array_new (FALSE, FALSE, sizeof (gsize));
+      tpaw_string_match_link (text, len, webkit_record_link, no_parsers,
+          &links);
+
+      for (i = 0; i < links.spans->len; i += 2)
+        {
+          gsize start = g_array_index (links.spans, gsize, i);
+          gsize end = g_array_index (links.spans, gsize, i + 1);
+
+          webkit_append_body_segment (string, text + last, start - last,
+              smiley_manager, smiley_start);
+          tpaw_string_replace_link (text + start, end - start, NULL, string);
+          last = end;
+        }
+
+      g_array_unref (links.spans);
+    }
+
+  webkit_append_body_segment (string, text + last, len - last,
+      smiley_manager, smiley_start);
+
+  if (smiley_manager != NULL)
+    g_object_unref (smiley_manager);
+}
+
 static gboolean
 webkit_get_font_family (GValue *value,
     GVariant *variant,
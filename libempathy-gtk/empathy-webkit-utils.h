@@ -33,6 +33,11 @@ typedef enum {
 
 TpawStringParser * empathy_webkit_get_string_parser (gboolean smileys);
 
+void empathy_webkit_append_body (GString *string,
+    const gchar *text,
+    gssize len,
+    gboolean smileys);
+
 void empathy_webkit_bind_font_setting (WebKitWebView *webview,
     GSettings *gsettings,
     const char *key);
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-chat-snapshot.h"
+
+#include <glib/gstdio.h>
+#include <telepathy-logger/telepathy-logger.h>
+
+#define DEBUG_FLAG EMPATHY_DEBUG_CHAT
+#include "empathy-debug.h"
+
+/* Snapshot of the last messages of a conversation, so a chat can show them
+ * as soon as it's opened rather than waiting for the logger.
+ *
+ * Each (account, contact) pair has its own file in the user cache
+ * directory, in a directory per account so they can be deleted with the
+ * logs of the account. The file holds a serialized GVariant with the timestamp of the last
+ * message and the messages themselves, the oldest first. A snapshot is
+ * only a hint: the chat checks it against the logs once they are there. */
+
+#define SNAPSHOT_VERSION 1
+/* version, last timestamp, messages; each message is its type, timestamp,
+ * original timestamp, token, supersedes token, body, sender and receiver;
+ * each contact is its id, TplEntityType, alias and avatar token */
+#define SNAPSHOT_TYPE "(uxa(uxxsss(suss)(suss)))"
+#define SNAPSHOT_MESSAGE_TYPE "(uxxsss(suss)(suss))"
+
+/* Number of messages kept */
+#define SNAPSHOT_MAX_MESSAGES 50
+
+struct _EmpathyChatSnapshot
+{
+  TpAccount *account;
+  gchar *filename;
+  /* owned GVariant * of type SNAPSHOT_MESSAGE_TYPE, the oldest first */
+  GQueue messages;
+  gint64 last_timestamp;
+  gboolean dirty;
+  /* TRUE if the file was there when we last looked at it */
+  gboolean on_disk;
+};
+
+static gchar *
+chat_snapshot_dup_dirname (TpAccount *account)
+{
+  gchar *checksum, *dirname;
+
+  if (account == NULL)
+    return g_build_filename (g_get_user_cache_dir (), "empathy",
+        "chat-snapshots", NULL);
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1,
+      tp_proxy_get_object_path (account), -1);
+  dirname = g_build_filename (g_get_user_cache_dir (), "empathy",
+      "chat-snapshots", checksum, NULL);
+  g_free (checksum);
+
+  return dirname;
+}
+
+static void
+chat_snapshot_load (EmpathyChatSnapshot *self)
+{
+  GMappedFile *mapped;
+  GVariant *snapshot, *messages, *message;
+  GVariantIter iter;
+  GBytes *bytes;
+  guint32 version;
+
+  mapped = g_mapped_file_new (self->filename, FALSE, NULL);
+  if (mapped == NULL)
+    return;
+
+  self->on_disk = TRUE;
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+
+  /* Not trusted: a corrupted file gives an empty snapshot */
+  snapshot = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (SNAPSHOT_TYPE), bytes, FALSE));
+  g_bytes_unref (bytes);
+
+  g_variant_get_child (snapshot, 0, "u", &version);
+  if (version != SNAPSHOT_VERSION)
+    {
+      DEBUG ("Ignoring snapshot version %u", version);
+      g_variant_unref (snapshot);
+      return;
+    }
+
+  g_variant_get_child (snapshot, 1, "x", &self->last_timestamp);
+
+  /* The messages keep the file mapped; it's replaced rather than
+   * rewritten by empathy_chat_snapshot_save() */
+  messages = g_variant_get_child_value (snapshot, 2);
+  g_variant_iter_init (&iter, messages);
+  while ((message = g_variant_iter_next_value (&iter)) != NULL)
+    g_queue_push_tail (&self->messages, message);
+
+  g_variant_unref (messages);
+  g_variant_unref (snapshot);
+}
+
+EmpathyChatSnapshot *
+empathy_chat_snapshot_new (TpAccount *account,
+    const gchar *id)
+{
+  EmpathyChatSnapshot *self;
+  gchar *dirname;
+  gchar *checksum;
+
+  g_return_val_if_fail (TP_IS_ACCOUNT (account), NULL);
+  g_return_val_if_fail (id != NULL, NULL);
+
+  self = g_slice_new0 (EmpathyChatSnapshot);
+  self->account = g_object_ref (account);
+  g_queue_init (&self->messages);
+
+  dirname = chat_snapshot_dup_dirname (account);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, id, -1);
+  self->filename = g_build_filename (dirname, checksum, NULL);
+  g_free (checksum);
+  g_free (dirname);
+
+  chat_snapshot_load (self);
+
+  return self;
+}
+
+void
+empathy_chat_snapshot_free (EmpathyChatSnapshot *self)
+{
+  if (self == NULL)
+    return;
+
+  g_object_unref (self->account);
+  g_free (self->filename);
+  g_queue_foreach (&self->messages, (GFunc) g_variant_unref, NULL);
+  g_queue_clear (&self->messages);
+  g_slice_free (EmpathyChatSnapshot, self);
+}
+
+guint
+empathy_chat_snapshot_get_n_messages (EmpathyChatSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return g_queue_get_length (&self->messages);
+}
+
+/* Timestamp of the last message, as it is logged; 0 if there isn't any */
+gint64
+empathy_chat_snapshot_get_last_timestamp (EmpathyChatSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->last_timestamp;
+}
+
+static EmpathyContact *
+chat_snapshot_dup_contact (EmpathyChatSnapshot *self,
+    EmpathyContactMemo *memo,
+    GVariant *variant)
+{
+  EmpathyContact *contact;
+  TplEntity *entity;
+  const gchar *id, *alias, *avatar_token;
+  guint32 type;
+
+  g_variant_get (variant, "(&su&s&s)", &id, &type, &alias, &avatar_token);
+
+  if (tp_str_empty (id))
+    return NULL;
+
+  entity = tpl_entity_new (id, type, alias, avatar_token);
+  contact = empathy_contact_memo_from_tpl_contact (memo, self->account,
+      entity);
+  g_object_unref (entity);
+
+  return contact;
+}
+
+/* Returns a list of new EmpathyMessage, the oldest first, built like
+ * empathy_message_from_tpl_log_event_memo() does */
+GList *
+empathy_chat_snapshot_dup_messages (EmpathyChatSnapshot *self,
+    EmpathyContactMemo *memo)
+{
+  GList *messages = NULL;
+  GList *l;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (memo != NULL, NULL);
+
+  for (l = self->messages.tail; l != NULL; l = g_list_previous (l))
+    {
+      EmpathyMessage *message;
+      EmpathyContact *contact;
+      GVariant *sender, *receiver;
+      const gchar *token, *supersedes, *body;
+      guint32 type;
+      gint64 timestamp, original_timestamp;
+
+      g_variant_get (l->data, "(uxx&s&s&s@(suss)@(suss))", &type,
+          &timestamp, &original_timestamp, &token, &supersedes, &body,
+          &sender, &receiver);
+
+      message = g_object_new (EMPATHY_TYPE_MESSAGE,
+          "type", type,
+          "token", tp_str_empty (token) ? NULL : token,
+          "supersedes", tp_str_empty (supersedes) ? NULL : supersedes,
+          "body", body,
+          "is-backlog", TRUE,
+          "timestamp", timestamp,
+          "original-timestamp", original_timestamp,
+          NULL);
+
+      contact = chat_snapshot_dup_contact (self, memo, receiver);
+      if (contact != NULL)
+        {
+          empathy_message_set_receiver (message, contact);
+          g_object_unref (contact);
+        }
+
+      contact = chat_snapshot_dup_contact (self, memo, sender);
+      if (contact != NULL)
+        {
+          empathy_message_set_sender (message, contact);
+          g_object_unref (contact);
+        }
+
+      messages = g_list_prepend (messages, message);
+
+      g_variant_unref (sender);
+      g_variant_unref (receiver);
+    }
+
+  return messages;
+}
+
+void
+empathy_chat_snapshot_clear (EmpathyChatSnapshot *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_queue_foreach (&self->messages, (GFunc) g_variant_unref, NULL);
+  g_queue_clear (&self->messages);
+  self->last_timestamp = 0;
+  self->dirty = TRUE;
+}
+
+static GVariant *
+chat_snapshot_contact_to_variant (EmpathyContact *contact)
+{
+  EmpathyAvatar *avatar;
+
+  if (contact == NULL)
+    return g_variant_new ("(suss)", "", TPL_ENTITY_UNKNOWN, "", "");
+
+  avatar = empathy_contact_get_avatar (contact);
+
+  return g_variant_new ("(suss)",
+      empathy_contact_get_id (contact),
+      empathy_contact_is_user (contact) ? TPL_ENTITY_SELF : TPL_ENTITY_CONTACT,
+      tp_str_empty (empathy_contact_get_alias (contact)) ?
+        "" : empathy_contact_get_alias (contact),
+      avatar != NULL && avatar->token != NULL ? avatar->token : "");
+}
+
+/* Adds @message as the last one of the conversation, forgetting the oldest
+ * one if there are too many */
+void
+empathy_chat_snapshot_add_message (EmpathyChatSnapshot *self,
+    EmpathyMessage *message)
+{
+  GVariant *variant;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (EMPATHY_IS_MESSAGE (message));
+
+  variant = g_variant_new ("(uxxsss@(suss)@(suss))",
+      empathy_message_get_tptype (message),
+      empathy_message_get_timestamp (message),
+      empathy_message_get_original_timestamp (message),
+      tp_str_empty (empathy_message_get_token (message)) ?
+        "" : empathy_message_get_token (message),
+      tp_str_empty (empathy_message_get_supersedes (message)) ?
+        "" : empathy_message_get_supersedes (message),
+      tp_str_empty (empathy_message_get_body (message)) ?
+        "" : empathy_message_get_body (message),
+      chat_snapshot_contact_to_variant (
+        empathy_message_get_sender (message)),
+      chat_snapshot_contact_to_variant (
+        empathy_message_get_receiver (message)));
+
+  g_queue_push_tail (&self->messages, g_variant_ref_sink (variant));
+
+  if (g_queue_get_length (&self->messages) > SNAPSHOT_MAX_MESSAGES)
+    g_variant_unref (g_queue_pop_head (&self->messages));
+
+  self->last_timestamp = empathy_message_get_timestamp (message);
+  self->dirty = TRUE;
+}
+
+void
+empathy_chat_snapshot_save (EmpathyChatSnapshot *self)
+{
+  GVariantBuilder messages;
+  GVariant *snapshot;
+  GError *error = NULL;
+  gchar *dirname;
+  GList *l;
+
+  g_return_if_fail (self != NULL);
+
+  if (!self->dirty)
+    return;
+
+  /* The logs have been cleared meanwhile, so must be what we had */
+  if (self->on_disk && !g_file_test (self->filename, G_FILE_TEST_EXISTS))
+    {
+      DEBUG ("Snapshot has been deleted, not writing it again");
+      g_queue_foreach (&self->messages, (GFunc) g_variant_unref, NULL);
+      g_queue_clear (&self->messages);
+      self->last_timestamp = 0;
+      self->on_disk = FALSE;
+      self->dirty = FALSE;
+      return;
+    }
+
+  if (g_queue_is_empty (&self->messages))
+    {
+      g_unlink (self->filename);
+      self->on_disk = FALSE;
+      self->dirty = FALSE;
+      return;
+    }
+
+  g_variant_builder_init (&messages,
+      G_VARIANT_TYPE ("a" SNAPSHOT_MESSAGE_TYPE));
+
+  for (l = self->messages.head; l != NULL; l = g_list_next (l))
+    g_variant_builder_add_value (&messages, l->data);
+
+  snapshot = g_variant_ref_sink (g_variant_new ("(ux@a" SNAPSHOT_MESSAGE_TYPE
+        ")", SNAPSHOT_VERSION, self->last_timestamp,
+        g_variant_builder_end (&messages)));
+
+  dirname = g_path_get_dirname (self->filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (!g_file_set_contents (self->filename, g_variant_get_data (snapshot),
+        g_variant_get_size (snapshot), &error))
+    {
+      DEBUG ("Failed to write %s: %s", self->filename, error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      DEBUG ("Wrote snapshot of %u messages",
+          g_queue_get_length (&self->messages));
+      self->on_disk = TRUE;
+      self->dirty = FALSE;
+    }
+
+  g_variant_unref (snapshot);
+}
+
+static void
+chat_snapshot_delete_dir (const gchar *dirname)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      gchar *path = g_build_filename (dirname, name, NULL);
+
+      if (g_file_test (path, G_FILE_TEST_IS_DIR))
+        chat_snapshot_delete_dir (path);
+      else
+        g_unlink (path);
+
+      g_free (path);
+    }
+
+  g_dir_close (dir);
+  g_rmdir (dirname);
+}
+
+/* Deletes the snapshots of all the conversations of @account, or of all the
+ * accounts if it's %NULL; to be done when their logs are cleared */
+void
+empathy_chat_snapshot_delete (TpAccount *account)
+{
+  gchar *dirname;
+
+  g_return_if_fail (account == NULL || TP_IS_ACCOUNT (account));
+
+  dirname = chat_snapshot_dup_dirname (account);
+  DEBUG ("Deleting %s", dirname);
+  chat_snapshot_delete_dir (dirname);
+  g_free (dirname);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_CHAT_SNAPSHOT_H__
+#define __EMPATHY_CHAT_SNAPSHOT_H__
+
+#include <glib.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "empathy-contact.h"
+#include "empathy-message.h"
+
+G_BEGIN_DECLS
+
+/* The last messages of a conversation, kept on disk */
+typedef struct _EmpathyChatSnapshot EmpathyChatSnapshot;
+
+EmpathyChatSnapshot * empathy_chat_snapshot_new (TpAccount *account,
+    const gchar *id);
+void empathy_chat_snapshot_free (EmpathyChatSnapshot *self);
+
+guint empathy_chat_snapshot_get_n_messages (EmpathyChatSnapshot *self);
+gint64 empathy_chat_snapshot_get_last_timestamp (EmpathyChatSnapshot *self);
+GList * empathy_chat_snapshot_dup_messages (EmpathyChatSnapshot *self,
+    EmpathyContactMemo *memo);
+
+void empathy_chat_snapshot_clear (EmpathyChatSnapshot *self);
+void empathy_chat_snapshot_add_message (EmpathyChatSnapshot *self,
+    EmpathyMessage *message);
+void empathy_chat_snapshot_save (EmpathyChatSnapshot *self);
+
+void empathy_chat_snapshot_delete (TpAccount *account);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_CHAT_SNAPSHOT_H__ */
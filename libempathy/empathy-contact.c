@@ -58,6 +58,8 @@ typedef struct {
   GHashTable *location;
   GeeHashSet *groups;
   gchar **client_types;
+  /* Key of the contact in contacts_by_identity, if any */
+  gchar *identity;
 } EmpathyContactPriv;
 
 static void contact_finalize (GObject *object);
@@ -116,6 +118,64 @@ static guint signals[LAST_SIGNAL];
 /* TpContact* -> EmpathyContact*, both borrowed ref */
 static GHashTable *contacts_table = NULL;
 
+/* "account path\nidentifier" -> GList of the EmpathyContact from
+ * contacts_table having that identity, newest first, borrowed refs */
+static GHashTable *contacts_by_identity = NULL;
+
+static gchar *
+contact_identity_key (TpAccount *account,
+    const gchar *id)
+{
+  return g_strdup_printf ("%s\n%s", tp_proxy_get_object_path (account), id);
+}
+
+static void
+contacts_by_identity_remove (EmpathyContact *contact)
+{
+  EmpathyContactPriv *priv = GET_PRIV (contact);
+  GList *contacts;
+
+  if (priv->identity == NULL)
+    return;
+
+  contacts = g_hash_table_lookup (contacts_by_identity, priv->identity);
+  contacts = g_list_remove (contacts, contact);
+
+  if (contacts == NULL)
+    g_hash_table_remove (contacts_by_identity, priv->identity);
+  else
+    g_hash_table_insert (contacts_by_identity, g_strdup (priv->identity),
+        contacts);
+
+  g_free (priv->identity);
+  priv->identity = NULL;
+}
+
+static void
+contacts_by_identity_add (EmpathyContact *contact)
+{
+  EmpathyContactPriv *priv = GET_PRIV (contact);
+  TpAccount *account;
+  const gchar *id;
+  GList *contacts;
+
+  account = empathy_contact_get_account (contact);
+  id = empathy_contact_get_id (contact);
+
+  if (account == NULL || id == NULL)
+    return;
+
+  if (contacts_by_identity == NULL)
+    contacts_by_identity = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+
+  priv->identity = contact_identity_key (account, id);
+
+  contacts = g_hash_table_lookup (contacts_by_identity, priv->identity);
+  g_hash_table_insert (contacts_by_identity, g_strdup (priv->identity),
+      g_list_prepend (contacts, contact));
+}
+
 static void
 tp_contact_notify_cb (TpContact *tp_contact,
                       GParamSpec *param,
@@ -136,7 +196,15 @@ tp_contact_notify_cb (TpContact *tp_contact,
     g_object_notify (contact, "presence");
   }
   else if (!tp_strdiff (param->name, "identifier"))
-    g_object_notify (contact, "id");
+    {
+      if (priv->identity != NULL)
+        {
+          contacts_by_identity_remove (EMPATHY_CONTACT (contact));
+          contacts_by_identity_add (EMPATHY_CONTACT (contact));
+        }
+
+      g_object_notify (contact, "id");
+    }
   else if (!tp_strdiff (param->name, "handle"))
     g_object_notify (contact, "handle");
   else if (!tp_strdiff (param->name, "location"))
@@ -421,6 +489,7 @@ contact_finalize (GObject *object)
   g_free (priv->alias);
   g_free (priv->logged_alias);
   g_free (priv->id);
+  g_free (priv->identity);
   g_strfreev (priv->client_types);
 
   G_OBJECT_CLASS (empathy_contact_parent_class)->finalize (object);
@@ -636,6 +705,7 @@ remove_tp_contact (gpointer data,
     GObject *object)
 {
   g_hash_table_remove (contacts_table, data);
+  contacts_by_identity_remove ((EmpathyContact *) object);
 }
 
 static EmpathyContact *
@@ -654,30 +724,6 @@ empathy_contact_new (TpContact *tp_contact)
   return retval;
 }
 
-typedef struct
-{
-  TplEntity *entity;
-  TpAccount *account;
-} FindContactData;
-
-static gboolean
-contact_is_tpl_entity (gpointer key,
-    gpointer value,
-    gpointer user_data)
-{
-  EmpathyContact *contact = value;
-  FindContactData *data = user_data;
-  TpAccount *account = empathy_contact_get_account (contact);
-  const gchar *path = NULL;
-
-  if (account != NULL)
-    path = tp_proxy_get_object_path (account);
-
-  return !tp_strdiff (empathy_contact_get_id (contact),
-              tpl_entity_get_identifier (data->entity)) &&
-         !tp_strdiff (tp_proxy_get_object_path (data->account), path);
-}
-
 static void
 get_contacts_cb (GObject *source,
     GAsyncResult *result,
@@ -721,15 +767,18 @@ empathy_contact_from_tpl_contact (TpAccount *account,
 
   g_return_val_if_fail (TPL_IS_ENTITY (tpl_entity), NULL);
 
-  if (contacts_table != NULL)
+  if (contacts_by_identity != NULL && account != NULL)
     {
-      FindContactData data;
+      GList *contacts;
+      gchar *key;
 
-      data.entity = tpl_entity;
-      data.account = account;
+      key = contact_identity_key (account,
+          tpl_entity_get_identifier (tpl_entity));
+      contacts = g_hash_table_lookup (contacts_by_identity, key);
+      g_free (key);
 
-      existing_contact = g_hash_table_find (contacts_table,
-        contact_is_tpl_entity, &data);
+      if (contacts != NULL)
+        existing_contact = contacts->data;
     }
 
   if (existing_contact != NULL)
@@ -777,6 +826,78 @@ empathy_contact_from_tpl_contact (TpAccount *account,
   return retval;
 }
 
+struct _EmpathyContactMemo
+{
+  /* owned "account path\nid\nalias\navatar token" -> owned EmpathyContact */
+  GHashTable *contacts;
+  /* Number of empathy_contact_from_tpl_contact () calls avoided */
+  guint n_avoided;
+};
+
+EmpathyContactMemo *
+empathy_contact_memo_new (void)
+{
+  EmpathyContactMemo *memo;
+
+  memo = g_slice_new0 (EmpathyContactMemo);
+  memo->contacts = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, g_object_unref);
+
+  return memo;
+}
+
+void
+empathy_contact_memo_free (EmpathyContactMemo *memo)
+{
+  g_hash_table_unref (memo->contacts);
+  g_slice_free (EmpathyContactMemo, memo);
+}
+
+/* Same as empathy_contact_from_tpl_contact (), but log entities which only
+ * differ by their identity are only resolved once per @memo. The alias and
+ * avatar token are part of the identity, as the contact is built from
+ * them. */
+EmpathyContact *
+empathy_contact_memo_from_tpl_contact (EmpathyContactMemo *memo,
+    TpAccount *account,
+    TplEntity *tpl_entity)
+{
+  EmpathyContact *contact;
+  gchar *key;
+
+  g_return_val_if_fail (memo != NULL, NULL);
+  g_return_val_if_fail (TPL_IS_ENTITY (tpl_entity), NULL);
+
+  key = g_strdup_printf ("%s\n%s\n%s\n%s",
+      account != NULL ? tp_proxy_get_object_path (account) : "",
+      tpl_entity_get_identifier (tpl_entity),
+      tp_str_empty (tpl_entity_get_alias (tpl_entity)) ?
+          "" : tpl_entity_get_alias (tpl_entity),
+      tp_str_empty (tpl_entity_get_avatar_token (tpl_entity)) ?
+          "" : tpl_entity_get_avatar_token (tpl_entity));
+
+  contact = g_hash_table_lookup (memo->contacts, key);
+  if (contact != NULL)
+    {
+      memo->n_avoided++;
+      g_free (key);
+      return g_object_ref (contact);
+    }
+
+  contact = empathy_contact_from_tpl_contact (account, tpl_entity);
+  g_hash_table_insert (memo->contacts, key, g_object_ref (contact));
+
+  return contact;
+}
+
+guint
+empathy_contact_memo_get_n_avoided (EmpathyContactMemo *memo)
+{
+  g_return_val_if_fail (memo != NULL, 0);
+
+  return memo->n_avoided;
+}
+
 TpContact *
 empathy_contact_get_tp_contact (EmpathyContact *contact)
 {
@@ -1383,6 +1504,7 @@ contact_load_avatar_cache (EmpathyContact *contact,
     {
       DEBUG ("Avatar loaded from %s", filename);
       avatar = empathy_avatar_new ((guchar *) data, len, NULL, filename);
+      avatar->token = g_strdup (token);
       contact_set_avatar (contact, avatar);
       empathy_avatar_unref (avatar);
     }
@@ -1447,6 +1569,7 @@ empathy_avatar_unref (EmpathyAvatar *avatar)
     {
       g_free (avatar->data);
       g_free (avatar->format);
+      g_free (avatar->token);
       g_free (avatar->filename);
       g_slice_free (EmpathyAvatar, avatar);
     }
@@ -1759,6 +1882,7 @@ contact_set_avatar_from_tp_contact (EmpathyContact *contact)
       path = g_file_get_path (file);
 
       avatar = empathy_avatar_new ((guchar *) data, len, mime, path);
+      avatar->token = g_strdup (tp_contact_get_avatar_token (priv->tp_contact));
 
       contact_set_avatar (contact, avatar);
       empathy_avatar_unref (avatar);
@@ -1791,6 +1915,7 @@ empathy_contact_dup_from_tp_contact (TpContact *tp_contact)
        * contact keeps a ref to tp_contact, and is removed from the table in
        * contact_dispose() */
       g_hash_table_insert (contacts_table, tp_contact, contact);
+      contacts_by_identity_add (contact);
     }
   else
     {
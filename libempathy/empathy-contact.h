@@ -69,9 +69,20 @@ typedef enum {
   EMPATHY_CAPABILITIES_UNKNOWN = 1 << 7
 } EmpathyCapabilities;
 
+/* Remembers the contacts built by empathy_contact_memo_from_tpl_contact () */
+typedef struct _EmpathyContactMemo EmpathyContactMemo;
+
 GType empathy_contact_get_type (void) G_GNUC_CONST;
 EmpathyContact * empathy_contact_from_tpl_contact (TpAccount *account,
     TplEntity *tpl_contact);
+
+EmpathyContactMemo * empathy_contact_memo_new (void);
+void empathy_contact_memo_free (EmpathyContactMemo *memo);
+EmpathyContact * empathy_contact_memo_from_tpl_contact (
+    EmpathyContactMemo *memo,
+    TpAccount *account,
+    TplEntity *tpl_contact);
+guint empathy_contact_memo_get_n_avoided (EmpathyContactMemo *memo);
 TpContact * empathy_contact_get_tp_contact (EmpathyContact *contact);
 const gchar * empathy_contact_get_id (EmpathyContact *contact);
 const gchar * empathy_contact_get_alias (EmpathyContact *contact);
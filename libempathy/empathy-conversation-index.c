@@ -0,0 +1,532 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-conversation-index.h"
+
+#include <telepathy-logger/telepathy-logger.h>
+#include <tp-account-widgets/tpaw-time.h>
+
+#include "empathy-log-query-queue.h"
+#include "empathy-utils.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* Most recent text event of each (account, contact) pair. The index is
+ * filled once from the logs, then kept up to date by observing the text
+ * channels, whichever process handles them, so widgets listing contacts
+ * never have to query the logger themselves. Building it is expensive, so
+ * it lives as long as the process. */
+
+struct _EmpathyConversationIndexPriv
+{
+  TplLogManager *log_manager;
+  TpAccountManager *account_manager;
+
+  /* owned gchar * detail -> owned ConversationEntry */
+  GHashTable *entries;
+
+  /* "last event" log queries queued or running */
+  guint n_queries;
+  guint n_accounts_pending;
+
+  TpBaseClient *observer;
+};
+
+typedef struct
+{
+  gint64 timestamp;
+  gchar *message;
+} ConversationEntry;
+
+typedef struct
+{
+  EmpathyConversationIndex *self;
+  TpAccount *account;
+  TplEntity *entity;
+} PendingQuery;
+
+enum
+{
+  UPDATED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+G_DEFINE_TYPE (EmpathyConversationIndex, empathy_conversation_index,
+    G_TYPE_OBJECT);
+
+static EmpathyConversationIndex *singleton = NULL;
+
+static void
+conversation_entry_free (ConversationEntry *entry)
+{
+  g_free (entry->message);
+  g_slice_free (ConversationEntry, entry);
+}
+
+static PendingQuery *
+pending_query_new (EmpathyConversationIndex *self,
+    TpAccount *account,
+    TplEntity *entity)
+{
+  PendingQuery *query;
+
+  query = g_slice_new0 (PendingQuery);
+  query->self = g_object_ref (self);
+  query->account = g_object_ref (account);
+  query->entity = g_object_ref (entity);
+
+  return query;
+}
+
+static void
+pending_query_free (PendingQuery *query)
+{
+  g_object_unref (query->self);
+  g_object_unref (query->account);
+  g_object_unref (query->entity);
+  g_slice_free (PendingQuery, query);
+}
+
+gchar *
+empathy_conversation_index_dup_detail (TpAccount *account,
+    const gchar *id)
+{
+  return g_strdup_printf ("%s/%s", tp_proxy_get_object_path (account), id);
+}
+
+void
+empathy_conversation_index_add_event (EmpathyConversationIndex *self,
+    TpAccount *account,
+    const gchar *id,
+    gint64 timestamp,
+    const gchar *message)
+{
+  ConversationEntry *entry;
+  gchar *detail;
+
+  g_return_if_fail (EMPATHY_IS_CONVERSATION_INDEX (self));
+  g_return_if_fail (TP_IS_ACCOUNT (account));
+  g_return_if_fail (id != NULL);
+
+  detail = empathy_conversation_index_dup_detail (account, id);
+  entry = g_hash_table_lookup (self->priv->entries, detail);
+
+  if (entry == NULL)
+    {
+      entry = g_slice_new0 (ConversationEntry);
+      g_hash_table_insert (self->priv->entries, g_strdup (detail), entry);
+    }
+  else if (entry->timestamp > timestamp)
+    {
+      /* A live message arrived before the logs were read */
+      g_free (detail);
+      return;
+    }
+
+  entry->timestamp = timestamp;
+  g_free (entry->message);
+  entry->message = g_strdup (message);
+
+  g_signal_emit (self, signals[UPDATED], g_quark_from_string (detail),
+      account, id);
+
+  g_free (detail);
+}
+
+static const ConversationEntry *
+conversation_index_lookup (EmpathyConversationIndex *self,
+    TpAccount *account,
+    const gchar *id)
+{
+  ConversationEntry *entry;
+  gchar *detail;
+
+  detail = empathy_conversation_index_dup_detail (account, id);
+  entry = g_hash_table_lookup (self->priv->entries, detail);
+  g_free (detail);
+
+  return entry;
+}
+
+gint64
+empathy_conversation_index_get_timestamp (EmpathyConversationIndex *self,
+    TpAccount *account,
+    const gchar *id)
+{
+  const ConversationEntry *entry;
+
+  g_return_val_if_fail (EMPATHY_IS_CONVERSATION_INDEX (self), 0);
+  g_return_val_if_fail (TP_IS_ACCOUNT (account), 0);
+
+  entry = conversation_index_lookup (self, account, id);
+
+  return entry != NULL ? entry->timestamp : 0;
+}
+
+const gchar *
+empathy_conversation_index_get_message (EmpathyConversationIndex *self,
+    TpAccount *account,
+    const gchar *id)
+{
+  const ConversationEntry *entry;
+
+  g_return_val_if_fail (EMPATHY_IS_CONVERSATION_INDEX (self), NULL);
+  g_return_val_if_fail (TP_IS_ACCOUNT (account), NULL);
+
+  entry = conversation_index_lookup (self, account, id);
+
+  return entry != NULL ? entry->message : NULL;
+}
+
+static void
+conversation_index_check_built (EmpathyConversationIndex *self)
+{
+  if (self->priv->n_queries == 0 && self->priv->n_accounts_pending == 0)
+    DEBUG ("Index built, %u conversations",
+        g_hash_table_size (self->priv->entries));
+}
+
+static void
+get_filtered_events_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  PendingQuery *query = user_data;
+  EmpathyConversationIndex *self = query->self;
+  GList *events;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_filtered_events_finish (self->priv->log_manager,
+        result, &events, &error))
+    {
+      DEBUG ("Unable to get events: %s", error->message);
+      g_error_free (error);
+    }
+  else if (events != NULL)
+    {
+      TplEvent *event = TPL_EVENT (events->data);
+
+      empathy_conversation_index_add_event (self, query->account,
+          tpl_entity_get_identifier (query->entity),
+          tpl_event_get_timestamp (event),
+          tpl_text_event_get_message (TPL_TEXT_EVENT (event)));
+
+      g_list_free_full (events, g_object_unref);
+    }
+
+  empathy_log_query_queue_done ();
+
+  self->priv->n_queries--;
+  conversation_index_check_built (self);
+
+  pending_query_free (query);
+}
+
+static void
+start_query (gpointer user_data)
+{
+  PendingQuery *query = user_data;
+
+  tpl_log_manager_get_filtered_events_async (query->self->priv->log_manager,
+      query->account, query->entity, TPL_EVENT_MASK_TEXT, 1,
+      NULL, NULL, get_filtered_events_cb, query);
+}
+
+static void
+get_entities_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  PendingQuery *account_query = user_data;
+  EmpathyConversationIndex *self = account_query->self;
+  GList *entities, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_entities_finish (self->priv->log_manager,
+        result, &entities, &error))
+    {
+      DEBUG ("Unable to get entities of %s: %s",
+          tp_proxy_get_object_path (account_query->account), error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  for (l = entities; l != NULL; l = g_list_next (l))
+    {
+      TplEntity *entity = l->data;
+
+      if (tpl_entity_get_entity_type (entity) != TPL_ENTITY_CONTACT)
+        continue;
+
+      self->priv->n_queries++;
+      empathy_log_query_queue_push (start_query,
+          pending_query_new (self, account_query->account, entity));
+    }
+
+  g_list_free_full (entities, g_object_unref);
+
+out:
+  self->priv->n_accounts_pending--;
+  conversation_index_check_built (self);
+
+  g_object_unref (account_query->self);
+  g_object_unref (account_query->account);
+  g_slice_free (PendingQuery, account_query);
+}
+
+static void
+account_manager_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyConversationIndex *self = user_data;
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (source, result, &error))
+    {
+      DEBUG ("Failed to prepare account manager: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  accounts = tp_account_manager_dup_valid_accounts (
+      self->priv->account_manager);
+
+  for (l = accounts; l != NULL; l = g_list_next (l))
+    {
+      PendingQuery *account_query;
+
+      account_query = g_slice_new0 (PendingQuery);
+      account_query->self = g_object_ref (self);
+      account_query->account = g_object_ref (l->data);
+
+      self->priv->n_accounts_pending++;
+
+      tpl_log_manager_get_entities_async (self->priv->log_manager,
+          l->data, get_entities_cb, account_query);
+    }
+
+  g_list_free_full (accounts, g_object_unref);
+
+out:
+  g_object_unref (self);
+}
+
+static void
+add_signalled_message (EmpathyConversationIndex *self,
+    TpTextChannel *channel,
+    TpSignalledMessage *message)
+{
+  TpAccount *account;
+  gchar *text;
+  gint64 timestamp;
+
+  if (tp_message_is_delivery_report (TP_MESSAGE (message)))
+    return;
+
+  account = tp_connection_get_account (
+      tp_channel_get_connection (TP_CHANNEL (channel)));
+  if (account == NULL)
+    return;
+
+  timestamp = tp_message_get_sent_timestamp (TP_MESSAGE (message));
+  if (timestamp == 0)
+    timestamp = tp_message_get_received_timestamp (TP_MESSAGE (message));
+  if (timestamp == 0)
+    timestamp = tpaw_time_get_current ();
+
+  text = tp_message_to_text (TP_MESSAGE (message), NULL);
+
+  empathy_conversation_index_add_event (self, account,
+      tp_channel_get_identifier (TP_CHANNEL (channel)), timestamp, text);
+
+  g_free (text);
+}
+
+static void
+channel_message_received_cb (TpTextChannel *channel,
+    TpSignalledMessage *message,
+    EmpathyConversationIndex *self)
+{
+  add_signalled_message (self, channel, message);
+}
+
+static void
+channel_message_sent_cb (TpTextChannel *channel,
+    TpSignalledMessage *message,
+    guint flags,
+    const gchar *token,
+    EmpathyConversationIndex *self)
+{
+  add_signalled_message (self, channel, message);
+}
+
+static void
+observe_channels (TpSimpleObserver *observer,
+    TpAccount *account,
+    TpConnection *connection,
+    GList *channels,
+    TpChannelDispatchOperation *dispatch_operation,
+    GList *requests,
+    TpObserveChannelsContext *context,
+    gpointer user_data)
+{
+  EmpathyConversationIndex *self = user_data;
+  GList *l;
+
+  for (l = channels; l != NULL; l = g_list_next (l))
+    {
+      if (!TP_IS_TEXT_CHANNEL (l->data))
+        continue;
+
+      /* Messages going both ways, whichever process handles the channel */
+      tp_g_signal_connect_object (l->data, "message-received",
+          G_CALLBACK (channel_message_received_cb), self, 0);
+      tp_g_signal_connect_object (l->data, "message-sent",
+          G_CALLBACK (channel_message_sent_cb), self, 0);
+    }
+
+  tp_observe_channels_context_accept (context);
+}
+
+static void
+conversation_index_finalize (GObject *object)
+{
+  EmpathyConversationIndex *self = EMPATHY_CONVERSATION_INDEX (object);
+
+  /* Queued queries hold a ref on the index */
+  g_assert (self->priv->n_queries == 0);
+
+  tp_clear_object (&self->priv->observer);
+  g_hash_table_unref (self->priv->entries);
+  g_object_unref (self->priv->log_manager);
+  g_object_unref (self->priv->account_manager);
+
+  G_OBJECT_CLASS (empathy_conversation_index_parent_class)->finalize (object);
+}
+
+static GObject *
+conversation_index_constructor (GType type,
+    guint n_props,
+    GObjectConstructParam *props)
+{
+  GObject *retval;
+
+  if (singleton != NULL)
+    {
+      retval = g_object_ref (singleton);
+    }
+  else
+    {
+      retval = G_OBJECT_CLASS (empathy_conversation_index_parent_class)->
+        constructor (type, n_props, props);
+
+      /* Keep the index for the whole process rather than building it
+       * again from the logs each time it's needed */
+      singleton = EMPATHY_CONVERSATION_INDEX (g_object_ref (retval));
+    }
+
+  return retval;
+}
+
+static void
+conversation_index_constructed (GObject *object)
+{
+  EmpathyConversationIndex *self = EMPATHY_CONVERSATION_INDEX (object);
+  GError *error = NULL;
+
+  G_OBJECT_CLASS (empathy_conversation_index_parent_class)->constructed (
+      object);
+
+  tp_proxy_prepare_async (self->priv->account_manager, NULL,
+      account_manager_prepared_cb, g_object_ref (self));
+
+  /* Several processes may use the index, each has its own observer */
+  self->priv->observer = tp_simple_observer_new_with_am (
+      self->priv->account_manager, TRUE, "Empathy.ConversationIndex", TRUE,
+      observe_channels, self, NULL);
+
+  tp_base_client_take_observer_filter (self->priv->observer,
+      tp_asv_new (
+        TP_PROP_CHANNEL_CHANNEL_TYPE, G_TYPE_STRING,
+          TP_IFACE_CHANNEL_TYPE_TEXT,
+        TP_PROP_CHANNEL_TARGET_HANDLE_TYPE, G_TYPE_UINT,
+          TP_HANDLE_TYPE_CONTACT,
+        NULL));
+
+  if (!tp_base_client_register (self->priv->observer, &error))
+    {
+      DEBUG ("Failed to register observer: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+empathy_conversation_index_class_init (EmpathyConversationIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = conversation_index_finalize;
+  object_class->constructor = conversation_index_constructor;
+  object_class->constructed = conversation_index_constructed;
+
+  /**
+   * EmpathyConversationIndex::updated:
+   * @self: the index
+   * @account: the #TpAccount of the conversation
+   * @id: the identifier of the contact
+   *
+   * Emitted when the most recent event of a conversation changed. The
+   * signal detail is the string returned by
+   * empathy_conversation_index_dup_detail() for @account and @id.
+   */
+  signals[UPDATED] =
+      g_signal_new ("updated",
+          G_TYPE_FROM_CLASS (klass),
+          G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+          0,
+          NULL, NULL,
+          g_cclosure_marshal_generic,
+          G_TYPE_NONE, 2, TP_TYPE_ACCOUNT, G_TYPE_STRING);
+
+  g_type_class_add_private (object_class,
+      sizeof (EmpathyConversationIndexPriv));
+}
+
+static void
+empathy_conversation_index_init (EmpathyConversationIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_CONVERSATION_INDEX, EmpathyConversationIndexPriv);
+
+  self->priv->log_manager = tpl_log_manager_dup_singleton ();
+  self->priv->account_manager = tp_account_manager_dup ();
+  self->priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) conversation_entry_free);
+}
+
+EmpathyConversationIndex *
+empathy_conversation_index_dup_singleton (void)
+{
+  return g_object_new (EMPATHY_TYPE_CONVERSATION_INDEX, NULL);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_CONVERSATION_INDEX_H__
+#define __EMPATHY_CONVERSATION_INDEX_H__
+
+#include <glib-object.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+#define EMPATHY_TYPE_CONVERSATION_INDEX         (empathy_conversation_index_get_type ())
+#define EMPATHY_CONVERSATION_INDEX(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), EMPATHY_TYPE_CONVERSATION_INDEX, EmpathyConversationIndex))
+#define EMPATHY_CONVERSATION_INDEX_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), EMPATHY_TYPE_CONVERSATION_INDEX, EmpathyConversationIndexClass))
+#define EMPATHY_IS_CONVERSATION_INDEX(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), EMPATHY_TYPE_CONVERSATION_INDEX))
+#define EMPATHY_IS_CONVERSATION_INDEX_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), EMPATHY_TYPE_CONVERSATION_INDEX))
+#define EMPATHY_CONVERSATION_INDEX_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), EMPATHY_TYPE_CONVERSATION_INDEX, EmpathyConversationIndexClass))
+
+typedef struct _EmpathyConversationIndex      EmpathyConversationIndex;
+typedef struct _EmpathyConversationIndexClass EmpathyConversationIndexClass;
+typedef struct _EmpathyConversationIndexPriv  EmpathyConversationIndexPriv;
+
+struct _EmpathyConversationIndex {
+  GObject parent;
+  EmpathyConversationIndexPriv *priv;
+};
+
+struct _EmpathyConversationIndexClass
+{
+  GObjectClass parent_class;
+};
+
+GType empathy_conversation_index_get_type (void) G_GNUC_CONST;
+
+EmpathyConversationIndex * empathy_conversation_index_dup_singleton (void);
+
+gint64 empathy_conversation_index_get_timestamp (
+    EmpathyConversationIndex *self,
+    TpAccount *account,
+    const gchar *id);
+
+const gchar * empathy_conversation_index_get_message (
+    EmpathyConversationIndex *self,
+    TpAccount *account,
+    const gchar *id);
+
+void empathy_conversation_index_add_event (EmpathyConversationIndex *self,
+    TpAccount *account,
+    const gchar *id,
+    gint64 timestamp,
+    const gchar *message);
+
+gchar * empathy_conversation_index_dup_detail (TpAccount *account,
+    const gchar *id);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_CONVERSATION_INDEX_H__ */
@@ -71,7 +71,11 @@ G_DEFINE_TYPE (EmpathyFTHandler, empathy_ft_handler, G_TYPE_OBJECT)
 
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyFTHandler)
 
-#define BUFFER_SIZE 4096
+/* Read buffer used for hashing, allocated once per file */
+#define BUFFER_SIZE (256 * 1024)
+
+/* Minimum delay between two ::hashing-progress signals, in microseconds */
+#define HASHING_PROGRESS_INTERVAL (G_USEC_PER_SEC / 10)
 
 enum {
   PROP_CHANNEL = 1,
@@ -100,13 +104,17 @@ enum {
 typedef struct {
   GInputStream *stream;
   GError *error /* comment to make the style checker happy */;
-  guchar *buffer;
   GChecksum *checksum;
-  gssize total_read;
   guint64 total_bytes;
   EmpathyFTHandler *handler;
+  GIOSchedulerJob *job;
 } HashingData;
 
+typedef struct {
+  HashingData *hash_data;
+  guint64 total_read;
+} HashingProgress;
+
 typedef struct {
   EmpathyFTHandlerReadyCallback callback;
   gpointer user_data;
@@ -551,8 +559,6 @@ empathy_ft_handler_init (EmpathyFTHandler *self)
 static void
 hash_data_free (HashingData *data)
 {
-  g_free (data->buffer);
-
   if (data->stream != NULL)
     g_object_unref (data->stream);
 
@@ -932,55 +938,112 @@ cleanup:
   return FALSE;
 }
 
+static void
+hashing_progress_free (HashingProgress *progress)
+{
+  g_slice_free (HashingProgress, progress);
+}
+
 static gboolean
 emit_hashing_progress (gpointer user_data)
 {
-  HashingData *hash_data = user_data;
+  HashingProgress *progress = user_data;
 
-  g_signal_emit (hash_data->handler, signals[HASHING_PROGRESS], 0,
-      (guint64) hash_data->total_read, (guint64) hash_data->total_bytes);
+  g_signal_emit (progress->hash_data->handler, signals[HASHING_PROGRESS], 0,
+      progress->total_read, progress->hash_data->total_bytes);
 
   return FALSE;
 }
 
-static gboolean
-do_hash_job (GIOSchedulerJob *job,
-    GCancellable *cancellable,
+static void
+hashing_progress_cb (guint64 total_read,
     gpointer user_data)
 {
   HashingData *hash_data = user_data;
-  gssize bytes_read;
-  GError *error = NULL;
+  HashingProgress *progress;
 
-again:
-  if (hash_data->buffer == NULL)
-    hash_data->buffer = g_malloc0 (BUFFER_SIZE);
+  progress = g_slice_new (HashingProgress);
+  progress->hash_data = hash_data;
+  progress->total_read = total_read;
 
-  bytes_read = g_input_stream_read (hash_data->stream, hash_data->buffer,
-                                    BUFFER_SIZE, cancellable, &error);
-  if (error != NULL)
-    goto out;
+  /* hash_job_done() is queued after this, so hash_data outlives it */
+  g_io_scheduler_job_send_to_mainloop_async (hash_data->job,
+      emit_hashing_progress, progress,
+      (GDestroyNotify) hashing_progress_free);
+}
+
+/**
+ * empathy_ft_hash_stream:
+ * @stream: the stream to read until its end
+ * @checksum: the checksum to update with the content of @stream
+ * @cancellable: optional #GCancellable, or %NULL
+ * @progress_func: (allow-none): called with the number of bytes read so far,
+ *  at most every tenth of a second and once at the end
+ * @user_data: user data passed to @progress_func
+ * @error: return location for a #GError, or %NULL
+ *
+ * Reads @stream in large chunks and feeds them to @checksum. This blocks, so
+ * it should be called from a thread.
+ *
+ * Returns: %TRUE if the whole stream has been hashed
+ */
+gboolean
+empathy_ft_hash_stream (GInputStream *stream,
+    GChecksum *checksum,
+    GCancellable *cancellable,
+    EmpathyFTHashProgressFunc progress_func,
+    gpointer user_data,
+    GError **error)
+{
+  guchar *buffer;
+  guint64 total_read = 0;
+  gint64 last_progress = 0;
+  gssize bytes_read;
 
-  hash_data->total_read += bytes_read;
+  buffer = g_malloc (BUFFER_SIZE);
 
-  /* we now have the chunk */
-  if (bytes_read > 0)
+  while ((bytes_read = g_input_stream_read (stream, buffer, BUFFER_SIZE,
+              cancellable, error)) > 0)
     {
-      g_checksum_update (hash_data->checksum, hash_data->buffer, bytes_read);
-      g_io_scheduler_job_send_to_mainloop_async (job, emit_hashing_progress,
-          hash_data, NULL);
+      gint64 now;
 
-      g_free (hash_data->buffer);
-      hash_data->buffer = NULL;
+      g_checksum_update (checksum, buffer, bytes_read);
+      total_read += bytes_read;
 
-      goto again;
+      now = g_get_monotonic_time ();
+      if (progress_func != NULL &&
+          now - last_progress >= HASHING_PROGRESS_INTERVAL)
+        {
+          progress_func (total_read, user_data);
+          last_progress = now;
+        }
     }
-  else
-  {
+
+  g_free (buffer);
+
+  if (bytes_read < 0)
+    return FALSE;
+
+  if (progress_func != NULL)
+    progress_func (total_read, user_data);
+
+  return TRUE;
+}
+
+static gboolean
+do_hash_job (GIOSchedulerJob *job,
+    GCancellable *cancellable,
+    gpointer user_data)
+{
+  HashingData *hash_data = user_data;
+  GError *error = NULL;
+
+  hash_data->job = job;
+
+  if (empathy_ft_hash_stream (hash_data->stream, hash_data->checksum,
+          cancellable, hashing_progress_cb, hash_data, &error))
     g_input_stream_close (hash_data->stream, cancellable, &error);
-  }
 
-out:
   if (error != NULL)
     hash_data->error = error;
 
@@ -78,6 +78,14 @@ typedef void (* EmpathyFTHandlerReadyCallback) (EmpathyFTHandler *handler,
     GError *error,
     gpointer user_data);
 
+/**
+ * EmpathyFTHashProgressFunc:
+ * @total_read: number of bytes hashed so far
+ * @user_data: user data passed to empathy_ft_hash_stream()
+ */
+typedef void (* EmpathyFTHashProgressFunc) (guint64 total_read,
+    gpointer user_data);
+
 GType empathy_ft_handler_get_type (void);
 
 /* public methods */
@@ -108,6 +116,14 @@ guint64 empathy_ft_handler_get_total_bytes (EmpathyFTHandler *handler);
 gboolean empathy_ft_handler_is_completed (EmpathyFTHandler *handler);
 gboolean empathy_ft_handler_is_cancelled (EmpathyFTHandler *handler);
 
+/* utilities */
+gboolean empathy_ft_hash_stream (GInputStream *stream,
+    GChecksum *checksum,
+    GCancellable *cancellable,
+    EmpathyFTHashProgressFunc progress_func,
+    gpointer user_data,
+    GError **error);
+
 G_END_DECLS
 
 #endif /* __EMPATHY_FT_HANDLER_H__ */
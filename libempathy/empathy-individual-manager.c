@@ -45,6 +45,10 @@
 /* The constant DAY_IN_SECONDS represents the seconds in a day */
 #define DAY_IN_SECONDS 86400
 
+/* Popularity decays with time so it's computed again for everyone at this
+ * interval, in seconds */
+#define POPULARITY_REFRESH_INTERVAL 3600
+
 /* This class only stores and refs Individuals who contain an EmpathyContact.
  *
  * This class merely forwards along signals from the aggregator and individuals
@@ -55,14 +59,22 @@ typedef struct
   GHashTable *individuals; /* Individual.id -> Individual */
   gboolean contacts_loaded;
 
-  /* reffed FolksIndividual sorted by popularity (most popular first) */
-  GSequence *individuals_pop;
-  /* The TOP_INDIVIDUALS_LEN first FolksIndividual (borrowed) from
-   * individuals_pop */
+  /* reffed FolksIndividual -> guint popularity, as computed the last time its
+   * interactions changed or the popularities were refreshed. Individuals with
+   * a popularity of 0 are not in the table. */
+  GHashTable *individuals_pop;
+  /* The TOP_INDIVIDUALS_LEN most popular FolksIndividual (borrowed) from
+   * individuals_pop, most popular first */
   GList *top_individuals;
-  guint global_interaction_counter;
+  guint refresh_pop_id;
 } EmpathyIndividualManagerPriv;
 
+typedef struct
+{
+  FolksIndividual *individual;
+  guint pop;
+} PopEntry;
+
 enum
 {
   PROP_TOP_INDIVIDUALS = 1,
@@ -130,19 +142,18 @@ individual_notify_is_favourite_cb (FolksIndividual *individual,
  * have an interaction count > INTERACTION_COUNT_COMPRESS_FACTOR have a
  * popularity value of the count/INTERACTION_COUNT_COMPRESS_FACTOR */
 static guint
-compute_popularity (FolksIndividual *individual)
+compute_popularity (FolksIndividual *individual,
+    gint64 current_timestamp)
 {
   FolksInteractionDetails *details = FOLKS_INTERACTION_DETAILS (individual);
   GDateTime *last;
-  guint  current_timestamp, count;
+  guint count;
   float timediff;
 
   last = folks_interaction_details_get_last_im_interaction_datetime (details);
   if (last == NULL)
     return 0;
 
-  /* Convert g_get_real_time () fro microseconds to seconds */
-  current_timestamp = g_get_real_time () / 1000000;
   timediff = current_timestamp - g_date_time_to_unix (last);
 
   if (timediff / DAY_IN_SECONDS > 30)
@@ -156,52 +167,82 @@ compute_popularity (FolksIndividual *individual)
   return count;
 }
 
-static void
-check_top_individuals (EmpathyIndividualManager *self)
+static gint64
+get_current_timestamp (void)
+{
+  /* Convert g_get_real_time () fro microseconds to seconds */
+  return g_get_real_time () / G_USEC_PER_SEC;
+}
+
+static guint
+get_popularity (EmpathyIndividualManager *self,
+    FolksIndividual *individual)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
-  GSequenceIter *iter;
-  GList *l, *new_list = NULL;
-  gboolean modified = FALSE;
-  guint i;
 
-  iter = g_sequence_get_begin_iter (priv->individuals_pop);
-  l = priv->top_individuals;
+  return GPOINTER_TO_UINT (g_hash_table_lookup (priv->individuals_pop,
+      individual));
+}
 
-  /* Check if the TOP_INDIVIDUALS_LEN first individuals in individuals_pop are
-   * still the same as the ones in top_individuals */
-  for (i = 0; i < TOP_INDIVIDUALS_LEN && !g_sequence_iter_is_end (iter); i++)
-    {
-      FolksIndividual *individual = g_sequence_get (iter);
-      guint pop;
+/* Returns TRUE if the popularity of @individual changed */
+static gboolean
+update_popularity (EmpathyIndividualManager *self,
+    FolksIndividual *individual,
+    gint64 current_timestamp)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  guint pop;
 
-      /* Don't include individual having 0 as pop */
-      pop = compute_popularity (individual);
-      if (pop <= 0)
-        break;
+  pop = compute_popularity (individual, current_timestamp);
+  if (pop == get_popularity (self, individual))
+    return FALSE;
 
-      if (!modified)
-        {
-          if (l == NULL)
-            {
-              /* Old list is shorter than the new one */
-              modified = TRUE;
-            }
-          else
-            {
-              modified = (individual != l->data);
+  if (pop > 0)
+    g_hash_table_insert (priv->individuals_pop, g_object_ref (individual),
+        GUINT_TO_POINTER (pop));
+  else
+    g_hash_table_remove (priv->individuals_pop, individual);
 
-              l = g_list_next (l);
-            }
-        }
+  return TRUE;
+}
 
-      new_list = g_list_prepend (new_list, individual);
+static gint
+compare_individual_by_pop (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  EmpathyIndividualManager *self = user_data;
+  guint pop_a, pop_b;
 
-      iter = g_sequence_iter_next (iter);
+  pop_a = get_popularity (self, FOLKS_INDIVIDUAL (a));
+  pop_b = get_popularity (self, FOLKS_INDIVIDUAL (b));
+
+  return (gint) pop_b - (gint) pop_a;
+}
+
+static void
+set_top_individuals (EmpathyIndividualManager *self,
+    GList *new_list)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GList *l, *old;
+  gboolean modified = FALSE;
+
+  /* Check if the new top individuals are still the same as the ones in
+   * top_individuals */
+  for (l = new_list, old = priv->top_individuals;
+      l != NULL || old != NULL;
+      l = g_list_next (l), old = g_list_next (old))
+    {
+      if (l == NULL || old == NULL || l->data != old->data)
+        {
+          modified = TRUE;
+          break;
+        }
     }
 
   g_list_free (priv->top_individuals);
-  priv->top_individuals = g_list_reverse (new_list);
+  priv->top_individuals = new_list;
 
   if (modified)
     {
@@ -213,24 +254,145 @@ check_top_individuals (EmpathyIndividualManager *self)
 
           DEBUG ("  %s (%u)",
               folks_alias_details_get_alias (FOLKS_ALIAS_DETAILS (individual)),
-              compute_popularity (individual));
+              get_popularity (self, individual));
         }
 
       g_object_notify (G_OBJECT (self), "top-individuals");
     }
 }
 
-static gint
-compare_individual_by_pop (gconstpointer a,
-    gconstpointer b,
-    gpointer user_data)
+static void
+pop_heap_sift_down (PopEntry *heap,
+    guint len,
+    guint i)
 {
-  guint pop_a, pop_b;
+  while (TRUE)
+    {
+      guint smallest = i;
+      guint left = 2 * i + 1;
+      guint right = 2 * i + 2;
+      PopEntry tmp;
+
+      if (left < len && heap[left].pop < heap[smallest].pop)
+        smallest = left;
+      if (right < len && heap[right].pop < heap[smallest].pop)
+        smallest = right;
+
+      if (smallest == i)
+        return;
+
+      tmp = heap[i];
+      heap[i] = heap[smallest];
+      heap[smallest] = tmp;
+      i = smallest;
+    }
+}
 
-  pop_a = compute_popularity (FOLKS_INDIVIDUAL (a));
-  pop_b = compute_popularity (FOLKS_INDIVIDUAL (b));
+static void
+pop_heap_sift_up (PopEntry *heap,
+    guint i)
+{
+  while (i > 0)
+    {
+      guint parent = (i - 1) / 2;
+      PopEntry tmp;
 
-  return pop_b - pop_a;
+      if (heap[parent].pop <= heap[i].pop)
+        return;
+
+      tmp = heap[i];
+      heap[i] = heap[parent];
+      heap[parent] = tmp;
+      i = parent;
+    }
+}
+
+/* Find the TOP_INDIVIDUALS_LEN most popular individuals using a min-heap of
+ * the best ones seen so far, so we don't have to sort all of them */
+static void
+check_top_individuals (EmpathyIndividualManager *self)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  PopEntry heap[TOP_INDIVIDUALS_LEN];
+  GHashTableIter iter;
+  gpointer key, value;
+  GList *new_list = NULL;
+  guint len = 0;
+  guint i;
+
+  g_hash_table_iter_init (&iter, priv->individuals_pop);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      PopEntry entry = { key, GPOINTER_TO_UINT (value) };
+
+      if (len < TOP_INDIVIDUALS_LEN)
+        {
+          heap[len] = entry;
+          pop_heap_sift_up (heap, len);
+          len++;
+        }
+      else if (entry.pop > heap[0].pop)
+        {
+          heap[0] = entry;
+          pop_heap_sift_down (heap, len, 0);
+        }
+    }
+
+  for (i = 0; i < len; i++)
+    new_list = g_list_prepend (new_list, heap[i].individual);
+
+  set_top_individuals (self, g_list_sort_with_data (new_list,
+        compare_individual_by_pop, self));
+}
+
+/* Update top_individuals after the popularity of @individual changed. The
+ * whole table only has to be looked at when a top individual becomes less
+ * popular as one of the others may replace it. */
+static void
+individual_pop_changed (EmpathyIndividualManager *self,
+    FolksIndividual *individual,
+    guint old_pop)
+{
+  EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GList *new_list, *last;
+  guint pop;
+
+  pop = get_popularity (self, individual);
+
+  if (g_list_find (priv->top_individuals, individual) != NULL)
+    {
+      if (pop < old_pop)
+        {
+          check_top_individuals (self);
+          return;
+        }
+
+      new_list = g_list_copy (priv->top_individuals);
+    }
+  else
+    {
+      /* If top_individuals isn't full it already contains all the
+       * individuals having a popularity */
+      last = g_list_last (priv->top_individuals);
+
+      if (pop == 0 ||
+          (g_list_length (priv->top_individuals) >= TOP_INDIVIDUALS_LEN &&
+           pop <= get_popularity (self, last->data)))
+        return;
+
+      new_list = g_list_append (g_list_copy (priv->top_individuals),
+          individual);
+    }
+
+  new_list = g_list_sort_with_data (new_list, compare_individual_by_pop, self);
+
+  if (g_list_length (new_list) > TOP_INDIVIDUALS_LEN)
+    {
+      last = g_list_last (new_list);
+      new_list = g_list_delete_link (new_list, last);
+    }
+
+  set_top_individuals (self, new_list);
 }
 
 static void
@@ -238,18 +400,40 @@ individual_notify_im_interaction_count (FolksIndividual *individual,
     GParamSpec *pspec,
     EmpathyIndividualManager *self)
 {
+  guint old_pop;
+
+  old_pop = get_popularity (self, individual);
+
+  if (update_popularity (self, individual, get_current_timestamp ()))
+    individual_pop_changed (self, individual, old_pop);
+}
+
+static gboolean
+refresh_pop_cb (gpointer user_data)
+{
+  EmpathyIndividualManager *self = user_data;
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
+  GList *individuals, *l;
+  gint64 now;
+  gboolean changed = FALSE;
 
-  /* We don't use g_sequence_sort_changed() because we'll first have to find
-   * the iter of @individual using g_sequence_lookup() but the lookup function
-   * won't work as it assumes that the sequence is sorted which is no longer
-   * the case at this point as @individual's popularity just changed. */
-  g_sequence_sort (priv->individuals_pop, compare_individual_by_pop, NULL);
+  now = get_current_timestamp ();
 
-  /* Only check for top individuals after 10 interaction events happen */
-  if (priv->global_interaction_counter % 10 == 0)
+  /* Only the individuals which have a popularity can lose it with time. They
+   * are still reffed by priv->individuals if update_popularity() removes
+   * them. */
+  individuals = g_hash_table_get_keys (priv->individuals_pop);
+  for (l = individuals; l != NULL; l = g_list_next (l))
+    {
+      if (update_popularity (self, l->data, now))
+        changed = TRUE;
+    }
+  g_list_free (individuals);
+
+  if (changed)
     check_top_individuals (self);
-  priv->global_interaction_counter++;
+
+  return G_SOURCE_CONTINUE;
 }
 
 static void
@@ -261,9 +445,8 @@ add_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
       g_strdup (folks_individual_get_id (individual)),
       g_object_ref (individual));
 
-  g_sequence_insert_sorted (priv->individuals_pop, g_object_ref (individual),
-      compare_individual_by_pop, NULL);
-  check_top_individuals (self);
+  if (update_popularity (self, individual, get_current_timestamp ()))
+    individual_pop_changed (self, individual, 0);
 
   g_signal_connect (individual, "group-changed",
       G_CALLBACK (individual_group_changed_cb), self);
@@ -277,19 +460,19 @@ static void
 remove_individual (EmpathyIndividualManager *self, FolksIndividual *individual)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (self);
-  GSequenceIter *iter;
 
-  iter = g_sequence_lookup (priv->individuals_pop, individual,
-      compare_individual_by_pop, NULL);
-  if (iter != NULL)
+  if (g_hash_table_contains (priv->individuals_pop, individual))
     {
       /* priv->top_individuals borrows its reference from
        * priv->individuals_pop so we take a reference on the individual while
        * removing it to make sure it stays alive while calling
        * check_top_individuals(). */
       g_object_ref (individual);
-      g_sequence_remove (iter);
-      check_top_individuals (self);
+      g_hash_table_remove (priv->individuals_pop, individual);
+
+      if (g_list_find (priv->top_individuals, individual) != NULL)
+        check_top_individuals (self);
+
       g_object_unref (individual);
     }
 
@@ -440,6 +623,12 @@ individual_manager_dispose (GObject *object)
 
   tp_clear_object (&priv->aggregator);
 
+  if (priv->refresh_pop_id != 0)
+    {
+      g_source_remove (priv->refresh_pop_id);
+      priv->refresh_pop_id = 0;
+    }
+
   G_OBJECT_CLASS (empathy_individual_manager_parent_class)->dispose (object);
 }
 
@@ -448,7 +637,8 @@ individual_manager_finalize (GObject *object)
 {
   EmpathyIndividualManagerPriv *priv = GET_PRIV (object);
 
-  g_sequence_free (priv->individuals_pop);
+  g_list_free (priv->top_individuals);
+  g_hash_table_unref (priv->individuals_pop);
 
   G_OBJECT_CLASS (empathy_individual_manager_parent_class)->finalize (object);
 }
@@ -583,7 +773,10 @@ empathy_individual_manager_init (EmpathyIndividualManager *self)
   priv->individuals = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, g_object_unref);
 
-  priv->individuals_pop = g_sequence_new (g_object_unref);
+  priv->individuals_pop = g_hash_table_new_full (NULL, NULL, g_object_unref,
+      NULL);
+  priv->refresh_pop_id = g_timeout_add_seconds (POPULARITY_REFRESH_INTERVAL,
+      refresh_pop_cb, self);
 
   priv->aggregator = folks_individual_aggregator_dup ();
   tp_g_signal_connect_object (priv->aggregator, "individuals-changed-detailed",
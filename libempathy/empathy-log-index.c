@@ -0,0 +1,1573 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-log-index.h"
+#include "empathy-log-index-internal.h"
+
+#include "empathy-log-query-queue.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* Full text index of the logged text messages.
+ *
+ * A document is the text logged with one entity on one day, which is what
+ * a TplLogSearchHit points to. Each document is indexed by the case folded
+ * character trigrams of its messages, so any substring of at least 3
+ * characters can be looked up, as with tpl_log_manager_search_async(). A
+ * document containing all the trigrams of a query is a hit.
+ *
+ * The index is kept in the user cache directory as a serialized GVariant,
+ * which is mapped and searched in place. Trigrams indexed since it was
+ * written live in memory until the next update writes a new file. Updates
+ * only read the days that were logged since the last indexed day of each
+ * entity, that day included. Clearing the logs of an account renumbers the
+ * remaining entities and documents and writes the whole index again. */
+
+#define LOG_INDEX_VERSION 1
+#define LOG_INDEX_TYPE "(ua(ssuu)a(uu)a(tau))"
+
+/* Minimum time between two updates */
+#define UPDATE_INTERVAL (60 * G_USEC_PER_SEC)
+
+#define TRIGRAM(a, b, c) \
+  (((guint64) (a) << 42) | ((guint64) (b) << 21) | (guint64) (c))
+
+typedef struct
+{
+  gchar *account_path;
+  gchar *id;
+  TplEntityType type;
+  /* Julian day of the last indexed day, 0 if none */
+  guint32 last_julian;
+
+  /* Used during updates */
+  guint32 update_julian;
+  guint n_pending;
+} IndexEntity;
+
+typedef struct
+{
+  guint32 entity;
+  guint32 julian;
+} IndexDocument;
+
+struct _EmpathyLogIndexPriv
+{
+  TplLogManager *log_manager;
+  TpAccountManager *account_manager;
+  gchar *filename;
+
+  /* owned IndexEntity, the position is the entity number */
+  GPtrArray *entities;
+  /* owned "account path\nid" -> entity number + 1 */
+  GHashTable *entity_numbers;
+
+  /* IndexDocument, the position is the document number */
+  GArray *documents;
+  /* owned gint64 (entity << 32 | julian) -> document number + 1 */
+  GHashTable *document_numbers;
+
+  /* a(tau) read from the file, sorted by trigram */
+  GVariant *postings;
+  /* owned guint64 trigram -> sorted GArray of guint32 document numbers,
+   * for the documents indexed since the file was written */
+  GHashTable *delta;
+
+  gboolean ready;
+  gboolean dirty;
+  gboolean changed;
+
+  gboolean updating;
+  gint64 last_update;
+  guint n_accounts_pending;
+
+  /* log queries queued or running */
+  guint n_queries;
+
+  /* owned account paths, or NULL for all of them, whose logs were cleared
+   * while updating */
+  GPtrArray *pending_clears;
+};
+
+typedef enum
+{
+  QUERY_DATES,
+  QUERY_EVENTS,
+} QueryType;
+
+typedef struct
+{
+  EmpathyLogIndex *self;
+  QueryType type;
+  TpAccount *account;
+  TplEntity *entity;
+  guint entity_number;
+  GDate *date;
+} PendingQuery;
+
+enum
+{
+  UPDATED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+G_DEFINE_TYPE (EmpathyLogIndex, empathy_log_index, G_TYPE_OBJECT);
+
+static EmpathyLogIndex *singleton = NULL;
+
+static void
+index_entity_free (IndexEntity *entity)
+{
+  g_free (entity->account_path);
+  g_free (entity->id);
+  g_slice_free (IndexEntity, entity);
+}
+
+static PendingQuery *
+pending_query_new (EmpathyLogIndex *self,
+    QueryType type,
+    TpAccount *account,
+    TplEntity *entity,
+    guint entity_number)
+{
+  PendingQuery *query;
+
+  query = g_slice_new0 (PendingQuery);
+  query->self = g_object_ref (self);
+  query->type = type;
+  query->account = g_object_ref (account);
+  query->entity = g_object_ref (entity);
+  query->entity_number = entity_number;
+
+  return query;
+}
+
+static void
+pending_query_free (PendingQuery *query)
+{
+  g_object_unref (query->self);
+  g_object_unref (query->account);
+  g_object_unref (query->entity);
+  tp_clear_pointer (&query->date, g_date_free);
+  g_slice_free (PendingQuery, query);
+}
+
+static gint
+compare_guint64 (gconstpointer a,
+    gconstpointer b)
+{
+  guint64 x = *(const guint64 *) a;
+  guint64 y = *(const guint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Appends the trigrams of the case folded @text to @trigrams */
+static void
+log_index_add_trigrams (GArray *trigrams,
+    const gchar *text)
+{
+  gunichar a = 0, b = 0;
+  gchar *folded;
+  const gchar *p;
+  guint n = 0;
+
+  if (text == NULL || !g_utf8_validate (text, -1, NULL))
+    return;
+
+  folded = g_utf8_casefold (text, -1);
+
+  for (p = folded; *p != '\0'; p = g_utf8_next_char (p))
+    {
+      gunichar c = g_utf8_get_char (p);
+
+      if (n >= 2)
+        {
+          guint64 trigram = TRIGRAM (a, b, c);
+
+          g_array_append_val (trigrams, trigram);
+        }
+
+      a = b;
+      b = c;
+      n++;
+    }
+
+  g_free (folded);
+}
+
+static void
+sort_unique (GArray *trigrams)
+{
+  guint i, n = 0;
+
+  g_array_sort (trigrams, compare_guint64);
+
+  for (i = 0; i < trigrams->len; i++)
+    {
+      if (n > 0 && g_array_index (trigrams, guint64, n - 1) ==
+          g_array_index (trigrams, guint64, i))
+        continue;
+
+      g_array_index (trigrams, guint64, n++) =
+        g_array_index (trigrams, guint64, i);
+    }
+
+  g_array_set_size (trigrams, n);
+}
+
+static gboolean
+postings_contain (const guint32 *documents,
+    gsize n,
+    guint32 document)
+{
+  gsize lo = 0, hi = n;
+
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+
+      if (documents[mid] == document)
+        return TRUE;
+
+      if (documents[mid] < document)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return FALSE;
+}
+
+static GArray *
+postings_union (const guint32 *a,
+    gsize n_a,
+    const guint32 *b,
+    gsize n_b)
+{
+  GArray *result;
+  gsize i = 0, j = 0;
+
+  result = g_array_sized_new (FALSE, FALSE, sizeof (guint32), n_a + n_b);
+
+  while (i < n_a || j < n_b)
+    {
+      guint32 next;
+
+      if (j >= n_b || (i < n_a && a[i] < b[j]))
+        {
+          next = a[i++];
+        }
+      else if (i >= n_a || b[j] < a[i])
+        {
+          next = b[j++];
+        }
+      else
+        {
+          next = a[i++];
+          j++;
+        }
+
+      g_array_append_val (result, next);
+    }
+
+  return result;
+}
+
+static void
+postings_intersect (GArray *result,
+    GArray *other)
+{
+  guint i = 0, j = 0, n = 0;
+
+  while (i < result->len && j < other->len)
+    {
+      guint32 a = g_array_index (result, guint32, i);
+      guint32 b = g_array_index (other, guint32, j);
+
+      if (a < b)
+        {
+          i++;
+        }
+      else if (b < a)
+        {
+          j++;
+        }
+      else
+        {
+          g_array_index (result, guint32, n++) = a;
+          i++;
+          j++;
+        }
+    }
+
+  g_array_set_size (result, n);
+}
+
+/* Returns the posting list of @trigram read from the file, or NULL */
+static GVariant *
+log_index_lookup_file (EmpathyLogIndex *self,
+    guint64 trigram)
+{
+  gsize lo = 0, hi;
+
+  if (self->priv->postings == NULL)
+    return NULL;
+
+  hi = g_variant_n_children (self->priv->postings);
+
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      GVariant *child;
+      guint64 key;
+
+      child = g_variant_get_child_value (self->priv->postings, mid);
+      g_variant_get_child (child, 0, "t", &key);
+
+      if (key == trigram)
+        {
+          GVariant *documents = g_variant_get_child_value (child, 1);
+
+          g_variant_unref (child);
+          return documents;
+        }
+
+      if (key < trigram)
+        lo = mid + 1;
+      else
+        hi = mid;
+
+      g_variant_unref (child);
+    }
+
+  return NULL;
+}
+
+/* Returns all the documents containing @trigram */
+static GArray *
+log_index_dup_postings (EmpathyLogIndex *self,
+    guint64 trigram)
+{
+  GVariant *file_postings;
+  GArray *delta, *result;
+  const guint32 *documents = NULL;
+  gsize n = 0;
+
+  file_postings = log_index_lookup_file (self, trigram);
+  if (file_postings != NULL)
+    documents = g_variant_get_fixed_array (file_postings, &n,
+        sizeof (guint32));
+
+  delta = g_hash_table_lookup (self->priv->delta, &trigram);
+
+  if (delta != NULL)
+    result = postings_union (documents, n, (guint32 *) delta->data,
+        delta->len);
+  else
+    result = postings_union (documents, n, NULL, 0);
+
+  if (file_postings != NULL)
+    g_variant_unref (file_postings);
+
+  return result;
+}
+
+static void
+log_index_add_posting (EmpathyLogIndex *self,
+    guint64 trigram,
+    guint32 document)
+{
+  GVariant *file_postings;
+  GArray *delta;
+  gboolean found = FALSE;
+  guint lo = 0, hi = 0;
+
+  delta = g_hash_table_lookup (self->priv->delta, &trigram);
+
+  if (delta != NULL)
+    {
+      hi = delta->len;
+
+      /* New documents get the highest number, so this is usually an
+       * append */
+      if (hi > 0 && g_array_index (delta, guint32, hi - 1) < document)
+        lo = hi;
+
+      while (lo < hi)
+        {
+          guint mid = lo + (hi - lo) / 2;
+          guint32 value = g_array_index (delta, guint32, mid);
+
+          if (value == document)
+            return;
+
+          if (value < document)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+    }
+
+  /* Days which are indexed again are usually already in the file */
+  file_postings = log_index_lookup_file (self, trigram);
+  if (file_postings != NULL)
+    {
+      const guint32 *documents;
+      gsize n;
+
+      documents = g_variant_get_fixed_array (file_postings, &n,
+          sizeof (guint32));
+      found = postings_contain (documents, n, document);
+      g_variant_unref (file_postings);
+    }
+
+  if (found)
+    return;
+
+  if (delta == NULL)
+    {
+      delta = g_array_new (FALSE, FALSE, sizeof (guint32));
+      g_hash_table_insert (self->priv->delta,
+          g_memdup (&trigram, sizeof (trigram)), delta);
+    }
+
+  g_array_insert_val (delta, lo, document);
+
+  self->priv->dirty = TRUE;
+  self->priv->changed = TRUE;
+}
+
+static guint
+log_index_ensure_entity (EmpathyLogIndex *self,
+    const gchar *account_path,
+    const gchar *id,
+    TplEntityType type)
+{
+  IndexEntity *entity;
+  gchar *key;
+  gpointer number;
+
+  key = g_strdup_printf ("%s\n%s", account_path, id);
+  number = g_hash_table_lookup (self->priv->entity_numbers, key);
+
+  if (number != NULL)
+    {
+      g_free (key);
+      return GPOINTER_TO_UINT (number) - 1;
+    }
+
+  entity = g_slice_new0 (IndexEntity);
+  entity->account_path = g_strdup (account_path);
+  entity->id = g_strdup (id);
+  entity->type = type;
+
+  g_ptr_array_add (self->priv->entities, entity);
+  g_hash_table_insert (self->priv->entity_numbers, key,
+      GUINT_TO_POINTER (self->priv->entities->len));
+
+  return self->priv->entities->len - 1;
+}
+
+static guint32
+log_index_ensure_document (EmpathyLogIndex *self,
+    guint32 entity,
+    guint32 julian)
+{
+  IndexDocument document = { entity, julian };
+  gint64 key = ((gint64) entity << 32) | julian;
+  gpointer number;
+
+  number = g_hash_table_lookup (self->priv->document_numbers, &key);
+  if (number != NULL)
+    return GPOINTER_TO_UINT (number) - 1;
+
+  g_array_append_val (self->priv->documents, document);
+  g_hash_table_insert (self->priv->document_numbers,
+      g_memdup (&key, sizeof (key)),
+      GUINT_TO_POINTER (self->priv->documents->len));
+
+  self->priv->dirty = TRUE;
+
+  return self->priv->documents->len - 1;
+}
+
+static void
+log_index_map_postings (EmpathyLogIndex *self,
+    GVariant *index)
+{
+  tp_clear_pointer (&self->priv->postings, g_variant_unref);
+  self->priv->postings = g_variant_get_child_value (index, 3);
+}
+
+static GVariant *
+log_index_read_file (EmpathyLogIndex *self)
+{
+  GMappedFile *mapped;
+  GVariant *index;
+  GBytes *bytes;
+  guint32 version;
+
+  mapped = g_mapped_file_new (self->priv->filename, FALSE, NULL);
+  if (mapped == NULL)
+    return NULL;
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+
+  /* Not trusted, so GLib hands out empty values for malformed parts of a
+   * corrupted file. The numbers it contains are checked by
+   * log_index_load(). */
+  index = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (LOG_INDEX_TYPE), bytes, FALSE));
+  g_bytes_unref (bytes);
+
+  g_variant_get_child (index, 0, "u", &version);
+  if (version != LOG_INDEX_VERSION)
+    {
+      DEBUG ("Ignoring index version %u", version);
+      g_variant_unref (index);
+      return NULL;
+    }
+
+  return index;
+}
+
+/* Whether the posting lists of the file are sorted by trigram, as lookups
+ * expect, and are sorted lists of existing documents */
+static gboolean
+log_index_check_postings (GVariant *postings,
+    guint n_documents)
+{
+  guint64 last_trigram = 0;
+  gsize i, n;
+
+  n = g_variant_n_children (postings);
+  for (i = 0; i < n; i++)
+    {
+      GVariant *child, *documents;
+      const guint32 *numbers;
+      guint64 trigram;
+      gboolean valid;
+      gsize j, n_numbers;
+
+      child = g_variant_get_child_value (postings, i);
+      g_variant_get_child (child, 0, "t", &trigram);
+      documents = g_variant_get_child_value (child, 1);
+      numbers = g_variant_get_fixed_array (documents, &n_numbers,
+          sizeof (guint32));
+
+      valid = (i == 0 || trigram > last_trigram);
+      for (j = 0; valid && j < n_numbers; j++)
+        valid = numbers[j] < n_documents &&
+          (j == 0 || numbers[j - 1] < numbers[j]);
+
+      g_variant_unref (documents);
+      g_variant_unref (child);
+
+      if (!valid)
+        return FALSE;
+
+      last_trigram = trigram;
+    }
+
+  return TRUE;
+}
+
+static void
+log_index_load (EmpathyLogIndex *self)
+{
+  GVariant *index, *entities, *documents, *postings;
+  GVariantIter iter;
+  const gchar *account_path, *id;
+  guint32 type, julian, entity;
+  gboolean valid = TRUE;
+
+  index = log_index_read_file (self);
+  if (index == NULL)
+    return;
+
+  /* Everything refers to entities and documents by their position, so
+   * each of them must only be once in the file */
+  entities = g_variant_get_child_value (index, 1);
+  g_variant_iter_init (&iter, entities);
+  while (valid && g_variant_iter_next (&iter, "(&s&suu)", &account_path, &id,
+        &type, &julian))
+    {
+      guint n = self->priv->entities->len;
+
+      valid = log_index_ensure_entity (self, account_path, id, type) == n;
+      if (valid)
+        ((IndexEntity *) g_ptr_array_index (self->priv->entities,
+            n))->last_julian = julian;
+    }
+  g_variant_unref (entities);
+
+  documents = g_variant_get_child_value (index, 2);
+  g_variant_iter_init (&iter, documents);
+  while (valid && g_variant_iter_next (&iter, "(uu)", &entity, &julian))
+    {
+      guint n = self->priv->documents->len;
+
+      valid = entity < self->priv->entities->len &&
+        log_index_ensure_document (self, entity, julian) == n;
+    }
+  g_variant_unref (documents);
+
+  postings = g_variant_get_child_value (index, 3);
+  valid = valid &&
+    log_index_check_postings (postings, self->priv->documents->len);
+  g_variant_unref (postings);
+
+  if (!valid)
+    {
+      DEBUG ("Ignoring corrupted index %s", self->priv->filename);
+
+      g_ptr_array_set_size (self->priv->entities, 0);
+      g_hash_table_remove_all (self->priv->entity_numbers);
+      g_array_set_size (self->priv->documents, 0);
+      g_hash_table_remove_all (self->priv->document_numbers);
+      self->priv->dirty = FALSE;
+      g_variant_unref (index);
+      return;
+    }
+
+  log_index_map_postings (self, index);
+  g_variant_unref (index);
+
+  self->priv->dirty = FALSE;
+  self->priv->ready = TRUE;
+
+  DEBUG ("Loaded index of %u days with %u entities",
+      self->priv->documents->len, self->priv->entities->len);
+}
+
+static void
+log_index_save (EmpathyLogIndex *self)
+{
+  GVariantBuilder entities, documents, postings;
+  GVariant *index;
+  GHashTableIter hash_iter;
+  GArray *trigrams;
+  gpointer key;
+  gchar *dirname;
+  gsize i = 0, j = 0, n_file = 0;
+  GError *error = NULL;
+
+  g_variant_builder_init (&entities, G_VARIANT_TYPE ("a(ssuu)"));
+  for (i = 0; i < self->priv->entities->len; i++)
+    {
+      IndexEntity *entity = g_ptr_array_index (self->priv->entities, i);
+
+      g_variant_builder_add (&entities, "(ssuu)", entity->account_path,
+          entity->id, entity->type, entity->last_julian);
+    }
+
+  g_variant_builder_init (&documents, G_VARIANT_TYPE ("a(uu)"));
+  for (i = 0; i < self->priv->documents->len; i++)
+    {
+      IndexDocument *document = &g_array_index (self->priv->documents,
+          IndexDocument, i);
+
+      g_variant_builder_add (&documents, "(uu)", document->entity,
+          document->julian);
+    }
+
+  trigrams = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+      g_hash_table_size (self->priv->delta));
+  g_hash_table_iter_init (&hash_iter, self->priv->delta);
+  while (g_hash_table_iter_next (&hash_iter, &key, NULL))
+    g_array_append_val (trigrams, *(guint64 *) key);
+  g_array_sort (trigrams, compare_guint64);
+
+  /* Merge the posting lists of the file with the new ones, both sorted by
+   * trigram */
+  if (self->priv->postings != NULL)
+    n_file = g_variant_n_children (self->priv->postings);
+
+  g_variant_builder_init (&postings, G_VARIANT_TYPE ("a(tau)"));
+  i = 0;
+  while (i < n_file || j < trigrams->len)
+    {
+      GVariant *child = NULL;
+      guint64 file_trigram = G_MAXUINT64;
+      guint64 trigram;
+
+      if (i < n_file)
+        {
+          child = g_variant_get_child_value (self->priv->postings, i);
+          g_variant_get_child (child, 0, "t", &file_trigram);
+        }
+
+      if (j < trigrams->len &&
+          (child == NULL ||
+           g_array_index (trigrams, guint64, j) <= file_trigram))
+        {
+          GArray *delta, *merged;
+          const guint32 *file_documents = NULL;
+          GVariant *file_postings = NULL;
+          gsize n = 0;
+
+          trigram = g_array_index (trigrams, guint64, j++);
+          delta = g_hash_table_lookup (self->priv->delta, &trigram);
+
+          if (child != NULL && trigram == file_trigram)
+            {
+              file_postings = g_variant_get_child_value (child, 1);
+              file_documents = g_variant_get_fixed_array (file_postings, &n,
+                  sizeof (guint32));
+              i++;
+            }
+
+          merged = postings_union (file_documents, n,
+              (guint32 *) delta->data, delta->len);
+
+          g_variant_builder_add (&postings, "(t@au)", trigram,
+              g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                merged->data, merged->len, sizeof (guint32)));
+
+          g_array_unref (merged);
+          if (file_postings != NULL)
+            g_variant_unref (file_postings);
+        }
+      else
+        {
+          g_variant_builder_add_value (&postings, child);
+          i++;
+        }
+
+      if (child != NULL)
+        g_variant_unref (child);
+    }
+
+  g_array_unref (trigrams);
+
+  index = g_variant_ref_sink (g_variant_new ("(u@a(ssuu)@a(uu)@a(tau))",
+        LOG_INDEX_VERSION,
+        g_variant_builder_end (&entities),
+        g_variant_builder_end (&documents),
+        g_variant_builder_end (&postings)));
+
+  dirname = g_path_get_dirname (self->priv->filename);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (!g_file_set_contents (self->priv->filename, g_variant_get_data (index),
+        g_variant_get_size (index), &error))
+    {
+      DEBUG ("Failed to write %s: %s", self->priv->filename, error->message);
+      g_error_free (error);
+
+      /* Keep the new postings in memory, so we can try again later */
+      g_variant_unref (index);
+      return;
+    }
+
+  g_variant_unref (index);
+
+  DEBUG ("Wrote index of %u days", self->priv->documents->len);
+
+  /* Search the written file in place rather than the copy in memory */
+  tp_clear_pointer (&self->priv->postings, g_variant_unref);
+  g_hash_table_remove_all (self->priv->delta);
+  self->priv->dirty = FALSE;
+
+  index = log_index_read_file (self);
+  if (index != NULL)
+    {
+      log_index_map_postings (self, index);
+      g_variant_unref (index);
+    }
+}
+
+/* Appends the posting list @documents, renumbered with @document_map, to
+ * the ones of @trigram in @delta */
+static void
+log_index_add_remapped_postings (GHashTable *delta,
+    guint64 trigram,
+    const guint32 *documents,
+    gsize n,
+    const guint32 *document_map)
+{
+  GArray *remapped, *existing;
+  gsize i;
+
+  remapped = g_array_sized_new (FALSE, FALSE, sizeof (guint32), n);
+
+  /* Renumbering keeps the order of the documents, so the list stays
+   * sorted */
+  for (i = 0; i < n; i++)
+    {
+      guint32 document = document_map[documents[i]];
+
+      if (document != G_MAXUINT32)
+        g_array_append_val (remapped, document);
+    }
+
+  if (remapped->len == 0)
+    {
+      g_array_unref (remapped);
+      return;
+    }
+
+  existing = g_hash_table_lookup (delta, &trigram);
+  if (existing != NULL)
+    {
+      GArray *merged;
+
+      merged = postings_union ((guint32 *) existing->data, existing->len,
+          (guint32 *) remapped->data, remapped->len);
+      g_array_unref (remapped);
+      remapped = merged;
+    }
+
+  g_hash_table_insert (delta, g_memdup (&trigram, sizeof (trigram)),
+      remapped);
+}
+
+/* Forgets the entities of @account_path, or all of them if it's NULL, and
+ * their documents. The others are renumbered and all the postings are
+ * moved to memory, until log_index_save() writes them. */
+static void
+log_index_remove_account (EmpathyLogIndex *self,
+    const gchar *account_path)
+{
+  GPtrArray *old_entities;
+  GArray *old_documents;
+  GHashTable *old_delta;
+  GHashTableIter iter;
+  gpointer key, value;
+  guint32 *entity_map, *document_map;
+  guint i, n_entities, n_documents;
+
+  old_entities = self->priv->entities;
+  old_documents = self->priv->documents;
+  old_delta = self->priv->delta;
+  n_entities = old_entities->len;
+  n_documents = old_documents->len;
+
+  self->priv->entities = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) index_entity_free);
+  g_hash_table_remove_all (self->priv->entity_numbers);
+  self->priv->documents = g_array_new (FALSE, FALSE, sizeof (IndexDocument));
+  g_hash_table_remove_all (self->priv->document_numbers);
+  self->priv->delta = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+      g_free, (GDestroyNotify) g_array_unref);
+
+  entity_map = g_new (guint32, n_entities);
+  for (i = 0; i < n_entities; i++)
+    {
+      IndexEntity *entity = g_ptr_array_index (old_entities, i);
+      guint number;
+
+      if (account_path == NULL ||
+          !tp_strdiff (entity->account_path, account_path))
+        {
+          entity_map[i] = G_MAXUINT32;
+          continue;
+        }
+
+      number = log_index_ensure_entity (self, entity->account_path,
+          entity->id, entity->type);
+      ((IndexEntity *) g_ptr_array_index (self->priv->entities,
+          number))->last_julian = entity->last_julian;
+      entity_map[i] = number;
+    }
+
+  document_map = g_new (guint32, n_documents);
+  for (i = 0; i < n_documents; i++)
+    {
+      IndexDocument *document = &g_array_index (old_documents,
+          IndexDocument, i);
+
+      if (entity_map[document->entity] == G_MAXUINT32)
+        document_map[i] = G_MAXUINT32;
+      else
+        document_map[i] = log_index_ensure_document (self,
+            entity_map[document->entity], document->julian);
+    }
+
+  if (self->priv->postings != NULL)
+    {
+      gsize n = g_variant_n_children (self->priv->postings);
+      gsize j;
+
+      for (j = 0; j < n; j++)
+        {
+          GVariant *child, *documents;
+          const guint32 *data;
+          gsize n_data;
+          guint64 trigram;
+
+          child = g_variant_get_child_value (self->priv->postings, j);
+          g_variant_get_child (child, 0, "t", &trigram);
+          documents = g_variant_get_child_value (child, 1);
+          data = g_variant_get_fixed_array (documents, &n_data,
+              sizeof (guint32));
+
+          log_index_add_remapped_postings (self->priv->delta, trigram, data,
+              n_data, document_map);
+
+          g_variant_unref (documents);
+          g_variant_unref (child);
+        }
+    }
+
+  g_hash_table_iter_init (&iter, old_delta);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      GArray *documents = value;
+
+      log_index_add_remapped_postings (self->priv->delta,
+          *(guint64 *) key, (guint32 *) documents->data, documents->len,
+          document_map);
+    }
+
+  tp_clear_pointer (&self->priv->postings, g_variant_unref);
+  self->priv->dirty = TRUE;
+  self->priv->changed = TRUE;
+
+  DEBUG ("Removed %u of %u days", n_documents - self->priv->documents->len,
+      n_documents);
+
+  g_free (entity_map);
+  g_free (document_map);
+  g_ptr_array_unref (old_entities);
+  g_array_unref (old_documents);
+  g_hash_table_unref (old_delta);
+}
+
+static void
+log_index_update_done (EmpathyLogIndex *self)
+{
+  guint i;
+
+  DEBUG ("Index updated, %u days with %u entities",
+      self->priv->documents->len, self->priv->entities->len);
+
+  /* The update may have read logs which are gone now */
+  for (i = 0; i < self->priv->pending_clears->len; i++)
+    log_index_remove_account (self,
+        g_ptr_array_index (self->priv->pending_clears, i));
+  g_ptr_array_set_size (self->priv->pending_clears, 0);
+
+  self->priv->updating = FALSE;
+  self->priv->ready = TRUE;
+  self->priv->last_update = g_get_monotonic_time ();
+
+  if (self->priv->dirty)
+    log_index_save (self);
+
+  if (self->priv->changed)
+    {
+      self->priv->changed = FALSE;
+      g_signal_emit (self, signals[UPDATED], 0);
+    }
+}
+
+static void
+log_index_check_update_done (EmpathyLogIndex *self)
+{
+  if (self->priv->n_queries == 0 && self->priv->n_accounts_pending == 0)
+    log_index_update_done (self);
+}
+
+static void
+query_done (PendingQuery *query)
+{
+  EmpathyLogIndex *self = query->self;
+  IndexEntity *entity;
+
+  entity = g_ptr_array_index (self->priv->entities, query->entity_number);
+
+  /* The last indexed day only moves once all the days have been read, so
+   * an interrupted update starts again from the same point */
+  if (query->type == QUERY_EVENTS && --entity->n_pending == 0 &&
+      entity->update_julian > entity->last_julian)
+    {
+      entity->last_julian = entity->update_julian;
+      self->priv->dirty = TRUE;
+    }
+
+  empathy_log_query_queue_done ();
+
+  self->priv->n_queries--;
+  log_index_check_update_done (self);
+}
+
+static void
+get_events_for_date_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  PendingQuery *query = user_data;
+  EmpathyLogIndex *self = query->self;
+  GList *events, *l;
+  GError *error = NULL;
+
+  if (!tpl_log_manager_get_events_for_date_finish (self->priv->log_manager,
+        result, &events, &error))
+    {
+      DEBUG ("Unable to get events: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      GArray *trigrams;
+      guint32 document;
+      guint i;
+
+      trigrams = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+      for (l = events; l != NULL; l = g_list_next (l))
+        {
+          if (!TPL_IS_TEXT_EVENT (l->data))
+            continue;
+
+          log_index_add_trigrams (trigrams,
+              tpl_text_event_get_message (l->data));
+        }
+
+      sort_unique (trigrams);
+
+      if (trigrams->len > 0)
+        {
+          document = log_index_ensure_document (self, query->entity_number,
+              g_date_get_julian (query->date));
+
+          for (i = 0; i < trigrams->len; i++)
+            log_index_add_posting (self,
+                g_array_index (trigrams, guint64, i), document);
+        }
+
+      g_array_unref (trigrams);
+      g_list_free_full (events, g_object_unref);
+    }
+
+  query_done (query);
+  pending_query_free (query);
+}
+
+static void start_query (gpointer user_data);
+
+static void
+push_query (EmpathyLogIndex *self,
+    PendingQuery *query)
+{
+  self->priv->n_queries++;
+  empathy_log_query_queue_push (start_query, query);
+}
+
+static void
+get_dates_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  PendingQuery *query = user_data;
+  EmpathyLogIndex *self = query->self;
+  IndexEntity *entity;
+  GList *dates, *l;
+  GError *error = NULL;
+
+  entity = g_ptr_array_index (self->priv->entities, query->entity_number);
+
+  if (!tpl_log_manager_get_dates_finish (self->priv->log_manager,
+        result, &dates, &error))
+    {
+      DEBUG ("Unable to get dates: %s", error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  for (l = dates; l != NULL; l = g_list_next (l))
+    {
+      PendingQuery *events_query;
+      guint32 julian = g_date_get_julian (l->data);
+
+      /* The last indexed day may have been logged to since */
+      if (julian < entity->last_julian)
+        continue;
+
+      events_query = pending_query_new (self, QUERY_EVENTS, query->account,
+          query->entity, query->entity_number);
+      events_query->date = g_date_copy (l->data);
+
+      entity->n_pending++;
+      entity->update_julian = MAX (entity->update_julian, julian);
+
+      push_query (self, events_query);
+    }
+
+  g_list_free_full (dates, (GDestroyNotify) g_date_free);
+
+out:
+  query_done (query);
+  pending_query_free (query);
+}
+
+static void
+start_query (gpointer user_data)
+{
+  PendingQuery *query = user_data;
+  EmpathyLogIndex *self = query->self;
+
+  if (query->type == QUERY_DATES)
+    tpl_log_manager_get_dates_async (self->priv->log_manager,
+        query->account, query->entity, TPL_EVENT_MASK_TEXT,
+        get_dates_cb, query);
+  else
+    tpl_log_manager_get_events_for_date_async (self->priv->log_manager,
+        query->account, query->entity, TPL_EVENT_MASK_TEXT, query->date,
+        get_events_for_date_cb, query);
+}
+
+static void
+get_entities_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  PendingQuery *account_query = user_data;
+  EmpathyLogIndex *self = account_query->self;
+  const gchar *account_path;
+  GList *entities, *l;
+  GError *error = NULL;
+
+  account_path = tp_proxy_get_object_path (account_query->account);
+
+  if (!tpl_log_manager_get_entities_finish (self->priv->log_manager,
+        result, &entities, &error))
+    {
+      DEBUG ("Unable to get entities of %s: %s", account_path,
+          error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  for (l = entities; l != NULL; l = g_list_next (l))
+    {
+      TplEntity *entity = l->data;
+      guint number;
+
+      number = log_index_ensure_entity (self, account_path,
+          tpl_entity_get_identifier (entity),
+          tpl_entity_get_entity_type (entity));
+
+      push_query (self, pending_query_new (self, QUERY_DATES,
+            account_query->account, entity, number));
+    }
+
+  g_list_free_full (entities, g_object_unref);
+
+out:
+  self->priv->n_accounts_pending--;
+  log_index_check_update_done (self);
+
+  g_object_unref (account_query->self);
+  g_object_unref (account_query->account);
+  g_slice_free (PendingQuery, account_query);
+}
+
+static void
+account_manager_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  EmpathyLogIndex *self = user_data;
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (source, result, &error))
+    {
+      DEBUG ("Failed to prepare account manager: %s", error->message);
+      g_error_free (error);
+      self->priv->updating = FALSE;
+      goto out;
+    }
+
+  accounts = tp_account_manager_dup_valid_accounts (
+      self->priv->account_manager);
+
+  for (l = accounts; l != NULL; l = g_list_next (l))
+    {
+      PendingQuery *account_query;
+
+      account_query = g_slice_new0 (PendingQuery);
+      account_query->self = g_object_ref (self);
+      account_query->account = g_object_ref (l->data);
+
+      self->priv->n_accounts_pending++;
+
+      tpl_log_manager_get_entities_async (self->priv->log_manager,
+          l->data, get_entities_cb, account_query);
+    }
+
+  g_list_free_full (accounts, g_object_unref);
+
+  log_index_check_update_done (self);
+
+out:
+  g_object_unref (self);
+}
+
+/**
+ * empathy_log_index_update:
+ * @self: the index
+ *
+ * Indexes, in the background, the messages logged since the last update.
+ * Does nothing if an update is running or finished less than a minute ago.
+ * #EmpathyLogIndex::updated is emitted if new messages were indexed.
+ */
+void
+empathy_log_index_update (EmpathyLogIndex *self)
+{
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+
+  if (self->priv->updating)
+    return;
+
+  if (self->priv->last_update != 0 &&
+      g_get_monotonic_time () - self->priv->last_update < UPDATE_INTERVAL)
+    return;
+
+  DEBUG ("Updating index");
+
+  self->priv->updating = TRUE;
+
+  tp_proxy_prepare_async (self->priv->account_manager, NULL,
+      account_manager_prepared_cb, g_object_ref (self));
+}
+
+/**
+ * empathy_log_index_clear:
+ * @self: the index
+ * @account: the account whose logs were cleared, or %NULL for all of them
+ *
+ * Removes the messages of @account from the index, to be called when its
+ * logs are cleared. #EmpathyLogIndex::updated is emitted once they are
+ * gone.
+ */
+void
+empathy_log_index_clear (EmpathyLogIndex *self,
+    TpAccount *account)
+{
+  const gchar *account_path = NULL;
+
+  g_return_if_fail (EMPATHY_IS_LOG_INDEX (self));
+  g_return_if_fail (account == NULL || TP_IS_ACCOUNT (account));
+
+  if (account != NULL)
+    account_path = tp_proxy_get_object_path (account);
+
+  /* Running queries refer to the entities by their number */
+  if (self->priv->updating)
+    {
+      DEBUG ("Update running, clearing %s once it's done",
+          account_path != NULL ? account_path : "all accounts");
+      g_ptr_array_add (self->priv->pending_clears, g_strdup (account_path));
+      return;
+    }
+
+  log_index_remove_account (self, account_path);
+  log_index_save (self);
+
+  self->priv->changed = FALSE;
+  g_signal_emit (self, signals[UPDATED], 0);
+}
+
+/**
+ * empathy_log_index_can_search:
+ * @self: the index
+ * @text: the text to search
+ *
+ * Returns: %TRUE if the index has been built and @text is long enough to
+ * be looked up in it
+ */
+gboolean
+empathy_log_index_can_search (EmpathyLogIndex *self,
+    const gchar *text)
+{
+  g_return_val_if_fail (EMPATHY_IS_LOG_INDEX (self), FALSE);
+
+  return self->priv->ready && text != NULL &&
+    g_utf8_validate (text, -1, NULL) && g_utf8_strlen (text, -1) >= 3;
+}
+
+static gint
+compare_documents (gconstpointer a,
+    gconstpointer b,
+    gpointer user_data)
+{
+  GArray *documents = user_data;
+  const IndexDocument *x, *y;
+
+  x = &g_array_index (documents, IndexDocument, *(const guint32 *) a);
+  y = &g_array_index (documents, IndexDocument, *(const guint32 *) b);
+
+  if (x->julian != y->julian)
+    return x->julian < y->julian ? -1 : 1;
+
+  return x->entity < y->entity ? -1 : x->entity > y->entity;
+}
+
+/**
+ * empathy_log_index_search:
+ * @self: the index
+ * @text: the text to search, see empathy_log_index_can_search()
+ *
+ * Finds the days when a text message containing @text, ignoring case, was
+ * logged.
+ *
+ * Returns: a list of #TplLogSearchHit, as tpl_log_manager_search_finish()
+ * would. Free with tpl_log_manager_search_free().
+ */
+GList *
+empathy_log_index_search (EmpathyLogIndex *self,
+    const gchar *text)
+{
+  TpSimpleClientFactory *factory;
+  GArray *trigrams, *result = NULL;
+  GList *hits = NULL;
+  gint64 start;
+  guint i;
+
+  g_return_val_if_fail (empathy_log_index_can_search (self, text), NULL);
+
+  start = g_get_monotonic_time ();
+
+  trigrams = g_array_new (FALSE, FALSE, sizeof (guint64));
+  log_index_add_trigrams (trigrams, text);
+  sort_unique (trigrams);
+
+  for (i = 0; i < trigrams->len; i++)
+    {
+      GArray *documents;
+
+      documents = log_index_dup_postings (self,
+          g_array_index (trigrams, guint64, i));
+
+      if (result == NULL)
+        {
+          result = documents;
+        }
+      else
+        {
+          postings_intersect (result, documents);
+          g_array_unref (documents);
+        }
+
+      if (result->len == 0)
+        break;
+    }
+
+  g_array_unref (trigrams);
+
+  if (result == NULL)
+    return NULL;
+
+  g_array_sort_with_data (result, compare_documents, self->priv->documents);
+
+  factory = tp_proxy_get_factory (self->priv->account_manager);
+
+  for (i = result->len; i > 0; i--)
+    {
+      IndexDocument *document;
+      IndexEntity *entity;
+      TplLogSearchHit *hit;
+      TpAccount *account;
+
+      document = &g_array_index (self->priv->documents, IndexDocument,
+          g_array_index (result, guint32, i - 1));
+      entity = g_ptr_array_index (self->priv->entities, document->entity);
+
+      account = tp_simple_client_factory_ensure_account (factory,
+          entity->account_path, NULL, NULL);
+      if (account == NULL)
+        continue;
+
+      /* Allocated like tpl does, so tpl_log_manager_search_free() can free
+       * it */
+      hit = g_slice_new0 (TplLogSearchHit);
+      hit->account = account;
+      hit->target = tpl_entity_new (entity->id, entity->type, entity->id,
+          NULL);
+      hit->date = g_date_new_julian (document->julian);
+
+      hits = g_list_prepend (hits, hit);
+    }
+
+  DEBUG ("Found %u days for '%s' in %" G_GINT64_FORMAT " us", result->len,
+      text, g_get_monotonic_time () - start);
+
+  g_array_unref (result);
+
+  return hits;
+}
+
+/* Indexes @text as if it had been logged with @id on @date, without
+ * reading the logs. For the tests. */
+void
+_empathy_log_index_add_text (EmpathyLogIndex *self,
+    const gchar *account_path,
+    const gchar *id,
+    TplEntityType type,
+    GDate *date,
+    const gchar *text)
+{
+  GArray *trigrams;
+  guint32 document;
+  guint entity, i;
+
+  entity = log_index_ensure_entity (self, account_path, id, type);
+  document = log_index_ensure_document (self, entity,
+      g_date_get_julian (date));
+
+  trigrams = g_array_new (FALSE, FALSE, sizeof (guint64));
+  log_index_add_trigrams (trigrams, text);
+  sort_unique (trigrams);
+
+  for (i = 0; i < trigrams->len; i++)
+    log_index_add_posting (self, g_array_index (trigrams, guint64, i),
+        document);
+
+  g_array_unref (trigrams);
+}
+
+/* Finishes like an update does: writes the index and makes it
+ * searchable. For the tests. */
+void
+_empathy_log_index_update_done (EmpathyLogIndex *self)
+{
+  log_index_update_done (self);
+}
+
+static void
+log_index_finalize (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  /* Queued queries hold a ref on the index */
+  g_assert (self->priv->n_queries == 0);
+
+  g_ptr_array_unref (self->priv->pending_clears);
+  g_ptr_array_unref (self->priv->entities);
+  g_hash_table_unref (self->priv->entity_numbers);
+  g_array_unref (self->priv->documents);
+  g_hash_table_unref (self->priv->document_numbers);
+  g_hash_table_unref (self->priv->delta);
+  tp_clear_pointer (&self->priv->postings, g_variant_unref);
+  g_free (self->priv->filename);
+  g_object_unref (self->priv->log_manager);
+  g_object_unref (self->priv->account_manager);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->finalize (object);
+}
+
+static GObject *
+log_index_constructor (GType type,
+    guint n_props,
+    GObjectConstructParam *props)
+{
+  GObject *retval;
+
+  if (singleton != NULL)
+    {
+      retval = g_object_ref (singleton);
+    }
+  else
+    {
+      retval = G_OBJECT_CLASS (empathy_log_index_parent_class)->
+        constructor (type, n_props, props);
+
+      singleton = EMPATHY_LOG_INDEX (retval);
+      g_object_add_weak_pointer (retval, (gpointer) &singleton);
+    }
+
+  return retval;
+}
+
+static void
+log_index_constructed (GObject *object)
+{
+  EmpathyLogIndex *self = EMPATHY_LOG_INDEX (object);
+
+  G_OBJECT_CLASS (empathy_log_index_parent_class)->constructed (object);
+
+  log_index_load (self);
+}
+
+static void
+empathy_log_index_class_init (EmpathyLogIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = log_index_finalize;
+  object_class->constructor = log_index_constructor;
+  object_class->constructed = log_index_constructed;
+
+  /**
+   * EmpathyLogIndex::updated:
+   * @self: the index
+   *
+   * Emitted when an update indexed new messages, or when messages were
+   * removed by empathy_log_index_clear(), so searches may return other
+   * hits.
+   */
+  signals[UPDATED] =
+      g_signal_new ("updated",
+          G_TYPE_FROM_CLASS (klass),
+          G_SIGNAL_RUN_LAST,
+          0,
+          NULL, NULL,
+          g_cclosure_marshal_generic,
+          G_TYPE_NONE, 0);
+
+  g_type_class_add_private (object_class, sizeof (EmpathyLogIndexPriv));
+}
+
+static void
+empathy_log_index_init (EmpathyLogIndex *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_LOG_INDEX, EmpathyLogIndexPriv);
+
+  self->priv->log_manager = tpl_log_manager_dup_singleton ();
+  self->priv->account_manager = tp_account_manager_dup ();
+  self->priv->filename = g_build_filename (g_get_user_cache_dir (),
+      "empathy", "log-index", NULL);
+
+  self->priv->entities = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) index_entity_free);
+  self->priv->entity_numbers = g_hash_table_new_full (g_str_hash,
+      g_str_equal, g_free, NULL);
+  self->priv->documents = g_array_new (FALSE, FALSE, sizeof (IndexDocument));
+  self->priv->document_numbers = g_hash_table_new_full (g_int64_hash,
+      g_int64_equal, g_free, NULL);
+  self->priv->delta = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+      g_free, (GDestroyNotify) g_array_unref);
+  self->priv->pending_clears = g_ptr_array_new_with_free_func (g_free);
+}
+
+EmpathyLogIndex *
+empathy_log_index_dup_singleton (void)
+{
+  return g_object_new (EMPATHY_TYPE_LOG_INDEX, NULL);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-log-query-queue.h"
+
+/* The indexes built in the background from the logs share this queue, so
+ * together they don't keep the logger busier than one of them would */
+
+/* Number of log queries running at the same time */
+#define MAX_RUNNING_QUERIES 4
+
+typedef struct
+{
+  EmpathyLogQueryFunc start;
+  gpointer user_data;
+} QueuedQuery;
+
+/* owned QueuedQuery, waiting for a free slot */
+static GQueue queries = G_QUEUE_INIT;
+static guint n_running = 0;
+
+static void
+log_query_queue_run (void)
+{
+  while (n_running < MAX_RUNNING_QUERIES && !g_queue_is_empty (&queries))
+    {
+      QueuedQuery *query = g_queue_pop_head (&queries);
+
+      n_running++;
+      query->start (query->user_data);
+
+      g_slice_free (QueuedQuery, query);
+    }
+}
+
+/* Calls @start once fewer than MAX_RUNNING_QUERIES queries are running */
+void
+empathy_log_query_queue_push (EmpathyLogQueryFunc start,
+    gpointer user_data)
+{
+  QueuedQuery *query;
+
+  g_return_if_fail (start != NULL);
+
+  query = g_slice_new (QueuedQuery);
+  query->start = start;
+  query->user_data = user_data;
+
+  g_queue_push_tail (&queries, query);
+  log_query_queue_run ();
+}
+
+void
+empathy_log_query_queue_done (void)
+{
+  g_return_if_fail (n_running > 0);
+
+  n_running--;
+  log_query_queue_run ();
+}
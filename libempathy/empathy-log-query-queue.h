@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_LOG_QUERY_QUEUE_H__
+#define __EMPATHY_LOG_QUERY_QUEUE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Starts an asynchronous log query, which has to call
+ * empathy_log_query_queue_done() once finished */
+typedef void (*EmpathyLogQueryFunc) (gpointer user_data);
+
+void empathy_log_query_queue_push (EmpathyLogQueryFunc start,
+    gpointer user_data);
+void empathy_log_query_queue_done (void);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_LOG_QUERY_QUEUE_H__ */
@@ -322,6 +322,26 @@ message_set_property (GObject      *object,
 
 EmpathyMessage *
 empathy_message_from_tpl_log_event (TplEvent *logevent)
+{
+	return empathy_message_from_tpl_log_event_memo (logevent, NULL);
+}
+
+static EmpathyContact *
+message_contact_from_tpl_contact (EmpathyContactMemo *memo,
+				  TpAccount *account,
+				  TplEntity *entity)
+{
+	if (memo != NULL)
+		return empathy_contact_memo_from_tpl_contact (memo, account, entity);
+
+	return empathy_contact_from_tpl_contact (account, entity);
+}
+
+/* Same as empathy_message_from_tpl_log_event (), resolving the sender and
+ * receiver through @memo if it's not %NULL */
+EmpathyMessage *
+empathy_message_from_tpl_log_event_memo (TplEvent *logevent,
+					 EmpathyContactMemo *memo)
 {
 	EmpathyMessage *retval = NULL;
 	EmpathyClientFactory *factory;
@@ -411,13 +431,13 @@ empathy_message_from_tpl_log_event (TplEvent *logevent)
 		NULL);
 
 	if (receiver != NULL) {
-		contact = empathy_contact_from_tpl_contact (account, receiver);
+		contact = message_contact_from_tpl_contact (memo, account, receiver);
 		empathy_message_set_receiver (retval, contact);
 		g_object_unref (contact);
 	}
 
 	if (sender != NULL) {
-		contact = empathy_contact_from_tpl_contact (account, sender);
+		contact = message_contact_from_tpl_contact (memo, account, sender);
 		empathy_message_set_sender (retval, contact);
 		g_object_unref (contact);
 	}
@@ -55,6 +55,8 @@ struct _EmpathyMessageClass {
 GType                    empathy_message_get_type          (void) G_GNUC_CONST;
 
 EmpathyMessage *         empathy_message_from_tpl_log_event (TplEvent                *logevent);
+EmpathyMessage *         empathy_message_from_tpl_log_event_memo (TplEvent          *logevent,
+								  EmpathyContactMemo *memo);
 EmpathyMessage *         empathy_message_new_from_tp_message (TpMessage *tp_msg,
 							      gboolean incoming);
 
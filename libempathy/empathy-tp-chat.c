@@ -38,6 +38,8 @@ struct _EmpathyTpChatPrivate
   GList *members;
   /* Queue of messages signalled but not acked yet */
   GQueue *pending_messages_queue;
+  /* TpMessage -> its link in pending_messages_queue */
+  GHashTable *pending_messages_links;
 
   /* Subject */
   gboolean supports_subject;
@@ -293,6 +295,11 @@ tp_chat_build_message (EmpathyTpChat *self,
     }
 
   g_queue_push_tail (self->priv->pending_messages_queue, message);
+
+  if (!g_hash_table_contains (self->priv->pending_messages_links, msg))
+    g_hash_table_insert (self->priv->pending_messages_links, msg,
+        self->priv->pending_messages_queue->tail);
+
   g_signal_emit (self, signals[MESSAGE_RECEIVED], 0, message);
 }
 
@@ -410,19 +417,6 @@ message_received_cb (TpTextChannel *channel,
   handle_incoming_message (self, message, FALSE);
 }
 
-static gboolean
-find_pending_message_func (gconstpointer a,
-    gconstpointer b)
-{
-  EmpathyMessage *msg = (EmpathyMessage *) a;
-  TpMessage *message = (TpMessage *) b;
-
-  if (empathy_message_get_tp_message (msg) == message)
-    return 0;
-
-  return -1;
-}
-
 static void
 pending_message_removed_cb (TpTextChannel   *channel,
     TpMessage *message,
@@ -430,12 +424,13 @@ pending_message_removed_cb (TpTextChannel   *channel,
 {
   GList *m;
 
-  m = g_queue_find_custom (self->priv->pending_messages_queue, message,
-      find_pending_message_func);
+  m = g_hash_table_lookup (self->priv->pending_messages_links, message);
 
   if (m == NULL)
     return;
 
+  g_hash_table_remove (self->priv->pending_messages_links, message);
+
   g_signal_emit (self, signals[MESSAGE_ACKNOWLEDGED], 0, m->data);
 
   g_object_unref (m->data);
@@ -684,6 +679,7 @@ tp_chat_dispose (GObject *object)
   g_queue_foreach (self->priv->pending_messages_queue,
     (GFunc) g_object_unref, NULL);
   g_queue_clear (self->priv->pending_messages_queue);
+  g_hash_table_remove_all (self->priv->pending_messages_links);
 
   tp_clear_object (&self->priv->ready_result);
 
@@ -699,6 +695,7 @@ tp_chat_finalize (GObject *object)
   DEBUG ("Finalize: %p", object);
 
   g_queue_free (self->priv->pending_messages_queue);
+  g_hash_table_unref (self->priv->pending_messages_links);
   g_hash_table_unref (self->priv->messages_being_sent);
 
   g_free (self->priv->title);
@@ -1080,6 +1077,7 @@ empathy_tp_chat_init (EmpathyTpChat *self)
       EmpathyTpChatPrivate);
 
   self->priv->pending_messages_queue = g_queue_new ();
+  self->priv->pending_messages_links = g_hash_table_new (NULL, NULL);
   self->priv->messages_being_sent = g_hash_table_new_full (
       g_str_hash, g_str_equal, g_free, NULL);
 }
@@ -1184,6 +1182,39 @@ empathy_tp_chat_acknowledge_message (EmpathyTpChat *self,
              tp_msg, NULL, NULL);
 }
 
+/* Acknowledges the incoming messages in @messages, a list of
+ * EmpathyMessage, with a single call to the CM */
+void
+empathy_tp_chat_acknowledge_messages (EmpathyTpChat *self,
+    const GList *messages)
+{
+  const GList *l;
+  GList *tp_msgs = NULL;
+
+  g_return_if_fail (EMPATHY_IS_TP_CHAT (self));
+
+  for (l = messages; l != NULL; l = g_list_next (l))
+    {
+      if (!empathy_message_is_incoming (l->data))
+        continue;
+
+      tp_msgs = g_list_prepend (tp_msgs,
+          empathy_message_get_tp_message (l->data));
+    }
+
+  if (tp_msgs == NULL)
+    return;
+
+  tp_msgs = g_list_reverse (tp_msgs);
+
+  DEBUG ("Acknowledging %u messages", g_list_length (tp_msgs));
+
+  tp_text_channel_ack_messages_async (TP_TEXT_CHANNEL (self),
+      tp_msgs, NULL, NULL);
+
+  g_list_free (tp_msgs);
+}
+
 /**
  * empathy_tp_chat_can_add_contact:
  *
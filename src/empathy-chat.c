@@ -61,6 +61,8 @@ displayed_chats_changed_cb (EmpathyChatManager *mgr,
 static void
 activate_cb (GApplication *application)
 {
+  EmpathyThemeManager *theme_mgr;
+
   if (activated)
     return;
 
@@ -78,6 +80,11 @@ activate_cb (GApplication *application)
 
   empathy_chat_window_present_chat(NULL, 0);
 
+  /* Have views ready for the chats to come */
+  theme_mgr = empathy_theme_manager_dup_singleton ();
+  empathy_theme_manager_prewarm (theme_mgr);
+  g_object_unref (theme_mgr);
+
   g_signal_connect (chat_mgr, "displayed-chats-changed",
       G_CALLBACK (displayed_chats_changed_cb), GUINT_TO_POINTER (1));
 }
@@ -21,6 +21,23 @@
 
 var chat = document.getElementById("Chat");
 
+// Number of chunks of old messages removed from the page by trim(); they
+// are kept by EmpathyThemeAdium until restore() puts them back.
+var evictedChunks = 0;
+var restoring = false;
+
+// Same for the newer messages removed while the user was reading older
+// ones; they were where the NEWER_MARKER element is.
+var NEWER_MARKER = "empathy-evicted-newer";
+var evictedNewerChunks = 0;
+var restoringNewer = false;
+
+// Older messages are fetched from the logs a page at a time when the user
+// scrolls near the top; see beginPrepend() and endPrepend().
+var fetchingBacklog = false;
+var backlogComplete = false;
+var prependHeight = -1;
+
 
 function createHTMLNode(html) {
   var range = document.createRange();
@@ -61,8 +78,27 @@ function removePrependNodes(node) {
 }
 
 
+function postToView(handler, html) {
+  var handlers = window.webkit && window.webkit.messageHandlers;
+
+  if (handlers && handlers[handler])
+    handlers[handler].postMessage(html);
+}
+
+
 function prepend(html) {
   var node = createHTMLNode(html);
+
+  // Older than the evicted messages, so it has to be evicted as well
+  if (evictedChunks > 0) {
+    var div = document.createElement("div");
+
+    div.appendChild(node);
+    evictedChunks++;
+    postToView("empathyEvictedOldest", div.innerHTML);
+    return;
+  }
+
   chat.insertBefore(node, chat.firstChild);
 
   // The lastChild should retain the #insert
@@ -75,6 +111,12 @@ function prepend(html) {
 
 
 function prependPrev(html) {
+  // The message it follows has been evicted
+  if (evictedChunks > 0) {
+    prepend(html);
+    return;
+  }
+
   var pre = chat.firstChild.querySelector("#prepend");
 
   // For themes that don't support #prepend
@@ -90,3 +132,232 @@ function prependPrev(html) {
   for (var i = node.childNodes.length - 2; i > 0; i--)
     contents.insertBefore(node.childNodes[i], pre.nextSibling);
 }
+
+
+// Whether trim() may take @node out of the page
+function canEvict(node) {
+  return node.id != "interleaving_page" && node.id != NEWER_MARKER &&
+    !node.querySelector("#insert");
+}
+
+
+// Remove messages from the page so about @max are left, and hand them over
+// to the view which gives them back with restore() or restoreNewer(). They
+// are taken from whichever end of the page is further from what the user is
+// reading, so a chat left scrolled up doesn't grow either.
+function trim(max) {
+  var count = chat.children.length;
+  var above = document.body.scrollTop;
+  var below = document.body.scrollHeight - above - window.innerHeight;
+
+  if (count <= max + max / 5)
+    return;
+
+  if (above >= below)
+    trimOldest(count - max);
+  else
+    trimNewest(count - max);
+}
+
+
+// Remove up to @n of the oldest messages, leaving the two screens above the
+// viewport alone
+function trimOldest(n) {
+  var height = document.body.scrollHeight;
+  var html = "";
+
+  while (n > 0 && chat.firstChild) {
+    var node = chat.firstChild;
+
+    if (node.nodeType == Node.ELEMENT_NODE) {
+      if (!canEvict(node) ||
+          node.getBoundingClientRect().bottom > -2 * window.innerHeight)
+        break;
+
+      html += node.outerHTML;
+      n--;
+    }
+
+    chat.removeChild(node);
+  }
+
+  document.body.scrollTop -= height - document.body.scrollHeight;
+
+  if (html.length == 0)
+    return;
+
+  evictedChunks++;
+  postToView("empathyEvicted", html);
+}
+
+
+// Remove up to @n of the newest messages, leaving the three screens below
+// the top of the viewport alone. New messages keep being appended to the
+// last one, so it stays and the others are replaced by a marker where
+// restoreNewer() puts them back.
+function trimNewest(n) {
+  var marker = document.getElementById(NEWER_MARKER);
+  var html = "";
+  var node;
+
+  if (marker) {
+    // Those newer messages are being put back
+    if (marker.getBoundingClientRect().top < 3 * window.innerHeight)
+      return;
+
+    node = marker.nextSibling;
+  } else {
+    node = chat.firstElementChild;
+    while (node && node.getBoundingClientRect().top < 3 * window.innerHeight)
+      node = node.nextElementSibling;
+
+    if (!node)
+      return;
+
+    marker = document.createElement("div");
+    marker.id = NEWER_MARKER;
+    chat.insertBefore(marker, node);
+  }
+
+  while (n > 0 && node) {
+    var next = node.nextSibling;
+
+    if (node.nodeType == Node.ELEMENT_NODE) {
+      if (node == chat.lastElementChild || !canEvict(node))
+        break;
+
+      html += node.outerHTML;
+      n--;
+    }
+
+    chat.removeChild(node);
+    node = next;
+  }
+
+  if (html.length == 0) {
+    if (evictedNewerChunks == 0)
+      chat.removeChild(marker);
+    return;
+  }
+
+  evictedNewerChunks++;
+  postToView("empathyEvictedNewer", html);
+}
+
+
+// Put back the most recently evicted messages, on top of the page
+function restore(html) {
+  var height = document.body.scrollHeight;
+
+  restoring = false;
+
+  // The view doesn't have anything left
+  if (html.length == 0) {
+    evictedChunks = 0;
+    return;
+  }
+
+  evictedChunks--;
+  chat.insertBefore(createHTMLNode(html), chat.firstChild);
+  document.body.scrollTop += document.body.scrollHeight - height;
+}
+
+
+// Put back the oldest of the newer messages evicted by trimNewest(), where
+// they were taken from
+function restoreNewer(html) {
+  var marker = document.getElementById(NEWER_MARKER);
+
+  restoringNewer = false;
+
+  if (!marker)
+    return;
+
+  // The view doesn't have anything left
+  if (html.length == 0)
+    evictedNewerChunks = 0;
+  else {
+    evictedNewerChunks--;
+    chat.insertBefore(createHTMLNode(html), marker);
+  }
+
+  if (evictedNewerChunks == 0)
+    chat.removeChild(marker);
+}
+
+
+// Replace the text of the message sent with @token, see
+// empathy_theme_adium_edit_message()
+function editMessage(token, html, title, style) {
+  var span = document.getElementById("message-token-" + token);
+
+  // Evicted, the view edits it again when it puts it back
+  if (!span)
+    return;
+
+  span.innerHTML = html;
+  span.title = title;
+
+  if (style.length > 0)
+    span.setAttribute("style", style);
+}
+
+
+// Called before a page of backlog is prepended
+function beginPrepend() {
+  prependHeight = document.body.scrollHeight;
+}
+
+
+// Called once a page of backlog has been prepended, keeps the messages the
+// user is reading where they were
+function endPrepend(complete) {
+  if (prependHeight >= 0)
+    document.body.scrollTop += document.body.scrollHeight - prependHeight;
+
+  prependHeight = -1;
+  fetchingBacklog = false;
+  backlogComplete = complete;
+
+  // The page may still not be tall enough to scroll
+  checkNearTop();
+}
+
+
+// Ask for older messages before the user reaches the top of the page
+function checkNearTop() {
+  if (restoring || fetchingBacklog)
+    return;
+
+  if (document.body.scrollTop > window.innerHeight)
+    return;
+
+  if (evictedChunks > 0) {
+    restoring = true;
+    postToView("empathyRestore", "");
+  } else if (!backlogComplete) {
+    fetchingBacklog = true;
+    postToView("empathyNearTop", "");
+  }
+}
+
+
+// Put back the newer messages before the user reaches where they were
+function checkNearNewer() {
+  if (restoringNewer || evictedNewerChunks == 0)
+    return;
+
+  var marker = document.getElementById(NEWER_MARKER);
+  if (marker && marker.getBoundingClientRect().top > 2 * window.innerHeight)
+    return;
+
+  restoringNewer = true;
+  postToView("empathyRestoreNewer", "");
+}
+
+
+window.addEventListener("scroll", checkNearTop);
+window.addEventListener("scroll", checkNearNewer);
+
+// Once what is already there has been rendered, fill the page if needed
+setTimeout(checkNearTop, 0);
@@ -0,0 +1,919 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "empathy-debug-store.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_OTHER
+#include "empathy-debug.h"
+
+/* List model of debug messages, in two flavours:
+ *
+ * - service stores keep the last max_messages messages of one service in a
+ *   ring buffer; appending to a full store drops its oldest message.
+ *
+ * - merged stores own no message at all. They show the rows of their
+ *   source stores in the order they were appended, which is what "All"
+ *   displays. Every appended message gets a serial number that is unique
+ *   across stores, so the position of a row in a merged store is the
+ *   number of visible source rows with a lower serial.
+ *
+ * Iters point to a row of a service store: user_data is the service store,
+ * user_data2 the row index in that store and user_data3 the row position in
+ * the model the iter belongs to. */
+
+#define RING_INDEX(priv, n) (((priv)->head + (n)) % (priv)->capacity)
+
+/* Smallest number of slots allocated by a service store */
+#define MIN_CAPACITY 64
+
+struct _EmpathyDebugStorePriv
+{
+  gint stamp;
+
+  /* Service stores */
+  TpDebugMessage **messages;
+  guint64 *serials;
+  guint capacity;
+  guint max_messages;
+  guint head;
+  guint len;
+  /* Serial of the row being removed while row-deleted is emitted, for the
+   * merged stores to find where it was */
+  guint64 removed_serial;
+
+  /* Merged stores: owned MergedSource */
+  GPtrArray *sources;
+  /* Rows with a serial lower or equal to this one have been cleared */
+  guint64 floor;
+  /* Last iter returned by get_iter, as rows are usually read in order */
+  GtkTreeIter cached_iter;
+};
+
+typedef struct
+{
+  EmpathyDebugStore *self;
+  EmpathyDebugStore *store;
+  /* Only the rows up to this serial are visible, used while the source is
+   * being added or removed */
+  guint64 limit;
+  gulong row_inserted_id;
+  gulong row_deleted_id;
+} MergedSource;
+
+static guint64 last_serial = 0;
+
+static void debug_store_tree_model_iface_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmpathyDebugStore, empathy_debug_store,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL,
+      debug_store_tree_model_iface_init))
+
+static guint64
+ring_serial (EmpathyDebugStore *store,
+    guint n)
+{
+  return store->priv->serials[RING_INDEX (store->priv, n)];
+}
+
+/* Number of rows of the service store @store with a serial lower or equal
+ * to @serial */
+static guint
+ring_count_up_to (EmpathyDebugStore *store,
+    guint64 serial)
+{
+  guint lo = 0, hi = store->priv->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (ring_serial (store, mid) <= serial)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+static void
+debug_store_fill_iter (EmpathyDebugStore *self,
+    GtkTreeIter *iter,
+    EmpathyDebugStore *store,
+    guint index,
+    guint position)
+{
+  iter->stamp = self->priv->stamp;
+  iter->user_data = store;
+  iter->user_data2 = GUINT_TO_POINTER (index);
+  iter->user_data3 = GUINT_TO_POINTER (position);
+}
+
+static void
+debug_store_resize (EmpathyDebugStore *self,
+    guint capacity)
+{
+  EmpathyDebugStorePriv *priv = self->priv;
+  TpDebugMessage **messages;
+  guint64 *serials;
+  guint i;
+
+  messages = g_new (TpDebugMessage *, capacity);
+  serials = g_new (guint64, capacity);
+
+  for (i = 0; i < priv->len; i++)
+    {
+      messages[i] = priv->messages[RING_INDEX (priv, i)];
+      serials[i] = priv->serials[RING_INDEX (priv, i)];
+    }
+
+  g_free (priv->messages);
+  g_free (priv->serials);
+
+  priv->messages = messages;
+  priv->serials = serials;
+  priv->capacity = capacity;
+  priv->head = 0;
+}
+
+static void
+debug_store_remove_first (EmpathyDebugStore *self)
+{
+  EmpathyDebugStorePriv *priv = self->priv;
+  TpDebugMessage *msg;
+  GtkTreePath *path;
+
+  msg = priv->messages[priv->head];
+  priv->removed_serial = priv->serials[priv->head];
+  priv->messages[priv->head] = NULL;
+  priv->head = (priv->head + 1) % priv->capacity;
+  priv->len--;
+  priv->stamp++;
+
+  path = gtk_tree_path_new_from_indices (0, -1);
+  gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+  gtk_tree_path_free (path);
+
+  g_object_unref (msg);
+}
+
+/* Number of rows of @source shown by the merged store with a serial lower
+ * or equal to @serial */
+static guint
+merged_source_count (EmpathyDebugStore *self,
+    MergedSource *source,
+    guint64 serial)
+{
+  guint64 floor = self->priv->floor;
+
+  serial = MIN (serial, source->limit);
+  if (serial <= floor)
+    return 0;
+
+  return ring_count_up_to (source->store, serial) -
+    ring_count_up_to (source->store, floor);
+}
+
+static guint
+merged_count_up_to (EmpathyDebugStore *self,
+    guint64 serial)
+{
+  guint i, count = 0;
+
+  for (i = 0; i < self->priv->sources->len; i++)
+    count += merged_source_count (self,
+        g_ptr_array_index (self->priv->sources, i), serial);
+
+  return count;
+}
+
+static gboolean
+merged_iter_next (EmpathyDebugStore *self,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugStore *current = iter->user_data;
+  EmpathyDebugStore *best = NULL;
+  guint64 serial, best_serial = G_MAXUINT64;
+  guint i, best_index = 0;
+
+  serial = ring_serial (current, GPOINTER_TO_UINT (iter->user_data2));
+
+  /* The next row is the one with the lowest serial following this one, in
+   * any of the sources */
+  for (i = 0; i < self->priv->sources->len; i++)
+    {
+      MergedSource *source = g_ptr_array_index (self->priv->sources, i);
+      guint index;
+      guint64 s;
+
+      index = ring_count_up_to (source->store, serial);
+      if (index >= source->store->priv->len)
+        continue;
+
+      s = ring_serial (source->store, index);
+      if (s > source->limit || s >= best_serial)
+        continue;
+
+      best = source->store;
+      best_index = index;
+      best_serial = s;
+    }
+
+  if (best == NULL)
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  debug_store_fill_iter (self, iter, best, best_index,
+      GPOINTER_TO_UINT (iter->user_data3) + 1);
+
+  return TRUE;
+}
+
+static gboolean
+merged_get_nth (EmpathyDebugStore *self,
+    guint n,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugStorePriv *priv = self->priv;
+  GtkTreeIter *cached = &priv->cached_iter;
+  guint64 lo, hi;
+  guint i;
+
+  if (cached->stamp == priv->stamp)
+    {
+      guint position = GPOINTER_TO_UINT (cached->user_data3);
+
+      if (position == n)
+        {
+          *iter = *cached;
+          return TRUE;
+        }
+
+      if (position + 1 == n)
+        {
+          *iter = *cached;
+          if (!merged_iter_next (self, iter))
+            return FALSE;
+
+          *cached = *iter;
+          return TRUE;
+        }
+    }
+
+  if (n >= merged_count_up_to (self, G_MAXUINT64))
+    return FALSE;
+
+  /* Find the serial of the n-th row: the smallest one having n + 1 rows up
+   * to it */
+  lo = priv->floor + 1;
+  hi = last_serial;
+
+  while (lo < hi)
+    {
+      guint64 mid = lo + (hi - lo) / 2;
+
+      if (merged_count_up_to (self, mid) > n)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  for (i = 0; i < priv->sources->len; i++)
+    {
+      MergedSource *source = g_ptr_array_index (priv->sources, i);
+      guint index;
+
+      if (lo > source->limit)
+        continue;
+
+      index = ring_count_up_to (source->store, lo);
+      if (index == 0 || ring_serial (source->store, index - 1) != lo)
+        continue;
+
+      debug_store_fill_iter (self, iter, source->store, index - 1, n);
+      *cached = *iter;
+
+      return TRUE;
+    }
+
+  g_return_val_if_reached (FALSE);
+}
+
+static void
+merged_source_row_inserted_cb (GtkTreeModel *model,
+    GtkTreePath *path,
+    GtkTreeIter *source_iter,
+    gpointer user_data)
+{
+  MergedSource *source = user_data;
+  EmpathyDebugStore *self = source->self;
+  GtkTreePath *merged_path;
+  GtkTreeIter iter;
+  guint index, position;
+  guint64 serial;
+
+  /* Even when the row isn't shown, the indexes of the source rows have
+   * changed */
+  self->priv->stamp++;
+
+  index = GPOINTER_TO_UINT (source_iter->user_data2);
+  serial = ring_serial (source->store, index);
+
+  if (serial <= self->priv->floor || serial > source->limit)
+    return;
+
+  position = merged_count_up_to (self, serial) - 1;
+  debug_store_fill_iter (self, &iter, source->store, index, position);
+
+  merged_path = gtk_tree_path_new_from_indices (position, -1);
+  gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), merged_path, &iter);
+  gtk_tree_path_free (merged_path);
+}
+
+static void
+merged_source_row_deleted_cb (GtkTreeModel *model,
+    GtkTreePath *path,
+    gpointer user_data)
+{
+  MergedSource *source = user_data;
+  EmpathyDebugStore *self = source->self;
+  GtkTreePath *merged_path;
+  guint64 serial;
+
+  self->priv->stamp++;
+
+  serial = source->store->priv->removed_serial;
+
+  if (serial <= self->priv->floor || serial > source->limit)
+    return;
+
+  merged_path = gtk_tree_path_new_from_indices (
+      merged_count_up_to (self, serial - 1), -1);
+  gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), merged_path);
+  gtk_tree_path_free (merged_path);
+}
+
+static void
+merged_source_free (MergedSource *source)
+{
+  g_signal_handler_disconnect (source->store, source->row_inserted_id);
+  g_signal_handler_disconnect (source->store, source->row_deleted_id);
+  g_object_unref (source->store);
+
+  g_slice_free (MergedSource, source);
+}
+
+static MergedSource *
+merged_find_source (EmpathyDebugStore *self,
+    EmpathyDebugStore *store,
+    guint *index)
+{
+  guint i;
+
+  for (i = 0; i < self->priv->sources->len; i++)
+    {
+      MergedSource *source = g_ptr_array_index (self->priv->sources, i);
+
+      if (source->store == store)
+        {
+          if (index != NULL)
+            *index = i;
+
+          return source;
+        }
+    }
+
+  return NULL;
+}
+
+static GtkTreeModelFlags
+debug_store_get_flags (GtkTreeModel *model)
+{
+  return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint
+debug_store_get_n_columns (GtkTreeModel *model)
+{
+  return EMPATHY_DEBUG_STORE_N_COLUMNS;
+}
+
+static GType
+debug_store_get_column_type (GtkTreeModel *model,
+    gint column)
+{
+  g_return_val_if_fail (column == EMPATHY_DEBUG_STORE_COL_MESSAGE,
+      G_TYPE_INVALID);
+
+  return TP_TYPE_DEBUG_MESSAGE;
+}
+
+static gboolean
+debug_store_iter_nth_child (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *parent,
+    gint n)
+{
+  EmpathyDebugStore *self = EMPATHY_DEBUG_STORE (model);
+
+  if (parent != NULL || n < 0)
+    return FALSE;
+
+  if (self->priv->sources != NULL)
+    return merged_get_nth (self, n, iter);
+
+  if ((guint) n >= self->priv->len)
+    return FALSE;
+
+  debug_store_fill_iter (self, iter, self, n, n);
+
+  return TRUE;
+}
+
+static gboolean
+debug_store_get_iter (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreePath *path)
+{
+  if (gtk_tree_path_get_depth (path) != 1)
+    return FALSE;
+
+  return debug_store_iter_nth_child (model, iter, NULL,
+      gtk_tree_path_get_indices (path)[0]);
+}
+
+static GtkTreePath *
+debug_store_get_path (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugStore *self = EMPATHY_DEBUG_STORE (model);
+
+  g_return_val_if_fail (iter->stamp == self->priv->stamp, NULL);
+
+  return gtk_tree_path_new_from_indices (
+      GPOINTER_TO_UINT (iter->user_data3), -1);
+}
+
+static void
+debug_store_get_value (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    gint column,
+    GValue *value)
+{
+  EmpathyDebugStore *self = EMPATHY_DEBUG_STORE (model);
+  EmpathyDebugStore *store;
+
+  g_return_if_fail (iter->stamp == self->priv->stamp);
+  g_return_if_fail (column == EMPATHY_DEBUG_STORE_COL_MESSAGE);
+
+  store = iter->user_data;
+
+  g_value_init (value, TP_TYPE_DEBUG_MESSAGE);
+  g_value_set_object (value, store->priv->messages[
+      RING_INDEX (store->priv, GPOINTER_TO_UINT (iter->user_data2))]);
+}
+
+static gboolean
+debug_store_iter_next (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  EmpathyDebugStore *self = EMPATHY_DEBUG_STORE (model);
+  guint n;
+
+  g_return_val_if_fail (iter->stamp == self->priv->stamp, FALSE);
+
+  if (self->priv->sources != NULL)
+    return merged_iter_next (self, iter);
+
+  n = GPOINTER_TO_UINT (iter->user_data2) + 1;
+  if (n >= self->priv->len)
+    {
+      iter->stamp = 0;
+      return FALSE;
+    }
+
+  debug_store_fill_iter (self, iter, self, n, n);
+
+  return TRUE;
+}
+
+static gboolean
+debug_store_iter_children (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *parent)
+{
+  return debug_store_iter_nth_child (model, iter, parent, 0);
+}
+
+static gboolean
+debug_store_iter_has_child (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  return FALSE;
+}
+
+static gint
+debug_store_iter_n_children (GtkTreeModel *model,
+    GtkTreeIter *iter)
+{
+  if (iter != NULL)
+    return 0;
+
+  return empathy_debug_store_get_n_messages (EMPATHY_DEBUG_STORE (model));
+}
+
+static gboolean
+debug_store_iter_parent (GtkTreeModel *model,
+    GtkTreeIter *iter,
+    GtkTreeIter *child)
+{
+  return FALSE;
+}
+
+static void
+debug_store_tree_model_iface_init (GtkTreeModelIface *iface)
+{
+  iface->get_flags = debug_store_get_flags;
+  iface->get_n_columns = debug_store_get_n_columns;
+  iface->get_column_type = debug_store_get_column_type;
+  iface->get_iter = debug_store_get_iter;
+  iface->get_path = debug_store_get_path;
+  iface->get_value = debug_store_get_value;
+  iface->iter_next = debug_store_iter_next;
+  iface->iter_children = debug_store_iter_children;
+  iface->iter_has_child = debug_store_iter_has_child;
+  iface->iter_n_children = debug_store_iter_n_children;
+  iface->iter_nth_child = debug_store_iter_nth_child;
+  iface->iter_parent = debug_store_iter_parent;
+}
+
+static void
+debug_store_dispose (GObject *object)
+{
+  EmpathyDebugStore *self = EMPATHY_DEBUG_STORE (object);
+
+  tp_clear_pointer (&self->priv->sources, g_ptr_array_unref);
+
+  G_OBJECT_CLASS (empathy_debug_store_parent_class)->dispose (object);
+}
+
+static void
+debug_store_finalize (GObject *object)
+{
+  EmpathyDebugStore *self = EMPATHY_DEBUG_STORE (object);
+  EmpathyDebugStorePriv *priv = self->priv;
+  guint i;
+
+  for (i = 0; i < priv->len; i++)
+    g_object_unref (priv->messages[RING_INDEX (priv, i)]);
+
+  g_free (priv->messages);
+  g_free (priv->serials);
+
+  G_OBJECT_CLASS (empathy_debug_store_parent_class)->finalize (object);
+}
+
+static void
+empathy_debug_store_class_init (EmpathyDebugStoreClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = debug_store_dispose;
+  object_class->finalize = debug_store_finalize;
+
+  g_type_class_add_private (object_class, sizeof (EmpathyDebugStorePriv));
+}
+
+static void
+empathy_debug_store_init (EmpathyDebugStore *self)
+{
+  self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      EMPATHY_TYPE_DEBUG_STORE, EmpathyDebugStorePriv);
+
+  /* Never 0, which marks invalid iters */
+  self->priv->stamp = g_random_int_range (1, G_MAXINT32);
+}
+
+/**
+ * empathy_debug_store_new:
+ * @max_messages: number of messages to keep
+ *
+ * Creates a store for the messages of one service. Once it holds
+ * @max_messages messages, appending one drops the oldest.
+ *
+ * Returns: a new #EmpathyDebugStore
+ */
+EmpathyDebugStore *
+empathy_debug_store_new (guint max_messages)
+{
+  EmpathyDebugStore *self;
+
+  g_return_val_if_fail (max_messages > 0, NULL);
+
+  self = g_object_new (EMPATHY_TYPE_DEBUG_STORE, NULL);
+  self->priv->max_messages = max_messages;
+
+  return self;
+}
+
+/**
+ * empathy_debug_store_new_merged:
+ *
+ * Creates a store showing the messages of the stores added with
+ * empathy_debug_store_add_source(), in the order they were appended. The
+ * messages are not copied.
+ *
+ * Returns: a new #EmpathyDebugStore
+ */
+EmpathyDebugStore *
+empathy_debug_store_new_merged (void)
+{
+  EmpathyDebugStore *self;
+
+  self = g_object_new (EMPATHY_TYPE_DEBUG_STORE, NULL);
+  self->priv->sources = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) merged_source_free);
+
+  return self;
+}
+
+void
+empathy_debug_store_append (EmpathyDebugStore *self,
+    TpDebugMessage *msg)
+{
+  EmpathyDebugStorePriv *priv;
+  GtkTreePath *path;
+  GtkTreeIter iter;
+  guint i;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_STORE (self));
+  g_return_if_fail (TP_IS_DEBUG_MESSAGE (msg));
+  g_return_if_fail (self->priv->sources == NULL);
+
+  priv = self->priv;
+
+  if (priv->len == priv->max_messages)
+    debug_store_remove_first (self);
+
+  if (priv->len == priv->capacity)
+    debug_store_resize (self, MIN (priv->max_messages,
+          MAX (MIN_CAPACITY, priv->capacity * 2)));
+
+  i = RING_INDEX (priv, priv->len);
+  priv->messages[i] = g_object_ref (msg);
+  priv->serials[i] = ++last_serial;
+  priv->len++;
+  priv->stamp++;
+
+  debug_store_fill_iter (self, &iter, self, priv->len - 1, priv->len - 1);
+
+  path = gtk_tree_path_new_from_indices (priv->len - 1, -1);
+  gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+  gtk_tree_path_free (path);
+}
+
+/**
+ * empathy_debug_store_clear:
+ * @self: a #EmpathyDebugStore
+ *
+ * Removes all the messages of @self. Clearing a merged store only hides
+ * the messages it is currently showing, its sources are left untouched.
+ */
+void
+empathy_debug_store_clear (EmpathyDebugStore *self)
+{
+  EmpathyDebugStorePriv *priv;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_STORE (self));
+
+  priv = self->priv;
+
+  if (priv->sources == NULL)
+    {
+      while (priv->len > 0)
+        debug_store_remove_first (self);
+
+      return;
+    }
+
+  /* Move the floor up one row at a time, so the model stays consistent
+   * with the signals */
+  while (TRUE)
+    {
+      GtkTreePath *path;
+      guint64 first = G_MAXUINT64;
+      guint i;
+
+      for (i = 0; i < priv->sources->len; i++)
+        {
+          MergedSource *source = g_ptr_array_index (priv->sources, i);
+          guint index;
+          guint64 s;
+
+          index = ring_count_up_to (source->store, priv->floor);
+          if (index >= source->store->priv->len)
+            continue;
+
+          s = ring_serial (source->store, index);
+          if (s <= source->limit && s < first)
+            first = s;
+        }
+
+      if (first == G_MAXUINT64)
+        break;
+
+      priv->floor = first;
+      priv->stamp++;
+
+      path = gtk_tree_path_new_from_indices (0, -1);
+      gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+      gtk_tree_path_free (path);
+    }
+}
+
+guint
+empathy_debug_store_get_n_messages (EmpathyDebugStore *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_STORE (self), 0);
+
+  if (self->priv->sources != NULL)
+    return merged_count_up_to (self, G_MAXUINT64);
+
+  return self->priv->len;
+}
+
+/**
+ * empathy_debug_store_get_message:
+ * @self: a #EmpathyDebugStore
+ * @n: the position of the message
+ *
+ * Returns: (transfer none): the @n-th message of @self, or %NULL
+ */
+TpDebugMessage *
+empathy_debug_store_get_message (EmpathyDebugStore *self,
+    guint n)
+{
+  EmpathyDebugStore *store;
+  GtkTreeIter iter;
+
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_STORE (self), NULL);
+
+  if (!debug_store_iter_nth_child (GTK_TREE_MODEL (self), &iter, NULL, n))
+    return NULL;
+
+  store = iter.user_data;
+
+  return store->priv->messages[RING_INDEX (store->priv, GPOINTER_TO_UINT (
+          iter.user_data2))];
+}
+
+void
+empathy_debug_store_set_max_messages (EmpathyDebugStore *self,
+    guint max_messages)
+{
+  EmpathyDebugStorePriv *priv;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_STORE (self));
+  g_return_if_fail (self->priv->sources == NULL);
+  g_return_if_fail (max_messages > 0);
+
+  priv = self->priv;
+  priv->max_messages = max_messages;
+
+  while (priv->len > max_messages)
+    debug_store_remove_first (self);
+
+  if (priv->capacity > max_messages)
+    debug_store_resize (self, max_messages);
+}
+
+guint
+empathy_debug_store_get_max_messages (EmpathyDebugStore *self)
+{
+  g_return_val_if_fail (EMPATHY_IS_DEBUG_STORE (self), 0);
+
+  return self->priv->max_messages;
+}
+
+/**
+ * empathy_debug_store_add_source:
+ * @self: a merged #EmpathyDebugStore
+ * @source: a service #EmpathyDebugStore
+ *
+ * Shows the messages of @source in @self. Does nothing if @source is
+ * already shown.
+ */
+void
+empathy_debug_store_add_source (EmpathyDebugStore *self,
+    EmpathyDebugStore *source)
+{
+  MergedSource *merged;
+  guint n;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_STORE (self));
+  g_return_if_fail (EMPATHY_IS_DEBUG_STORE (source));
+  g_return_if_fail (self->priv->sources != NULL);
+  g_return_if_fail (source->priv->sources == NULL);
+
+  if (merged_find_source (self, source, NULL) != NULL)
+    return;
+
+  DEBUG ("Merging %u messages", source->priv->len);
+
+  merged = g_slice_new0 (MergedSource);
+  merged->self = self;
+  merged->store = g_object_ref (source);
+  merged->limit = 0;
+  merged->row_inserted_id = g_signal_connect (source, "row-inserted",
+      G_CALLBACK (merged_source_row_inserted_cb), merged);
+  merged->row_deleted_id = g_signal_connect (source, "row-deleted",
+      G_CALLBACK (merged_source_row_deleted_cb), merged);
+
+  g_ptr_array_add (self->priv->sources, merged);
+
+  /* Reveal the rows one by one */
+  for (n = ring_count_up_to (source, self->priv->floor);
+       n < source->priv->len;
+       n++)
+    {
+      GtkTreePath *path;
+      GtkTreeIter iter;
+      guint position;
+
+      merged->limit = ring_serial (source, n);
+      self->priv->stamp++;
+
+      position = merged_count_up_to (self, merged->limit) - 1;
+      debug_store_fill_iter (self, &iter, source, n, position);
+
+      path = gtk_tree_path_new_from_indices (position, -1);
+      gtk_tree_model_row_inserted (GTK_TREE_MODEL (self), path, &iter);
+      gtk_tree_path_free (path);
+    }
+
+  merged->limit = G_MAXUINT64;
+}
+
+/**
+ * empathy_debug_store_remove_source:
+ * @self: a merged #EmpathyDebugStore
+ * @source: a service #EmpathyDebugStore
+ *
+ * Stops showing the messages of @source in @self. Does nothing if @source
+ * isn't shown.
+ */
+void
+empathy_debug_store_remove_source (EmpathyDebugStore *self,
+    EmpathyDebugStore *source)
+{
+  MergedSource *merged;
+  guint index, n;
+
+  g_return_if_fail (EMPATHY_IS_DEBUG_STORE (self));
+  g_return_if_fail (EMPATHY_IS_DEBUG_STORE (source));
+  g_return_if_fail (self->priv->sources != NULL);
+
+  merged = merged_find_source (self, source, &index);
+  if (merged == NULL)
+    return;
+
+  /* Hide the rows one by one, starting from the most recent */
+  for (n = source->priv->len; n > 0; n--)
+    {
+      GtkTreePath *path;
+      guint64 serial = ring_serial (source, n - 1);
+
+      if (serial <= self->priv->floor)
+        break;
+
+      merged->limit = serial - 1;
+      self->priv->stamp++;
+
+      path = gtk_tree_path_new_from_indices (
+          merged_count_up_to (self, serial - 1), -1);
+      gtk_tree_model_row_deleted (GTK_TREE_MODEL (self), path);
+      gtk_tree_path_free (path);
+    }
+
+  g_ptr_array_remove_index (self->priv->sources, index);
+  self->priv->stamp++;
+}
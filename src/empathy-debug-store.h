@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMPATHY_DEBUG_STORE_H__
+#define __EMPATHY_DEBUG_STORE_H__
+
+#include <gtk/gtk.h>
+#include <telepathy-glib/telepathy-glib.h>
+
+G_BEGIN_DECLS
+
+#define EMPATHY_TYPE_DEBUG_STORE         (empathy_debug_store_get_type ())
+#define EMPATHY_DEBUG_STORE(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), EMPATHY_TYPE_DEBUG_STORE, EmpathyDebugStore))
+#define EMPATHY_DEBUG_STORE_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), EMPATHY_TYPE_DEBUG_STORE, EmpathyDebugStoreClass))
+#define EMPATHY_IS_DEBUG_STORE(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), EMPATHY_TYPE_DEBUG_STORE))
+#define EMPATHY_IS_DEBUG_STORE_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), EMPATHY_TYPE_DEBUG_STORE))
+#define EMPATHY_DEBUG_STORE_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), EMPATHY_TYPE_DEBUG_STORE, EmpathyDebugStoreClass))
+
+/* Default number of messages kept for each service */
+#define EMPATHY_DEBUG_STORE_DEFAULT_MAX_MESSAGES 10000
+
+typedef struct _EmpathyDebugStore      EmpathyDebugStore;
+typedef struct _EmpathyDebugStoreClass EmpathyDebugStoreClass;
+typedef struct _EmpathyDebugStorePriv  EmpathyDebugStorePriv;
+
+struct _EmpathyDebugStore {
+  GObject parent;
+  EmpathyDebugStorePriv *priv;
+};
+
+struct _EmpathyDebugStoreClass
+{
+  GObjectClass parent_class;
+};
+
+/* Single column list model: column 0 is the TpDebugMessage */
+enum
+{
+  EMPATHY_DEBUG_STORE_COL_MESSAGE = 0,
+  EMPATHY_DEBUG_STORE_N_COLUMNS
+};
+
+GType empathy_debug_store_get_type (void) G_GNUC_CONST;
+
+EmpathyDebugStore * empathy_debug_store_new (guint max_messages);
+
+EmpathyDebugStore * empathy_debug_store_new_merged (void);
+
+void empathy_debug_store_append (EmpathyDebugStore *self,
+    TpDebugMessage *msg);
+
+void empathy_debug_store_clear (EmpathyDebugStore *self);
+
+guint empathy_debug_store_get_n_messages (EmpathyDebugStore *self);
+
+TpDebugMessage * empathy_debug_store_get_message (EmpathyDebugStore *self,
+    guint n);
+
+void empathy_debug_store_set_max_messages (EmpathyDebugStore *self,
+    guint max_messages);
+
+guint empathy_debug_store_get_max_messages (EmpathyDebugStore *self);
+
+void empathy_debug_store_add_source (EmpathyDebugStore *self,
+    EmpathyDebugStore *source);
+
+void empathy_debug_store_remove_source (EmpathyDebugStore *self,
+    EmpathyDebugStore *source);
+
+G_END_DECLS
+
+#endif /* __EMPATHY_DEBUG_STORE_H__ */
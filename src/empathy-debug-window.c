@@ -27,6 +27,7 @@
 #include <tp-account-widgets/tpaw-utils.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "empathy-debug-store.h"
 #include "empathy-geometry.h"
 #include "empathy-ui-utils.h"
 #include "empathy-utils.h"
@@ -46,8 +47,7 @@ typedef enum
 
 enum
 {
-  COL_DEBUG_MESSAGE = 0,
-  NUM_DEBUG_COLS
+  COL_DEBUG_MESSAGE = EMPATHY_DEBUG_STORE_COL_MESSAGE
 };
 
 enum
@@ -68,6 +68,11 @@ enum
   NUM_COLS_LEVEL
 };
 
+enum
+{
+  PROP_MAX_MESSAGES = 1,
+};
+
 #define GET_PRIV(obj) EMPATHY_GET_PRIV (obj, EmpathyDebugWindow)
 struct _EmpathyDebugWindowPriv
 {
@@ -105,10 +110,14 @@ struct _EmpathyDebugWindowPriv
   /* Debug to show upon creation */
   gchar *select_name;
 
+  /* Number of messages kept for each service */
+  guint max_messages;
+
   /* Misc. */
   gboolean dispose_run;
   TpAccountManager *am;
-  GtkListStore *all_active_buffer;
+  /* Merged view of the services' active buffers, shown by "All" */
+  EmpathyDebugStore *all_active_buffer;
 };
 
 static const gchar *
@@ -156,60 +165,21 @@ get_active_service_name (EmpathyDebugWindow *self)
   return name;
 }
 
-static gboolean
-copy_buffered_messages (GtkTreeModel *buffer,
-    GtkTreePath *path,
-    GtkTreeIter *iter,
-    gpointer data)
-{
-  GtkListStore *active_buffer = data;
-  GtkTreeIter active_buffer_iter;
-  TpDebugMessage *msg;
-
-  gtk_tree_model_get (buffer, iter,
-      COL_DEBUG_MESSAGE, &msg,
-      -1);
-  gtk_list_store_insert_with_values (active_buffer, &active_buffer_iter, -1,
-      COL_DEBUG_MESSAGE, msg,
-      -1);
-
-  g_object_unref (msg);
-
-  return FALSE;
-}
-
-static void
-insert_values_in_buffer (GtkListStore *store,
-    TpDebugMessage *msg)
-{
-  GtkTreeIter iter;
-
-  gtk_list_store_insert_with_values (store, &iter, -1,
-      COL_DEBUG_MESSAGE, msg,
-      -1);
-}
-
 static void
 debug_window_add_message (EmpathyDebugWindow *self,
     TpDebugClient *debug,
     TpDebugMessage *msg)
 {
-  GtkListStore *active_buffer, *pause_buffer;
+  EmpathyDebugStore *active_buffer, *pause_buffer;
 
   pause_buffer = g_object_get_data (G_OBJECT (debug), "pause-buffer");
   active_buffer = g_object_get_data (G_OBJECT (debug), "active-buffer");
 
+  /* All's view picks up the messages of the active-buffer by itself */
   if (self->priv->paused)
-    {
-      insert_values_in_buffer (pause_buffer, msg);
-    }
+    empathy_debug_store_append (pause_buffer, msg);
   else
-    {
-      /* Append 'this' message to this service's and All's active-buffers */
-      insert_values_in_buffer (active_buffer, msg);
-
-      insert_values_in_buffer (self->priv->all_active_buffer, msg);
-    }
+    empathy_debug_store_append (active_buffer, msg);
 }
 
 static void
@@ -285,7 +255,7 @@ debug_window_set_toolbar_sensitivity (EmpathyDebugWindow *self,
 }
 
 static gboolean
-debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
+debug_window_get_iter_for_active_buffer (EmpathyDebugStore *active_buffer,
     GtkTreeIter *iter,
     EmpathyDebugWindow *self)
 {
@@ -297,7 +267,7 @@ debug_window_get_iter_for_active_buffer (GtkListStore *active_buffer,
        valid_iter;
        valid_iter = gtk_tree_model_iter_next (model, iter))
     {
-      GtkListStore *stored_active_buffer;
+      EmpathyDebugStore *stored_active_buffer;
 
       gtk_tree_model_get (model, iter,
           COL_ACTIVE_BUFFER, &stored_active_buffer,
@@ -366,7 +336,7 @@ debug_window_get_messages_cb (GObject *object,
   EmpathyDebugWindow *self = user_data;
   gchar *active_service_name;
   guint i;
-  GtkListStore *active_buffer;
+  EmpathyDebugStore *active_buffer;
   gboolean valid_iter;
   GtkTreeIter iter;
   gchar *proxy_service_name;
@@ -417,6 +387,9 @@ debug_window_get_messages_cb (GObject *object,
       gtk_list_store_set (self->priv->service_store, &iter,
           COL_PROXY, debug,
           -1);
+
+      empathy_debug_store_add_source (self->priv->all_active_buffer,
+          active_buffer);
     }
   g_ptr_array_unref (messages);
 
@@ -507,11 +480,10 @@ finally:
   g_object_unref (pause_buffer);
 }
 
-static GtkListStore *
-new_list_store_for_service (void)
+static EmpathyDebugStore *
+new_store_for_service (EmpathyDebugWindow *self)
 {
-  return gtk_list_store_new (NUM_DEBUG_COLS,
-             TP_TYPE_DEBUG_MESSAGE); /* COL_DEBUG_MESSAGE */
+  return empathy_debug_store_new (self->priv->max_messages);
 }
 
 static gboolean
@@ -574,7 +546,7 @@ tree_view_search_equal_func_cb (GtkTreeModel *model,
 
 static void
 update_store_filter (EmpathyDebugWindow *self,
-    GtkListStore *active_buffer)
+    EmpathyDebugStore *active_buffer)
 {
   debug_window_set_toolbar_sensitivity (self, FALSE);
 
@@ -605,9 +577,6 @@ refresh_all_buffer (EmpathyDebugWindow *self)
   GtkTreeIter iter;
   GtkTreeModel *service_store = GTK_TREE_MODEL (self->priv->service_store);
 
-  /* Clear All's active-buffer */
-  gtk_list_store_clear (self->priv->all_active_buffer);
-
   /* Skipping the first service store iter which is reserved for "All" */
   gtk_tree_model_get_iter_first (service_store, &iter);
   for (valid_iter = gtk_tree_model_iter_next (service_store, &iter);
@@ -615,7 +584,7 @@ refresh_all_buffer (EmpathyDebugWindow *self)
        valid_iter = gtk_tree_model_iter_next (service_store, &iter))
     {
       TpProxy *proxy = NULL;
-      GtkListStore *service_active_buffer;
+      EmpathyDebugStore *service_active_buffer;
       gboolean gone;
 
       gtk_tree_model_get (service_store, &iter,
@@ -624,37 +593,40 @@ refresh_all_buffer (EmpathyDebugWindow *self)
           COL_ACTIVE_BUFFER, &service_active_buffer,
           -1);
 
-      if (gone)
+      if (service_active_buffer == NULL)
         {
-          gtk_tree_model_foreach (GTK_TREE_MODEL (service_active_buffer),
-              copy_buffered_messages, self->priv->all_active_buffer);
+          tp_clear_object (&proxy);
+          continue;
+        }
+
+      /* All's view only references the active-buffers, so adding one which
+       * is already shown costs nothing */
+      if (gone || proxy != NULL)
+        {
+          empathy_debug_store_add_source (self->priv->all_active_buffer,
+              service_active_buffer);
         }
       else
         {
-          if (proxy != NULL)
-            {
-              if (service_active_buffer == NULL)
-                break;
-
-              /* Copy the debug messages to all_active_buffer */
-              gtk_tree_model_foreach (GTK_TREE_MODEL (service_active_buffer),
-                  copy_buffered_messages, self->priv->all_active_buffer);
-            }
-          else
-            {
-              GError *error = NULL;
-              TpDBusDaemon *dbus = tp_dbus_daemon_dup (&error);
+          GError *error = NULL;
+          TpDBusDaemon *dbus;
 
-              if (error != NULL)
-                {
-                  DEBUG ("Failed at duping the dbus daemon: %s", error->message);
-                  g_error_free (error);
-                }
+          /* The messages of an invalidated proxy are not shown until they
+           * have been fetched again */
+          empathy_debug_store_remove_source (self->priv->all_active_buffer,
+              service_active_buffer);
 
-              create_proxy_to_get_messages (self, &iter, dbus);
+          dbus = tp_dbus_daemon_dup (&error);
 
-              g_object_unref (dbus);
+          if (error != NULL)
+            {
+              DEBUG ("Failed at duping the dbus daemon: %s", error->message);
+              g_error_free (error);
             }
+
+          create_proxy_to_get_messages (self, &iter, dbus);
+
+          g_object_unref (dbus);
         }
 
       g_object_unref (service_active_buffer);
@@ -668,7 +640,7 @@ debug_window_service_chooser_changed_cb (GtkComboBox *chooser,
 {
   TpDBusDaemon *dbus;
   GError *error = NULL;
-  GtkListStore *stored_active_buffer = NULL;
+  EmpathyDebugStore *stored_active_buffer = NULL;
   gchar *name = NULL;
   GtkTreeIter iter;
   gboolean gone;
@@ -915,7 +887,7 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
   if (!debug_window_service_is_in_model (data->self, out, NULL, FALSE))
     {
       char *name;
-      GtkListStore *active_buffer, *pause_buffer;
+      EmpathyDebugStore *active_buffer, *pause_buffer;
 
       DEBUG ("Adding %s to list: %s at unique name: %s",
           service_type_to_string (data->type),
@@ -923,8 +895,8 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
 
       name = service_dup_display_name (self, data->type, data->name);
 
-      active_buffer = new_list_store_for_service ();
-      pause_buffer = new_list_store_for_service ();
+      active_buffer = new_store_for_service (self);
+      pause_buffer = new_store_for_service (self);
 
       gtk_list_store_insert_with_values (self->priv->service_store, &iter, -1,
           COL_NAME, name,
@@ -957,8 +929,6 @@ debug_window_get_name_owner_cb (TpDBusDaemon *proxy,
             COL_ACTIVE_BUFFER, NULL,
             -1);
 
-        self->priv->all_active_buffer = new_list_store_for_service ();
-
         /* Populate active buffers for all services */
         refresh_all_buffer (self);
 
@@ -1008,12 +978,12 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
            &found_at_iter, TRUE))
         {
           GtkTreeIter iter;
-          GtkListStore *active_buffer, *pause_buffer;
+          EmpathyDebugStore *active_buffer, *pause_buffer;
 
           DEBUG ("Adding new service '%s' at %s.", name, arg2);
 
-          active_buffer = new_list_store_for_service ();
-          pause_buffer = new_list_store_for_service ();
+          active_buffer = new_store_for_service (self);
+          pause_buffer = new_store_for_service (self);
 
           gtk_list_store_insert_with_values (self->priv->service_store,
               &iter, -1,
@@ -1033,19 +1003,28 @@ debug_window_name_owner_changed_cb (TpDBusDaemon *proxy,
           /* a service with the same name is already in the service_store,
            * update it and set it as re-enabled.
            */
-          GtkListStore *active_buffer, *pause_buffer;
+          EmpathyDebugStore *active_buffer, *pause_buffer;
+          EmpathyDebugStore *old_active_buffer;
           TpProxy *stored_proxy;
 
           DEBUG ("Refreshing CM '%s' at '%s'.", name, arg2);
 
-          active_buffer= new_list_store_for_service ();
-          pause_buffer = new_list_store_for_service ();
+          active_buffer= new_store_for_service (self);
+          pause_buffer = new_store_for_service (self);
 
           gtk_tree_model_get (GTK_TREE_MODEL (self->priv->service_store),
-              found_at_iter, COL_PROXY, &stored_proxy, -1);
+              found_at_iter,
+              COL_PROXY, &stored_proxy,
+              COL_ACTIVE_BUFFER, &old_active_buffer,
+              -1);
 
           tp_clear_object (&stored_proxy);
 
+          /* The messages of the previous owner go away with its buffer */
+          empathy_debug_store_remove_source (self->priv->all_active_buffer,
+              old_active_buffer);
+          g_object_unref (old_active_buffer);
+
           gtk_list_store_set (self->priv->service_store, found_at_iter,
               COL_NAME, display_name,
               COL_UNIQUE_NAME, arg2,
@@ -1191,19 +1170,21 @@ debug_window_pause_toggled_cb (GtkToggleToolButton *pause_,
            valid_iter;
            valid_iter = gtk_tree_model_iter_next (model, &iter))
         {
-          GtkListStore *pause_buffer, *active_buffer;
+          EmpathyDebugStore *pause_buffer, *active_buffer;
+          guint i, n;
 
           gtk_tree_model_get (service_store, &iter,
               COL_PAUSE_BUFFER, &pause_buffer,
               COL_ACTIVE_BUFFER, &active_buffer,
               -1);
 
-          gtk_tree_model_foreach (GTK_TREE_MODEL (pause_buffer),
-              copy_buffered_messages, active_buffer);
-          gtk_tree_model_foreach (GTK_TREE_MODEL (pause_buffer),
-              copy_buffered_messages, self->priv->all_active_buffer);
+          /* All's view follows the active-buffer */
+          n = empathy_debug_store_get_n_messages (pause_buffer);
+          for (i = 0; i < n; i++)
+            empathy_debug_store_append (active_buffer,
+                empathy_debug_store_get_message (pause_buffer, i));
 
-          gtk_list_store_clear (pause_buffer);
+          empathy_debug_store_clear (pause_buffer);
 
           g_object_unref (active_buffer);
           g_object_unref (pause_buffer);
@@ -1224,14 +1205,15 @@ debug_window_clear_clicked_cb (GtkToolButton *clear_button,
     EmpathyDebugWindow *self)
 {
   GtkTreeIter iter;
-  GtkListStore *active_buffer;
+  EmpathyDebugStore *active_buffer;
 
   /* "All" is the first choice in the service chooser and it's buffer is
    * not saved in the service-store but is accessed using a self->private
-   * reference */
+   * reference. Clearing it only hides the messages shown so far, the
+   * services keep theirs. */
   if (gtk_combo_box_get_active (GTK_COMBO_BOX (self->priv->chooser)) == 0)
     {
-      gtk_list_store_clear (self->priv->all_active_buffer);
+      empathy_debug_store_clear (self->priv->all_active_buffer);
       return;
     }
 
@@ -1239,7 +1221,7 @@ debug_window_clear_clicked_cb (GtkToolButton *clear_button,
   gtk_tree_model_get (GTK_TREE_MODEL (self->priv->service_store), &iter,
       COL_ACTIVE_BUFFER, &active_buffer, -1);
 
-  gtk_list_store_clear (active_buffer);
+  empathy_debug_store_clear (active_buffer);
 
   g_object_unref (active_buffer);
 }
@@ -2075,8 +2057,6 @@ am_prepared_cb (GObject *am,
 
   self->priv->view_visible = FALSE;
 
-  self->priv->all_active_buffer = NULL;
-
   debug_window_set_toolbar_sensitivity (EMPATHY_DEBUG_WINDOW (object), FALSE);
   debug_window_fill_service_chooser (EMPATHY_DEBUG_WINDOW (object));
   gtk_widget_show (GTK_WIDGET (object));
@@ -2096,6 +2076,43 @@ empathy_debug_window_init (EmpathyDebugWindow *self)
 {
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
       EMPATHY_TYPE_DEBUG_WINDOW, EmpathyDebugWindowPriv);
+
+  self->priv->max_messages = EMPATHY_DEBUG_STORE_DEFAULT_MAX_MESSAGES;
+  self->priv->all_active_buffer = empathy_debug_store_new_merged ();
+}
+
+static void
+debug_window_set_max_messages (EmpathyDebugWindow *self,
+    guint max_messages)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (self->priv->service_store);
+  GtkTreeIter iter;
+  gboolean valid_iter;
+
+  self->priv->max_messages = max_messages;
+
+  if (model == NULL)
+    return;
+
+  /* Skipping the first iter which is reserved for "All" */
+  gtk_tree_model_get_iter_first (model, &iter);
+  for (valid_iter = gtk_tree_model_iter_next (model, &iter);
+       valid_iter;
+       valid_iter = gtk_tree_model_iter_next (model, &iter))
+    {
+      EmpathyDebugStore *active_buffer, *pause_buffer;
+
+      gtk_tree_model_get (model, &iter,
+          COL_ACTIVE_BUFFER, &active_buffer,
+          COL_PAUSE_BUFFER, &pause_buffer,
+          -1);
+
+      empathy_debug_store_set_max_messages (active_buffer, max_messages);
+      empathy_debug_store_set_max_messages (pause_buffer, max_messages);
+
+      g_object_unref (active_buffer);
+      g_object_unref (pause_buffer);
+    }
 }
 
 static void
@@ -2104,8 +2121,13 @@ debug_window_set_property (GObject *object,
     const GValue *value,
     GParamSpec *pspec)
 {
+  EmpathyDebugWindow *self = EMPATHY_DEBUG_WINDOW (object);
+
   switch (prop_id)
     {
+      case PROP_MAX_MESSAGES:
+        debug_window_set_max_messages (self, g_value_get_uint (value));
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -2118,8 +2140,13 @@ debug_window_get_property (GObject *object,
     GValue *value,
     GParamSpec *pspec)
 {
+  EmpathyDebugWindow *self = EMPATHY_DEBUG_WINDOW (object);
+
   switch (prop_id)
     {
+      case PROP_MAX_MESSAGES:
+        g_value_set_uint (value, self->priv->max_messages);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -2195,6 +2222,19 @@ empathy_debug_window_class_init (EmpathyDebugWindowClass *klass)
   object_class->set_property = debug_window_set_property;
   object_class->get_property = debug_window_get_property;
 
+  /**
+   * EmpathyDebugWindow:max-messages:
+   *
+   * Number of messages kept for each service, the oldest ones are dropped
+   * first.
+   */
+  g_object_class_install_property (object_class, PROP_MAX_MESSAGES,
+      g_param_spec_uint ("max-messages",
+        "Max messages",
+        "Number of messages kept for each service",
+        1, G_MAXUINT, EMPATHY_DEBUG_STORE_DEFAULT_MAX_MESSAGES,
+        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_type_class_add_private (klass, sizeof (EmpathyDebugWindowPriv));
 }
 
@@ -27,6 +27,7 @@
 
 static GtkWidget *window = NULL;
 static gchar *service = NULL;
+static gint max_messages = 0;
 
 static void
 app_activate (GApplication *app)
@@ -35,6 +36,9 @@ app_activate (GApplication *app)
     {
       window = empathy_debug_window_new (NULL);
 
+      if (max_messages > 0)
+        g_object_set (window, "max-messages", (guint) max_messages, NULL);
+
       gtk_application_add_window (GTK_APPLICATION (app),
           GTK_WINDOW (window));
     }
@@ -75,6 +79,10 @@ local_cmdline (GApplication *app,
         0, G_OPTION_ARG_STRING, &service,
         N_("Show a particular service"),
         NULL },
+      { "max-messages", 'm',
+        0, G_OPTION_ARG_INT, &max_messages,
+        N_("Number of messages kept for each service"),
+        NULL },
       { NULL }
   };
 
@@ -29,6 +29,7 @@
 
 #include "empathy-call-utils.h"
 #include "empathy-connection-aggregator.h"
+#include "empathy-conversation-index.h"
 #include "empathy-gsettings.h"
 #include "empathy-images.h"
 #include "empathy-presence-manager.h"
@@ -81,6 +82,7 @@ typedef struct {
   GSettings *gsettings_ui;
 
   EmpathySoundManager *sound_mgr;
+  EmpathyConversationIndex *conversation_index;
 
   /* TpContact -> EmpathyContact */
   GHashTable *contacts;
@@ -1216,6 +1218,7 @@ event_manager_finalize (GObject *object)
   g_object_unref (priv->gsettings_notif);
   g_object_unref (priv->gsettings_ui);
   g_object_unref (priv->sound_mgr);
+  g_object_unref (priv->conversation_index);
   g_hash_table_unref (priv->contacts);
 }
 
@@ -1327,6 +1330,8 @@ empathy_event_manager_init (EmpathyEventManager *manager)
   priv->gsettings_ui = g_settings_new (EMPATHY_PREFS_UI_SCHEMA);
 
   priv->sound_mgr = empathy_sound_manager_dup_singleton ();
+  /* Start building the index and observing text channels early */
+  priv->conversation_index = empathy_conversation_index_dup_singleton ();
 
   priv->contacts = g_hash_table_new_full (NULL, NULL, g_object_unref,
       g_object_unref);
@@ -0,0 +1,226 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "empathy-ft-handler.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+typedef struct
+{
+  guint n_calls;
+  guint64 last;
+} ProgressData;
+
+static void
+progress_cb (guint64 total_read,
+    gpointer user_data)
+{
+  ProgressData *data = user_data;
+
+  g_assert_cmpuint (total_read, >=, data->last);
+
+  data->n_calls++;
+  data->last = total_read;
+}
+
+/* Write @size pseudo-random bytes to a temporary file, and return its path */
+static gchar *
+create_file (gsize size,
+    gchar **checksum)
+{
+  GChecksum *sum;
+  GRand *rand;
+  guint32 chunk[1024];
+  gsize written = 0;
+  gchar *path;
+  gint fd;
+
+  fd = g_file_open_tmp ("empathy-ft-hash-XXXXXX", &path, NULL);
+  g_assert (fd >= 0);
+
+  sum = g_checksum_new (G_CHECKSUM_MD5);
+  rand = g_rand_new_with_seed (size);
+
+  while (written < size)
+    {
+      gsize len = MIN (sizeof (chunk), size - written);
+      guint i;
+
+      for (i = 0; i < G_N_ELEMENTS (chunk); i++)
+        chunk[i] = g_rand_int (rand);
+
+      g_assert_cmpint (write (fd, chunk, len), ==, len);
+      g_checksum_update (sum, (const guchar *) chunk, len);
+      written += len;
+    }
+
+  close (fd);
+
+  *checksum = g_strdup (g_checksum_get_string (sum));
+  g_checksum_free (sum);
+  g_rand_free (rand);
+
+  return path;
+}
+
+static gchar *
+hash_file (const gchar *path,
+    ProgressData *data)
+{
+  GFile *file;
+  GInputStream *stream;
+  GChecksum *sum;
+  GError *error = NULL;
+  gchar *result;
+  gboolean hashed;
+
+  file = g_file_new_for_path (path);
+  stream = G_INPUT_STREAM (g_file_read (file, NULL, &error));
+  g_assert_no_error (error);
+
+  sum = g_checksum_new (G_CHECKSUM_MD5);
+  hashed = empathy_ft_hash_stream (stream, sum, NULL, progress_cb, data,
+      &error);
+  g_assert_no_error (error);
+  g_assert (hashed);
+
+  result = g_strdup (g_checksum_get_string (sum));
+
+  g_checksum_free (sum);
+  g_object_unref (stream);
+  g_object_unref (file);
+
+  return result;
+}
+
+static void
+test_hash_stream (void)
+{
+  gsize sizes[] = { 0, 1, 4096, 256 * 1024, 3 * 1024 * 1024 + 123 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      ProgressData data = { 0, 0 };
+      gchar *path, *expected, *result;
+
+      path = create_file (sizes[i], &expected);
+      result = hash_file (path, &data);
+
+      DEBUG ("%" G_GSIZE_FORMAT " bytes: %s, %u progress calls", sizes[i],
+          result, data.n_calls);
+
+      g_assert_cmpstr (result, ==, expected);
+      g_assert_cmpuint (data.last, ==, sizes[i]);
+      g_assert_cmpuint (data.n_calls, >=, 1);
+
+      g_unlink (path);
+      g_free (path);
+      g_free (expected);
+      g_free (result);
+    }
+}
+
+static gboolean
+noop_idle_cb (gpointer user_data)
+{
+  return FALSE;
+}
+
+/* What hashing used to do: a fresh 4 KiB buffer and a main loop callback
+ * for every chunk */
+static gchar *
+hash_file_by_chunks (const gchar *path)
+{
+  GFile *file;
+  GInputStream *stream;
+  GChecksum *sum;
+  gssize bytes_read;
+  gchar *result;
+
+  file = g_file_new_for_path (path);
+  stream = G_INPUT_STREAM (g_file_read (file, NULL, NULL));
+  sum = g_checksum_new (G_CHECKSUM_MD5);
+
+  do
+    {
+      guchar *buffer = g_malloc0 (4096);
+
+      bytes_read = g_input_stream_read (stream, buffer, 4096, NULL, NULL);
+      if (bytes_read > 0)
+        {
+          g_checksum_update (sum, buffer, bytes_read);
+          g_idle_add (noop_idle_cb, NULL);
+        }
+
+      g_free (buffer);
+    }
+  while (bytes_read > 0);
+
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  result = g_strdup (g_checksum_get_string (sum));
+
+  g_checksum_free (sum);
+  g_object_unref (stream);
+  g_object_unref (file);
+
+  return result;
+}
+
+static void
+test_hash_stream_perf (void)
+{
+  gsize size = 512 * 1024 * 1024;
+  ProgressData data = { 0, 0 };
+  gchar *path, *expected, *result;
+  gdouble chunked, buffered;
+
+  path = create_file (size, &expected);
+
+  g_test_timer_start ();
+  result = hash_file_by_chunks (path);
+  chunked = g_test_timer_elapsed ();
+  g_assert_cmpstr (result, ==, expected);
+  g_free (result);
+
+  g_test_timer_start ();
+  result = hash_file (path, &data);
+  buffered = g_test_timer_elapsed ();
+  g_assert_cmpstr (result, ==, expected);
+  g_free (result);
+
+  g_test_message ("4 KiB chunks: %.1f MB/s, empathy_ft_hash_stream: "
+      "%.1f MB/s with %u progress calls",
+      size / chunked / 1e6, size / buffered / 1e6, data.n_calls);
+  g_test_maximized_result (size / buffered / 1e6, "hashing speed in MB/s");
+
+  g_unlink (path);
+  g_free (path);
+  g_free (expected);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/ft-hash", test_hash_stream);
+  if (g_test_perf ())
+    g_test_add_func ("/ft-hash/perf", test_hash_stream_perf);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
@@ -0,0 +1,161 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <folks/folks.h>
+
+#include "empathy-individual-store.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+typedef struct
+{
+  EmpathyIndividualStore *store;
+  GList *individuals;
+  guint n_sort_changes;
+} Fixture;
+
+static void
+sort_column_changed_cb (GtkTreeSortable *sortable,
+    Fixture *fixture)
+{
+  fixture->n_sort_changes++;
+}
+
+static void
+setup (Fixture *fixture,
+    gconstpointer data)
+{
+  guint n = GPOINTER_TO_UINT (data);
+  guint i;
+
+  fixture->store = g_object_new (EMPATHY_TYPE_INDIVIDUAL_STORE, NULL);
+
+  for (i = 0; i < n; i++)
+    {
+      FolksIndividual *individual = folks_individual_new (NULL);
+
+      fixture->individuals = g_list_prepend (fixture->individuals,
+          individual);
+      individual_store_add_individual_and_connect (fixture->store,
+          individual);
+    }
+
+  g_signal_connect (fixture->store, "sort-column-changed",
+      G_CALLBACK (sort_column_changed_cb), fixture);
+}
+
+static void
+teardown (Fixture *fixture,
+    gconstpointer data)
+{
+  GList *l;
+
+  for (l = fixture->individuals; l != NULL; l = g_list_next (l))
+    individual_store_remove_individual_and_disconnect (fixture->store,
+        l->data);
+
+  g_list_free_full (fixture->individuals, g_object_unref);
+  g_object_unref (fixture->store);
+}
+
+/* Runs the main loop until it has had nothing to do for a while */
+static void
+run_until_idle (void)
+{
+  gint64 last_work;
+
+  last_work = g_get_monotonic_time ();
+
+  while (g_get_monotonic_time () - last_work < 500 * G_TIME_SPAN_MILLISECOND)
+    {
+      if (g_main_context_iteration (NULL, FALSE))
+        last_work = g_get_monotonic_time ();
+      else
+        g_usleep (G_TIME_SPAN_MILLISECOND);
+    }
+}
+
+static void
+change_all (Fixture *fixture)
+{
+  GList *l;
+
+  for (l = fixture->individuals; l != NULL; l = g_list_next (l))
+    g_object_notify (l->data, "alias");
+}
+
+static void
+assert_sorted_by (Fixture *fixture,
+    EmpathyIndividualStoreCol expected)
+{
+  gint column;
+  GtkSortType order;
+
+  g_assert (gtk_tree_sortable_get_sort_column_id (
+        GTK_TREE_SORTABLE (fixture->store), &column, &order));
+  g_assert_cmpint (column, ==, expected);
+  g_assert_cmpint (order, ==, GTK_SORT_ASCENDING);
+}
+
+static void
+test_few_changes (Fixture *fixture,
+    gconstpointer data)
+{
+  change_all (fixture);
+  run_until_idle ();
+
+  /* The rows are moved one by one */
+  g_assert_cmpuint (fixture->n_sort_changes, ==, 0);
+  assert_sorted_by (fixture, EMPATHY_INDIVIDUAL_STORE_COL_NAME);
+}
+
+static void
+test_many_changes (Fixture *fixture,
+    gconstpointer data)
+{
+  change_all (fixture);
+  run_until_idle ();
+
+  /* The store is left unsorted until all the changes are applied, however
+   * many frames it takes, then sorted once */
+  g_assert_cmpuint (fixture->n_sort_changes, ==, 2);
+  assert_sorted_by (fixture, EMPATHY_INDIVIDUAL_STORE_COL_NAME);
+}
+
+static void
+test_sort_while_changing (Fixture *fixture,
+    gconstpointer data)
+{
+  change_all (fixture);
+  g_main_context_iteration (NULL, FALSE);
+
+  empathy_individual_store_set_sort_criterium (fixture->store,
+      EMPATHY_INDIVIDUAL_STORE_SORT_STATE);
+  run_until_idle ();
+
+  assert_sorted_by (fixture, EMPATHY_INDIVIDUAL_STORE_COL_STATUS);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add ("/individual-store/few-changes", Fixture,
+      GUINT_TO_POINTER (50), setup, test_few_changes, teardown);
+  g_test_add ("/individual-store/many-changes", Fixture,
+      GUINT_TO_POINTER (5000), setup, test_many_changes, teardown);
+  g_test_add ("/individual-store/sort-while-changing", Fixture,
+      GUINT_TO_POINTER (5000), setup, test_sort_while_changing, teardown);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
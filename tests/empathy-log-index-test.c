@@ -0,0 +1,254 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "empathy-log-index.h"
+#include "empathy-log-index-internal.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+#define ACCOUNT_PATH TP_ACCOUNT_OBJECT_PATH_BASE "gabble/jabber/test0"
+
+static gchar *
+get_index_file (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "empathy", "log-index",
+      NULL);
+}
+
+/* Returns the index in the cache directory, once it has been loaded */
+static EmpathyLogIndex *
+load_index (void)
+{
+  EmpathyLogIndex *index, *weak;
+
+  index = empathy_log_index_dup_singleton ();
+
+  /* The singleton must be a new object, which read the file */
+  weak = index;
+  g_object_add_weak_pointer (G_OBJECT (index), (gpointer) &weak);
+  g_object_unref (index);
+  g_assert (weak == NULL);
+
+  return empathy_log_index_dup_singleton ();
+}
+
+static void
+add_text (EmpathyLogIndex *index,
+    const gchar *id,
+    guint32 julian,
+    const gchar *text)
+{
+  GDate *date = g_date_new_julian (julian);
+
+  _empathy_log_index_add_text (index, ACCOUNT_PATH, id, TPL_ENTITY_CONTACT,
+      date, text);
+  g_date_free (date);
+}
+
+/* Checks that searching @text only finds the day @julian with @id */
+static void
+assert_single_hit (EmpathyLogIndex *index,
+    const gchar *text,
+    const gchar *id,
+    guint32 julian)
+{
+  GList *hits;
+  TplLogSearchHit *hit;
+
+  g_assert (empathy_log_index_can_search (index, text));
+
+  hits = empathy_log_index_search (index, text);
+  g_assert_cmpuint (g_list_length (hits), ==, 1);
+
+  hit = hits->data;
+  g_assert_cmpstr (tp_proxy_get_object_path (hit->account), ==,
+      ACCOUNT_PATH);
+  g_assert_cmpstr (tpl_entity_get_identifier (hit->target), ==, id);
+  g_assert_cmpuint (g_date_get_julian (hit->date), ==, julian);
+
+  tpl_log_manager_search_free (hits);
+}
+
+static void
+test_save_load (void)
+{
+  EmpathyLogIndex *index;
+  gchar *filename;
+  GList *hits;
+
+  filename = get_index_file ();
+  g_unlink (filename);
+
+  index = load_index ();
+  g_assert (!empathy_log_index_can_search (index, "hello"));
+
+  add_text (index, "alice@example.com", 730000, "Hello, how are you?");
+  add_text (index, "bob@example.com", 730001, "Lunch tomorrow?");
+  add_text (index, "bob@example.com", 730002, "Hello Bob");
+  _empathy_log_index_update_done (index);
+  g_assert (g_file_test (filename, G_FILE_TEST_EXISTS));
+
+  assert_single_hit (index, "how are", "alice@example.com", 730000);
+  g_object_unref (index);
+
+  /* Search the file read back */
+  index = load_index ();
+  assert_single_hit (index, "how are", "alice@example.com", 730000);
+  assert_single_hit (index, "TOMORROW", "bob@example.com", 730001);
+  assert_single_hit (index, "llo bob", "bob@example.com", 730002);
+
+  hits = empathy_log_index_search (index, "hello");
+  g_assert_cmpuint (g_list_length (hits), ==, 2);
+  tpl_log_manager_search_free (hits);
+
+  g_assert (empathy_log_index_search (index, "goodbye") == NULL);
+
+  /* Days indexed on top of the file are found with the ones in it */
+  add_text (index, "alice@example.com", 730003, "Hello again");
+  _empathy_log_index_update_done (index);
+  g_object_unref (index);
+
+  index = load_index ();
+  hits = empathy_log_index_search (index, "hello");
+  g_assert_cmpuint (g_list_length (hits), ==, 3);
+  tpl_log_manager_search_free (hits);
+  g_object_unref (index);
+
+  g_unlink (filename);
+  g_free (filename);
+}
+
+/* Writes an index with one entity, the given documents of that entity, and
+ * the given posting lists of the trigram "hel" then "llo" */
+static void
+write_index (guint32 document_entity,
+    const guint32 *hel,
+    gsize n_hel,
+    const guint32 *llo,
+    gsize n_llo)
+{
+  GVariantBuilder entities, documents, postings;
+  GVariant *index;
+  gchar *filename, *dirname;
+  gboolean written;
+
+  g_variant_builder_init (&entities, G_VARIANT_TYPE ("a(ssuu)"));
+  g_variant_builder_add (&entities, "(ssuu)", ACCOUNT_PATH,
+      "alice@example.com", TPL_ENTITY_CONTACT, 730001);
+
+  g_variant_builder_init (&documents, G_VARIANT_TYPE ("a(uu)"));
+  g_variant_builder_add (&documents, "(uu)", 0, 730000);
+  g_variant_builder_add (&documents, "(uu)", document_entity, 730001);
+
+  g_variant_builder_init (&postings, G_VARIANT_TYPE ("a(tau)"));
+  g_variant_builder_add (&postings, "(t@au)",
+      ((guint64) 'h' << 42) | ((guint64) 'e' << 21) | 'l',
+      g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32, hel, n_hel,
+        sizeof (guint32)));
+  g_variant_builder_add (&postings, "(t@au)",
+      ((guint64) 'l' << 42) | ((guint64) 'l' << 21) | 'o',
+      g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32, llo, n_llo,
+        sizeof (guint32)));
+
+  index = g_variant_ref_sink (g_variant_new ("(u@a(ssuu)@a(uu)@a(tau))", 1,
+        g_variant_builder_end (&entities),
+        g_variant_builder_end (&documents),
+        g_variant_builder_end (&postings)));
+
+  filename = get_index_file ();
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0700);
+
+  written = g_file_set_contents (filename, g_variant_get_data (index),
+      g_variant_get_size (index), NULL);
+  g_assert (written);
+
+  g_variant_unref (index);
+  g_free (dirname);
+  g_free (filename);
+}
+
+static void
+test_corrupted (void)
+{
+  const guint32 both[] = { 0, 1 };
+  const guint32 unsorted[] = { 1, 0 };
+  const guint32 missing[] = { 0, 2 };
+  EmpathyLogIndex *index;
+  gchar *filename;
+  GList *hits;
+
+  /* A valid file to start with */
+  write_index (0, both, 2, both, 2);
+  index = load_index ();
+  hits = empathy_log_index_search (index, "hel");
+  g_assert_cmpuint (g_list_length (hits), ==, 2);
+  tpl_log_manager_search_free (hits);
+  g_object_unref (index);
+
+  /* A document of an entity which doesn't exist */
+  write_index (1, both, 2, both, 2);
+  index = load_index ();
+  g_assert (!empathy_log_index_can_search (index, "hello"));
+  g_object_unref (index);
+
+  /* A posting list which isn't sorted */
+  write_index (0, both, 2, unsorted, 2);
+  index = load_index ();
+  g_assert (!empathy_log_index_can_search (index, "hello"));
+  g_object_unref (index);
+
+  /* A posting of a document which doesn't exist */
+  write_index (0, missing, 2, both, 2);
+  index = load_index ();
+  g_assert (!empathy_log_index_can_search (index, "hello"));
+  g_object_unref (index);
+
+  /* Rebuilding replaces the corrupted file */
+  index = load_index ();
+  add_text (index, "alice@example.com", 730000, "Hello");
+  _empathy_log_index_update_done (index);
+  g_object_unref (index);
+
+  index = load_index ();
+  assert_single_hit (index, "hello", "alice@example.com", 730000);
+  g_object_unref (index);
+
+  filename = get_index_file ();
+  g_unlink (filename);
+  g_free (filename);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  gchar *cache_dir, *empathy_dir;
+  int result;
+
+  /* Don't touch the index of the user */
+  cache_dir = g_dir_make_tmp ("empathy-log-index-test-XXXXXX", NULL);
+  g_assert (cache_dir != NULL);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/log-index/save-load", test_save_load);
+  g_test_add_func ("/log-index/corrupted", test_corrupted);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  empathy_dir = g_build_filename (cache_dir, "empathy", NULL);
+  g_rmdir (empathy_dir);
+  g_rmdir (cache_dir);
+  g_free (empathy_dir);
+  g_free (cache_dir);
+
+  return result;
+}
@@ -7,6 +7,7 @@
 #include <tp-account-widgets/tpaw-string-parser.h>
 
 #include "empathy-string-parser.h"
+#include "empathy-webkit-utils.h"
 #include "test-helper.h"
 
 #define DEBUG_FLAG EMPATHY_DEBUG_TESTS
@@ -122,6 +123,97 @@ test_parsers (void)
     }
 }
 
+static const gchar *body_tests[] =
+  {
+    "",
+    "plain text",
+    "<b>bold</b> & \"quoted\" 'text'",
+    "a :) b http://foo.com c :( d www.test.com e",
+    ":)http://foo.com",
+    "mail user@server.com <3",
+    "line\nother\r\nlast\n\r",
+    "control\x01\x1f\x7f chars\tand tab",
+    "c1 \xc2\x80\xc2\x85\xc2\x9f\xc2\xa0 end",
+    "unicode \xe2\x84\xa2 \xc3\xa9t\xc3\xa9 >:)",
+    "<a href='http://apos'foo.com'>bar</a>",
+    NULL
+  };
+
+static gchar *
+parse_body_with_parsers (const gchar *text,
+    gboolean smileys)
+{
+  GString *string = g_string_new (NULL);
+
+  tpaw_string_parser_substr (text, -1,
+      empathy_webkit_get_string_parser (smileys), string);
+
+  return g_string_free (string, FALSE);
+}
+
+static gchar *
+parse_body_fused (const gchar *text,
+    gboolean smileys)
+{
+  GString *string = g_string_new (NULL);
+
+  empathy_webkit_append_body (string, text, -1, smileys);
+
+  return g_string_free (string, FALSE);
+}
+
+static void
+test_webkit_body (void)
+{
+  guint i;
+
+  for (i = 0; body_tests[i] != NULL; i++)
+    {
+      gint smileys;
+
+      for (smileys = 0; smileys < 2; smileys++)
+        {
+          gchar *expected = parse_body_with_parsers (body_tests[i], smileys);
+          gchar *result = parse_body_fused (body_tests[i], smileys);
+
+          DEBUG ("'%s' => '%s'", body_tests[i], result);
+          g_assert_cmpstr (result, ==, expected);
+
+          g_free (expected);
+          g_free (result);
+        }
+    }
+}
+
+static void
+test_webkit_body_perf (void)
+{
+  GString *body = g_string_new (NULL);
+  gdouble chain, fused;
+  guint i;
+
+  while (body->len < 64 * 1024)
+    for (i = 0; body_tests[i] != NULL; i++)
+      g_string_append_printf (body, "%s\n", body_tests[i]);
+
+  g_test_timer_start ();
+  for (i = 0; i < 50; i++)
+    g_free (parse_body_with_parsers (body->str, TRUE));
+  chain = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  for (i = 0; i < 50; i++)
+    g_free (parse_body_fused (body->str, TRUE));
+  fused = g_test_timer_elapsed ();
+
+  g_test_message ("parser chain: %.1f MB/s, single pass: %.1f MB/s",
+      50 * body->len / chain / 1e6, 50 * body->len / fused / 1e6);
+  g_test_maximized_result (50 * body->len / fused / 1e6,
+      "single pass body parsing in MB/s");
+
+  g_string_free (body, TRUE);
+}
+
 int
 main (int argc,
     char **argv)
@@ -131,6 +223,9 @@ main (int argc,
   test_init (argc, argv);
 
   g_test_add_func ("/parsers", test_parsers);
+  g_test_add_func ("/parsers/webkit-body", test_webkit_body);
+  if (g_test_perf ())
+    g_test_add_func ("/parsers/webkit-body-perf", test_webkit_body_perf);
 
   result = g_test_run ();
   test_deinit ();
@@ -0,0 +1,277 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <folks/folks.h>
+
+#include "empathy-roster-model.h"
+#include "empathy-roster-view.h"
+#include "empathy-roster-view-internal.h"
+#include "empathy-roster-contact.h"
+#include "empathy-roster-group.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+#define N_GROUPS 7
+
+/* A roster model holding individuals without any persona, each of them in
+ * one of N_GROUPS groups */
+
+typedef struct
+{
+  GObject parent;
+  GList *individuals;
+} TestRosterModel;
+
+typedef struct
+{
+  GObjectClass parent_class;
+} TestRosterModelClass;
+
+static GType test_roster_model_get_type (void);
+static void test_roster_model_iface_init (EmpathyRosterModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (TestRosterModel, test_roster_model, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (EMPATHY_TYPE_ROSTER_MODEL,
+      test_roster_model_iface_init))
+
+static GList *
+test_roster_model_get_individuals (EmpathyRosterModel *model)
+{
+  TestRosterModel *self = (TestRosterModel *) model;
+
+  return g_list_copy (self->individuals);
+}
+
+static GList *
+test_roster_model_dup_groups_for_individual (EmpathyRosterModel *model,
+    FolksIndividual *individual)
+{
+  const gchar *group = g_object_get_data (G_OBJECT (individual), "group");
+
+  return g_list_prepend (NULL, g_strdup (group));
+}
+
+static void
+test_roster_model_iface_init (EmpathyRosterModelInterface *iface)
+{
+  iface->get_individuals = test_roster_model_get_individuals;
+  iface->dup_groups_for_individual =
+    test_roster_model_dup_groups_for_individual;
+}
+
+static void
+test_roster_model_finalize (GObject *object)
+{
+  TestRosterModel *self = (TestRosterModel *) object;
+
+  g_list_free_full (self->individuals, g_object_unref);
+
+  G_OBJECT_CLASS (test_roster_model_parent_class)->finalize (object);
+}
+
+static void
+test_roster_model_class_init (TestRosterModelClass *klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = test_roster_model_finalize;
+}
+
+static void
+test_roster_model_init (TestRosterModel *self)
+{
+}
+
+static void
+add_individuals (TestRosterModel *model,
+    guint n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    {
+      FolksIndividual *individual = folks_individual_new (NULL);
+
+      g_object_set_data_full (G_OBJECT (individual), "group",
+          g_strdup_printf ("Group %u", i % N_GROUPS), g_free);
+
+      model->individuals = g_list_prepend (model->individuals, individual);
+      empathy_roster_model_fire_individual_added (EMPATHY_ROSTER_MODEL (model),
+          individual);
+    }
+}
+
+/* Runs the main loop until it has had nothing to do for a while, and
+ * returns the longest time, in seconds, one iteration took */
+static gdouble
+run_until_idle (void)
+{
+  gdouble longest = 0;
+  gint64 last_work;
+
+  last_work = g_get_monotonic_time ();
+
+  while (g_get_monotonic_time () - last_work < 500 * G_TIME_SPAN_MILLISECOND)
+    {
+      gdouble elapsed;
+      gboolean dispatched;
+
+      g_test_timer_start ();
+      dispatched = g_main_context_iteration (NULL, FALSE);
+      elapsed = g_test_timer_elapsed ();
+
+      if (!dispatched)
+        {
+          g_usleep (G_TIME_SPAN_MILLISECOND);
+          continue;
+        }
+
+      longest = MAX (longest, elapsed);
+      last_work = g_get_monotonic_time ();
+    }
+
+  return longest;
+}
+
+/* Checks that the rows of @view are its groups in order, each followed
+ * by its contacts, and that all the groups and contacts are displayed if
+ * @shown is TRUE and none of them otherwise */
+static void
+check_rows (GtkWidget *view,
+    guint n,
+    gboolean shown)
+{
+  GList *children, *l;
+  const gchar *group = NULL;
+  guint n_groups = 0, n_contacts = 0;
+
+  g_assert (!_empathy_roster_view_has_pending_changes (
+        EMPATHY_ROSTER_VIEW (view)));
+  g_assert (empathy_roster_view_is_empty (EMPATHY_ROSTER_VIEW (view)) ==
+      !shown);
+
+  children = gtk_container_get_children (GTK_CONTAINER (view));
+
+  for (l = children; l != NULL; l = g_list_next (l))
+    {
+      GtkWidget *row = l->data;
+
+      if (EMPATHY_IS_ROSTER_GROUP (row))
+        {
+          const gchar *name;
+
+          name = empathy_roster_group_get_name (EMPATHY_ROSTER_GROUP (row));
+          if (group != NULL)
+            g_assert_cmpint (g_utf8_collate (group, name), <, 0);
+
+          group = name;
+          n_groups++;
+        }
+      else
+        {
+          g_assert_cmpstr (empathy_roster_contact_get_group (
+                EMPATHY_ROSTER_CONTACT (row)), ==, group);
+          n_contacts++;
+        }
+
+      g_assert (gtk_widget_get_child_visible (row) == shown);
+    }
+
+  g_assert_cmpuint (n_groups, ==, N_GROUPS);
+  g_assert_cmpuint (n_contacts, ==, n);
+
+  g_list_free (children);
+}
+
+/* Adds @n contacts to a shown roster, then makes them all change at once,
+ * as when connecting. Returns the longest main loop iteration while
+ * applying the changes. */
+static gdouble
+simulate_connect (guint n)
+{
+  TestRosterModel *model;
+  GtkWidget *window, *sw, *view;
+  GList *l;
+  gdouble longest;
+
+  model = g_object_new (test_roster_model_get_type (), NULL);
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_default_size (GTK_WINDOW (window), 300, 600);
+  sw = gtk_scrolled_window_new (NULL, NULL);
+  gtk_container_add (GTK_CONTAINER (window), sw);
+
+  view = empathy_roster_view_new (EMPATHY_ROSTER_MODEL (model));
+  empathy_roster_view_show_offline (EMPATHY_ROSTER_VIEW (view), TRUE);
+  empathy_roster_view_show_groups (EMPATHY_ROSTER_VIEW (view), TRUE);
+  gtk_container_add (GTK_CONTAINER (sw), view);
+  gtk_widget_show_all (window);
+
+  add_individuals (model, n);
+  run_until_idle ();
+
+  check_rows (view, n, TRUE);
+
+  for (l = model->individuals; l != NULL; l = g_list_next (l))
+    {
+      g_object_notify (l->data, "alias");
+      g_object_notify (l->data, "presence-status");
+    }
+
+  longest = run_until_idle ();
+
+  check_rows (view, n, TRUE);
+
+  /* The contacts have no presence, so they are all offline */
+  empathy_roster_view_show_offline (EMPATHY_ROSTER_VIEW (view), FALSE);
+  run_until_idle ();
+  check_rows (view, n, FALSE);
+
+  empathy_roster_view_show_offline (EMPATHY_ROSTER_VIEW (view), TRUE);
+  run_until_idle ();
+  check_rows (view, n, TRUE);
+
+  gtk_widget_destroy (window);
+  g_object_unref (model);
+
+  return longest;
+}
+
+static void
+test_roster_view_connect (void)
+{
+  simulate_connect (300);
+}
+
+static void
+test_roster_view_connect_perf (void)
+{
+  gdouble longest;
+
+  longest = simulate_connect (5000);
+
+  g_test_message ("5000 contacts: longest main loop iteration %.1f ms",
+      longest * 1000);
+  g_test_minimized_result (longest * 1000,
+      "longest main loop iteration in ms while 5000 contacts change");
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add_func ("/roster-view/connect", test_roster_view_connect);
+  if (g_test_perf ())
+    g_test_add_func ("/roster-view/connect-perf",
+        test_roster_view_connect_perf);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
@@ -0,0 +1,196 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <JavaScriptCore/JavaScript.h>
+
+#include "empathy-theme-adium.h"
+#include "test-helper.h"
+
+#define DEBUG_FLAG EMPATHY_DEBUG_TESTS
+#include "empathy-debug.h"
+
+#define ACCOUNT_PATH TP_ACCOUNT_OBJECT_PATH_BASE "gabble/jabber/test0"
+
+typedef struct
+{
+  GtkWidget *window;
+  EmpathyThemeAdium *view;
+  EmpathyContact *contact;
+  gboolean loaded;
+  gchar *result;
+} Fixture;
+
+static void
+load_changed_cb (WebKitWebView *view,
+    WebKitLoadEvent event,
+    Fixture *fixture)
+{
+  if (event == WEBKIT_LOAD_FINISHED)
+    fixture->loaded = TRUE;
+}
+
+static void
+setup (Fixture *fixture,
+    gconstpointer data)
+{
+  TpAccountManager *account_manager;
+  TpAccount *account;
+  EmpathyAdiumData *adium_data;
+  gchar *path;
+
+  path = g_build_filename (g_getenv ("EMPATHY_SRCDIR"), "data", "themes",
+      "Classic.AdiumMessageStyle", NULL);
+  adium_data = empathy_adium_data_new (path);
+  g_assert (adium_data != NULL);
+
+  fixture->window = gtk_offscreen_window_new ();
+  fixture->view = empathy_theme_adium_new (adium_data, NULL);
+  gtk_container_add (GTK_CONTAINER (fixture->window),
+      GTK_WIDGET (fixture->view));
+  gtk_widget_show_all (fixture->window);
+
+  g_signal_connect (fixture->view, "load-changed",
+      G_CALLBACK (load_changed_cb), fixture);
+
+  account_manager = tp_account_manager_dup ();
+  account = tp_simple_client_factory_ensure_account (
+      tp_proxy_get_factory (account_manager), ACCOUNT_PATH, NULL, NULL);
+  g_assert (account != NULL);
+
+  fixture->contact = g_object_new (EMPATHY_TYPE_CONTACT,
+      "account", account,
+      "id", "alice@example.com",
+      "alias", "Alice",
+      NULL);
+
+  g_object_unref (account);
+  g_object_unref (account_manager);
+  empathy_adium_data_unref (adium_data);
+  g_free (path);
+}
+
+static void
+teardown (Fixture *fixture,
+    gconstpointer data)
+{
+  gtk_widget_destroy (fixture->window);
+  g_object_unref (fixture->contact);
+  g_free (fixture->result);
+}
+
+static EmpathyMessage *
+new_message (Fixture *fixture,
+    const gchar *token,
+    const gchar *supersedes,
+    const gchar *body)
+{
+  return g_object_new (EMPATHY_TYPE_MESSAGE,
+      "type", TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL,
+      "sender", fixture->contact,
+      "token", token,
+      "supersedes", supersedes,
+      "body", body,
+      "timestamp", (gint64) 1380000000,
+      "incoming", TRUE,
+      NULL);
+}
+
+static void
+run_javascript_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  Fixture *fixture = user_data;
+  WebKitJavascriptResult *js_result;
+  JSGlobalContextRef context;
+  JSStringRef js_str;
+  GError *error = NULL;
+  gsize size;
+
+  js_result = webkit_web_view_run_javascript_finish (WEBKIT_WEB_VIEW (source),
+      result, &error);
+  g_assert_no_error (error);
+
+  context = webkit_javascript_result_get_global_context (js_result);
+  js_str = JSValueToStringCopy (context,
+      webkit_javascript_result_get_value (js_result), NULL);
+
+  size = JSStringGetMaximumUTF8CStringSize (js_str);
+  fixture->result = g_malloc (size);
+  JSStringGetUTF8CString (js_str, fixture->result, size);
+
+  JSStringRelease (js_str);
+  webkit_javascript_result_unref (js_result);
+}
+
+/* Returns the number of elements of the page holding the message @token,
+ * and the text of the first one, as "<number>:<text>" */
+static const gchar *
+get_message_in_page (Fixture *fixture,
+    const gchar *token)
+{
+  gchar *script;
+
+  script = g_strdup_printf ("(function () {"
+      "  var spans = document.querySelectorAll(\"#message-token-%s\");"
+      "  return spans.length + \":\" +"
+      "    (spans.length > 0 ? spans[0].textContent : \"\");"
+      "})()", token);
+
+  g_clear_pointer (&fixture->result, g_free);
+  webkit_web_view_run_javascript (WEBKIT_WEB_VIEW (fixture->view), script,
+      NULL, run_javascript_cb, fixture);
+
+  while (fixture->result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_free (script);
+
+  return fixture->result;
+}
+
+/* A message and an edit of it, both added before the page is loaded, are
+ * both rendered in the page itself */
+static void
+test_edit_before_load (Fixture *fixture,
+    gconstpointer data)
+{
+  EmpathyMessage *message, *edit;
+
+  empathy_theme_adium_freeze_document (fixture->view);
+
+  message = new_message (fixture, "first", NULL, "Hello");
+  empathy_theme_adium_append_message (fixture->view, message, FALSE);
+
+  edit = new_message (fixture, "second", "first", "Hello again");
+  empathy_theme_adium_edit_message (fixture->view, edit);
+
+  empathy_theme_adium_thaw_document (fixture->view);
+
+  while (!fixture->loaded)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpstr (get_message_in_page (fixture, "first"), ==,
+      "1:Hello again");
+
+  g_object_unref (message);
+  g_object_unref (edit);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  int result;
+
+  test_init (argc, argv);
+
+  g_test_add ("/theme-adium/edit-before-load", Fixture, NULL,
+      setup, test_edit_before_load, teardown);
+
+  result = g_test_run ();
+  test_deinit ();
+
+  return result;
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2013 Collabora Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+/* Measures how long converting logged senders to EmpathyContact takes
+ * depending on the number of live contacts. Uses the contact lists of the
+ * currently connected accounts. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <glib.h>
+#include <telepathy-logger/telepathy-logger.h>
+
+#include "empathy-contact.h"
+#include "empathy-utils.h"
+
+/* Number of logged events converted for each roster size */
+#define N_EVENTS 10000
+
+static GMainLoop *loop = NULL;
+static GPtrArray *tp_contacts = NULL;
+static guint n_pending = 0;
+
+static void
+run_benchmark (void)
+{
+  GPtrArray *live;
+  guint n;
+
+  live = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_print ("%u contacts available\n", tp_contacts->len);
+
+  for (n = MIN (10, tp_contacts->len); ;
+      n = MIN (n * 10, tp_contacts->len))
+    {
+      GTimer *timer;
+      guint i;
+
+      while (live->len < n)
+        g_ptr_array_add (live, empathy_contact_dup_from_tp_contact (
+              g_ptr_array_index (tp_contacts, live->len)));
+
+      timer = g_timer_new ();
+
+      for (i = 0; i < N_EVENTS; i++)
+        {
+          EmpathyContact *logged = g_ptr_array_index (live, i % live->len);
+          TplEntity *entity;
+          EmpathyContact *contact;
+
+          entity = tpl_entity_new (empathy_contact_get_id (logged),
+              TPL_ENTITY_CONTACT, empathy_contact_get_alias (logged), NULL);
+
+          contact = empathy_contact_from_tpl_contact (
+              empathy_contact_get_account (logged), entity);
+
+          g_object_unref (contact);
+          g_object_unref (entity);
+        }
+
+      g_print ("%6u live contacts: %.2f us per logged event\n", live->len,
+          g_timer_elapsed (timer, NULL) * G_USEC_PER_SEC / N_EVENTS);
+
+      g_timer_destroy (timer);
+
+      if (n == tp_contacts->len)
+        break;
+    }
+
+  g_ptr_array_unref (live);
+  g_main_loop_quit (loop);
+}
+
+static void
+connection_prepared_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GError *error = NULL;
+
+  if (!tp_proxy_prepare_finish (source, result, &error))
+    {
+      g_print ("Failed to prepare connection: %s\n", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      GPtrArray *contacts;
+      guint i;
+
+      contacts = tp_connection_dup_contact_list (TP_CONNECTION (source));
+      for (i = 0; i < contacts->len; i++)
+        g_ptr_array_add (tp_contacts,
+            g_object_ref (g_ptr_array_index (contacts, i)));
+
+      g_ptr_array_unref (contacts);
+    }
+
+  if (--n_pending == 0)
+    {
+      if (tp_contacts->len == 0)
+        {
+          g_print ("No contacts, connect an account first\n");
+          g_main_loop_quit (loop);
+          return;
+        }
+
+      run_benchmark ();
+    }
+}
+
+static void
+account_manager_prepare_cb (GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  GQuark features[] = { TP_CONNECTION_FEATURE_CONTACT_LIST, 0 };
+  GList *accounts, *l;
+  GError *error = NULL;
+
+  tp_proxy_prepare_finish (source, result, &error);
+  g_assert_no_error (error);
+
+  accounts = tp_account_manager_dup_valid_accounts (
+      TP_ACCOUNT_MANAGER (source));
+
+  /* Keep the count up while requests are being sent */
+  n_pending++;
+
+  for (l = accounts; l != NULL; l = g_list_next (l))
+    {
+      TpConnection *conn = tp_account_get_connection (l->data);
+
+      if (conn == NULL)
+        continue;
+
+      n_pending++;
+      tp_proxy_prepare_async (conn, features, connection_prepared_cb, NULL);
+    }
+
+  g_list_free_full (accounts, g_object_unref);
+
+  if (--n_pending == 0)
+    {
+      g_print ("No connected account\n");
+      g_main_loop_quit (loop);
+    }
+}
+
+int
+main (int argc,
+    char *argv[])
+{
+  TpAccountManager *mgr;
+
+  empathy_init ();
+
+  loop = g_main_loop_new (NULL, FALSE);
+  tp_contacts = g_ptr_array_new_with_free_func (g_object_unref);
+
+  mgr = tp_account_manager_dup ();
+  tp_proxy_prepare_async (mgr, NULL, account_manager_prepare_cb, NULL);
+
+  g_main_loop_run (loop);
+
+  g_object_unref (mgr);
+  g_ptr_array_unref (tp_contacts);
+  g_main_loop_unref (loop);
+
+  return EXIT_SUCCESS;
+}